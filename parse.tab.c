@@ -1,8 +1,8 @@
-/* A Bison parser, made by GNU Bison 3.5.1.  */
+/* A Bison parser, made by GNU Bison 3.8.2.  */
 
 /* Bison implementation for Yacc-like parsers in C
 
-   Copyright (C) 1984, 1989-1990, 2000-2015, 2018-2020 Free Software Foundation,
+   Copyright (C) 1984, 1989-1990, 2000-2015, 2018-2021 Free Software Foundation,
    Inc.
 
    This program is free software: you can redistribute it and/or modify
@@ -16,7 +16,7 @@
    GNU General Public License for more details.
 
    You should have received a copy of the GNU General Public License
-   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
 
 /* As a special exception, you may create a larger work that contains
    part or all of the Bison parser skeleton and distribute that work
@@ -34,6 +34,10 @@
 /* C LALR(1) parser skeleton written by Richard Stallman, by
    simplifying the original so-called "semantic" parser.  */
 
+/* DO NOT RELY ON FEATURES THAT ARE NOT DOCUMENTED in the manual,
+   especially those whose name start with YY_ or yy_.  They are
+   private implementation details that can be changed or removed.  */
+
 /* All symbols defined below should begin with yy or YY, to avoid
    infringing on user name space.  This should be done even for local
    variables, as they might otherwise be expanded by user macros.
@@ -41,14 +45,11 @@
    define necessary library symbols; they are noted "INFRINGES ON
    USER NAME SPACE" below.  */
 
-/* Undocumented macros, especially those whose name start with YY_,
-   are private implementation details.  Do not rely on them.  */
-
-/* Identify Bison output.  */
-#define YYBISON 1
+/* Identify Bison output, and Bison version.  */
+#define YYBISON 30802
 
-/* Bison version.  */
-#define YYBISON_VERSION "3.5.1"
+/* Bison version string.  */
+#define YYBISON_VERSION "3.8.2"
 
 /* Skeleton name.  */
 #define YYSKELETON_NAME "yacc.c"
@@ -84,7 +85,7 @@ struct commtype {
    int errorcode;
 };
 
-static int err;  /* value used by parser to store return values */
+static THREADLOCAL int err;  /* value used by parser to store return values */
 
 /* 
    The CHECK macro aborts parse if an error has occurred.  It optionally
@@ -99,8 +100,7 @@ static int err;  /* value used by parser to store return values */
 int yylex();
 void yyerror(struct commtype *comm, char *);
 
-#define MAXMEM 100
-int unitcount=0;    /* Counts the number of units allocated by the parser */
+THREADLOCAL int unitcount=0;  /* Units allocated by the parser */
 
 struct function { 
    char *name; 
@@ -126,6 +126,8 @@ getnewunit()
     return 0;
   initializeunit(unit);
   unitcount++;
+  STATCOUNT(getnewunit);
+  STATMAX(maxparserunits, unitcount);
   return unit;
 }
 
@@ -206,7 +208,7 @@ funcunit(struct unittype *theunit, struct function const *fun)
 
 
 
-#line 210 "parse.tab.c"
+#line 212 "parse.tab.c"
 
 # ifndef YY_CAST
 #  ifdef __cplusplus
@@ -229,14 +231,6 @@ funcunit(struct unittype *theunit, struct function const *fun)
 #  endif
 # endif
 
-/* Enabling verbose error messages.  */
-#ifdef YYERROR_VERBOSE
-# undef YYERROR_VERBOSE
-# define YYERROR_VERBOSE 1
-#else
-# define YYERROR_VERBOSE 0
-#endif
-
 
 /* Debug traces.  */
 #ifndef UNITSDEBUG
@@ -254,41 +248,46 @@ funcunit(struct unittype *theunit, struct function const *fun)
 extern int unitsdebug;
 #endif
 
-/* Token type.  */
+/* Token kinds.  */
 #ifndef UNITSTOKENTYPE
 # define UNITSTOKENTYPE
   enum unitstokentype
   {
-    REAL = 258,
-    UNIT = 259,
-    REALFUNC = 260,
-    LOG = 261,
-    UNITFUNC = 262,
-    EXPONENT = 263,
-    MULTIPLY = 264,
-    MULTSTAR = 265,
-    DIVIDE = 266,
-    NUMDIV = 267,
-    SQRT = 268,
-    CUBEROOT = 269,
-    MULTMINUS = 270,
-    EOL = 271,
-    FUNCINV = 272,
-    MEMERROR = 273,
-    BADNUMBER = 274,
-    UNITEND = 275,
-    LASTUNSET = 276,
-    ADD = 277,
-    MINUS = 278,
-    UNARY = 279
+    UNITSEMPTY = -2,
+    UNITSEOF = 0,                  /* "end of file"  */
+    UNITSerror = 256,              /* error  */
+    UNITSUNDEF = 257,              /* "invalid token"  */
+    REAL = 258,                    /* REAL  */
+    UNIT = 259,                    /* UNIT  */
+    REALFUNC = 260,                /* REALFUNC  */
+    LOG = 261,                     /* LOG  */
+    UNITFUNC = 262,                /* UNITFUNC  */
+    EXPONENT = 263,                /* EXPONENT  */
+    MULTIPLY = 264,                /* MULTIPLY  */
+    MULTSTAR = 265,                /* MULTSTAR  */
+    DIVIDE = 266,                  /* DIVIDE  */
+    NUMDIV = 267,                  /* NUMDIV  */
+    SQRT = 268,                    /* SQRT  */
+    CUBEROOT = 269,                /* CUBEROOT  */
+    MULTMINUS = 270,               /* MULTMINUS  */
+    EOL = 271,                     /* EOL  */
+    FUNCINV = 272,                 /* FUNCINV  */
+    MEMERROR = 273,                /* MEMERROR  */
+    BADNUMBER = 274,               /* BADNUMBER  */
+    UNITEND = 275,                 /* UNITEND  */
+    LASTUNSET = 276,               /* LASTUNSET  */
+    ADD = 277,                     /* ADD  */
+    MINUS = 278,                   /* MINUS  */
+    UNARY = 279                    /* UNARY  */
   };
+  typedef enum unitstokentype unitstoken_kind_t;
 #endif
 
 /* Value type.  */
 #if ! defined UNITSSTYPE && ! defined UNITSSTYPE_IS_DECLARED
 union UNITSSTYPE
 {
-#line 163 "parse.y"
+#line 164 "parse.y"
 
   double number;
   int integer;
@@ -296,7 +295,7 @@ union UNITSSTYPE
   struct function *realfunc;
   struct func *unitfunc;
 
-#line 300 "parse.tab.c"
+#line 299 "parse.tab.c"
 
 };
 typedef union UNITSSTYPE UNITSSTYPE;
@@ -306,10 +305,53 @@ typedef union UNITSSTYPE UNITSSTYPE;
 
 
 
+
 int unitsparse (struct commtype *comm);
 
 
 
+/* Symbol kind.  */
+enum yysymbol_kind_t
+{
+  YYSYMBOL_YYEMPTY = -2,
+  YYSYMBOL_YYEOF = 0,                      /* "end of file"  */
+  YYSYMBOL_YYerror = 1,                    /* error  */
+  YYSYMBOL_YYUNDEF = 2,                    /* "invalid token"  */
+  YYSYMBOL_REAL = 3,                       /* REAL  */
+  YYSYMBOL_UNIT = 4,                       /* UNIT  */
+  YYSYMBOL_REALFUNC = 5,                   /* REALFUNC  */
+  YYSYMBOL_LOG = 6,                        /* LOG  */
+  YYSYMBOL_UNITFUNC = 7,                   /* UNITFUNC  */
+  YYSYMBOL_EXPONENT = 8,                   /* EXPONENT  */
+  YYSYMBOL_MULTIPLY = 9,                   /* MULTIPLY  */
+  YYSYMBOL_MULTSTAR = 10,                  /* MULTSTAR  */
+  YYSYMBOL_DIVIDE = 11,                    /* DIVIDE  */
+  YYSYMBOL_NUMDIV = 12,                    /* NUMDIV  */
+  YYSYMBOL_SQRT = 13,                      /* SQRT  */
+  YYSYMBOL_CUBEROOT = 14,                  /* CUBEROOT  */
+  YYSYMBOL_MULTMINUS = 15,                 /* MULTMINUS  */
+  YYSYMBOL_EOL = 16,                       /* EOL  */
+  YYSYMBOL_FUNCINV = 17,                   /* FUNCINV  */
+  YYSYMBOL_MEMERROR = 18,                  /* MEMERROR  */
+  YYSYMBOL_BADNUMBER = 19,                 /* BADNUMBER  */
+  YYSYMBOL_UNITEND = 20,                   /* UNITEND  */
+  YYSYMBOL_LASTUNSET = 21,                 /* LASTUNSET  */
+  YYSYMBOL_ADD = 22,                       /* ADD  */
+  YYSYMBOL_MINUS = 23,                     /* MINUS  */
+  YYSYMBOL_UNARY = 24,                     /* UNARY  */
+  YYSYMBOL_25_ = 25,                       /* '('  */
+  YYSYMBOL_26_ = 26,                       /* ')'  */
+  YYSYMBOL_YYACCEPT = 27,                  /* $accept  */
+  YYSYMBOL_input = 28,                     /* input  */
+  YYSYMBOL_unitexpr = 29,                  /* unitexpr  */
+  YYSYMBOL_expr = 30,                      /* expr  */
+  YYSYMBOL_numexpr = 31,                   /* numexpr  */
+  YYSYMBOL_pexpr = 32,                     /* pexpr  */
+  YYSYMBOL_list = 33                       /* list  */
+};
+typedef enum yysymbol_kind_t yysymbol_kind_t;
+
+
 
 
 #ifdef short
@@ -349,6 +391,18 @@ typedef int_least16_t yytype_int16;
 typedef short yytype_int16;
 #endif
 
+/* Work around bug in HP-UX 11.23, which defines these macros
+   incorrectly for preprocessor constants.  This workaround can likely
+   be removed in 2023, as HPE has promised support for HP-UX 11.23
+   (aka HP-UX 11i v2) only through the end of 2022; see Table 2 of
+   <https://h20195.www2.hpe.com/V2/getpdf.aspx/4AA4-7673ENW.pdf>.  */
+#ifdef __hpux
+# undef UINT_LEAST8_MAX
+# undef UINT_LEAST16_MAX
+# define UINT_LEAST8_MAX 255
+# define UINT_LEAST16_MAX 65535
+#endif
+
 #if defined __UINT_LEAST8_MAX__ && __UINT_LEAST8_MAX__ <= __INT_MAX__
 typedef __UINT_LEAST8_TYPE__ yytype_uint8;
 #elif (!defined __UINT_LEAST8_MAX__ && defined YY_STDINT_H \
@@ -408,6 +462,7 @@ typedef int yytype_uint16;
 
 #define YYSIZEOF(X) YY_CAST (YYPTRDIFF_T, sizeof (X))
 
+
 /* Stored state numbers (used for stacks). */
 typedef yytype_int8 yy_state_t;
 
@@ -426,6 +481,7 @@ typedef int yy_state_fast_t;
 # endif
 #endif
 
+
 #ifndef YY_ATTRIBUTE_PURE
 # if defined __GNUC__ && 2 < __GNUC__ + (96 <= __GNUC_MINOR__)
 #  define YY_ATTRIBUTE_PURE __attribute__ ((__pure__))
@@ -444,17 +500,23 @@ typedef int yy_state_fast_t;
 
 /* Suppress unused-variable warnings by "using" E.  */
 #if ! defined lint || defined __GNUC__
-# define YYUSE(E) ((void) (E))
+# define YY_USE(E) ((void) (E))
 #else
-# define YYUSE(E) /* empty */
+# define YY_USE(E) /* empty */
 #endif
 
-#if defined __GNUC__ && ! defined __ICC && 407 <= __GNUC__ * 100 + __GNUC_MINOR__
 /* Suppress an incorrect diagnostic about yylval being uninitialized.  */
-# define YY_IGNORE_MAYBE_UNINITIALIZED_BEGIN                            \
+#if defined __GNUC__ && ! defined __ICC && 406 <= __GNUC__ * 100 + __GNUC_MINOR__
+# if __GNUC__ * 100 + __GNUC_MINOR__ < 407
+#  define YY_IGNORE_MAYBE_UNINITIALIZED_BEGIN                           \
+    _Pragma ("GCC diagnostic push")                                     \
+    _Pragma ("GCC diagnostic ignored \"-Wuninitialized\"")
+# else
+#  define YY_IGNORE_MAYBE_UNINITIALIZED_BEGIN                           \
     _Pragma ("GCC diagnostic push")                                     \
     _Pragma ("GCC diagnostic ignored \"-Wuninitialized\"")              \
     _Pragma ("GCC diagnostic ignored \"-Wmaybe-uninitialized\"")
+# endif
 # define YY_IGNORE_MAYBE_UNINITIALIZED_END      \
     _Pragma ("GCC diagnostic pop")
 #else
@@ -483,7 +545,7 @@ typedef int yy_state_fast_t;
 
 #define YY_ASSERT(E) ((void) (0 && (E)))
 
-#if ! defined yyoverflow || YYERROR_VERBOSE
+#if !defined yyoverflow
 
 /* The parser invokes alloca or malloc; define the necessary symbols.  */
 
@@ -548,8 +610,7 @@ void free (void *); /* INFRINGES ON USER NAME SPACE */
 #   endif
 #  endif
 # endif
-#endif /* ! defined yyoverflow || YYERROR_VERBOSE */
-
+#endif /* !defined yyoverflow */
 
 #if (! defined yyoverflow \
      && (! defined __cplusplus \
@@ -625,14 +686,16 @@ union yyalloc
 /* YYNSTATES -- Number of states.  */
 #define YYNSTATES  61
 
-#define YYUNDEFTOK  2
+/* YYMAXUTOK -- Last valid token kind.  */
 #define YYMAXUTOK   279
 
 
 /* YYTRANSLATE(TOKEN-NUM) -- Symbol number corresponding to TOKEN-NUM
    as returned by yylex, with out-of-bounds checking.  */
-#define YYTRANSLATE(YYX)                                                \
-  (0 <= (YYX) && (YYX) <= YYMAXUTOK ? yytranslate[YYX] : YYUNDEFTOK)
+#define YYTRANSLATE(YYX)                                \
+  (0 <= (YYX) && (YYX) <= YYMAXUTOK                     \
+   ? YY_CAST (yysymbol_kind_t, yytranslate[YYX])        \
+   : YYSYMBOL_YYUNDEF)
 
 /* YYTRANSLATE[TOKEN-NUM] -- Symbol number corresponding to TOKEN-NUM
    as returned by yylex.  */
@@ -669,40 +732,42 @@ static const yytype_int8 yytranslate[] =
 };
 
 #if UNITSDEBUG
-  /* YYRLINE[YYN] -- Source line where rule number YYN was defined.  */
+/* YYRLINE[YYN] -- Source line where rule number YYN was defined.  */
 static const yytype_int16 yyrline[] =
 {
-       0,   209,   209,   211,   212,   215,   216,   219,   220,   221,
-     222,   224,   227,   229,   231,   235,   236,   239,   245,   246,
-     247,   249,   251,   253,   254,   255,   256,   257,   258,   259,
-     260,   263,   266,   267,   268,   269,   270
+       0,   210,   210,   212,   213,   216,   217,   220,   221,   222,
+     223,   225,   228,   230,   232,   236,   237,   240,   246,   247,
+     248,   250,   252,   254,   255,   256,   257,   258,   259,   260,
+     261,   264,   267,   268,   269,   270,   271
 };
 #endif
 
-#if UNITSDEBUG || YYERROR_VERBOSE || 0
+/** Accessing symbol of state STATE.  */
+#define YY_ACCESSING_SYMBOL(State) YY_CAST (yysymbol_kind_t, yystos[State])
+
+#if UNITSDEBUG || 0
+/* The user-facing name of the symbol whose (internal) number is
+   YYSYMBOL.  No bounds checking.  */
+static const char *yysymbol_name (yysymbol_kind_t yysymbol) YY_ATTRIBUTE_UNUSED;
+
 /* YYTNAME[SYMBOL-NUM] -- String name of the symbol SYMBOL-NUM.
    First, the terminals, then, starting at YYNTOKENS, nonterminals.  */
 static const char *const yytname[] =
 {
-  "$end", "error", "$undefined", "REAL", "UNIT", "REALFUNC", "LOG",
-  "UNITFUNC", "EXPONENT", "MULTIPLY", "MULTSTAR", "DIVIDE", "NUMDIV",
-  "SQRT", "CUBEROOT", "MULTMINUS", "EOL", "FUNCINV", "MEMERROR",
-  "BADNUMBER", "UNITEND", "LASTUNSET", "ADD", "MINUS", "UNARY", "'('",
-  "')'", "$accept", "input", "unitexpr", "expr", "numexpr", "pexpr",
+  "\"end of file\"", "error", "\"invalid token\"", "REAL", "UNIT",
+  "REALFUNC", "LOG", "UNITFUNC", "EXPONENT", "MULTIPLY", "MULTSTAR",
+  "DIVIDE", "NUMDIV", "SQRT", "CUBEROOT", "MULTMINUS", "EOL", "FUNCINV",
+  "MEMERROR", "BADNUMBER", "UNITEND", "LASTUNSET", "ADD", "MINUS", "UNARY",
+  "'('", "')'", "$accept", "input", "unitexpr", "expr", "numexpr", "pexpr",
   "list", YY_NULLPTR
 };
-#endif
 
-# ifdef YYPRINT
-/* YYTOKNUM[NUM] -- (External) token number corresponding to the
-   (internal) symbol number NUM (which must be that of a token).  */
-static const yytype_int16 yytoknum[] =
+static const char *
+yysymbol_name (yysymbol_kind_t yysymbol)
 {
-       0,   256,   257,   258,   259,   260,   261,   262,   263,   264,
-     265,   266,   267,   268,   269,   270,   271,   272,   273,   274,
-     275,   276,   277,   278,   279,    40,    41
-};
-# endif
+  return yytname[yysymbol];
+}
+#endif
 
 #define YYPACT_NINF (-22)
 
@@ -714,8 +779,8 @@ static const yytype_int16 yytoknum[] =
 #define yytable_value_is_error(Yyn) \
   0
 
-  /* YYPACT[STATE-NUM] -- Index in YYTABLE of the portion describing
-     STATE-NUM.  */
+/* YYPACT[STATE-NUM] -- Index in YYTABLE of the portion describing
+   STATE-NUM.  */
 static const yytype_int16 yypact[] =
 {
        8,   -22,   -22,   -22,   -21,   -21,   -21,   151,   -21,   -21,
@@ -727,9 +792,9 @@ static const yytype_int16 yypact[] =
       42
 };
 
-  /* YYDEFACT[STATE-NUM] -- Default reduction number in state STATE-NUM.
-     Performed when YYTABLE does not specify something else to do.  Zero
-     means the default is an error.  */
+/* YYDEFACT[STATE-NUM] -- Default reduction number in state STATE-NUM.
+   Performed when YYTABLE does not specify something else to do.  Zero
+   means the default is an error.  */
 static const yytype_int8 yydefact[] =
 {
        0,     4,    15,    19,     0,     0,     0,     0,     0,     0,
@@ -741,21 +806,21 @@ static const yytype_int8 yydefact[] =
       31
 };
 
-  /* YYPGOTO[NTERM-NUM].  */
+/* YYPGOTO[NTERM-NUM].  */
 static const yytype_int8 yypgoto[] =
 {
      -22,   -22,   -22,    19,    24,    -3,     0
 };
 
-  /* YYDEFGOTO[NTERM-NUM].  */
+/* YYDEFGOTO[NTERM-NUM].  */
 static const yytype_int8 yydefgoto[] =
 {
-      -1,    19,    20,    21,    22,    23,    46
+       0,    19,    20,    21,    22,    23,    46
 };
 
-  /* YYTABLE[YYPACT[STATE-NUM]] -- What to do in state STATE-NUM.  If
-     positive, shift that token.  If negative, reduce the rule whose
-     number is the opposite.  If YYTABLE_NINF, syntax error.  */
+/* YYTABLE[YYPACT[STATE-NUM]] -- What to do in state STATE-NUM.  If
+   positive, shift that token.  If negative, reduce the rule whose
+   number is the opposite.  If YYTABLE_NINF, syntax error.  */
 static const yytype_int8 yytable[] =
 {
       24,    25,    26,    27,    18,    29,    30,    28,    37,     1,
@@ -800,8 +865,8 @@ static const yytype_int8 yycheck[] =
       19,    20,    21,    -1,    -1,    -1,    25
 };
 
-  /* YYSTOS[STATE-NUM] -- The (internal number of the) accessing
-     symbol of state STATE-NUM.  */
+/* YYSTOS[STATE-NUM] -- The symbol kind of the accessing symbol of
+   state STATE-NUM.  */
 static const yytype_int8 yystos[] =
 {
        0,     1,     3,     4,     5,     6,     7,    11,    13,    14,
@@ -813,7 +878,7 @@ static const yytype_int8 yystos[] =
       33
 };
 
-  /* YYR1[YYN] -- Symbol number of symbol that rule YYN derives.  */
+/* YYR1[RULE-NUM] -- Symbol kind of the left-hand side of rule RULE-NUM.  */
 static const yytype_int8 yyr1[] =
 {
        0,    27,    28,    28,    28,    29,    29,    30,    30,    30,
@@ -822,7 +887,7 @@ static const yytype_int8 yyr1[] =
       33,    33,    33,    33,    33,    33,    33
 };
 
-  /* YYR2[YYN] -- Number of symbols on the right hand side of rule YYN.  */
+/* YYR2[RULE-NUM] -- Number of symbols on the right-hand side of rule RULE-NUM.  */
 static const yytype_int8 yyr2[] =
 {
        0,     2,     1,     2,     1,     1,     2,     1,     2,     2,
@@ -832,21 +897,22 @@ static const yytype_int8 yyr2[] =
 };
 
 
+enum { YYENOMEM = -2 };
+
 #define yyerrok         (yyerrstatus = 0)
-#define yyclearin       (yychar = YYEMPTY)
-#define YYEMPTY         (-2)
-#define YYEOF           0
+#define yyclearin       (yychar = UNITSEMPTY)
 
 #define YYACCEPT        goto yyacceptlab
 #define YYABORT         goto yyabortlab
 #define YYERROR         goto yyerrorlab
+#define YYNOMEM         goto yyexhaustedlab
 
 
 #define YYRECOVERING()  (!!yyerrstatus)
 
 #define YYBACKUP(Token, Value)                                    \
   do                                                              \
-    if (yychar == YYEMPTY)                                        \
+    if (yychar == UNITSEMPTY)                                        \
       {                                                           \
         yychar = (Token);                                         \
         yylval = (Value);                                         \
@@ -861,10 +927,9 @@ static const yytype_int8 yyr2[] =
       }                                                           \
   while (0)
 
-/* Error token number */
-#define YYTERROR        1
-#define YYERRCODE       256
-
+/* Backward compatibility with an undocumented macro.
+   Use UNITSerror or UNITSUNDEF. */
+#define YYERRCODE UNITSUNDEF
 
 
 /* Enable debugging if requested.  */
@@ -881,19 +946,16 @@ do {                                            \
     YYFPRINTF Args;                             \
 } while (0)
 
-/* This macro is provided for backward compatibility. */
-#ifndef YY_LOCATION_PRINT
-# define YY_LOCATION_PRINT(File, Loc) ((void) 0)
-#endif
 
 
-# define YY_SYMBOL_PRINT(Title, Type, Value, Location)                    \
+
+# define YY_SYMBOL_PRINT(Title, Kind, Value, Location)                    \
 do {                                                                      \
   if (yydebug)                                                            \
     {                                                                     \
       YYFPRINTF (stderr, "%s ", Title);                                   \
       yy_symbol_print (stderr,                                            \
-                  Type, Value, comm); \
+                  Kind, Value, comm); \
       YYFPRINTF (stderr, "\n");                                           \
     }                                                                     \
 } while (0)
@@ -904,19 +966,16 @@ do {                                                                      \
 `-----------------------------------*/
 
 static void
-yy_symbol_value_print (FILE *yyo, int yytype, YYSTYPE const * const yyvaluep, struct commtype *comm)
+yy_symbol_value_print (FILE *yyo,
+                       yysymbol_kind_t yykind, YYSTYPE const * const yyvaluep, struct commtype *comm)
 {
   FILE *yyoutput = yyo;
-  YYUSE (yyoutput);
-  YYUSE (comm);
+  YY_USE (yyoutput);
+  YY_USE (comm);
   if (!yyvaluep)
     return;
-# ifdef YYPRINT
-  if (yytype < YYNTOKENS)
-    YYPRINT (yyo, yytoknum[yytype], *yyvaluep);
-# endif
   YY_IGNORE_MAYBE_UNINITIALIZED_BEGIN
-  YYUSE (yytype);
+  YY_USE (yykind);
   YY_IGNORE_MAYBE_UNINITIALIZED_END
 }
 
@@ -926,12 +985,13 @@ yy_symbol_value_print (FILE *yyo, int yytype, YYSTYPE const * const yyvaluep, st
 `---------------------------*/
 
 static void
-yy_symbol_print (FILE *yyo, int yytype, YYSTYPE const * const yyvaluep, struct commtype *comm)
+yy_symbol_print (FILE *yyo,
+                 yysymbol_kind_t yykind, YYSTYPE const * const yyvaluep, struct commtype *comm)
 {
   YYFPRINTF (yyo, "%s %s (",
-             yytype < YYNTOKENS ? "token" : "nterm", yytname[yytype]);
+             yykind < YYNTOKENS ? "token" : "nterm", yysymbol_name (yykind));
 
-  yy_symbol_value_print (yyo, yytype, yyvaluep, comm);
+  yy_symbol_value_print (yyo, yykind, yyvaluep, comm);
   YYFPRINTF (yyo, ")");
 }
 
@@ -964,7 +1024,8 @@ do {                                                            \
 `------------------------------------------------*/
 
 static void
-yy_reduce_print (yy_state_t *yyssp, YYSTYPE *yyvsp, int yyrule, struct commtype *comm)
+yy_reduce_print (yy_state_t *yyssp, YYSTYPE *yyvsp,
+                 int yyrule, struct commtype *comm)
 {
   int yylno = yyrline[yyrule];
   int yynrhs = yyr2[yyrule];
@@ -976,9 +1037,8 @@ yy_reduce_print (yy_state_t *yyssp, YYSTYPE *yyvsp, int yyrule, struct commtype
     {
       YYFPRINTF (stderr, "   $%d = ", yyi + 1);
       yy_symbol_print (stderr,
-                       yystos[+yyssp[yyi + 1 - yynrhs]],
-                       &yyvsp[(yyi + 1) - (yynrhs)]
-                                              , comm);
+                       YY_ACCESSING_SYMBOL (+yyssp[yyi + 1 - yynrhs]),
+                       &yyvsp[(yyi + 1) - (yynrhs)], comm);
       YYFPRINTF (stderr, "\n");
     }
 }
@@ -993,8 +1053,8 @@ do {                                    \
    multiple parsers can coexist.  */
 int yydebug;
 #else /* !UNITSDEBUG */
-# define YYDPRINTF(Args)
-# define YY_SYMBOL_PRINT(Title, Type, Value, Location)
+# define YYDPRINTF(Args) ((void) 0)
+# define YY_SYMBOL_PRINT(Title, Kind, Value, Location)
 # define YY_STACK_PRINT(Bottom, Top)
 # define YY_REDUCE_PRINT(Rule)
 #endif /* !UNITSDEBUG */
@@ -1017,282 +1077,55 @@ int yydebug;
 #endif
 
 
-#if YYERROR_VERBOSE
 
-# ifndef yystrlen
-#  if defined __GLIBC__ && defined _STRING_H
-#   define yystrlen(S) (YY_CAST (YYPTRDIFF_T, strlen (S)))
-#  else
-/* Return the length of YYSTR.  */
-static YYPTRDIFF_T
-yystrlen (const char *yystr)
-{
-  YYPTRDIFF_T yylen;
-  for (yylen = 0; yystr[yylen]; yylen++)
-    continue;
-  return yylen;
-}
-#  endif
-# endif
 
-# ifndef yystpcpy
-#  if defined __GLIBC__ && defined _STRING_H && defined _GNU_SOURCE
-#   define yystpcpy stpcpy
-#  else
-/* Copy YYSRC to YYDEST, returning the address of the terminating '\0' in
-   YYDEST.  */
-static char *
-yystpcpy (char *yydest, const char *yysrc)
-{
-  char *yyd = yydest;
-  const char *yys = yysrc;
-
-  while ((*yyd++ = *yys++) != '\0')
-    continue;
-
-  return yyd - 1;
-}
-#  endif
-# endif
-
-# ifndef yytnamerr
-/* Copy to YYRES the contents of YYSTR after stripping away unnecessary
-   quotes and backslashes, so that it's suitable for yyerror.  The
-   heuristic is that double-quoting is unnecessary unless the string
-   contains an apostrophe, a comma, or backslash (other than
-   backslash-backslash).  YYSTR is taken from yytname.  If YYRES is
-   null, do not copy; instead, return the length of what the result
-   would have been.  */
-static YYPTRDIFF_T
-yytnamerr (char *yyres, const char *yystr)
-{
-  if (*yystr == '"')
-    {
-      YYPTRDIFF_T yyn = 0;
-      char const *yyp = yystr;
-
-      for (;;)
-        switch (*++yyp)
-          {
-          case '\'':
-          case ',':
-            goto do_not_strip_quotes;
-
-          case '\\':
-            if (*++yyp != '\\')
-              goto do_not_strip_quotes;
-            else
-              goto append;
-
-          append:
-          default:
-            if (yyres)
-              yyres[yyn] = *yyp;
-            yyn++;
-            break;
-
-          case '"':
-            if (yyres)
-              yyres[yyn] = '\0';
-            return yyn;
-          }
-    do_not_strip_quotes: ;
-    }
-
-  if (yyres)
-    return yystpcpy (yyres, yystr) - yyres;
-  else
-    return yystrlen (yystr);
-}
-# endif
 
-/* Copy into *YYMSG, which is of size *YYMSG_ALLOC, an error message
-   about the unexpected token YYTOKEN for the state stack whose top is
-   YYSSP.
-
-   Return 0 if *YYMSG was successfully written.  Return 1 if *YYMSG is
-   not large enough to hold the message.  In that case, also set
-   *YYMSG_ALLOC to the required number of bytes.  Return 2 if the
-   required number of bytes is too large to store.  */
-static int
-yysyntax_error (YYPTRDIFF_T *yymsg_alloc, char **yymsg,
-                yy_state_t *yyssp, int yytoken)
-{
-  enum { YYERROR_VERBOSE_ARGS_MAXIMUM = 5 };
-  /* Internationalized format string. */
-  const char *yyformat = YY_NULLPTR;
-  /* Arguments of yyformat: reported tokens (one for the "unexpected",
-     one per "expected"). */
-  char const *yyarg[YYERROR_VERBOSE_ARGS_MAXIMUM];
-  /* Actual size of YYARG. */
-  int yycount = 0;
-  /* Cumulated lengths of YYARG.  */
-  YYPTRDIFF_T yysize = 0;
-
-  /* There are many possibilities here to consider:
-     - If this state is a consistent state with a default action, then
-       the only way this function was invoked is if the default action
-       is an error action.  In that case, don't check for expected
-       tokens because there are none.
-     - The only way there can be no lookahead present (in yychar) is if
-       this state is a consistent state with a default action.  Thus,
-       detecting the absence of a lookahead is sufficient to determine
-       that there is no unexpected or expected token to report.  In that
-       case, just report a simple "syntax error".
-     - Don't assume there isn't a lookahead just because this state is a
-       consistent state with a default action.  There might have been a
-       previous inconsistent state, consistent state with a non-default
-       action, or user semantic action that manipulated yychar.
-     - Of course, the expected token list depends on states to have
-       correct lookahead information, and it depends on the parser not
-       to perform extra reductions after fetching a lookahead from the
-       scanner and before detecting a syntax error.  Thus, state merging
-       (from LALR or IELR) and default reductions corrupt the expected
-       token list.  However, the list is correct for canonical LR with
-       one exception: it will still contain any token that will not be
-       accepted due to an error action in a later state.
-  */
-  if (yytoken != YYEMPTY)
-    {
-      int yyn = yypact[+*yyssp];
-      YYPTRDIFF_T yysize0 = yytnamerr (YY_NULLPTR, yytname[yytoken]);
-      yysize = yysize0;
-      yyarg[yycount++] = yytname[yytoken];
-      if (!yypact_value_is_default (yyn))
-        {
-          /* Start YYX at -YYN if negative to avoid negative indexes in
-             YYCHECK.  In other words, skip the first -YYN actions for
-             this state because they are default actions.  */
-          int yyxbegin = yyn < 0 ? -yyn : 0;
-          /* Stay within bounds of both yycheck and yytname.  */
-          int yychecklim = YYLAST - yyn + 1;
-          int yyxend = yychecklim < YYNTOKENS ? yychecklim : YYNTOKENS;
-          int yyx;
-
-          for (yyx = yyxbegin; yyx < yyxend; ++yyx)
-            if (yycheck[yyx + yyn] == yyx && yyx != YYTERROR
-                && !yytable_value_is_error (yytable[yyx + yyn]))
-              {
-                if (yycount == YYERROR_VERBOSE_ARGS_MAXIMUM)
-                  {
-                    yycount = 1;
-                    yysize = yysize0;
-                    break;
-                  }
-                yyarg[yycount++] = yytname[yyx];
-                {
-                  YYPTRDIFF_T yysize1
-                    = yysize + yytnamerr (YY_NULLPTR, yytname[yyx]);
-                  if (yysize <= yysize1 && yysize1 <= YYSTACK_ALLOC_MAXIMUM)
-                    yysize = yysize1;
-                  else
-                    return 2;
-                }
-              }
-        }
-    }
-
-  switch (yycount)
-    {
-# define YYCASE_(N, S)                      \
-      case N:                               \
-        yyformat = S;                       \
-      break
-    default: /* Avoid compiler warnings. */
-      YYCASE_(0, YY_("syntax error"));
-      YYCASE_(1, YY_("syntax error, unexpected %s"));
-      YYCASE_(2, YY_("syntax error, unexpected %s, expecting %s"));
-      YYCASE_(3, YY_("syntax error, unexpected %s, expecting %s or %s"));
-      YYCASE_(4, YY_("syntax error, unexpected %s, expecting %s or %s or %s"));
-      YYCASE_(5, YY_("syntax error, unexpected %s, expecting %s or %s or %s or %s"));
-# undef YYCASE_
-    }
-
-  {
-    /* Don't count the "%s"s in the final size, but reserve room for
-       the terminator.  */
-    YYPTRDIFF_T yysize1 = yysize + (yystrlen (yyformat) - 2 * yycount) + 1;
-    if (yysize <= yysize1 && yysize1 <= YYSTACK_ALLOC_MAXIMUM)
-      yysize = yysize1;
-    else
-      return 2;
-  }
-
-  if (*yymsg_alloc < yysize)
-    {
-      *yymsg_alloc = 2 * yysize;
-      if (! (yysize <= *yymsg_alloc
-             && *yymsg_alloc <= YYSTACK_ALLOC_MAXIMUM))
-        *yymsg_alloc = YYSTACK_ALLOC_MAXIMUM;
-      return 1;
-    }
-
-  /* Avoid sprintf, as that infringes on the user's name space.
-     Don't have undefined behavior even if the translation
-     produced a string with the wrong number of "%s"s.  */
-  {
-    char *yyp = *yymsg;
-    int yyi = 0;
-    while ((*yyp = *yyformat) != '\0')
-      if (*yyp == '%' && yyformat[1] == 's' && yyi < yycount)
-        {
-          yyp += yytnamerr (yyp, yyarg[yyi++]);
-          yyformat += 2;
-        }
-      else
-        {
-          ++yyp;
-          ++yyformat;
-        }
-  }
-  return 0;
-}
-#endif /* YYERROR_VERBOSE */
 
 /*-----------------------------------------------.
 | Release the memory associated to this symbol.  |
 `-----------------------------------------------*/
 
 static void
-yydestruct (const char *yymsg, int yytype, YYSTYPE *yyvaluep, struct commtype *comm)
+yydestruct (const char *yymsg,
+            yysymbol_kind_t yykind, YYSTYPE *yyvaluep, struct commtype *comm)
 {
-  YYUSE (yyvaluep);
-  YYUSE (comm);
+  YY_USE (yyvaluep);
+  YY_USE (comm);
   if (!yymsg)
     yymsg = "Deleting";
-  YY_SYMBOL_PRINT (yymsg, yytype, yyvaluep, yylocationp);
+  YY_SYMBOL_PRINT (yymsg, yykind, yyvaluep, yylocationp);
 
   YY_IGNORE_MAYBE_UNINITIALIZED_BEGIN
-  switch (yytype)
+  switch (yykind)
     {
-    case 4: /* UNIT  */
-#line 197 "parse.y"
+    case YYSYMBOL_UNIT: /* UNIT  */
+#line 198 "parse.y"
             { destroyunit(((*yyvaluep).unit));}
-#line 1272 "parse.tab.c"
+#line 1105 "parse.tab.c"
         break;
 
-    case 29: /* unitexpr  */
-#line 197 "parse.y"
+    case YYSYMBOL_unitexpr: /* unitexpr  */
+#line 198 "parse.y"
             { destroyunit(((*yyvaluep).unit));}
-#line 1278 "parse.tab.c"
+#line 1111 "parse.tab.c"
         break;
 
-    case 30: /* expr  */
-#line 197 "parse.y"
+    case YYSYMBOL_expr: /* expr  */
+#line 198 "parse.y"
             { destroyunit(((*yyvaluep).unit));}
-#line 1284 "parse.tab.c"
+#line 1117 "parse.tab.c"
         break;
 
-    case 32: /* pexpr  */
-#line 197 "parse.y"
+    case YYSYMBOL_pexpr: /* pexpr  */
+#line 198 "parse.y"
             { destroyunit(((*yyvaluep).unit));}
-#line 1290 "parse.tab.c"
+#line 1123 "parse.tab.c"
         break;
 
-    case 33: /* list  */
-#line 197 "parse.y"
+    case YYSYMBOL_list: /* list  */
+#line 198 "parse.y"
             { destroyunit(((*yyvaluep).unit));}
-#line 1296 "parse.tab.c"
+#line 1129 "parse.tab.c"
         break;
 
       default:
@@ -1304,6 +1137,8 @@ yydestruct (const char *yymsg, int yytype, YYSTYPE *yyvaluep, struct commtype *c
 
 
 
+
+
 /*----------.
 | yyparse.  |
 `----------*/
@@ -1311,7 +1146,7 @@ yydestruct (const char *yymsg, int yytype, YYSTYPE *yyvaluep, struct commtype *c
 int
 yyparse (struct commtype *comm)
 {
-/* The lookahead symbol.  */
+/* Lookahead token kind.  */
 int yychar;
 
 
@@ -1322,45 +1157,38 @@ YY_INITIAL_VALUE (static YYSTYPE yyval_default;)
 YYSTYPE yylval YY_INITIAL_VALUE (= yyval_default);
 
     /* Number of syntax errors so far.  */
-    int yynerrs;
+    int yynerrs = 0;
 
-    yy_state_fast_t yystate;
+    yy_state_fast_t yystate = 0;
     /* Number of tokens to shift before error messages enabled.  */
-    int yyerrstatus;
-
-    /* The stacks and their tools:
-       'yyss': related to states.
-       'yyvs': related to semantic values.
+    int yyerrstatus = 0;
 
-       Refer to the stacks through separate pointers, to allow yyoverflow
+    /* Refer to the stacks through separate pointers, to allow yyoverflow
        to reallocate them elsewhere.  */
 
-    /* The state stack.  */
+    /* Their size.  */
+    YYPTRDIFF_T yystacksize = YYINITDEPTH;
+
+    /* The state stack: array, bottom, top.  */
     yy_state_t yyssa[YYINITDEPTH];
-    yy_state_t *yyss;
-    yy_state_t *yyssp;
+    yy_state_t *yyss = yyssa;
+    yy_state_t *yyssp = yyss;
 
-    /* The semantic value stack.  */
+    /* The semantic value stack: array, bottom, top.  */
     YYSTYPE yyvsa[YYINITDEPTH];
-    YYSTYPE *yyvs;
-    YYSTYPE *yyvsp;
-
-    YYPTRDIFF_T yystacksize;
+    YYSTYPE *yyvs = yyvsa;
+    YYSTYPE *yyvsp = yyvs;
 
   int yyn;
+  /* The return value of yyparse.  */
   int yyresult;
-  /* Lookahead token as an internal (translated) token number.  */
-  int yytoken = 0;
+  /* Lookahead symbol kind.  */
+  yysymbol_kind_t yytoken = YYSYMBOL_YYEMPTY;
   /* The variables used to return semantic value and location from the
      action routines.  */
   YYSTYPE yyval;
 
-#if YYERROR_VERBOSE
-  /* Buffer for error messages, and its allocated size.  */
-  char yymsgbuf[128];
-  char *yymsg = yymsgbuf;
-  YYPTRDIFF_T yymsg_alloc = sizeof yymsgbuf;
-#endif
+
 
 #define YYPOPSTACK(N)   (yyvsp -= (N), yyssp -= (N))
 
@@ -1368,16 +1196,10 @@ YYSTYPE yylval YY_INITIAL_VALUE (= yyval_default);
      Keep to zero when no symbol should be popped.  */
   int yylen = 0;
 
-  yyssp = yyss = yyssa;
-  yyvsp = yyvs = yyvsa;
-  yystacksize = YYINITDEPTH;
-
   YYDPRINTF ((stderr, "Starting parse\n"));
 
-  yystate = 0;
-  yyerrstatus = 0;
-  yynerrs = 0;
-  yychar = YYEMPTY; /* Cause a token to be read.  */
+  yychar = UNITSEMPTY; /* Cause a token to be read.  */
+
   goto yysetstate;
 
 
@@ -1399,10 +1221,11 @@ yysetstate:
   YY_IGNORE_USELESS_CAST_BEGIN
   *yyssp = YY_CAST (yy_state_t, yystate);
   YY_IGNORE_USELESS_CAST_END
+  YY_STACK_PRINT (yyss, yyssp);
 
   if (yyss + yystacksize - 1 <= yyssp)
 #if !defined yyoverflow && !defined YYSTACK_RELOCATE
-    goto yyexhaustedlab;
+    YYNOMEM;
 #else
     {
       /* Get the current used size of the three stacks, in elements.  */
@@ -1430,7 +1253,7 @@ yysetstate:
 # else /* defined YYSTACK_RELOCATE */
       /* Extend the stack our own way.  */
       if (YYMAXDEPTH <= yystacksize)
-        goto yyexhaustedlab;
+        YYNOMEM;
       yystacksize *= 2;
       if (YYMAXDEPTH < yystacksize)
         yystacksize = YYMAXDEPTH;
@@ -1441,10 +1264,10 @@ yysetstate:
           YY_CAST (union yyalloc *,
                    YYSTACK_ALLOC (YY_CAST (YYSIZE_T, YYSTACK_BYTES (yystacksize))));
         if (! yyptr)
-          goto yyexhaustedlab;
+          YYNOMEM;
         YYSTACK_RELOCATE (yyss_alloc, yyss);
         YYSTACK_RELOCATE (yyvs_alloc, yyvs);
-# undef YYSTACK_RELOCATE
+#  undef YYSTACK_RELOCATE
         if (yyss1 != yyssa)
           YYSTACK_FREE (yyss1);
       }
@@ -1463,6 +1286,7 @@ yysetstate:
     }
 #endif /* !defined yyoverflow && !defined YYSTACK_RELOCATE */
 
+
   if (yystate == YYFINAL)
     YYACCEPT;
 
@@ -1483,18 +1307,29 @@ yybackup:
 
   /* Not known => get a lookahead token if don't already have one.  */
 
-  /* YYCHAR is either YYEMPTY or YYEOF or a valid lookahead symbol.  */
-  if (yychar == YYEMPTY)
+  /* YYCHAR is either empty, or end-of-input, or a valid lookahead.  */
+  if (yychar == UNITSEMPTY)
     {
-      YYDPRINTF ((stderr, "Reading a token: "));
+      YYDPRINTF ((stderr, "Reading a token\n"));
       yychar = yylex (&yylval, comm);
     }
 
-  if (yychar <= YYEOF)
+  if (yychar <= UNITSEOF)
     {
-      yychar = yytoken = YYEOF;
+      yychar = UNITSEOF;
+      yytoken = YYSYMBOL_YYEOF;
       YYDPRINTF ((stderr, "Now at end of input.\n"));
     }
+  else if (yychar == UNITSerror)
+    {
+      /* The scanner already issued an error message, process directly
+         to error recovery.  But do not keep the error token as
+         lookahead, it is too special and may lead us to an endless
+         loop in error recovery. */
+      yychar = UNITSUNDEF;
+      yytoken = YYSYMBOL_YYerror;
+      goto yyerrlab1;
+    }
   else
     {
       yytoken = YYTRANSLATE (yychar);
@@ -1528,7 +1363,7 @@ yybackup:
   YY_IGNORE_MAYBE_UNINITIALIZED_END
 
   /* Discard the shifted token.  */
-  yychar = YYEMPTY;
+  yychar = UNITSEMPTY;
   goto yynewstate;
 
 
@@ -1563,230 +1398,230 @@ yyreduce:
   YY_REDUCE_PRINT (yyn);
   switch (yyn)
     {
-  case 2:
-#line 209 "parse.y"
+  case 2: /* input: EOL  */
+#line 210 "parse.y"
                       { comm->result = makenumunit(1,&err); CHECK(0);
                        comm->errorcode = 0; YYACCEPT; }
-#line 1571 "parse.tab.c"
+#line 1406 "parse.tab.c"
     break;
 
-  case 3:
-#line 211 "parse.y"
+  case 3: /* input: unitexpr EOL  */
+#line 212 "parse.y"
                      { comm->result = (yyvsp[-1].unit); comm->errorcode = 0; YYACCEPT; }
-#line 1577 "parse.tab.c"
+#line 1412 "parse.tab.c"
     break;
 
-  case 4:
-#line 212 "parse.y"
+  case 4: /* input: error  */
+#line 213 "parse.y"
                      { YYABORT; }
-#line 1583 "parse.tab.c"
+#line 1418 "parse.tab.c"
     break;
 
-  case 5:
-#line 215 "parse.y"
+  case 5: /* unitexpr: expr  */
+#line 216 "parse.y"
                                     { (yyval.unit) = (yyvsp[0].unit);}
-#line 1589 "parse.tab.c"
+#line 1424 "parse.tab.c"
     break;
 
-  case 6:
-#line 216 "parse.y"
+  case 6: /* unitexpr: DIVIDE list  */
+#line 217 "parse.y"
                                     { invertunit((yyvsp[0].unit)); (yyval.unit)=(yyvsp[0].unit);}
-#line 1595 "parse.tab.c"
+#line 1430 "parse.tab.c"
     break;
 
-  case 7:
-#line 219 "parse.y"
+  case 7: /* expr: list  */
+#line 220 "parse.y"
                                     { (yyval.unit) = (yyvsp[0].unit); }
-#line 1601 "parse.tab.c"
+#line 1436 "parse.tab.c"
     break;
 
-  case 8:
-#line 220 "parse.y"
+  case 8: /* expr: MULTMINUS list  */
+#line 221 "parse.y"
                                     { (yyval.unit) = (yyvsp[0].unit); (yyval.unit)->factor *= -1; }
-#line 1607 "parse.tab.c"
+#line 1442 "parse.tab.c"
     break;
 
-  case 9:
-#line 221 "parse.y"
+  case 9: /* expr: MINUS list  */
+#line 222 "parse.y"
                                     { (yyval.unit) = (yyvsp[0].unit); (yyval.unit)->factor *= -1; }
-#line 1613 "parse.tab.c"
+#line 1448 "parse.tab.c"
     break;
 
-  case 10:
-#line 222 "parse.y"
+  case 10: /* expr: expr ADD expr  */
+#line 223 "parse.y"
                                     { err = addunit((yyvsp[-2].unit),(yyvsp[0].unit)); destroyunit((yyvsp[0].unit));
                                       CHECK((yyvsp[-2].unit));(yyval.unit)=(yyvsp[-2].unit);}
-#line 1620 "parse.tab.c"
+#line 1455 "parse.tab.c"
     break;
 
-  case 11:
-#line 224 "parse.y"
+  case 11: /* expr: expr MINUS expr  */
+#line 225 "parse.y"
                                     { (yyvsp[0].unit)->factor *= -1;
                                       err = addunit((yyvsp[-2].unit),(yyvsp[0].unit)); destroyunit((yyvsp[0].unit));
                                       CHECK((yyvsp[-2].unit));(yyval.unit)=(yyvsp[-2].unit);}
-#line 1628 "parse.tab.c"
+#line 1463 "parse.tab.c"
     break;
 
-  case 12:
-#line 227 "parse.y"
+  case 12: /* expr: expr DIVIDE expr  */
+#line 228 "parse.y"
                                     { err = divunit((yyvsp[-2].unit), (yyvsp[0].unit)); destroyunit((yyvsp[0].unit));
                                       CHECK((yyvsp[-2].unit));(yyval.unit)=(yyvsp[-2].unit);}
-#line 1635 "parse.tab.c"
+#line 1470 "parse.tab.c"
     break;
 
-  case 13:
-#line 229 "parse.y"
+  case 13: /* expr: expr MULTIPLY expr  */
+#line 230 "parse.y"
                                     { err = multunit((yyvsp[-2].unit),(yyvsp[0].unit)); destroyunit((yyvsp[0].unit));
                                       CHECK((yyvsp[-2].unit));(yyval.unit)=(yyvsp[-2].unit);}
-#line 1642 "parse.tab.c"
+#line 1477 "parse.tab.c"
     break;
 
-  case 14:
-#line 231 "parse.y"
+  case 14: /* expr: expr MULTSTAR expr  */
+#line 232 "parse.y"
                                     { err = multunit((yyvsp[-2].unit),(yyvsp[0].unit)); destroyunit((yyvsp[0].unit));
                                       CHECK((yyvsp[-2].unit));(yyval.unit)=(yyvsp[-2].unit);}
-#line 1649 "parse.tab.c"
+#line 1484 "parse.tab.c"
     break;
 
-  case 15:
-#line 235 "parse.y"
+  case 15: /* numexpr: REAL  */
+#line 236 "parse.y"
                                     { (yyval.number) = (yyvsp[0].number);         }
-#line 1655 "parse.tab.c"
+#line 1490 "parse.tab.c"
     break;
 
-  case 16:
-#line 236 "parse.y"
+  case 16: /* numexpr: numexpr NUMDIV numexpr  */
+#line 237 "parse.y"
                                     { (yyval.number) = (yyvsp[-2].number) / (yyvsp[0].number);    }
-#line 1661 "parse.tab.c"
+#line 1496 "parse.tab.c"
     break;
 
-  case 17:
-#line 239 "parse.y"
+  case 17: /* pexpr: '(' expr ')'  */
+#line 240 "parse.y"
                                     { (yyval.unit) = (yyvsp[-1].unit);  }
-#line 1667 "parse.tab.c"
+#line 1502 "parse.tab.c"
     break;
 
-  case 18:
-#line 245 "parse.y"
+  case 18: /* list: numexpr  */
+#line 246 "parse.y"
                                    { (yyval.unit) = makenumunit((yyvsp[0].number),&err); CHECK(0);}
-#line 1673 "parse.tab.c"
+#line 1508 "parse.tab.c"
     break;
 
-  case 19:
-#line 246 "parse.y"
+  case 19: /* list: UNIT  */
+#line 247 "parse.y"
                                    { (yyval.unit) = (yyvsp[0].unit); }
-#line 1679 "parse.tab.c"
+#line 1514 "parse.tab.c"
     break;
 
-  case 20:
-#line 247 "parse.y"
+  case 20: /* list: list EXPONENT list  */
+#line 248 "parse.y"
                                    { err = unitpower((yyvsp[-2].unit),(yyvsp[0].unit));destroyunit((yyvsp[0].unit));
                                      CHECK((yyvsp[-2].unit));(yyval.unit)=(yyvsp[-2].unit);}
-#line 1686 "parse.tab.c"
+#line 1521 "parse.tab.c"
     break;
 
-  case 21:
-#line 249 "parse.y"
+  case 21: /* list: list MULTMINUS list  */
+#line 250 "parse.y"
                                    { err = multunit((yyvsp[-2].unit),(yyvsp[0].unit)); destroyunit((yyvsp[0].unit));
                                      CHECK((yyvsp[-2].unit));(yyval.unit)=(yyvsp[-2].unit);}
-#line 1693 "parse.tab.c"
+#line 1528 "parse.tab.c"
     break;
 
-  case 22:
-#line 251 "parse.y"
+  case 22: /* list: list list  */
+#line 252 "parse.y"
                                    { err = multunit((yyvsp[-1].unit),(yyvsp[0].unit)); destroyunit((yyvsp[0].unit));
                                      CHECK((yyvsp[-1].unit));(yyval.unit)=(yyvsp[-1].unit);}
-#line 1700 "parse.tab.c"
+#line 1535 "parse.tab.c"
     break;
 
-  case 23:
-#line 253 "parse.y"
+  case 23: /* list: pexpr  */
+#line 254 "parse.y"
                                    { (yyval.unit)=(yyvsp[0].unit); }
-#line 1706 "parse.tab.c"
+#line 1541 "parse.tab.c"
     break;
 
-  case 24:
-#line 254 "parse.y"
+  case 24: /* list: SQRT pexpr  */
+#line 255 "parse.y"
                                    { err = rootunit((yyvsp[0].unit),2); CHECK((yyvsp[0].unit)); (yyval.unit)=(yyvsp[0].unit);}
-#line 1712 "parse.tab.c"
+#line 1547 "parse.tab.c"
     break;
 
-  case 25:
-#line 255 "parse.y"
+  case 25: /* list: CUBEROOT pexpr  */
+#line 256 "parse.y"
                                    { err = rootunit((yyvsp[0].unit),3); CHECK((yyvsp[0].unit)); (yyval.unit)=(yyvsp[0].unit);}
-#line 1718 "parse.tab.c"
+#line 1553 "parse.tab.c"
     break;
 
-  case 26:
-#line 256 "parse.y"
+  case 26: /* list: REALFUNC pexpr  */
+#line 257 "parse.y"
                                    { err = funcunit((yyvsp[0].unit),(yyvsp[-1].realfunc));CHECK((yyvsp[0].unit)); (yyval.unit)=(yyvsp[0].unit);}
-#line 1724 "parse.tab.c"
+#line 1559 "parse.tab.c"
     break;
 
-  case 27:
-#line 257 "parse.y"
+  case 27: /* list: LOG pexpr  */
+#line 258 "parse.y"
                                    { err = logunit((yyvsp[0].unit),(yyvsp[-1].integer)); CHECK((yyvsp[0].unit)); (yyval.unit)=(yyvsp[0].unit);}
-#line 1730 "parse.tab.c"
+#line 1565 "parse.tab.c"
     break;
 
-  case 28:
-#line 258 "parse.y"
+  case 28: /* list: UNITFUNC pexpr  */
+#line 259 "parse.y"
                                    { err = evalfunc((yyvsp[0].unit),(yyvsp[-1].unitfunc),0,0); CHECK((yyvsp[0].unit));(yyval.unit)=(yyvsp[0].unit);}
-#line 1736 "parse.tab.c"
+#line 1571 "parse.tab.c"
     break;
 
-  case 29:
-#line 259 "parse.y"
+  case 29: /* list: FUNCINV UNITFUNC pexpr  */
+#line 260 "parse.y"
                                    { err = evalfunc((yyvsp[0].unit),(yyvsp[-1].unitfunc),1,0); CHECK((yyvsp[0].unit));(yyval.unit)=(yyvsp[0].unit);}
-#line 1742 "parse.tab.c"
+#line 1577 "parse.tab.c"
     break;
 
-  case 30:
-#line 261 "parse.y"
+  case 30: /* list: list EXPONENT MULTMINUS list  */
+#line 262 "parse.y"
                                    { (yyvsp[0].unit)->factor *= -1; err = unitpower((yyvsp[-3].unit),(yyvsp[0].unit));
                                      destroyunit((yyvsp[0].unit));CHECK((yyvsp[-3].unit));(yyval.unit)=(yyvsp[-3].unit);}
-#line 1749 "parse.tab.c"
+#line 1584 "parse.tab.c"
     break;
 
-  case 31:
-#line 264 "parse.y"
+  case 31: /* list: list EXPONENT MINUS list  */
+#line 265 "parse.y"
                                    { (yyvsp[0].unit)->factor *= -1; err = unitpower((yyvsp[-3].unit),(yyvsp[0].unit));
                                      destroyunit((yyvsp[0].unit));CHECK((yyvsp[-3].unit));(yyval.unit)=(yyvsp[-3].unit);}
-#line 1756 "parse.tab.c"
+#line 1591 "parse.tab.c"
     break;
 
-  case 32:
-#line 266 "parse.y"
+  case 32: /* list: BADNUMBER  */
+#line 267 "parse.y"
                                    { err = E_BADNUM;   CHECK(0); }
-#line 1762 "parse.tab.c"
+#line 1597 "parse.tab.c"
     break;
 
-  case 33:
-#line 267 "parse.y"
+  case 33: /* list: MEMERROR  */
+#line 268 "parse.y"
                                    { err = E_PARSEMEM; CHECK(0); }
-#line 1768 "parse.tab.c"
+#line 1603 "parse.tab.c"
     break;
 
-  case 34:
-#line 268 "parse.y"
+  case 34: /* list: UNITEND  */
+#line 269 "parse.y"
                                    { err = E_UNITEND;  CHECK(0); }
-#line 1774 "parse.tab.c"
+#line 1609 "parse.tab.c"
     break;
 
-  case 35:
-#line 269 "parse.y"
+  case 35: /* list: LASTUNSET  */
+#line 270 "parse.y"
                                    { err = E_LASTUNSET;CHECK(0); }
-#line 1780 "parse.tab.c"
+#line 1615 "parse.tab.c"
     break;
 
-  case 36:
-#line 270 "parse.y"
+  case 36: /* list: FUNCINV UNIT  */
+#line 271 "parse.y"
                                    { err = E_NOTAFUNC; CHECK((yyvsp[0].unit));}
-#line 1786 "parse.tab.c"
+#line 1621 "parse.tab.c"
     break;
 
 
-#line 1790 "parse.tab.c"
+#line 1625 "parse.tab.c"
 
       default: break;
     }
@@ -1801,11 +1636,10 @@ yyreduce:
      case of YYERROR or YYBACKUP, subsequent parser actions might lead
      to an incorrect destructor call or verbose syntax error message
      before the lookahead is translated.  */
-  YY_SYMBOL_PRINT ("-> $$ =", yyr1[yyn], &yyval, &yyloc);
+  YY_SYMBOL_PRINT ("-> $$ =", YY_CAST (yysymbol_kind_t, yyr1[yyn]), &yyval, &yyloc);
 
   YYPOPSTACK (yylen);
   yylen = 0;
-  YY_STACK_PRINT (yyss, yyssp);
 
   *++yyvsp = yyval;
 
@@ -1829,66 +1663,30 @@ yyreduce:
 yyerrlab:
   /* Make sure we have latest lookahead translation.  See comments at
      user semantic actions for why this is necessary.  */
-  yytoken = yychar == YYEMPTY ? YYEMPTY : YYTRANSLATE (yychar);
-
+  yytoken = yychar == UNITSEMPTY ? YYSYMBOL_YYEMPTY : YYTRANSLATE (yychar);
   /* If not already recovering from an error, report this error.  */
   if (!yyerrstatus)
     {
       ++yynerrs;
-#if ! YYERROR_VERBOSE
       yyerror (comm, YY_("syntax error"));
-#else
-# define YYSYNTAX_ERROR yysyntax_error (&yymsg_alloc, &yymsg, \
-                                        yyssp, yytoken)
-      {
-        char const *yymsgp = YY_("syntax error");
-        int yysyntax_error_status;
-        yysyntax_error_status = YYSYNTAX_ERROR;
-        if (yysyntax_error_status == 0)
-          yymsgp = yymsg;
-        else if (yysyntax_error_status == 1)
-          {
-            if (yymsg != yymsgbuf)
-              YYSTACK_FREE (yymsg);
-            yymsg = YY_CAST (char *, YYSTACK_ALLOC (YY_CAST (YYSIZE_T, yymsg_alloc)));
-            if (!yymsg)
-              {
-                yymsg = yymsgbuf;
-                yymsg_alloc = sizeof yymsgbuf;
-                yysyntax_error_status = 2;
-              }
-            else
-              {
-                yysyntax_error_status = YYSYNTAX_ERROR;
-                yymsgp = yymsg;
-              }
-          }
-        yyerror (comm, yymsgp);
-        if (yysyntax_error_status == 2)
-          goto yyexhaustedlab;
-      }
-# undef YYSYNTAX_ERROR
-#endif
     }
 
-
-
   if (yyerrstatus == 3)
     {
       /* If just tried and failed to reuse lookahead token after an
          error, discard it.  */
 
-      if (yychar <= YYEOF)
+      if (yychar <= UNITSEOF)
         {
           /* Return failure if at end of input.  */
-          if (yychar == YYEOF)
+          if (yychar == UNITSEOF)
             YYABORT;
         }
       else
         {
           yydestruct ("Error: discarding",
                       yytoken, &yylval, comm);
-          yychar = YYEMPTY;
+          yychar = UNITSEMPTY;
         }
     }
 
@@ -1905,6 +1703,7 @@ yyerrorlab:
      label yyerrorlab therefore never appears in user code.  */
   if (0)
     YYERROR;
+  ++yynerrs;
 
   /* Do not reclaim the symbols of the rule whose action triggered
      this YYERROR.  */
@@ -1921,13 +1720,14 @@ yyerrorlab:
 yyerrlab1:
   yyerrstatus = 3;      /* Each real token shifted decrements this.  */
 
+  /* Pop stack until we find a state that shifts the error token.  */
   for (;;)
     {
       yyn = yypact[yystate];
       if (!yypact_value_is_default (yyn))
         {
-          yyn += YYTERROR;
-          if (0 <= yyn && yyn <= YYLAST && yycheck[yyn] == YYTERROR)
+          yyn += YYSYMBOL_YYerror;
+          if (0 <= yyn && yyn <= YYLAST && yycheck[yyn] == YYSYMBOL_YYerror)
             {
               yyn = yytable[yyn];
               if (0 < yyn)
@@ -1941,7 +1741,7 @@ yyerrlab1:
 
 
       yydestruct ("Error: popping",
-                  yystos[yystate], yyvsp, comm);
+                  YY_ACCESSING_SYMBOL (yystate), yyvsp, comm);
       YYPOPSTACK (1);
       yystate = *yyssp;
       YY_STACK_PRINT (yyss, yyssp);
@@ -1953,7 +1753,7 @@ yyerrlab1:
 
 
   /* Shift the error token.  */
-  YY_SYMBOL_PRINT ("Shifting", yystos[yyn], yyvsp, yylsp);
+  YY_SYMBOL_PRINT ("Shifting", YY_ACCESSING_SYMBOL (yyn), yyvsp, yylsp);
 
   yystate = yyn;
   goto yynewstate;
@@ -1964,7 +1764,7 @@ yyerrlab1:
 `-------------------------------------*/
 yyacceptlab:
   yyresult = 0;
-  goto yyreturn;
+  goto yyreturnlab;
 
 
 /*-----------------------------------.
@@ -1972,25 +1772,23 @@ yyacceptlab:
 `-----------------------------------*/
 yyabortlab:
   yyresult = 1;
-  goto yyreturn;
+  goto yyreturnlab;
 
 
-#if !defined yyoverflow || YYERROR_VERBOSE
-/*-------------------------------------------------.
-| yyexhaustedlab -- memory exhaustion comes here.  |
-`-------------------------------------------------*/
+/*-----------------------------------------------------------.
+| yyexhaustedlab -- YYNOMEM (memory exhaustion) comes here.  |
+`-----------------------------------------------------------*/
 yyexhaustedlab:
   yyerror (comm, YY_("memory exhausted"));
   yyresult = 2;
-  /* Fall through.  */
-#endif
+  goto yyreturnlab;
 
 
-/*-----------------------------------------------------.
-| yyreturn -- parsing is finished, return the result.  |
-`-----------------------------------------------------*/
-yyreturn:
-  if (yychar != YYEMPTY)
+/*----------------------------------------------------------.
+| yyreturnlab -- parsing is finished, clean up and return.  |
+`----------------------------------------------------------*/
+yyreturnlab:
+  if (yychar != UNITSEMPTY)
     {
       /* Make sure we have latest lookahead translation.  See comments at
          user semantic actions for why this is necessary.  */
@@ -2005,20 +1803,18 @@ yyreturn:
   while (yyssp != yyss)
     {
       yydestruct ("Cleanup: popping",
-                  yystos[+*yyssp], yyvsp, comm);
+                  YY_ACCESSING_SYMBOL (+*yyssp), yyvsp, comm);
       YYPOPSTACK (1);
     }
 #ifndef yyoverflow
   if (yyss != yyssa)
     YYSTACK_FREE (yyss);
 #endif
-#if YYERROR_VERBOSE
-  if (yymsg != yymsgbuf)
-    YYSTACK_FREE (yymsg);
-#endif
+
   return yyresult;
 }
-#line 273 "parse.y"
+
+#line 274 "parse.y"
 
 
 double
@@ -2273,6 +2069,9 @@ parseunit(struct unittype *output, char const *input,char **errstr,int *errloc)
   struct commtype comm;
   int saveunitcount;
 
+  STATCOUNT(parseunit);
+  STATCOUNT(parsedepth);
+  STATMAX(maxparsedepth, unitsstats.parsedepth);
   saveunitcount = unitcount;
   initializeunit(output);
   comm.result = 0;
@@ -2294,6 +2093,7 @@ parseunit(struct unittype *output, char const *input,char **errstr,int *errloc)
     if (unitcount!=saveunitcount)
       fprintf(stderr,"units: Parser leaked memory with error: %d in %d out\n",
              saveunitcount, unitcount);
+    STATADD(parsedepth, -1);
     return comm.errorcode;
   } else {
     if (errstr)
@@ -2303,6 +2103,7 @@ parseunit(struct unittype *output, char const *input,char **errstr,int *errloc)
     if (unitcount!=saveunitcount)
       fprintf(stderr,"units: Parser leaked memory without error: %d in %d out\n",
 	      saveunitcount, unitcount);
+    STATADD(parsedepth, -1);
     return 0;
   }
 }
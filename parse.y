@@ -32,7 +32,7 @@ struct commtype {
    int errorcode;
 };
 
-static int err;  /* value used by parser to store return values */
+static THREADLOCAL int err;  /* value used by parser to store return values */
 
 /* 
    The CHECK macro aborts parse if an error has occurred.  It optionally
@@ -47,8 +47,7 @@ static int err;  /* value used by parser to store return values */
 int yylex();
 void yyerror(struct commtype *comm, char *);
 
-#define MAXMEM 100
-int unitcount=0;    /* Counts the number of units allocated by the parser */
+THREADLOCAL int unitcount=0;  /* Units allocated by the parser */
 
 struct function { 
    char *name; 
@@ -74,6 +73,8 @@ getnewunit()
     return 0;
   initializeunit(unit);
   unitcount++;
+  STATCOUNT(getnewunit);
+  STATMAX(maxparserunits, unitcount);
   return unit;
 }
 
@@ -524,6 +525,9 @@ parseunit(struct unittype *output, char const *input,char **errstr,int *errloc)
   struct commtype comm;
   int saveunitcount;
 
+  STATCOUNT(parseunit);
+  STATCOUNT(parsedepth);
+  STATMAX(maxparsedepth, unitsstats.parsedepth);
   saveunitcount = unitcount;
   initializeunit(output);
   comm.result = 0;
@@ -545,6 +549,7 @@ parseunit(struct unittype *output, char const *input,char **errstr,int *errloc)
     if (unitcount!=saveunitcount)
       fprintf(stderr,"units: Parser leaked memory with error: %d in %d out\n",
              saveunitcount, unitcount);
+    STATADD(parsedepth, -1);
     return comm.errorcode;
   } else {
     if (errstr)
@@ -554,6 +559,7 @@ parseunit(struct unittype *output, char const *input,char **errstr,int *errloc)
     if (unitcount!=saveunitcount)
       fprintf(stderr,"units: Parser leaked memory without error: %d in %d out\n",
 	      saveunitcount, unitcount);
+    STATADD(parsedepth, -1);
     return 0;
   }
 }
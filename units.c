@@ -63,6 +63,10 @@ under the terms of the GNU General Public License."
 #  include<locale.h>
 #endif
 
+#ifdef UNITS_THREADS
+#  include <pthread.h>
+#endif
+
 #ifdef SUPPORT_UTF8
 /* Apparently this define is needed to get wcswidth() prototype */
 #  include <wchar.h>
@@ -107,6 +111,22 @@ under the terms of the GNU General Public License."
 #  include <unistd.h>
 #endif
 
+/* Worker processes are used for --jobs where fork() is available */
+
+#if !defined (_WIN32) && !defined (__EMSCRIPTEN__)
+#  define USE_FORK
+#  include <sys/wait.h>
+#  include <sys/time.h>
+#endif
+
+/* Units data files are mapped into memory where mmap() is available */
+
+#if !defined (_WIN32)
+#  define USE_MMAP
+#  include <sys/mman.h>
+#  include <fcntl.h>
+#endif
+
 #ifdef _WIN32
 #  define EXE_EXT ".exe"
 #  define PATHSEP ';'
@@ -197,6 +217,13 @@ struct {    /* Program command line option flags */
    strictconvert, /* Strict conversion (disables reciprocals) */
    unitcheck,     /* Enable unit checking: 1 for regular check, 2 for verbose*/
    verbose,       /* Flag for output verbosity */
+   checkchanged,  /* Only check definitions changed since the last check */
+   eager,         /* Reduce every unit after loading (--eager) */
+   lazy,          /* Defer parsing definitions until used (--lazy) */
+   stats,         /* Print the hot path counters (--stats) */
+   explain,       /* Print how the units are reduced (--explain) */
+   memstats,      /* Print the memory used by the database (--memstats) */
+   jobs,          /* Number of worker processes (--jobs) */
    readline;      /* Using readline library? */
 } flags;
 
@@ -206,6 +233,10 @@ struct {    /* Program command line option flags */
 
 struct parseflag parserflags;   /* parser options */
 
+char *subsetnames = 0;          /* names file for --subset */
+char *subsetoutput = 0;         /* file written by --subset */
+char *tracefile = 0;            /* file written by --trace */
+
 
 char *homeunitsfile = ".units"; /* Units filename in home directory */
 char *homedir = NULL;           /* User's home direcotry */
@@ -264,25 +295,59 @@ char *errormsg[]={"Successful completion",
                   "Base unit not dimensionless; rational exponent required",
                   "Base unit not a root",
                   "Exponent not dimensionless",
-                  "Unknown function name"
+                  "Unknown function name",
+                  "Unit not loaded yet",
+                  "Units not conformable"
                   };
 
 char *invalid_utf8 = "invalid/nonprinting UTF-8";
 
-char *irreducible=0;            /* Name of last irreducible unit */
+THREADLOCAL char *irreducible=0;  /* Name of last irreducible unit */
 
 
 /* Hash table for unit definitions. */
 
+/* A unit fully reduced to primitive units.  The factor is kept as the
+   list of multiplications and divisions that reducing the unit from
+   its definition makes, in the same order, so that applying them gives
+   the same result to the last bit.  The names are kept in the slots
+   where the reduction left them, with NULL for the empty slots, as
+   later units are put in the first empty slot. */
+
+struct reducedstep {
+   double factor;
+   char divide;                 /* divide by factor instead of multiplying */
+};
+
+struct reducedunit {
+   struct reducedstep *steps;
+   int stepcount;
+   int numlen, denlen;
+   char **names;                /* numerator slots, then denominator slots */
+};
+
 struct unitlist {
    char *name;                  /* unit name */
    char *value;                 /* unit value */
    int linenumber;              /* line in units data file where defined */
    char *file;                  /* file where defined */ 
    struct unitlist *next;       /* next item in list */
+   struct unitlist *target;     /* set by resolveunit(): the unit is */
+   double *chain;               /*   the chainlen factors of its chain, */
+   int chainlen;                /*   multiplied in order, times target, */
+   char flattened;              /*   the last unit of the chain, or */
+                                /*   times nothing if target is NULL */
+   char circular;               /* circular definition */
+   char resolvemark;            /* DFS state for resolveunit() */
+   struct reducedunit *reduced; /* set by eagerreduce() */
+   int level;                   /* dependency depth for eagerreduce() */
+   char lazy;                   /* value not yet parsed, see lazydbline() */
 } *utab[HASHSIZE];
 
 char hasLoadedUnits = 0;
+int dbversion = 0;              /* Incremented whenever the database changes */
+int loadjobs = 1;               /* Worker processes for --eager */
+int lazyload = 0;               /* Defer parsing unit definitions */
 
 /* Table for prefix definitions. */
 
@@ -293,6 +358,7 @@ struct prefixlist {
    int linenumber;              /* line in units data file where defined */
    char *file;                  /* file where defined */ 
    struct prefixlist *next;     /* next item in list */
+   char lazy;                   /* value not yet parsed, see lazydbline() */
 } *ptab[SIMPLEHASHSIZE];
 
 
@@ -318,8 +384,8 @@ struct func *ftab[SIMPLEHASHSIZE];
    it is replaced by the unit value stored in parameter_value.
 */
 
-char *function_parameter = 0; 
-struct unittype *parameter_value = 0;
+THREADLOCAL char *function_parameter = 0; 
+THREADLOCAL struct unittype *parameter_value = 0;
 
 /* Stores the last result value for replacement with '_' */
 
@@ -530,6 +596,236 @@ fgetscont(char *buf, int size, FILE *file, int *count)
 }
 
 
+/* Returns the wall clock time in seconds, used for timing reports */
+
+double
+walltime(void)
+{
+#if defined(USE_FORK) && defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+#elif defined(USE_FORK)
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+#else
+  return (double) clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+
+/*
+   Tracing (--trace).  tracebegin() and traceend() mark nested spans for
+   the phases of a conversion, such as reading a units file, parsing and
+   reducing the units or printing the answer.  Each span is written to a
+   memory buffer as a pair of Chrome trace events, so the buffer is a
+   JSON file that Perfetto and chrome://tracing can load.  The command
+   line saves it with writetrace() and the WASM build reads it with
+   tracejson().  When tracing is off each call only tests a flag.
+*/
+
+#define TRACEHEADER "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+#define TRACEFOOTER "\n]}\n"
+
+struct {
+  int on;
+  double start;            /* walltime() when tracing started */
+  char *buf;               /* the JSON text without TRACEFOOTER */
+  int len, size;
+  int events;
+  int depth;               /* spans not yet ended */
+} tracing;
+
+void
+traceappend(const char *str, int len)
+{
+  while (tracing.len + len + (int) sizeof(TRACEFOOTER) > tracing.size){
+    tracing.size = tracing.size ? 2*tracing.size : 4096;
+    tracing.buf = realloc(tracing.buf, tracing.size);
+    if (!tracing.buf){
+      fprintf(stderr, "%s: memory allocation error (traceappend)\n",
+              progname);
+      exit(EXIT_FAILURE);
+    }
+  }
+  memcpy(tracing.buf + tracing.len, str, len);
+  tracing.len += len;
+}
+
+/* Appends str as a JSON string */
+
+void
+tracestring(const char *str)
+{
+  char esc[8];
+
+  traceappend("\"", 1);
+  for(;*str;str++){
+    if (*str=='"' || *str=='\\'){
+      esc[0] = '\\';
+      esc[1] = *str;
+      traceappend(esc, 2);
+    } else if ((unsigned char) *str < ' '){
+      sprintf(esc, "\\u%04x", *str);
+      traceappend(esc, 6);
+    } else
+      traceappend(str, 1);
+  }
+  traceappend("\"", 1);
+}
+
+/* Appends one event of type ph at time ts, with the name and arguments
+   given unless they are NULL.  args is a list of name and value strings
+   ended by a NULL name; a NULL value leaves out that argument. */
+
+void
+traceevent(const char *ph, const char *name, double ts, double dur,
+           va_list *args)
+{
+  char num[80];
+  char *key, *value;
+  int first = 1;
+
+  if (tracing.events++)
+    traceappend(",\n", 2);
+  traceappend("{", 1);
+  if (name){
+    traceappend("\"name\":", 7);
+    tracestring(name);
+    traceappend(",\"cat\":\"units\",", 15);
+  }
+  sprintf(num, "\"ph\":\"%s\",\"ts\":%.3f,", ph, (ts - tracing.start)*1e6);
+  traceappend(num, strlen(num));
+  if (dur >= 0){
+    sprintf(num, "\"dur\":%.3f,", dur*1e6);
+    traceappend(num, strlen(num));
+  }
+  traceappend("\"pid\":1,\"tid\":1", 15);
+  if (args){
+    while ((key = va_arg(*args, char *))){
+      value = va_arg(*args, char *);
+      if (!value)
+        continue;
+      traceappend(first ? ",\"args\":{" : ",", first ? 9 : 1);
+      first = 0;
+      tracestring(key);
+      traceappend(":", 1);
+      tracestring(value);
+    }
+    if (!first)
+      traceappend("}", 1);
+  }
+  traceappend("}", 1);
+}
+
+/* Starts a span.  The arguments after the name are pairs of argument
+   names and values, such as the units involved, ended by a NULL. */
+
+void
+tracebegin(const char *name, ...)
+{
+  va_list args;
+
+  if (!tracing.on)
+    return;
+  va_start(args, name);
+  traceevent("B", name, walltime(), -1, &args);
+  va_end(args);
+  tracing.depth++;
+}
+
+void
+traceend(void)
+{
+  if (!tracing.on || !tracing.depth)
+    return;
+  traceevent("E", 0, walltime(), -1, 0);
+  tracing.depth--;
+}
+
+/* Ends every span still open, for the conversions that return early */
+
+void
+traceendall(void)
+{
+  while (tracing.on && tracing.depth)
+    traceend();
+}
+
+/* Adds a span that began at start and ends now.  This is for work done
+   before tracing could be turned on. */
+
+void
+tracespan(const char *name, double start, ...)
+{
+  va_list args;
+
+  if (!tracing.on)
+    return;
+  va_start(args, start);
+  traceevent("X", name, start, walltime() - start, &args);
+  va_end(args);
+}
+
+/* Clears the trace and starts recording, counting times from start */
+
+void
+starttrace(double start)
+{
+  tracing.len = tracing.events = tracing.depth = 0;
+  traceappend(TRACEHEADER, strlen(TRACEHEADER));
+  tracing.start = start;
+  tracing.on = 1;
+}
+
+void
+stoptrace(void)
+{
+  tracing.on = 0;
+  free(tracing.buf);
+  tracing.buf = 0;
+  tracing.len = tracing.size = 0;
+}
+
+/* Returns the trace recorded so far as JSON text, or NULL if tracing is
+   off.  The text stays valid until the next span. */
+
+char *
+tracejson(void)
+{
+  if (!tracing.on)
+    return 0;
+  strcpy(tracing.buf + tracing.len, TRACEFOOTER);
+  return tracing.buf;
+}
+
+/* Writes the trace to a file.  Returns 0 on success. */
+
+int
+writetrace(char *file)
+{
+  FILE *fp;
+  char *json;
+
+  if (!(json = tracejson()))
+    return 1;
+  if (!(fp = fopen(file, "w"))){
+    fprintf(stderr, "%s: cannot write trace file '%s'. ", progname, file);
+    perror((char *) 0);
+    return 1;
+  }
+  fputs(json, fp);
+  if (fclose(fp)){
+    fprintf(stderr, "%s: error writing trace file '%s'\n", progname, file);
+    return 1;
+  }
+  return 0;
+}
+
+
 /* 
    Gets arbitrarily long input data into a buffer using growbuffer().
    Returns 0 if no data is read.  Increments count by the number of
@@ -558,13 +854,17 @@ fgetslong(char **buf, int *bufsize, FILE *file, int *count)
   return *buf;
 }
 
-/* Allocates memory and aborts if malloc fails. */
+/* Allocates memory and aborts if malloc fails.  The calls are counted
+   for the allocations per operation that unitsbench reports. */
+
+THREADLOCAL unsigned long mymalloccount = 0;
 
 void *
 mymalloc(int bytes,const char *mesg)
 {
    void *pointer;
 
+   mymalloccount++;
    pointer = malloc(bytes);
    if (!pointer){
      fprintf(stderr, "%s: memory allocation error %s\n", progname, mesg);
@@ -581,6 +881,8 @@ dupstr(const char *str)
 {
    char *ret;
 
+   STATCOUNT(dupstr);
+   STATADD(dupstrbytes, strlen(str) + 1);
    ret = mymalloc(strlen(str) + 1,"(dupstr)");
    strcpy(ret, str);
    return ret;
@@ -602,21 +904,140 @@ dupnstr(const char *string, int length)
 
 #ifdef SUPPORT_UTF8
 
-/* 
-   The strwidth function gives the printed width of a UTF-8 byte sequence.
-   It will return -1 if the sequence is an invalid UTF-8 sequence or
-   if the sequence contains "nonprinting" characters.  Note that \n and \t are 
-   "nonprinting" characters. 
+/*
+   Most strings are plain printable ASCII, whose width is their length,
+   so strwidth() first checks that every byte is in the range ' ' to
+   '~'.  The length comes from strlen(), and only whole blocks inside
+   the string are loaded: with SSE2 16 bytes at a time, otherwise 8
+   bytes at a time in a 64-bit word.  The bytes left over are checked
+   one at a time.
+
+   asciiwidth() returns the length of a plain ASCII string, -1 if an
+   ASCII control character is found first, or NOTASCII if a byte
+   outside the ASCII range is found first.
 */
 
-int 
-strwidth(const char *str)
+#define NOTASCII -2
+
+int
+asciibyte(const unsigned char *ptr, const unsigned char *str)
 {
+  if (!*ptr)
+    return ptr - str;
+  if (*ptr >= 0x80)
+    return NOTASCII;
+  return -1;
+}
+
+#if defined (__SSE2__)
+#  include <emmintrin.h>
+
+int
+asciiwidth(const char *str)
+{
+  const unsigned char *ptr = (const unsigned char *) str;
+  const unsigned char *end = ptr + strlen(str);
+  const __m128i space = _mm_set1_epi8(' ');
+  const __m128i del = _mm_set1_epi8(0x7f);
+  __m128i block;
+  int bad;
+
+  for(;end - ptr >= 16;ptr+=16){
+    block = _mm_loadu_si128((const __m128i *) ptr);
+    /* Bytes from 0x80 up are negative, so they also compare below ' ' */
+    bad = _mm_movemask_epi8(_mm_or_si128(_mm_cmplt_epi8(block, space),
+                                         _mm_cmpeq_epi8(block, del)));
+    if (bad){
+      for(;!(bad & 1);bad >>= 1)
+        ptr++;
+      return asciibyte(ptr, (const unsigned char *) str);
+    }
+  }
+  for(;ptr < end;ptr++)
+    if (*ptr < ' ' || *ptr >= 0x7f)
+      return asciibyte(ptr, (const unsigned char *) str);
+  return end - (const unsigned char *) str;
+}
+
+#else
+
+#define ONES 0x0101010101010101ULL
+#define HIGHBITS 0x8080808080808080ULL
+
+int
+asciiwidth(const char *str)
+{
+  const unsigned char *ptr = (const unsigned char *) str;
+  const unsigned char *end = ptr + strlen(str);
+  unsigned long long word;
+
+  for(;end - ptr >= 8;ptr+=8){
+    memcpy(&word, ptr, 8);
+    /* A byte has its high bit set in one of these terms only if it is
+       below ' ' or above '~'.  Borrows and carries only start at such
+       bytes, so they can cause false alarms but never hide a byte. */
+    if (((word - ' '*ONES) | word | (word + ONES)) & HIGHBITS)
+      break;
+  }
+  for(;ptr < end;ptr++)
+    if (*ptr < ' ' || *ptr >= 0x7f)
+      return asciibyte(ptr, (const unsigned char *) str);
+  return end - (const unsigned char *) str;
+}
+
+#endif
+
+
+/*
+   Validates a UTF-8 string that is not plain ASCII and returns its
+   printed width.  Where wchar_t holds Unicode code points the string is
+   decoded directly, rejecting overlong forms, surrogates and values
+   past U+10FFFF; otherwise it is converted with mbsrtowcs().
+*/
+
+int
+utf8width(const char *str)
+{
+#ifdef __STDC_ISO_10646__
+  static const unsigned long mincode[] = {0, 0x80, 0x800, 0x10000};
+  const unsigned char *ptr = (const unsigned char *) str;
+  unsigned long code;
+  int len, extra, width, total = 0;
+
+  while (*ptr){
+    if (*ptr < 0x80){
+      code = *ptr++;
+      len = 0;
+    } else if (*ptr >= 0xc2 && *ptr <= 0xdf){
+      code = *ptr++ & 0x1f;
+      len = 1;
+    } else if (*ptr >= 0xe0 && *ptr <= 0xef){
+      code = *ptr++ & 0x0f;
+      len = 2;
+    } else if (*ptr >= 0xf0 && *ptr <= 0xf4){
+      code = *ptr++ & 0x07;
+      len = 3;
+    } else
+      return -1;
+    extra = len;
+    for(;len;len--,ptr++){
+      if ((*ptr & 0xc0) != 0x80)
+        return -1;
+      code = code << 6 | (*ptr & 0x3f);
+    }
+    if (code < mincode[extra] || code > 0x10ffff
+        || (code >= 0xd800 && code <= 0xdfff))
+      return -1;
+    width = wcwidth((wchar_t) code);
+    if (width < 0)
+      return -1;
+    total += width;
+  }
+  return total;
+#else
   wchar_t *widestr;
   int len;
 
-  if (!utf8mode)
-    return strlen(str);
   len = strlen(str)+1;
   widestr = mymalloc(sizeof(wchar_t)*len, "(strwidth)");
   len = mbsrtowcs(widestr, &str, len, NULL);
@@ -629,6 +1050,28 @@ strwidth(const char *str)
   len=wcswidth(widestr, len);
   free(widestr);
   return len;
+#endif
+}
+
+
+/* 
+   The strwidth function gives the printed width of a UTF-8 byte sequence.
+   It will return -1 if the sequence is an invalid UTF-8 sequence or
+   if the sequence contains "nonprinting" characters.  Note that \n and \t are 
+   "nonprinting" characters. 
+*/
+
+int 
+strwidth(const char *str)
+{
+  int len;
+
+  if (!utf8mode)
+    return strlen(str);
+  len = asciiwidth(str);
+  if (len != NOTASCII)
+    return len;
+  return utf8width(str);
 }
 #else
 #  define strwidth strlen
@@ -649,6 +1092,73 @@ uhash(const char *str)
 }
 
 
+/*
+   Index of the units table by name.  The program walks the utab hash
+   chains in a fixed order, but with a fixed number of chains a lookup
+   slows down in proportion to the size of the database, which makes
+   loading a large units file quadratic.  Lookups go through this open
+   addressing table instead, which is doubled whenever it becomes half
+   full.  The hash of each entry is kept so that probing only compares
+   names whose hashes match.
+*/
+
+#define UNITINDEXMIN 4096       /* Initial number of slots, a power of 2 */
+
+struct unitindex {
+  struct unitlist **slots;
+  unsigned *hashes;
+  unsigned size;
+  int count;
+} unitindex;
+
+unsigned
+namehash(const char *str)
+{
+  unsigned hashval = 2166136261u;
+
+  for(;*str;str++)
+    hashval = (hashval ^ (unsigned char)*str) * 16777619u;  /* FNV-1a */
+  return hashval;
+}
+
+void
+indexslot(struct unitlist *uptr, unsigned hashval)
+{
+  unsigned i, mask = unitindex.size-1;
+
+  for(i = hashval & mask; unitindex.slots[i]; i = (i+1) & mask);
+  unitindex.slots[i] = uptr;
+  unitindex.hashes[i] = hashval;
+}
+
+/* Add a unit that was just inserted into the units table */
+
+void
+indexadd(struct unitlist *uptr)
+{
+  struct unitlist **oldslots = unitindex.slots;
+  unsigned *oldhashes = unitindex.hashes, oldsize = unitindex.size, i;
+
+  if (2*(unitindex.count+1) > unitindex.size){
+    unitindex.size = oldsize ? 2*oldsize : UNITINDEXMIN;
+    unitindex.slots = (struct unitlist **)
+      mymalloc(unitindex.size*sizeof(struct unitlist *), "(indexadd)");
+    unitindex.hashes = (unsigned *)
+      mymalloc(unitindex.size*sizeof(unsigned), "(indexadd)");
+    memset(unitindex.slots, 0, unitindex.size*sizeof(struct unitlist *));
+    for(i=0;i<oldsize;i++)
+      if (oldslots[i])
+        indexslot(oldslots[i], oldhashes[i]);
+    free(oldslots);
+    free(oldhashes);
+  }
+  indexslot(uptr, namehash(uptr->name));
+  unitindex.count++;
+}
+
+
+void parselazy(char *value, char *lazy);
+
 /* Lookup a unit in the units table.  Returns the definition, or NULL
    if the unit isn't found in the table. */
 
@@ -656,10 +1166,20 @@ struct unitlist *
 ulookup(const char *str)
 {
    struct unitlist *uptr;
+   unsigned hashval, i, mask = unitindex.size-1;
 
-   for (uptr = utab[uhash(str)]; uptr; uptr = uptr->next)
-      if (strcmp(str, uptr->name) == 0)
+   STATCOUNT(ulookup);
+   if (!unitindex.count)
+      return NULL;
+   hashval = namehash(str);
+   for (i = hashval & mask; (uptr = unitindex.slots[i]); i = (i+1) & mask){
+      STATCOUNT(ulookupprobes);
+      if (unitindex.hashes[i] == hashval && strcmp(str, uptr->name) == 0){
+         if (uptr->lazy)
+            parselazy(uptr->value, &uptr->lazy);
          return uptr;
+      }
+   }
    return NULL;
 }
 
@@ -674,12 +1194,16 @@ plookup(const char *str)
    struct prefixlist *bestprefix=NULL;
    int bestlength=0;
 
+   STATCOUNT(plookup);
    for (prefix = ptab[simplehash(str)]; prefix; prefix = prefix->next) {
+     STATCOUNT(plookupprobes);
      if (prefix->len > bestlength && !strncmp(str, prefix->name, prefix->len)){
        bestlength = prefix->len;
        bestprefix = prefix;
      }
    }
+   if (bestprefix && bestprefix->lazy)
+     parselazy(bestprefix->value, &bestprefix->lazy);
    return bestprefix;
 }
 
@@ -690,9 +1214,12 @@ fnlookup(const char *str)
 { 
   struct func *funcptr;
 
-  for(funcptr=ftab[simplehash(str)];funcptr;funcptr = funcptr->next)
+  STATCOUNT(fnlookup);
+  for(funcptr=ftab[simplehash(str)];funcptr;funcptr = funcptr->next){
+    STATCOUNT(fnlookupprobes);
     if (!strcmp(funcptr->name, str))
       return funcptr;
+  }
   return 0;
 }
 
@@ -706,78 +1233,314 @@ aliaslookup(const char *str)
   return 0;
 }
 
-
-/* Insert a new function into the linked list of functions */
+/* Calls fn with the name and definition of every unit ('u'), prefix
+   ('p'), function ('f') and unit list alias ('a') in the database, in
+   table order.  Functions are passed without a definition.  unitsbench
+   builds its corpora with this. */
 
 void
-addfunction(struct func *newfunc)
+foreachdbname(void (*fn)(int kind, char *name, char *def, void *data),
+              void *data)
 {
-  int val;
+  struct unitlist *uptr;
+  struct prefixlist *pptr;
+  struct func *funcptr;
+  struct wantalias *aliasptr;
+  int i;
 
-  val = simplehash(newfunc->name);
-  newfunc->next = ftab[val];
-  ftab[val] = newfunc;
+  for(i=0;i<HASHSIZE;i++)
+    for(uptr = utab[i]; uptr; uptr = uptr->next)
+      fn('u', uptr->name, uptr->value, data);
+  for(i=0;i<SIMPLEHASHSIZE;i++)
+    for(pptr = ptab[i]; pptr; pptr = pptr->next)
+      fn('p', pptr->name, pptr->value, data);
+  for(i=0;i<SIMPLEHASHSIZE;i++)
+    for(funcptr = ftab[i]; funcptr; funcptr = funcptr->next)
+      fn('f', funcptr->name, 0, data);
+  for(aliasptr = firstalias; aliasptr; aliasptr = aliasptr->next)
+    fn('a', aliasptr->name, aliasptr->definition, data);
 }
 
+/* Reports how the entries of a table are spread for unitsbench: the
+   number of chains, the number of entries and the longest chain.
+   table is 'u' for utab, 'p' for ptab, 'f' for ftab or 'a' for the
+   unit list aliases, which are a single list.  For 'i', the unit
+   index, the chains are the slots and the longest chain is the
+   longest run of occupied slots, which bounds the probes of a lookup. */
 
-/* Free the fields in the function except for the name so that it
-   can be redefined.  It remains in position in the linked list. */
 void
-freefunction(struct func *funcentry)
+hashstats(int table, int *chains, int *entries, int *longest)
 {
-  if (funcentry->table){
-    free(funcentry->table);
-    free(funcentry->tableunit);
-  } else {
-    free(funcentry->forward.param);
-    free(funcentry->forward.def);
-    if (funcentry->forward.domain_min) free(funcentry->forward.domain_min);
-    if (funcentry->forward.domain_max) free(funcentry->forward.domain_max);
-    if (funcentry->inverse.domain_min) free(funcentry->inverse.domain_min);
-    if (funcentry->inverse.domain_max) free(funcentry->inverse.domain_max);
-    if (funcentry->forward.dimen) free(funcentry->forward.dimen);
-    if (funcentry->inverse.dimen) free(funcentry->inverse.dimen);
-    if (funcentry->inverse.def) free(funcentry->inverse.def);    
-    if (funcentry->inverse.param) free(funcentry->inverse.param);
+  struct unitlist *uptr;
+  struct prefixlist *pptr;
+  struct func *funcptr;
+  struct wantalias *aliasptr;
+  unsigned i;
+  int len;
+
+  *chains = *entries = *longest = 0;
+  switch(table){
+    case 'u':
+      *chains = HASHSIZE;
+      for(i=0;i<HASHSIZE;i++){
+        for(len=0, uptr = utab[i]; uptr; uptr = uptr->next)
+          len++;
+        *entries += len;
+        if (len > *longest)
+          *longest = len;
+      }
+      break;
+    case 'i':
+      *chains = unitindex.size;
+      *entries = unitindex.count;
+      for(len=0, i=0;i<unitindex.size;i++){
+        len = unitindex.slots[i] ? len+1 : 0;
+        if (len > *longest)
+          *longest = len;
+      }
+      break;
+    case 'p':
+    case 'f':
+      *chains = SIMPLEHASHSIZE;
+      for(i=0;i<SIMPLEHASHSIZE;i++){
+        len = 0;
+        if (table == 'p')
+          for(pptr = ptab[i]; pptr; pptr = pptr->next)
+            len++;
+        else
+          for(funcptr = ftab[i]; funcptr; funcptr = funcptr->next)
+            len++;
+        *entries += len;
+        if (len > *longest)
+          *longest = len;
+      }
+      break;
+    case 'a':
+      *chains = 1;
+      for(aliasptr = firstalias; aliasptr; aliasptr = aliasptr->next)
+        (*entries)++;
+      *longest = *entries;
+      break;
   }
 }
 
-/* Remove leading and trailing spaces from the input */
+/* 
+   Bloom filter over the names in the units table.  lookupunit() uses
+   it to reject names that cannot be found before it tries the plural
+   and prefix forms, which avoids the string copies and hash chain
+   scans for most unknown names.  The filter has no false negatives:
+   every name inserted into utab is added to it.
+*/
+
+#define BLOOMPROBES 4           /* Number of bits set for each name */
+#define BLOOMBITS 16            /* Filter bits per unit name */
+#define BLOOMMINNAMES 1024      /* Smallest filter capacity */
+
+struct unitbloom {
+  unsigned char *bits;
+  unsigned nbits;
+  int count;                    /* Number of names in the filter */
+  int capacity;                 /* Number of names the filter is sized for */
+} unitbloom;
 
 void
-removespaces(char *in)
+bloomhash(const char *str, unsigned *h1, unsigned *h2)
 {
-  char *ptr;
-  if (*in) {
-    for(ptr = &lastchar(in); *ptr==' '; ptr--); /* Last non-space */
-    *(ptr+1)=0;
-    if (*in==' '){
-      ptr = in + strspn(in," ");
-      memmove(in, ptr, strlen(ptr)+1);
-    }
+  unsigned a = 2166136261u, b = 0;
+
+  for(;*str;str++){
+    a = (a ^ (unsigned char)*str) * 16777619u;  /* FNV-1a */
+    b = (unsigned char)*str + HASHNUMBER * b;
   }
+  *h1 = a;
+  *h2 = b | 1;
 }
 
-
-/* 
-   Looks up an inverse function given as a ~ character followed by
-   spaces and then the function name.  The spaces will be deleted as a
-   side effect.  If an inverse function is found returns the function
-   pointer, otherwise returns null.
-*/
-
-struct func *
-invfnlookup(char *str)
+void
+bloomset(const char *str)
 {
-  if (*str != '~')
-    return 0;
-  removespaces(str+1);
-  return fnlookup(str+1);
+  unsigned h1, h2, bit;
+  int i;
+
+  bloomhash(str, &h1, &h2);
+  for(i=0;i<BLOOMPROBES;i++){
+    bit = (h1 + i*h2) % unitbloom.nbits;
+    unitbloom.bits[bit>>3] |= 1 << (bit & 7);
+  }
+  unitbloom.count++;
 }
 
+/* Returns zero if str is certainly not in the units table */
 
-char *
-strip_comment(char *line)
+int
+bloomcheck(const char *str)
+{
+  unsigned h1, h2, bit;
+  int i;
+
+  bloomhash(str, &h1, &h2);
+  for(i=0;i<BLOOMPROBES;i++){
+    bit = (h1 + i*h2) % unitbloom.nbits;
+    if (!(unitbloom.bits[bit>>3] & (1 << (bit & 7))))
+      return 0;
+  }
+  return 1;
+}
+
+/* Size the filter for at least the given number of names and refill it
+   from the units table. */
+
+void
+bloomrebuild(int capacity)
+{
+  struct unitlist *uptr;
+  int i;
+
+  if (capacity < BLOOMMINNAMES)
+    capacity = BLOOMMINNAMES;
+  if (unitbloom.bits)
+    free(unitbloom.bits);
+  unitbloom.capacity = capacity;
+  unitbloom.nbits = capacity * BLOOMBITS;
+  unitbloom.bits = mymalloc(unitbloom.nbits/8, "(bloomrebuild)");
+  memset(unitbloom.bits, 0, unitbloom.nbits/8);
+  unitbloom.count = 0;
+  for(i=0;i<HASHSIZE;i++)
+    for(uptr = utab[i]; uptr; uptr = uptr->next)
+      bloomset(uptr->name);
+}
+
+/* Add a name that was just inserted into the units table */
+
+void
+bloomadd(const char *str)
+{
+  if (!unitbloom.bits || unitbloom.count >= unitbloom.capacity)
+    bloomrebuild(2*unitbloom.count);   /* Includes the new name */
+  else
+    bloomset(str);
+}
+
+
+/*
+   Tries the forms of a unit name that lookupunit() accepts, in the same
+   order: the name itself, the singular forms of a plural, and with
+   prefixok set the name with a prefix removed, whose rest is tried the
+   same way but without a further prefix.  A bare prefix leaves an empty
+   name.  fn() is called on each form until it returns non-NULL, and
+   that value is returned.  The unit string is modified during the
+   search and restored before returning.
+*/
+
+void *
+tryunitforms(char *unit, int prefixok, void *(*fn)(char *name, void *data),
+             void *data)
+{
+  struct prefixlist *pfxptr;
+  void *found;
+  int len, copylen;
+
+  if ((found = fn(unit, data)))
+    return found;
+  len = strlen(unit);
+  if (len>2 && unit[len-1] == 's'){
+    unit[len-1] = 0;
+    copylen = len-1;
+    found = tryunitforms(unit, prefixok, fn, data);
+    if (!found && copylen>2 && unit[copylen-1] == 'e'){
+      unit[--copylen] = 0;
+      found = tryunitforms(unit, prefixok, fn, data);
+    }
+    if (!found && copylen>2 && unit[copylen-1] == 'i'){
+      unit[copylen-1] = 'y';
+      found = tryunitforms(unit, prefixok, fn, data);
+      unit[copylen-1] = 'i';
+    }
+    if (copylen < len-1)
+      unit[len-2] = 'e';
+    unit[len-1] = 's';
+    if (found)
+      return found;
+  }
+  if (prefixok && (pfxptr = plookup(unit)))
+    return tryunitforms(unit+pfxptr->len, 0, fn, data);
+  return 0;
+}
+
+
+/* A bare prefix counts as found, as lookupunit() accepts it */
+
+void *
+bloomform(char *name, void *data)
+{
+  return emptystr(name) || bloomcheck(name) ? name : 0;
+}
+
+/* 
+   Returns zero if lookupunit() cannot find the unit.  This follows the
+   same plural and prefix rules as lookupunit() but only probes the
+   Bloom filter.  The unit string is modified during the search and
+   restored before returning.  The plural test uses strlen() where
+   lookupunit() uses strwidth(), which can only make this function try
+   more forms, never fewer.
+*/
+
+int
+unitmaybedefined(char *unit, int prefixok)
+{
+  return tryunitforms(unit, prefixok, bloomform, 0) != 0;
+}
+
+
+/* Insert a new function into the linked list of functions */
+
+void
+addfunction(struct func *newfunc)
+{
+  int val;
+
+  val = simplehash(newfunc->name);
+  newfunc->next = ftab[val];
+  ftab[val] = newfunc;
+}
+
+
+/* Remove leading and trailing spaces from the input */
+
+void
+removespaces(char *in)
+{
+  char *ptr;
+  if (*in) {
+    for(ptr = &lastchar(in); *ptr==' '; ptr--); /* Last non-space */
+    *(ptr+1)=0;
+    if (*in==' '){
+      ptr = in + strspn(in," ");
+      memmove(in, ptr, strlen(ptr)+1);
+    }
+  }
+}
+
+
+/* 
+   Looks up an inverse function given as a ~ character followed by
+   spaces and then the function name.  The spaces will be deleted as a
+   side effect.  If an inverse function is found returns the function
+   pointer, otherwise returns null.
+*/
+
+struct func *
+invfnlookup(char *str)
+{
+  if (*str != '~')
+    return 0;
+  removespaces(str+1);
+  return fnlookup(str+1);
+}
+
+
+char *
+strip_comment(char *line)
 {
   char *comment = 0;
   
@@ -881,9 +1644,173 @@ checkunitname(char *name, int linenum, char *file, FILE *errfile)
 }
 
 
+/*
+   Everything that lasts as long as the database is allocated from the
+   database arena: the table entries, copies of names and definitions
+   that are not in an image, function parameters, domains and tables,
+   and the file names.  The arena hands out memory in order from large
+   blocks, so the entries loaded from a file sit together in memory.
+   Nothing is freed individually; a redefinition leaves the old text in
+   the arena.  freedatabase() releases the whole database at once.
+*/
+
+#define ARENABLOCK 65536        /* Usual size of an arena block */
+#define ARENAALIGN sizeof(double)
+
+struct arenablock {
+  struct arenablock *next;
+  size_t size, used;
+  double data[1];               /* the memory, aligned for any entry */
+};
+
+struct dbarena {
+  struct arenablock *blocks;    /* current block first */
+  size_t allocated;             /* bytes in all blocks */
+  size_t used;                  /* bytes handed out */
+} dbarena;
+
+/* Returns size bytes from the arena.  Strings can pass zero for align
+   to have them packed; other objects need ARENAALIGN. */
+
+void *
+arenaalloc(size_t size, size_t align)
+{
+  struct arenablock *block = dbarena.blocks;
+  size_t start = 0, blocksize;
+
+  if (block){
+    start = block->used;
+    if (align)
+      start = (start + align-1) / align * align;
+  }
+  if (!block || start + size > block->size){
+    blocksize = size > ARENABLOCK/4 ? size : ARENABLOCK;
+    block = (struct arenablock *)
+      mymalloc(sizeof(struct arenablock) + blocksize, "(arenaalloc)");
+    block->size = blocksize;
+    if (dbarena.blocks && size > ARENABLOCK/4){
+      /* Keep filling the current block after a large request */
+      block->next = dbarena.blocks->next;
+      dbarena.blocks->next = block;
+    } else {
+      block->next = dbarena.blocks;
+      dbarena.blocks = block;
+    }
+    dbarena.allocated += blocksize;
+    start = 0;
+  }
+  block->used = start + size;
+  dbarena.used += size;
+  return (char *) block->data + start;
+}
+
+char *
+arenastr(const char *str)
+{
+  size_t len = strlen(str)+1;
+
+  return memcpy(arenaalloc(len, 0), str, len);
+}
+
+/* Bytes of database memory handed out by the arena */
+
+size_t
+arenaused(void)
+{
+  return dbarena.used;
+}
+
+
+/*
+   Units data files are loaded into memory in one piece, called an
+   image.  Where mmap() is available the file is mapped privately, so
+   a page is only copied when a line in it is modified; otherwise the
+   file is read into a single buffer.  Files that the program can write
+   are read as well: a file rewritten in place, as units_cur does,
+   would change under the pages that were not copied, and
+   reloadunits() relies on the old tables staying intact while it
+   loads the new ones.  Lines are normalized in place, and the names
+   and definitions stored in the units tables point into the image
+   instead of being copied.
+*/
+
+struct dbimage {
+  char *data;               /* file contents */
+  size_t size;
+  size_t pos;               /* start of the next line */
+  char saved;               /* byte at pos, overwritten by a terminator */
+  char savedvalid;
+  char mapped;              /* data is mapped rather than allocated */
+  struct dbimage *next;
+};
+
+struct dbimage *dbimages = 0;   /* all images that have been loaded */
+
+/* The units files read from disk, in the order they were read, with
+   the modification time and size they had.  reloadunits() uses these
+   to notice that a file has changed.  Kept in the arena. */
+
+struct dbfile {
+  char *name;
+  time_t mtime;
+  long size;
+  int depth;                /* 0 for files not read by !include */
+  char builtin;             /* taken from the built-in database */
+  struct dbfile *next;
+};
+
+struct dbfile *dbfiles = 0, **dbfilesend = &dbfiles;
+
+void
+adddbfile(char *name, int depth, int builtin)
+{
+  struct dbfile *dbf;
+  struct stat statbuf;
+
+  dbf = (struct dbfile *) arenaalloc(sizeof(*dbf), ARENAALIGN);
+  dbf->name = name;
+  dbf->depth = depth;
+  dbf->builtin = builtin;
+  dbf->mtime = 0;
+  dbf->size = 0;
+  if (!builtin && !stat(name, &statbuf)){
+    dbf->mtime = statbuf.st_mtime;
+    dbf->size = (long) statbuf.st_size;
+  }
+  dbf->next = 0;
+  *dbfilesend = dbf;
+  dbfilesend = &dbf->next;
+}
+
+/* Returns true if str points into a loaded image */
+
+int
+indbimage(const char *str)
+{
+  struct dbimage *img;
+
+  for(img = dbimages; img; img = img->next)
+    if (str >= img->data && str < img->data + img->size)
+      return 1;
+  return 0;
+}
+
+int dbstatic = 0;       /* set while adding built-in definitions, whose */
+                        /* strings are static */
+
+/* Returns a string for storing in the units tables: str itself if it
+   is static or in an image, or a copy in the arena otherwise. */
+
+char *
+dbstr(char *str)
+{
+  return dbstatic || indbimage(str) ? str : arenastr(str);
+}
+
+
 int
 newunit(char *unitname, char *unitdef, int *count, int linenum, 
-        char *file,FILE *errfile, int redefine)
+        char *file,FILE *errfile, int redefine, int lazy)
 {
   struct unitlist *uptr;
   unsigned hashval; 
@@ -914,35 +1841,40 @@ newunit(char *unitname, char *unitdef, int *count, int linenum,
       "%s: unit '%s' defined on line %d of '%s' is redefined on line %d of '%s'.\n",
               progname, unitname, uptr->linenumber,uptr->file,
               linenum, file);
-    free(uptr->value);
   } else {       
     /* make new units table entry */
 
-    uptr = (struct unitlist *) mymalloc(sizeof(*uptr),"(newunit)");
-    uptr->name = dupstr(unitname);
+    uptr = (struct unitlist *) arenaalloc(sizeof(*uptr), ARENAALIGN);
+    uptr->name = dbstr(unitname);
 
     /* install unit name/value pair in list */
 
     hashval = uhash(uptr->name);
     uptr->next = utab[hashval];
     utab[hashval] = uptr;
+    indexadd(uptr);
+    bloomadd(uptr->name);
+    uptr->reduced = 0;
     (*count)++;
   }
-  uptr->value = dupstr(unitdef);
+  uptr->value = dbstr(unitdef);
   uptr->linenumber = linenum;
   uptr->file = file;
+  uptr->target = 0;
+  uptr->flattened = uptr->circular = 0;
+  uptr->resolvemark = 0;
+  uptr->lazy = lazy;
   return 0;
 }
 
 
 int 
 newprefix(char *unitname, char *unitdef, int *count, int linenum, 
-          char *file,FILE *errfile, int redefine)
+          char *file,FILE *errfile, int redefine, int lazy)
 {
   struct prefixlist *pfxptr;
   unsigned pval;
 
-  lastchar(unitname) = 0;
   if (checkunitname(unitname,linenum,file,errfile))
     return E_BADFILE;
   if ((pfxptr = plookup(unitname))     /* already there: redefinition */
@@ -952,19 +1884,19 @@ newprefix(char *unitname, char *unitdef, int *count, int linenum,
              "%s: prefix '%s-' defined on line %d of '%s' is redefined on line %d of '%s'.\n",
               progname, unitname, pfxptr->linenumber,pfxptr->file,
               linenum, file);
-    free(pfxptr->value);
   } else {  
-    pfxptr = (struct prefixlist *) mymalloc(sizeof(*pfxptr),"(newprefix)");  
-    pfxptr->name = dupstr(unitname);
+    pfxptr = (struct prefixlist *) arenaalloc(sizeof(*pfxptr), ARENAALIGN);
+    pfxptr->name = dbstr(unitname);
     pfxptr->len = strlen(unitname);
     pval = simplehash(unitname);
     pfxptr->next = ptab[pval];
     ptab[pval] = pfxptr;
     (*count)++;
   }
-  pfxptr->value = dupstr(unitdef);
+  pfxptr->value = dbstr(unitdef);
   pfxptr->linenumber = linenum;
   pfxptr->file = file;
+  pfxptr->lazy = lazy;
   return 0;
 }
 
@@ -1048,7 +1980,7 @@ extract_interval(char *first, char *second,
     if (*end)
       return EI_ERR_MALF;
     else {
-      *firstout=(double *)mymalloc(sizeof(double), "(extract_interval)");
+      *firstout=(double *)arenaalloc(sizeof(double), ARENAALIGN);
       **firstout = val;
     }
   }
@@ -1059,7 +1991,7 @@ extract_interval(char *first, char *second,
     else if (*firstout && **firstout>=val)
       return EI_ERR_DEC;
     else {
-      *secondout=(double *)mymalloc(sizeof(double), "(extract_interval)");
+      *secondout=(double *)arenaalloc(sizeof(double), ARENAALIGN);
       **secondout = val;
     }
   }
@@ -1067,27 +1999,6 @@ extract_interval(char *first, char *second,
 }
 
 
- 
-void 
-copyfunctype(struct functype *dest, struct functype *src)
-{
-  dest->domain_min_open = src->domain_min_open;
-  dest->domain_max_open = src->domain_max_open;
-  dest->param = dest->def = dest->dimen = NULL;
-  dest->domain_min = dest->domain_max = NULL;
-  if (src->param) dest->param = dupstr(src->param); 
-  if (src->def) dest->def = dupstr(src->def);
-  if (src->dimen) dest->dimen = dupstr(src->dimen);
-  if (src->domain_min){
-    dest->domain_min = (double *) mymalloc(sizeof(double), "(copyfunctype)");
-    *dest->domain_min = *src->domain_min;
-  }
-  if (src->domain_max){
-    dest->domain_max = (double *) mymalloc(sizeof(double), "(copyfunctype)");
-    *dest->domain_max = *src->domain_max;
-  }
-}
-
 
 int
 copyfunction(char *unitname, char *funcname, int *count, int linenum, 
@@ -1119,40 +2030,52 @@ copyfunction(char *unitname, char *funcname, int *count, int linenum,
              "%s: function '%s' defined on line %d of '%s' is redefined on line %d of '%s'.\n",
               progname, unitname, funcentry->linenumber,funcentry->file,
               linenum, file);
-    freefunction(funcentry);
   } else {
-    funcentry = (struct func*)mymalloc(sizeof(struct func),"(newfunction)");    
-    funcentry->name = dupstr(unitname);
+    funcentry = (struct func *) arenaalloc(sizeof(struct func), ARENAALIGN);
+    funcentry->name = arenastr(unitname);
     addfunction(funcentry);
     (*count)++;
   }
   funcentry->linenumber = linenum;
   funcentry->file = file;
   funcentry->skip_error_check = source->skip_error_check;
-  if (source->table){
-    funcentry->tablelen = source->tablelen;
-    funcentry->tableunit = dupstr(source->tableunit);
-    funcentry->table = (struct pair *)
-        mymalloc(sizeof(struct pair)*funcentry->tablelen, "(copyfunction)");
-    for(i=0;i<funcentry->tablelen;i++){
-      funcentry->table[i].location = source->table[i].location;
-      funcentry->table[i].value = source->table[i].value;
-    }
-  } else {
-    funcentry->table = 0;
-      copyfunctype(&funcentry->forward, &source->forward);
-      copyfunctype(&funcentry->inverse, &source->inverse);
-  }
+
+  /* The definition lives in the arena, which keeps it even if the source
+     is redefined, so it can be shared */
+
+  funcentry->table = source->table;
+  funcentry->tablelen = source->tablelen;
+  funcentry->tableunit = source->tableunit;
+  funcentry->forward = source->forward;
+  funcentry->inverse = source->inverse;
   return 0;
 }
 
 
-#define FREE_STUFF {if (forward_dim) free(forward_dim);\
-                    if (inverse_dim) free(inverse_dim);\
-                    if (domain_min) free(domain_min);\
-                    if (domain_max) free(domain_max);\
-                    if (range_min) free(range_min);\
-                    if (range_max) free(range_max);}
+/* Returns the function table entry for a function or table definition,
+   adding a new entry if the name is not defined yet */
+
+struct func *
+getfuncentry(char *name, int table, int *count, int linenum, char *file,
+             FILE *errfile, int redefine)
+{
+  struct func *funcentry;
+
+  if ((funcentry=fnlookup(name))){
+    if (flags.unitcheck && errfile && !redefine)
+      fprintf(errfile,
+             "%s: %s '%s' defined on line %d of '%s' is redefined on line %d of '%s'.\n",
+              progname, table ? "unit" : "function", name,
+              funcentry->linenumber, funcentry->file, linenum, file);
+  } else {
+    funcentry = (struct func *) arenaalloc(sizeof(struct func), ARENAALIGN);
+    funcentry->name = dbstatic ? name : arenastr(name);
+    addfunction(funcentry);
+    (*count)++;
+  }
+  return funcentry;
+}
+
 
 #define REPEAT_ERR \
   if (errfile) fprintf(errfile, \
@@ -1216,7 +2139,6 @@ newfunction(char *unitname, char *unitdef, int *count,
                             fnkeywords[i].delimit, fnkeywords[i].checkopen,
                             unitname, linenum, file,errfile);
           if (!unitdef){
-            FREE_STUFF;
             return E_BADFILE;
           }
           removespaces(unitdef);
@@ -1228,9 +2150,9 @@ newfunction(char *unitname, char *unitdef, int *count,
             REPEAT_ERR;
             return E_BADFILE;
           }
-          forward_dim = dupstr(first);
+          forward_dim = arenastr(first);
           if (second)
-            inverse_dim = dupstr(second);
+            inverse_dim = arenastr(second);
         }
         if (i==FN_DOMAIN){
           int err=0;
@@ -1241,8 +2163,6 @@ newfunction(char *unitname, char *unitdef, int *count,
           err = extract_interval(first,second,&domain_min, &domain_max);
           domain_min_open = firstopen;
           domain_max_open = secondopen;
-          if (err)
-            FREE_STUFF;
           if (err==EI_ERR_DEC){
             if (errfile) fprintf(errfile,
                "%s: second endpoint for domain must be greater than the first\n       in definition of '%s' in '%s' line %d\n",
@@ -1260,14 +2180,11 @@ newfunction(char *unitname, char *unitdef, int *count,
           int err=0;
           if (range_min || range_max){
             REPEAT_ERR;
-            FREE_STUFF;
             return E_BADFILE;
           }
           err = extract_interval(first,second,&range_min, &range_max);
           range_min_open = firstopen;
           range_max_open = secondopen;
-          if (err)
-            FREE_STUFF;
           if (err==EI_ERR_DEC){
             if (errfile) fprintf(errfile,
                "%s: second endpoint for range must be greater than the first\n       in definition of '%s' in '%s' line %d\n",
@@ -1289,7 +2206,6 @@ newfunction(char *unitname, char *unitdef, int *count,
     if (errfile) fprintf(errfile,
                  "%s: function '%s' lacks a definition at line %d of '%s'\n",
                  progname, unitname, linenum, file);
-    FREE_STUFF;
     return E_BADFILE;
   }
 
@@ -1297,7 +2213,6 @@ newfunction(char *unitname, char *unitdef, int *count,
     if (errfile) fprintf(errfile,
          "%s: function '%s' missing keyword before '[' on line %d of '%s'\n", 
          progname, unitname, linenum, file);
-    FREE_STUFF;
     return E_BADFILE;
   }
 
@@ -1308,7 +2223,6 @@ newfunction(char *unitname, char *unitdef, int *count,
     if (errfile)
       fprintf(errfile,"%s: function '%s' defined on line %d of '%s' has domain with no units.\n", 
               progname, unitname, linenum, file);
-    FREE_STUFF;
     return E_BADFILE;
   }
   if (!inverse_dim &&
@@ -1316,23 +2230,13 @@ newfunction(char *unitname, char *unitdef, int *count,
     if (errfile)
       fprintf(errfile,"%s: function '%s' defined on line %d of '%s' has range with no units.\n", 
               progname, unitname, linenum, file);
-    FREE_STUFF;
     return E_BADFILE;
   }
-  if ((funcentry=fnlookup(unitname))){
-    if (flags.unitcheck && errfile && !redefine)
-      fprintf(errfile,
-             "%s: function '%s' defined on line %d of '%s' is redefined on line %d of '%s'.\n",
-              progname, unitname, funcentry->linenumber,funcentry->file,
-              linenum, file);
-    freefunction(funcentry);
-  } else {
-    funcentry = (struct func*)mymalloc(sizeof(struct func),"(newfunction)");    
-    funcentry->name = dupstr(unitname);
-    addfunction(funcentry);
-    (*count)++;
-  }
+  funcentry = getfuncentry(unitname, 0, count, linenum, file, errfile,
+                           redefine);
   funcentry->table = 0;
+  funcentry->tableunit = 0;
+  funcentry->tablelen = 0;
   funcentry->skip_error_check = noerror;
   funcentry->forward.dimen = forward_dim;
   funcentry->inverse.dimen = inverse_dim;
@@ -1347,13 +2251,13 @@ newfunction(char *unitname, char *unitdef, int *count,
   inv = strchr(unitdef,FUNCSEPCHAR);
   if (inv)
     *inv++ = 0;
-  funcentry->forward.param = dupstr(start);
+  funcentry->forward.param = arenastr(start);
   removespaces(unitdef);
-  funcentry->forward.def = dupstr(unitdef);
+  funcentry->forward.def = arenastr(unitdef);
   if (inv){
     removespaces(inv);
-    funcentry->inverse.def = dupstr(inv);
-    funcentry->inverse.param = dupstr(unitname);
+    funcentry->inverse.def = arenastr(inv);
+    funcentry->inverse.param = funcentry->name;
   } 
   else {
     funcentry->inverse.def = 0;
@@ -1445,22 +2349,14 @@ newtable(char *unitname,char *unitdef, int *count,
     tabpt++;
     start=end+strspn(end," ,");
   }
-  if ((funcentry=fnlookup(unitname))){
-    if (flags.unitcheck && errfile && !redefine)
-      fprintf(errfile,
-      "%s: unit '%s' defined on line %d of '%s' is redefined on line %d of '%s'.\n",
-                    progname, unitname, funcentry->linenumber,funcentry->file,
-                                         linenum, file);
-    freefunction(funcentry);
-  } else {
-    funcentry = (struct func *)mymalloc(sizeof(struct func),"(newtable)");
-    funcentry->name = dupstr(unitname);
-    addfunction(funcentry);
-    (*count)++;
-  }
-  funcentry->tableunit = dupstr(tableunit);
+  funcentry = getfuncentry(unitname, 1, count, linenum, file, errfile,
+                           redefine);
+  funcentry->tableunit = arenastr(tableunit);
   funcentry->tablelen = tabpt;
-  funcentry->table = tab;
+  funcentry->table = (struct pair *)
+    memcpy(arenaalloc(tabpt*sizeof(struct pair), ARENAALIGN), tab,
+           tabpt*sizeof(struct pair));
+  free(tab);
   funcentry->skip_error_check = noerror;
   funcentry->linenumber = linenum;
   funcentry->file = file;
@@ -1485,16 +2381,15 @@ newalias(char *unitname, char *unitdef,int linenum, char *file,FILE *errfile)
               "%s: unit list '%s' defined on line %d of '%s' is redefined on line %d of '%s'.\n",
               progname, unitname, aliasentry->linenumber,
               aliasentry->file, linenum, file);
-    free(aliasentry->definition);
   } else { 
     aliasentry = (struct wantalias *)
-      mymalloc(sizeof(struct wantalias),"(newalias)");
-    aliasentry->name = dupstr(unitname);
+      arenaalloc(sizeof(struct wantalias), ARENAALIGN);
+    aliasentry->name = dbstr(unitname);
     aliasentry->next = 0;
     *aliaslistend = aliasentry;
     aliaslistend = &aliasentry->next;
   }
-  aliasentry->definition = dupstr(unitdef);
+  aliasentry->definition = dbstr(unitdef);
   aliasentry->linenumber = linenum;
   aliasentry->file = file;
   return 0;
@@ -1588,66 +2483,551 @@ isfullpath(char *path)
   return isdirsep(*path);
 }
 
-/* 
-   Read in units data.  
+/* Loads a file into a new image.  Returns NULL with errno set if the
+   file cannot be read. */
 
-   file - Filename to load
-   errfile - File to receive messages about errors in the units database.  
-             Set it to 0 to suppress errors. 
-   unitcount, prefixcount, funccount - Return statistics to the caller.  
-                                       Must initialize to zero before calling.
-   depth - Used to prevent recursive includes.  Call with it set to zero.
+struct dbimage *
+opendbimage(char *file)
+{
+  struct dbimage *img;
+  char *data = 0;
+  size_t size = 0, len;
+  int mapped = 0;
+  FILE *fp = 0;
+#ifdef USE_MMAP
+  struct stat statbuf;
+  int fd;
 
-   The global variable progname is used in error messages.  
+  if ((fd = open(file, O_RDONLY)) < 0)
+    return 0;
+  if (fstat(fd, &statbuf)){
+    close(fd);
+    return 0;
+  }
+  if (S_ISDIR(statbuf.st_mode)){
+    close(fd);
+    errno = EISDIR;
+    return 0;
+  }
+  size = statbuf.st_size;
+  if (size && S_ISREG(statbuf.st_mode) && access(file, W_OK)){
+    data = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+      data = 0;
+    else if (size % sysconf(_SC_PAGESIZE) == 0){   /* no spare byte */
+      munmap(data, size);
+      data = 0;
+    } else
+      mapped = 1;
+  }
+  /* Anything that was not mapped, including a pipe, is read until EOF
+     from the descriptor already open, so a pipe is not opened twice */
+  if (mapped)
+    close(fd);
+  else if (!(fp = fdopen(fd, "rb"))){
+    close(fd);
+    return 0;
+  }
+#else
+  if (!(fp = openfile(file, "rb")))
+    return 0;
+#endif
+  if (fp){
+    size = 0;
+    data = mymalloc(BUFSIZ, "(opendbimage)");
+    while ((len = fread(data+size, 1, BUFSIZ, fp)) > 0){
+      size += len;
+      data = realloc(data, size+BUFSIZ);
+      if (!data){
+        fprintf(stderr, "%s: memory allocation error (opendbimage)\n",
+                progname);
+        exit(EXIT_FAILURE);
+      }
+    }
+    fclose(fp);
+  }
+  img = (struct dbimage *) mymalloc(sizeof(*img), "(opendbimage)");
+  img->data = data;
+  img->size = data ? size : 0;
+  img->pos = 0;
+  img->savedvalid = 0;
+  img->mapped = mapped;
+  img->next = dbimages;
+  dbimages = img;
+  if (img->size >= strlen(UTF8MARKER)
+      && !memcmp(img->data, UTF8MARKER, strlen(UTF8MARKER)))
+    memset(img->data, ' ', strlen(UTF8MARKER));
+  return img;
+}
+
+
+/*
+   Normalizes one line of a units file in a single pass: lines ending
+   in a backslash are joined to the following line, control characters
+   become spaces and anything after the comment character is removed.
+   As with the previous line reader, the newline is kept as a trailing
+   space.  The line starts at src and the result is written to dest,
+   which may be the same as src because the output never gets ahead of
+   the input.  The line is not terminated.
+
+   Returns the start of the next line.  The length of the result is
+   stored in len, count is incremented by the number of lines read, and
+   ascii is set if the line contains no bytes outside the ASCII range.
 */
 
-int
-readunits(char *file, FILE *errfile, 
-          int *unitcount, int *prefixcount, int *funccount, int depth)
+char *
+normalizeline(char *src, char *end, char *dest, int *len, int *count,
+              int *ascii)
 {
-   FILE *unitfile;
-   char *line = 0, *lineptr, *unitdef, *unitname, *permfile;
-   int linenum, linebufsize, goterr, retcode;
-   int locunitcount, locprefixcount, locfunccount, redefinition;
-   int wronglocale = 0;   /* If set then we are currently reading data */
-   int inlocale = 0;      /* for the wrong locale so we should skip it */
-   int in_utf8 = 0;       /* If set we are reading utf8 data */
-   int invar = 0;         /* If set we are in data for an env variable.*/
-   int wrongvar = 0;      /* If set then we are not processing */
-
-   locunitcount = 0;
-   locprefixcount = 0;
-   locfunccount  = 0;
-   linenum = 0;
-   linebufsize = 0;
-   goterr = 0;
+  char *ptr, *out = dest, *nl;
+  int comment = 0;
 
-   unitfile = openfile(file, "rt");
-   
-   if (!unitfile){
-     if (errfile)
-       fprintf(errfile, "%s: Unable to read units file '%s': %s\n", progname, file, strerror(errno));
-     return E_FILE;
-   }
-   growbuffer(&line,&linebufsize);
-                                            /* coverity[alloc_fn] */
-   permfile = dupstr(file);    /* This is a permanent copy to reference in */
-                               /* the database. It is never freed. */
-   while (!feof(unitfile)) {
-      if (!fgetslong(&line, &linebufsize, unitfile, &linenum)) 
-        break;
-      if (linenum==1 && startswith(line, UTF8MARKER)){ 
-        int i;
-        for(lineptr=line,i=0;i<strlen(UTF8MARKER);i++, lineptr++)
-          *lineptr=' ';
-      }
-      strip_comment(line);
-      if (-1 == strwidth(line)){
-        readerror(errfile, "%s: %s on line %d of '%s'\n",
-                      progname, invalid_utf8, linenum, file);
+  *ascii = 1;
+  for(ptr = src;;){
+    nl = memchr(ptr, '\n', end-ptr);
+    (*count)++;
+    for(;ptr < (nl ? nl : end);ptr++){
+      unsigned char c = *ptr;
+      if (comment)
         continue;
+      if (c == COMMENTCHAR)
+        comment = 1;
+      else if (c < ' ' || c == 0x7f)
+        *out++ = ' ';
+      else {
+        if (c >= 0x80)
+          *ascii = 0;
+        *out++ = c;
+      }
+    }
+    if (nl && ptr > src && ptr[-1] == '\\'){
+      if (!comment)         /* drop the backslash and join the next line */
+        out--;
+      ptr = nl+1;
+      continue;
+    }
+    break;
+  }
+  if (nl && !comment)
+    *out++ = ' ';           /* the newline, as a space */
+  *len = out - dest;
+  return nl ? nl+1 : end;
+}
+
+
+/*
+   Returns the next line of an image, or NULL at the end.  The count is
+   incremented by the number of lines read, and ascii is set if the
+   line contains no bytes outside the ASCII range.
+
+   The line is terminated in place.  The terminator can fall on the
+   first byte of the next line, which is saved and put back by the next
+   call, so the line is only valid until then.  Strings kept from it
+   must be split off with their own terminators, as strtok() and
+   splitline() do.  A file is only mapped if its last page has a spare
+   byte for the terminator of the last line; otherwise it is read into
+   a buffer that has one.
+*/
+
+char *
+nextdbline(struct dbimage *img, int *count, int *ascii)
+{
+  char *start, *out;
+  int len;
+
+  if (img->savedvalid){
+    img->data[img->pos] = img->saved;
+    img->savedvalid = 0;
+  }
+  if (img->pos >= img->size)
+    return 0;
+  start = img->data + img->pos;
+  img->pos = normalizeline(start, img->data + img->size, start, &len,
+                           count, ascii) - img->data;
+  out = start + len;
+  if (out < img->data + img->size && out == img->data + img->pos){
+    img->saved = *out;      /* first byte of the next line */
+    img->savedvalid = 1;
+  }
+  *out = 0;
+  return start;
+}
+
+
+/*
+   Lazy loading (--lazy).  Most runs convert only a few units, so
+   instead of normalizing every line, readunits() uses lazydbline() to
+   find the name of each plain unit or prefix definition and leaves the
+   rest of the line raw in the image.  Comment and blank lines are
+   skipped without being copied.  The definition is normalized in place
+   by parselazy() when ulookup() or plookup() first finds it, and
+   parsealllazy() finishes every definition before the whole table is
+   used.  Anything else, including functions, tables, commands, lines
+   with non-ASCII text and lines continued before the definition
+   starts, is returned as LAZY_NO and read with nextdbline() as usual.
+*/
+
+#define LAZY_NO 0               /* read the line with nextdbline() */
+#define LAZY_SKIP 1             /* a blank or comment line was skipped */
+#define LAZY_DEF 2              /* name and definition have been found */
+
+#define lazyblank(c) ((c) <= ' ' || (c) == 0x7f)
+
+int
+lazydbline(struct dbimage *img, int *count, char **name, char **def)
+{
+  unsigned char *ptr, *start, *end, *lineend, *nameend, *nl;
+  int lines = 1;
+
+  if (img->savedvalid){
+    img->data[img->pos] = img->saved;
+    img->savedvalid = 0;
+  }
+  if (img->pos >= img->size)
+    return LAZY_NO;
+  start = (unsigned char *) img->data + img->pos;
+  end = (unsigned char *) img->data + img->size;
+  for(ptr = start; (nl = memchr(ptr, '\n', end-ptr)) && nl > start
+                   && nl[-1] == '\\'; ptr = nl+1)
+    lines++;
+  lineend = nl ? nl : end;
+  for(ptr = start; ptr < lineend && lazyblank(*ptr); ptr++);
+  if (ptr == lineend || *ptr == COMMENTCHAR){
+    *count += lines;
+    img->pos = (nl ? nl+1 : end) - (unsigned char *) img->data;
+    return LAZY_SKIP;
+  }
+  if (*ptr == COMMANDCHAR)
+    return LAZY_NO;
+  *name = (char *) ptr;
+  for(; ptr < lineend && !lazyblank(*ptr) && *ptr != COMMENTCHAR; ptr++)
+    if (*ptr >= 0x80 || *ptr == '\\' || *ptr == '(' || *ptr == '[')
+      return LAZY_NO;
+  nameend = ptr;
+  for(; ptr < lineend && lazyblank(*ptr); ptr++);
+  if (ptr == lineend || *ptr == COMMENTCHAR || *ptr == '\\')
+    return LAZY_NO;
+  *def = (char *) ptr;
+  for(; ptr < lineend; ptr++)
+    if (*ptr >= 0x80)
+      return LAZY_NO;
+  *nameend = 0;
+  *lineend = 0;             /* the newline, or the spare byte at the end */
+  *count += lines;
+  img->pos = (nl ? nl+1 : end) - (unsigned char *) img->data;
+  return LAZY_DEF;
+}
+
+
+/* Normalizes a definition stored by lazydbline() in place, giving the
+   text that nextdbline() and splitline() would have produced, and
+   clears its lazy flag. */
+
+void
+parselazy(char *value, char *lazy)
+{
+  int len, count = 0, ascii;
+
+  normalizeline(value, value + strlen(value), value, &len, &count, &ascii);
+  value[len] = 0;
+  removespaces(value);
+  *lazy = 0;
+}
+
+
+/* Parses every definition that is still lazy.  This is needed before
+   the tables are scanned as a whole, as by --check or search. */
+
+void
+parsealllazy(void)
+{
+  struct unitlist *uptr;
+  struct prefixlist *pptr;
+  int i;
+
+  for(i=0;i<HASHSIZE;i++)
+    for(uptr = utab[i]; uptr; uptr = uptr->next)
+      if (uptr->lazy)
+        parselazy(uptr->value, &uptr->lazy);
+  for(i=0;i<SIMPLEHASHSIZE;i++)
+    for(pptr = ptab[i]; pptr; pptr = pptr->next)
+      if (pptr->lazy)
+        parselazy(pptr->value, &pptr->lazy);
+}
+
+
+#ifdef BUILTIN_UNITS
+
+/*
+   The standard units database can be compiled into the program (see
+   unitsgen.c).  findunitsfile() then returns builtinpath(0) and
+   readunits() takes that file, and the files it includes, from the
+   built-in records instead of reading them.  The built-in files are
+   named as if they were installed in the directory of UNITSFILE, so
+   messages and !include work as they do for the installed files.
+*/
+
+char **builtinpaths = 0;
+int loadingbuiltin = 0;       /* set while reading a built-in file */
+
+char *
+builtinpath(int file)
+{
+  int count, i, dirlen;
+
+  if (!builtinpaths){
+    for(count=0;builtinfiles[count].name;count++);
+    builtinpaths = (char **) mymalloc(count*sizeof(char *), "(builtinpath)");
+    dirlen = pathend(UNITSFILE) - UNITSFILE;
+    for(i=0;i<count;i++){
+      builtinpaths[i] = (char *) mymalloc(dirlen+strlen(builtinfiles[i].name)+1,
+                                          "(builtinpath)");
+      memcpy(builtinpaths[i], UNITSFILE, dirlen);
+      strcpy(builtinpaths[i]+dirlen, builtinfiles[i].name);
+    }
+  }
+  return builtinpaths[file];
+}
+
+
+/* Returns the built-in file to read for file, or null to read it from
+   disk.  Only the file returned by findunitsfile() and the files it
+   includes are built in; a file given by name is always read. */
+
+const struct builtinfile *
+findbuiltin(char *file)
+{
+  int i;
+
+  if (file != builtinpath(0) && !loadingbuiltin)
+    return 0;
+  for(i=0;builtinfiles[i].name;i++)
+    if (!strcmp(file, builtinpath(i)))
+      return builtinfiles+i;
+  return 0;
+}
+
+
+/* Adds a built-in unit, prefix or function definition to the tables */
+
+int
+addbuiltin(const struct builtinrecord *record, int *unitcount,
+           int *prefixcount, int *funccount, char *file, FILE *errfile)
+{
+  const struct func *source;
+  struct func *funcentry;
+  int redefine, err = 0;
+
+  redefine = record->flags & BUILTIN_REDEFINE;
+  dbstatic = 1;
+  if (record->kind == BUILTIN_UNIT)
+    err = newunit(record->name, record->value, unitcount, record->linenumber,
+                  file, errfile, redefine, 0);
+  else if (record->kind == BUILTIN_PREFIX)
+    err = newprefix(record->name, record->value, prefixcount,
+                    record->linenumber, file, errfile, redefine, 0);
+  else {
+    source = builtinfunctions + record->function;
+    funcentry = getfuncentry(source->name, source->table != 0, funccount,
+                             record->linenumber, file, errfile, redefine);
+    funcentry->forward = source->forward;
+    funcentry->inverse = source->inverse;
+    funcentry->table = source->table;
+    funcentry->tablelen = source->tablelen;
+    funcentry->tableunit = source->tableunit;
+    funcentry->skip_error_check = source->skip_error_check;
+    funcentry->linenumber = record->linenumber;
+    funcentry->file = file;
+  }
+  dbstatic = 0;
+  return err;
+}
+
+#endif
+
+
+/*
+   Chunked databases.  A units database can be split into chunks that
+   are loaded one after another, as the browser build does to serve
+   conversions before the whole database has arrived.  Each chunk file
+   starts with "!chunk name", and the first chunk lists the names that
+   the other chunks define with "!pending name unit ...".  A unit that
+   is pending in a chunk that has not been loaded yet is reported as
+   not loaded rather than unknown.
+*/
+
+struct unitschunk {
+  char *name;
+  int loaded;
+  struct unitschunk *next;
+};
+
+struct pendingunit {
+  char *name;
+  struct unitschunk *chunk;
+  struct pendingunit *next;
+};
+
+struct unitschunk *chunklist = 0;
+struct pendingunit *pendtab[HASHSIZE];
+THREADLOCAL char *notloadedchunk = 0;  /* Chunk of the last unit not loaded */
+
+struct unitschunk *
+findchunk(char *name)
+{
+  struct unitschunk *chunk;
+
+  for(chunk = chunklist; chunk; chunk = chunk->next)
+    if (!strcmp(chunk->name, name))
+      return chunk;
+  chunk = (struct unitschunk *) arenaalloc(sizeof(*chunk), ARENAALIGN);
+  chunk->name = arenastr(name);
+  chunk->loaded = 0;
+  chunk->next = chunklist;
+  chunklist = chunk;
+  return chunk;
+}
+
+
+void
+addpending(char *name, struct unitschunk *chunk)
+{
+  struct pendingunit *pend;
+  unsigned hashval = uhash(name);
+
+  pend = (struct pendingunit *) arenaalloc(sizeof(*pend), ARENAALIGN);
+  pend->name = arenastr(name);
+  pend->chunk = chunk;
+  pend->next = pendtab[hashval];
+  pendtab[hashval] = pend;
+}
+
+
+/*
+   Returns the chunk that has not been loaded yet in which a unit name
+   is pending, trying the forms of the name that tryunitforms() tries.
+   The name must be writable and is restored before returning.
+*/
+
+void *
+pendingform(char *name, void *data)
+{
+  struct pendingunit *pend;
+
+  for(pend = pendtab[uhash(name)]; pend; pend = pend->next)
+    if (!pend->chunk->loaded && !strcmp(pend->name, name))
+      return pend->chunk;
+  return 0;
+}
+
+struct unitschunk *
+pendingchunk(char *unit, int prefixok)
+{
+  return (struct unitschunk *) tryunitforms(unit, prefixok, pendingform, 0);
+}
+
+
+/* 
+   Read in units data.  
+
+   file - Filename to load
+   errfile - File to receive messages about errors in the units database.  
+             Set it to 0 to suppress errors. 
+   unitcount, prefixcount, funccount - Return statistics to the caller.  
+                                       Must initialize to zero before calling.
+   depth - Used to prevent recursive includes.  Call with it set to zero.
+
+   The global variable progname is used in error messages.  
+*/
+
+int
+readunits(char *file, FILE *errfile, 
+          int *unitcount, int *prefixcount, int *funccount, int depth)
+{
+   struct dbimage *image;
+   char *line, *unitdef, *unitname, *permfile;
+   int linenum, goterr, retcode, ascii, lazy;
+   int locunitcount, locprefixcount, locfunccount, redefinition;
+   int wronglocale = 0;   /* If set then we are currently reading data */
+   int inlocale = 0;      /* for the wrong locale so we should skip it */
+   int in_utf8 = 0;       /* If set we are reading utf8 data */
+   int invar = 0;         /* If set we are in data for an env variable.*/
+   int wrongvar = 0;      /* If set then we are not processing */
+#ifdef BUILTIN_UNITS
+   const struct builtinfile *builtin;
+   const struct builtinrecord *record;
+   int wasbuiltin = loadingbuiltin;
+   char *scratch = 0;
+#endif
+
+   locunitcount = 0;
+   locprefixcount = 0;
+   locfunccount  = 0;
+   linenum = 0;
+   goterr = 0;
+
+#ifdef BUILTIN_UNITS
+   if ((builtin = findbuiltin(file))){
+     image = 0;
+     record = builtin->records;
+     scratch = mymalloc(builtin->maxline+1, "(readunits)");
+     loadingbuiltin = 1;
+   } else
+#endif
+   {
+     image = opendbimage(file);
+   
+     if (!image){
+       if (errfile)
+         fprintf(errfile, "%s: Unable to read units file '%s': %s\n", progname, file, strerror(errno));
+       return E_FILE;
+     }
+   }
+                                            /* coverity[alloc_fn] */
+   permfile = arenastr(file);  /* This is a permanent copy to reference in */
+                               /* the database */
+   adddbfile(permfile, depth, !image);
+   for(;;){
+#ifdef BUILTIN_UNITS
+      if (builtin){
+        if (record == builtin->records + builtin->count)
+          break;
+        linenum = record->linenumber;
+        if (record->kind != BUILTIN_LINE){
+          if (!((in_utf8 && !utf8mode) || wronglocale || wrongvar)
+              && addbuiltin(record, &locunitcount, &locprefixcount,
+                            &locfunccount, permfile, errfile))
+            goterr = 1;
+          record++;
+          continue;
+        }
+        line = strcpy(scratch, record->name);   /* commands modify it */
+        ascii = record->flags & BUILTIN_ASCII;
+        lazy = LAZY_NO;
+        record++;
+      } else
+#endif
+      {
+        lazy = lazyload ? lazydbline(image, &linenum, &unitname, &unitdef)
+                        : LAZY_NO;
+        if (lazy == LAZY_SKIP)
+          continue;
+        if (lazy == LAZY_DEF){     /* already split, ASCII and not a command */
+          line = unitname;
+          ascii = 1;
+        } else if (!(line = nextdbline(image, &linenum, &ascii)))
+          break;
+      }
+      /* Lines with only ASCII characters are always valid and have no
+         Unicode minus signs */
+      if (!ascii){
+        if (-1 == strwidth(line)){
+          readerror(errfile, "%s: %s on line %d of '%s'\n",
+                        progname, invalid_utf8, linenum, file);
+          continue;
+        }
+        replace_minus(line);
       }
-      replace_minus(line);
 
       if (*line == COMMANDCHAR) {         /* Process units file commands */
         unitname = strtok(line+1, " ");
@@ -1776,6 +3156,34 @@ readunits(char *file, FILE *errfile,
             setenv(unitname, unitdef, 0);
           continue;
         }
+        else if (!strcmp(unitname, "chunk")){
+          unitname = strtok(0, " ");
+          if (!unitname)
+            readerror(errfile,
+                      "%s: no chunk name specified on line %d of '%s'\n",
+                      progname, linenum, file);
+          else {
+            struct unitschunk *chunk = findchunk(unitname);
+
+            if (chunk->loaded)        /* skip the rest of the file */
+              break;
+            chunk->loaded = 1;
+          }
+          continue;
+        }
+        else if (!strcmp(unitname, "pending")){
+          struct unitschunk *chunk;
+
+          unitname = strtok(0, " ");
+          if (!unitname)
+            readerror(errfile,
+                      "%s: no chunk name specified on line %d of '%s'\n",
+                      progname, linenum, file);
+          else if (!(chunk = findchunk(unitname))->loaded)
+            while ((unitname = strtok(0, " ")))
+              addpending(unitname, chunk);
+          continue;
+        }
         else if (!strcmp(unitname,"unitlist")){
           splitline(0,&unitname, &unitdef); /* 0 continues strtok call */
           if (!unitname || !unitdef)
@@ -1810,11 +3218,11 @@ readunits(char *file, FILE *errfile,
               strcpy(pathend(includefile), unitname);
             }
 
+            tracebegin("readunits", "file", includefile, (char *) 0);
             readerr = readunits(includefile, errfile, unitcount, prefixcount, 
                                 funccount, depth+1);
+            traceend();
             if (readerr == E_MEMORY){
-              fclose(unitfile);
-              free(line);
               free(includefile);
               return readerr;
             }
@@ -1832,13 +3240,15 @@ readunits(char *file, FILE *errfile,
       } 
       if (in_utf8 && !utf8mode) continue;
       if (wronglocale || wrongvar) continue;
-      splitline(line, &unitname, &unitdef);
-      if (!unitname) continue;
-      if (!unitdef){
-        readerror(errfile,
-              "%s: unit '%s' lacks a definition at line %d of '%s'\n",
-                  progname, unitname, linenum, file);
-        continue;
+      if (lazy != LAZY_DEF){
+        splitline(line, &unitname, &unitdef);
+        if (!unitname) continue;
+        if (!unitdef){
+          readerror(errfile,
+                "%s: unit '%s' lacks a definition at line %d of '%s'\n",
+                    progname, unitname, linenum, file);
+          continue;
+        }
       }
 
       if (*unitname == REDEFCHAR){
@@ -1848,19 +3258,17 @@ readunits(char *file, FILE *errfile,
         redefinition=0;
 
       if (lastchar(unitname) == '-'){      /* it's a prefix definition */
+        lastchar(unitname) = 0;
         if (newprefix(unitname,unitdef,&locprefixcount,linenum,
-                      permfile,errfile,redefinition))
+                      permfile,errfile,redefinition,lazy == LAZY_DEF))
           goterr=1;
       }
       else if (strchr(unitname,'[')){     /* table definition  */
         retcode=newtable(unitname,unitdef,&locfunccount,linenum,
                          permfile,errfile,redefinition);
         if (retcode){
-          if (retcode != E_BADFILE){
-            fclose(unitfile);
-            free(line);
+          if (retcode != E_BADFILE)
             return retcode;
-          }
           goterr=1;
         }
       }
@@ -1870,12 +3278,16 @@ readunits(char *file, FILE *errfile,
           goterr = 1;
       }
       else {                              /* ordinary unit definition */
-        if (newunit(unitname,unitdef,&locunitcount,linenum,permfile,errfile,redefinition))
+        if (newunit(unitname,unitdef,&locunitcount,linenum,permfile,errfile,
+                    redefinition,lazy == LAZY_DEF))
           goterr = 1;
       }
    }
-   fclose(unitfile);
-   free(line);
+#ifdef BUILTIN_UNITS
+   free(scratch);
+   loadingbuiltin = wasbuiltin;
+#endif
+   dbversion++;
    if (unitcount)
      *unitcount+=locunitcount;
    if (prefixcount)
@@ -1890,66 +3302,419 @@ readunits(char *file, FILE *errfile,
 	};
 }
 
-/* Initialize a unit to be equal to 1. */
+void freereduced(struct reducedunit *red);
+
+/*
+   Empties the tables without releasing anything they refer to.  This
+   is the second half of freedatabase(), and savedatabase() uses it
+   after moving the database aside.
+*/
 
 void
-initializeunit(struct unittype *theunit)
-{
-   theunit->factor = 1.0;
-   theunit->numerator[0] = theunit->denominator[0] = NULL;
+cleardatabase(void)
+{
+  memset(utab, 0, sizeof(utab));
+  memset(ptab, 0, sizeof(ptab));
+  memset(ftab, 0, sizeof(ftab));
+  firstalias = 0;
+  aliaslistend = &firstalias;
+  chunklist = 0;
+  memset(pendtab, 0, sizeof(pendtab));
+  notloadedchunk = 0;
+  memset(&unitindex, 0, sizeof(unitindex));
+  memset(&unitbloom, 0, sizeof(unitbloom));
+  dbimages = 0;
+  dbfiles = 0;
+  dbfilesend = &dbfiles;
+  memset(&dbarena, 0, sizeof(dbarena));
+  hasLoadedUnits = 0;
+  dbversion++;
 }
 
 
-/* Free a unit: frees all the strings used in the unit structure.
-   Does not free the unit structure itself.  */
+/*
+   Releases the whole database: the tables, the loaded images and the
+   arena that holds the entries.  The units data files can then be
+   loaded again from scratch.
+*/
 
 void
-freeunit(struct unittype *theunit)
+freedatabase(void)
 {
-   char **ptr;
+  struct arenablock *block;
+  struct dbimage *img;
+  struct unitlist *uptr;
+  int i;
 
-   for(ptr = theunit->numerator; *ptr; ptr++)
-     if (*ptr != NULLUNIT) free(*ptr);
-   for(ptr = theunit->denominator; *ptr; ptr++)
-     if (*ptr != NULLUNIT) free(*ptr);
+  for(i=0;i<HASHSIZE;i++)
+    for(uptr = utab[i]; uptr; uptr = uptr->next)
+      freereduced(uptr->reduced);
+  free(unitindex.slots);
+  free(unitindex.hashes);
+  free(unitbloom.bits);
+  while ((img = dbimages)){
+    dbimages = img->next;
+#ifdef USE_MMAP
+    if (img->mapped)
+      munmap(img->data, img->size);
+    else
+#endif
+      free(img->data);
+    free(img);
+  }
+  while ((block = dbarena.blocks)){
+    dbarena.blocks = block->next;
+    free(block);
+  }
+  cleardatabase();
+}
 
-   /* protect against repeated calls to freeunit() */
 
-   theunit->numerator[0] = 0;  
-   theunit->denominator[0] = 0;
+/*
+   Finds the units table entry that a unit name refers to, following
+   the plural and prefix rules of lookupunit().  The name must be
+   writable; it is modified during the search and restored before
+   returning.  Returns NULL if the name is unknown or is a bare prefix.
+*/
+
+void *
+entryform(char *name, void *data)
+{
+  return ulookup(name);
+}
+
+struct unitlist *
+findunitentry(char *unit, int prefixok)
+{
+  return (struct unitlist *) tryunitforms(unit, prefixok, entryform, 0);
 }
 
 
-/* Print out a unit  */
+/*
+   Calls unitfn() for every unit name that appears in a unit definition,
+   splitting the text the way the parser does.  Numbers and builtins
+   are skipped, and a trailing exponent digit (as in "m3") is removed.
+   The name passed to unitfn() is a writable copy.  Function names are
+   passed to funcfn() instead, or skipped if funcfn is NULL.
+*/
 
 void
-showunit(struct unittype *theunit)
+foreachname(char *def, void (*unitfn)(char *name, void *data),
+            void (*funcfn)(struct func *fun, void *data), void *data)
+{
+  struct func *fun;
+  char *nonunitchars = "~;+-*/|\t\n^ ()";   /* Same as in parse.y */
+  char *number_start = ".,0123456789";
+  char *copy, *ptr, *end, **builtin;
+  int length;
+
+  copy = dupstr(def);
+  ptr = copy;
+  while (*ptr){
+    ptr += strspn(ptr, nonunitchars);
+    if (!*ptr)
+      break;
+    if (strchr(number_start, *ptr)){
+      strtod(ptr, &end);
+      if (end != ptr){
+        ptr = end;
+        continue;
+      }
+    }
+    length = strcspn(ptr, nonunitchars);
+    end = ptr + length;
+    if (*end)
+      *end++ = 0;
+    if (strchr(".,_", *ptr) || strchr(".,_", ptr[length-1]))
+      ;
+    else if ((fun = fnlookup(ptr))){
+      if (funcfn)
+        funcfn(fun, data);
+    } else {
+      for(builtin = builtins; *builtin; builtin++)
+        if (!strcmp(ptr, *builtin))
+          break;
+      if (!*builtin){
+        if (strchr("23456789", ptr[length-1]) && !hassubscript(ptr))
+          ptr[length-1] = 0;
+        if (*ptr)
+          unitfn(ptr, data);
+      }
+    }
+    ptr = end;
+  }
+  free(copy);
+}
+
+
+void
+foreachunitname(char *def, void (*fn)(char *name, void *data), void *data)
 {
-   char **ptr;
-   int printedslash;
-   int counter = 1;
+  foreachname(def, fn, 0, data);
+}
 
-   logprintf(num_format.format, theunit->factor);
 
-   for (ptr = theunit->numerator; *ptr; ptr++) {
-      if (ptr > theunit->numerator && **ptr &&
-          !strcmp(*ptr, *(ptr - 1)))
-         counter++;
-      else {
-         if (counter > 1)
-           logprintf("%s%d", powerstring, counter);
-         if (**ptr)
-           logprintf(" %s", *ptr);
-         counter = 1;
-      }
-   }
-   if (counter > 1)
-     logprintf("%s%d", powerstring, counter);
-   counter = 1;
-   printedslash = 0;
-   for (ptr = theunit->denominator; *ptr; ptr++) {
-      if (ptr > theunit->denominator && **ptr &&
-          !strcmp(*ptr, *(ptr - 1)))
+/* 
+   Analysis of the units table.  Units whose definition is only a
+   number or a number times another unit name (synonyms such as
+   "metre meter") are marked so that reduceproduct() can replace them
+   with the last unit of the chain without parsing the definitions.
+   The factors of the definitions along the chain are kept in order
+   and multiplied in one at a time, as reducing the chain from the
+   text does, so the results are the same to the last bit.  The
+   original definitions are kept for display.  Circular
+   definitions are reported, and every unit of the cycle is marked so
+   that reducing it fails instead of looping.
+
+   Units are resolved with their dependencies the first time that
+   reduceproduct() uses them.  Only -c, --eager and batches shared
+   between threads resolve the whole table with resolveunits().
+*/
+
+#define RESOLVE_NEW 0
+#define RESOLVE_ACTIVE 1
+#define RESOLVE_DONE 2
+
+struct resolvestate {
+  FILE *errfile;
+  int circular;           /* count of circular definitions found */
+  struct unitlist **stack;        /* units being resolved, outermost */
+  int depth, stacksize;           /*   first */
+};
+
+void resolveunit(struct unitlist *uptr, struct resolvestate *state);
+
+void
+resolvedependency(char *name, void *data)
+{
+  struct unitlist *uptr;
+
+  if ((uptr = findunitentry(name, 1)))
+    resolveunit(uptr, (struct resolvestate *) data);
+}
+
+/* Marks and reports the units of the cycle that ends with uptr, which
+   are the units on the stack from uptr to the top. */
+
+void
+markcircular(struct unitlist *uptr, struct resolvestate *state)
+{
+  int i;
+
+  for(i=state->depth-1;i>0 && state->stack[i]!=uptr;i--);
+  for(;i<state->depth;i++){
+    uptr = state->stack[i];
+    if (uptr->circular)
+      continue;
+    uptr->circular = 1;
+    state->circular++;
+    if (state->errfile)
+      fprintf(state->errfile,
+              "%s: unit '%s' defined on line %d of '%s' has a circular definition\n",
+              progname, uptr->name, uptr->linenumber, uptr->file);
+  }
+}
+
+void
+resolveunit(struct unitlist *uptr, struct resolvestate *state)
+{
+  struct unittype def;
+  struct unitlist *target, *next;
+
+  if (uptr->resolvemark == RESOLVE_DONE)
+    return;
+  if (uptr->resolvemark == RESOLVE_ACTIVE){
+    markcircular(uptr, state);
+    return;
+  }
+  uptr->resolvemark = RESOLVE_ACTIVE;
+  if (state->depth == state->stacksize){
+    state->stacksize = state->stacksize ? 2*state->stacksize : 32;
+    state->stack = (struct unitlist **)
+      realloc(state->stack, state->stacksize*sizeof(*state->stack));
+    if (!state->stack){
+      fprintf(stderr, "%s: memory allocation error (resolveunit)\n",
+              progname);
+      exit(EXIT_FAILURE);
+    }
+  }
+  state->stack[state->depth++] = uptr;
+  if (!strchr(uptr->value, PRIMITIVECHAR))
+    foreachunitname(uptr->value, resolvedependency, state);
+  state->depth--;
+  uptr->resolvemark = RESOLVE_DONE;
+
+  /* Look for a definition that is a constant or a multiple of one unit. 
+     Definitions containing operators whose meaning depends on parser
+     flags or on evaluation context are left alone. */
+
+  if (uptr->circular || strchr(uptr->value, PRIMITIVECHAR)
+      || strpbrk(uptr->value, "()-_~;"))
+    return;
+  if (parseunit(&def, uptr->value, 0, 0))
+    return;
+  if (!def.denominator[0] && (!def.numerator[0] || !def.numerator[1])){
+    target = def.numerator[0] ? ulookup(def.numerator[0]) : 0;
+    if (!def.numerator[0] || (target && !target->circular)){
+      next = target && target->flattened ? target : 0;
+      uptr->chainlen = 1 + (next ? next->chainlen : 0);
+      uptr->chain = (double *)
+        arenaalloc(uptr->chainlen*sizeof(double), ARENAALIGN);
+      uptr->chain[0] = def.factor;
+      if (next){
+        memcpy(uptr->chain+1, next->chain, next->chainlen*sizeof(double));
+        target = next->target;
+      }
+      uptr->target = target;
+      uptr->flattened = 1;
+    }
+  }
+  freeunit(&def);
+}
+
+void
+initresolve(struct resolvestate *state, FILE *errfile)
+{
+  state->errfile = errfile;
+  state->circular = 0;
+  state->stack = 0;
+  state->depth = state->stacksize = 0;
+}
+
+int resolvedversion = -1;       /* dbversion when resolveunits() last ran */
+int eagerversion = -1;          /* dbversion when eagerreduce() last ran */
+
+int
+resolveunits(FILE *errfile)
+{
+  struct resolvestate state;
+  struct unitlist *uptr;
+  int i;
+
+  parsealllazy();
+  initresolve(&state, errfile);
+  for(i=0;i<HASHSIZE;i++)
+    for(uptr = utab[i]; uptr; uptr = uptr->next){
+      uptr->resolvemark = RESOLVE_NEW;
+      uptr->flattened = uptr->circular = 0;
+    }
+  for(i=0;i<HASHSIZE;i++)
+    for(uptr = utab[i]; uptr; uptr = uptr->next)
+      resolveunit(uptr, &state);
+  free(state.stack);
+  resolvedversion = dbversion;
+  return state.circular;
+}
+
+
+/* Resolves one unit and the units it depends on when reduceproduct()
+   first uses it.  New entries start out as RESOLVE_NEW. */
+
+void
+resolveused(struct unitlist *uptr)
+{
+  struct resolvestate state;
+
+  initresolve(&state, stderr);
+  resolveunit(uptr, &state);
+  free(state.stack);
+}
+
+
+/*
+   Adds a chunk of a split database to the units already loaded, as
+   the browser build does when a chunk arrives after the first
+   conversions.  The new units are resolved as they are used, and with
+   lazy set their definitions are also parsed on first use, as with
+   --lazy.  A chunk that is already loaded is skipped.
+   Returns the error code from readunits().
+*/
+
+int
+loadunitschunk(char *file, int lazy)
+{
+  int err;
+
+  lazyload = lazy;
+  tracebegin("readunits", "file", file, (char *) 0);
+  err = readunits(file, stderr, 0, 0, 0, 0);
+  traceend();
+  if (err == E_MEMORY || err == E_FILE)
+    return err;
+  resolvedversion = dbversion;   /* see resolveused() */
+  return err;
+}
+
+
+/* Returns the chunk of the last unit reported as not loaded yet. */
+
+char *
+pendingunitschunk(void)
+{
+  return notloadedchunk;
+}
+
+
+/* Initialize a unit to be equal to 1. */
+
+void
+initializeunit(struct unittype *theunit)
+{
+   theunit->factor = 1.0;
+   theunit->numerator[0] = theunit->denominator[0] = NULL;
+}
+
+
+/* Free a unit: frees all the strings used in the unit structure.
+   Does not free the unit structure itself.  */
+
+void
+freeunit(struct unittype *theunit)
+{
+   char **ptr;
+
+   for(ptr = theunit->numerator; *ptr; ptr++)
+     if (*ptr != NULLUNIT) free(*ptr);
+   for(ptr = theunit->denominator; *ptr; ptr++)
+     if (*ptr != NULLUNIT) free(*ptr);
+
+   /* protect against repeated calls to freeunit() */
+
+   theunit->numerator[0] = 0;  
+   theunit->denominator[0] = 0;
+}
+
+
+/* Print out a unit  */
+
+void
+showunit(struct unittype *theunit)
+{
+   char **ptr;
+   int printedslash;
+   int counter = 1;
+
+   logprintf(num_format.format, theunit->factor);
+
+   for (ptr = theunit->numerator; *ptr; ptr++) {
+      if (ptr > theunit->numerator && **ptr &&
+          !strcmp(*ptr, *(ptr - 1)))
+         counter++;
+      else {
+         if (counter > 1)
+           logprintf("%s%d", powerstring, counter);
+         if (**ptr)
+           logprintf(" %s", *ptr);
+         counter = 1;
+      }
+   }
+   if (counter > 1)
+     logprintf("%s%d", powerstring, counter);
+   counter = 1;
+   printedslash = 0;
+   for (ptr = theunit->denominator; *ptr; ptr++) {
+      if (ptr > theunit->denominator && **ptr &&
+          !strcmp(*ptr, *(ptr - 1)))
          counter++;
       else {
          if (counter > 1)
@@ -2035,8 +3800,314 @@ cancelunit(struct unittype *theunit)
    clobbered if it happened to be the internal buffer.  
 */
 
-static int bufsize=0;
-static char *buffer;  /* buffer for lookupunit answers with prefixes */
+static THREADLOCAL int bufsize=0;
+static THREADLOCAL char *buffer;  /* buffer for lookupunit answers with prefixes */
+
+
+/*
+   Explain mode (--explain).  While a unit expression is parsed and
+   reduced, reduceproduct() records a node for each unit name that it
+   replaces by its definition: the rule lookupunit() used to find the
+   name, the definition and its factor, and the time and allocations of
+   that step.  The names in the definition become children of the node,
+   and nonlinear units evaluated on the way get nodes of their own, so
+   that showexplain() can print the reduction as a tree with the cost of
+   each branch.  The stored reductions of --eager and flattened chains
+   are not used while explaining, so every definition appears.
+*/
+
+struct explainnode {
+  char *name;
+  char *rule;               /* how lookupunit() found the name */
+  char *def;                /* NULL if the name is unknown */
+  double factor;
+  int function;             /* a nonlinear unit evaluated by evalfunc() */
+  int primitive;
+  int parent;               /* index of the parent node or -1 */
+  int outer;                /* node whose step was running when this began */
+  double start, time, nested, total;
+  unsigned long startallocs, allocs, nestedallocs, totalallocs;
+};
+
+struct explainname {        /* a unit name in a product and its node */
+  char *name;
+  int parent;
+  int node;                 /* -1 until reduceproduct() reaches the name */
+};
+
+struct {
+  int on;
+  struct explainnode *nodes;
+  int count, alloc;
+  struct explainname *names;
+  int namecount, namealloc;
+  int active;               /* node of the step now running, or -1 */
+  char *rule;               /* set by searchunit() */
+} explain;
+
+
+void
+startexplain(void)
+{
+  explain.on = 1;
+  explain.count = explain.namecount = 0;
+  explain.active = -1;
+  explain.rule = 0;
+}
+
+
+void
+endexplain(void)
+{
+  int i;
+
+  for(i=0;i<explain.count;i++){
+    free(explain.nodes[i].name);
+    free(explain.nodes[i].rule);
+    free(explain.nodes[i].def);
+  }
+  free(explain.rule);
+  explain.rule = 0;
+  explain.on = 0;
+}
+
+
+/* Records how searchunit() found a name.  The rule found for the rest of
+   the name is kept after it if nested is set. */
+
+void
+setexplainrule(const char *rule, const char *name, int nested)
+{
+  char *old, *new;
+
+  old = nested ? explain.rule : 0;
+  if (!rule)
+    new = 0;
+  else {
+    new = mymalloc(strlen(rule) + strlen(name) + (old ? strlen(old) : 0) + 6,
+                   "(setexplainrule)");
+    sprintf(new, "%s '%s'%s%s", rule, name, old ? ", " : "", old ? old : "");
+  }
+  free(explain.rule);
+  explain.rule = new;
+}
+
+
+/* Finds the entry for a name in a product.  The latest entry is the
+   one wanted, as the names are freed when they are replaced by their
+   definitions, and a new name can get the same memory. */
+
+struct explainname *
+findexplainname(char *name)
+{
+  int i;
+
+  for(i=explain.namecount-1;i>=0;i--)
+    if (explain.names[i].name == name)
+      return explain.names + i;
+  return 0;
+}
+
+
+void
+addexplainname(char *name, int parent)
+{
+  struct explainname *entry;
+
+  if (name == NULLUNIT)
+    return;
+  if (explain.namecount == explain.namealloc){
+    explain.namealloc = explain.namealloc ? 2*explain.namealloc : 64;
+    explain.names = realloc(explain.names,
+                            explain.namealloc*sizeof(struct explainname));
+    if (!explain.names){
+      fprintf(stderr, "%s: memory allocation error (addexplainname)\n",
+              progname);
+      exit(EXIT_FAILURE);
+    }
+  }
+  entry = explain.names + explain.namecount++;
+  entry->name = name;
+  entry->parent = parent;
+  entry->node = -1;
+}
+
+
+/* Starts the node for a step of reduceproduct() on name, or for the
+   evaluation of a function if function is set.  Returns -1 for a
+   primitive unit that already has a node, as reduceproduct() looks up
+   the remaining primitive units again on each pass. */
+
+int
+explainstart(char *name, int function)
+{
+  struct explainname *entry = 0;
+  struct explainnode *node;
+  int parent = explain.active;
+
+  if (!function){
+    if ((entry = findexplainname(name))){
+      if (entry->node >= 0){
+        if (!strcmp(explain.nodes[entry->node].name, name))
+          return -1;
+      } else
+        parent = entry->parent;
+    } else {
+      addexplainname(name, parent);
+      entry = explain.names + explain.namecount - 1;
+    }
+  }
+  if (explain.count == explain.alloc){
+    explain.alloc = explain.alloc ? 2*explain.alloc : 64;
+    explain.nodes = realloc(explain.nodes,
+                            explain.alloc*sizeof(struct explainnode));
+    if (!explain.nodes){
+      fprintf(stderr, "%s: memory allocation error (explainstart)\n",
+              progname);
+      exit(EXIT_FAILURE);
+    }
+  }
+  node = explain.nodes + explain.count;
+  node->name = dupstr(name);
+  node->rule = node->def = 0;
+  node->factor = 1;
+  node->function = function;
+  node->primitive = 0;
+  node->parent = parent;
+  node->outer = explain.active;
+  node->nested = 0;
+  node->nestedallocs = 0;
+  if (entry)
+    entry->node = explain.count;
+  explain.active = explain.count++;
+  setexplainrule(0, 0, 0);
+  node->startallocs = mymalloccount;
+  node->start = walltime();
+  return explain.active;
+}
+
+
+/* Adds the names of a parsed definition as children of a node */
+
+void
+explainchildren(int index, struct unittype *def)
+{
+  char **ptr;
+
+  if (index < 0)
+    return;
+  explain.nodes[index].factor = def->factor;
+  for(ptr = def->numerator; *ptr; ptr++)
+    addexplainname(*ptr, index);
+  for(ptr = def->denominator; *ptr; ptr++)
+    addexplainname(*ptr, index);
+}
+
+
+/* Records the definition that lookupunit() found for a node, and how it
+   found it, before parsing the definition can look up other names */
+
+void
+explainfound(int index, const char *def)
+{
+  struct explainnode *node;
+
+  if (index < 0)
+    return;
+  node = explain.nodes + index;
+  node->def = dupstr(def);
+  node->primitive = strchr(def, PRIMITIVECHAR) != 0;
+  node->rule = explain.rule;
+  explain.rule = 0;
+}
+
+
+/* Ends the step of a node */
+
+void
+explainfinish(int index)
+{
+  struct explainnode *node;
+  double elapsed;
+  unsigned long allocs;
+
+  if (index < 0)
+    return;
+  elapsed = walltime();
+  allocs = mymalloccount;
+  node = explain.nodes + index;
+  elapsed -= node->start;
+  allocs -= node->startallocs;
+  node->time = elapsed - node->nested;
+  node->allocs = allocs - node->nestedallocs;
+  explain.active = node->outer;
+  if (node->outer >= 0){
+    explain.nodes[node->outer].nested += elapsed;
+    explain.nodes[node->outer].nestedallocs += allocs;
+  }
+}
+
+
+void
+printexplainnode(int index, int depth)
+{
+  struct explainnode *node = explain.nodes + index;
+  int i, children = 0;
+
+  for(i=index+1;i<explain.count;i++)
+    if (explain.nodes[i].parent == index)
+      children++;
+  printf("%*s%s", 2*depth, "", node->name);
+  if (node->function)
+    printf(": nonlinear unit");
+  else if (!node->def)
+    printf(": unknown unit");
+  else if (node->primitive)
+    printf(": primitive unit");
+  else
+    printf(" = %s", node->def);
+  if (node->rule)
+    printf("  (%s)", node->rule);
+  putchar('\n');
+  printf("%*s  ", 2*depth, "");
+  if (node->def && !node->primitive && !node->function)
+    printf("factor %.8g, ", node->factor);
+  printf("%.1f us, %lu allocs", node->time*1e6, node->allocs);
+  if (children)
+    printf("; total %.1f us, %lu allocs", node->total*1e6,
+           node->totalallocs);
+  putchar('\n');
+  for(i=index+1;i<explain.count;i++)
+    if (explain.nodes[i].parent == index)
+      printexplainnode(i, depth+1);
+}
+
+
+/* Prints the reduction tree recorded for unitstr */
+
+void
+showexplain(char *unitstr)
+{
+  int i;
+  struct explainnode *node;
+
+  for(i=0;i<explain.count;i++){
+    node = explain.nodes + i;
+    node->total = node->time;
+    node->totalallocs = node->allocs;
+  }
+  for(i=explain.count-1;i>=0;i--){
+    node = explain.nodes + i;
+    if (node->parent >= 0){
+      explain.nodes[node->parent].total += node->total;
+      explain.nodes[node->parent].totalallocs += node->totalallocs;
+    }
+  }
+  printf("Reduction of '%s':\n", unitstr);
+  for(i=0;i<explain.count;i++)
+    if (explain.nodes[i].parent < 0)
+      printexplainnode(i, 1);
+}
 
 
 /* 
@@ -2047,44 +4118,56 @@ static char *buffer;  /* buffer for lookupunit answers with prefixes */
   
 
 char *
-lookupunit(char *unit,int prefixok)
+searchunit(char *unit,int prefixok)
 {
    char *copy;
    struct prefixlist *pfxptr;
    struct unitlist *uptr;
 
-   if ((uptr = ulookup(unit)))
+   if ((uptr = ulookup(unit))){
+      if (explain.on)
+         setexplainrule(0, 0, 0);
       return uptr->value;
+   }
 
    if (strwidth(unit)>2 && lastchar(unit) == 's') {
       copy = dupstr(unit);
       lastchar(copy) = 0;
-      if (lookupunit(copy,prefixok)){
+      STATCOUNT(pluralretries);
+      if (searchunit(copy,prefixok)){
          while(strlen(copy)+1 > bufsize) {
             growbuffer(&buffer, &bufsize);
          }
          strcpy(buffer, copy);  /* Note: returning looked up result seems   */
+         if (explain.on)
+            setexplainrule("plural of", buffer, 0);
          free(copy);            /*   better but it causes problems when it  */
          return buffer;         /*   contains PRIMITIVECHAR.                */
       }
       if (strlen(copy)>2 && lastchar(copy) == 'e') {
          lastchar(copy) = 0;
-         if (lookupunit(copy,prefixok)){
+         STATCOUNT(pluralretries);
+         if (searchunit(copy,prefixok)){
             while (strlen(copy)+1 > bufsize) {
                growbuffer(&buffer,&bufsize);
             }
             strcpy(buffer,copy);
+            if (explain.on)
+               setexplainrule("plural of", buffer, 0);
             free(copy);
             return buffer;
          }
       }
       if (strlen(copy)>2 && lastchar(copy) == 'i') {
          lastchar(copy) = 'y';
-         if (lookupunit(copy,prefixok)){
+         STATCOUNT(pluralretries);
+         if (searchunit(copy,prefixok)){
             while (strlen(copy)+1 > bufsize) {
                growbuffer(&buffer,&bufsize);
             }
             strcpy(buffer,copy);
+            if (explain.on)
+               setexplainrule("plural of", buffer, 0);
             free(copy);
             return buffer;
          }
@@ -2093,7 +4176,8 @@ lookupunit(char *unit,int prefixok)
    }
    if (prefixok && (pfxptr = plookup(unit))) {
       copy = unit + pfxptr->len;
-      if (emptystr(copy) || lookupunit(copy,0)) {
+      STATCOUNT(prefixretries);
+      if (emptystr(copy) || searchunit(copy,0)) {
          char *tempbuf;
          while (strlen(pfxptr->value)+strlen(copy)+2 > bufsize){
             growbuffer(&buffer, &bufsize);
@@ -2102,6 +4186,8 @@ lookupunit(char *unit,int prefixok)
          strcpy(buffer, pfxptr->value);
          strcat(buffer, " ");
          strcat(buffer, tempbuf);
+         if (explain.on)
+            setexplainrule("prefix", pfxptr->name, !emptystr(tempbuf));
          free(tempbuf);
          return buffer;
       }
@@ -2110,10 +4196,30 @@ lookupunit(char *unit,int prefixok)
 }
 
 
-/* Points entries of product[] to the strings stored in tomove[].  
-   Leaves tomove pointing to a list of NULLUNITS.  */
+/* Names longer than this are not checked against the Bloom filter */
+#define BLOOMMAXNAME 256
 
-int
+char *
+lookupunit(char *unit,int prefixok)
+{
+   char namebuf[BLOOMMAXNAME];
+
+   STATCOUNT(lookupunit);
+   if (unitbloom.bits && strlen(unit) < BLOOMMAXNAME){
+     strcpy(namebuf, unit);
+     if (!unitmaybedefined(namebuf, prefixok)){
+       STATCOUNT(bloomrejects);
+       return 0;
+     }
+   }
+   return searchunit(unit, prefixok);
+}
+
+
+/* Points entries of product[] to the strings stored in tomove[].  
+   Leaves tomove pointing to a list of NULLUNITS.  */
+
+int
 moveproduct(char *product[], char *tomove[])
 {
    char **dest, **src;
@@ -2201,6 +4307,86 @@ divunit(struct unittype *left, struct unittype *right)
    Return values from multiple calls will be ORed together later.
  */
 
+int usereduced(struct unitlist *uptr);
+int expandreduced(struct reducedunit *red, struct unittype *theunit,
+                  char **product, int flip);
+
+/* Returns true if a slot before product in the numerator, or with flip
+   set in the denominator, of theunit is empty */
+
+int
+emptybefore(struct unittype *theunit, int flip, char **product)
+{
+   char **ptr;
+
+   for(ptr = flip ? theunit->denominator : theunit->numerator;
+       ptr < product; ptr++)
+      if (*ptr == NULLUNIT)
+         return 1;
+   return 0;
+}
+
+/* The steps that reduceentry() is recording, or NULL.  Only the steps
+   applied to the unit being reduced are recorded, not those of units
+   that the parser reduces while reading a definition. */
+
+struct stepbuffer {
+   struct unittype *unit;
+   struct reducedstep *steps;
+   int count, size;
+};
+
+THREADLOCAL struct stepbuffer *steprecord = 0;
+
+void
+recordstep(struct unittype *theunit, double factor, int divide)
+{
+   if (!steprecord || steprecord->unit != theunit)
+      return;
+   if (steprecord->count == steprecord->size){
+      steprecord->size = steprecord->size ? 2*steprecord->size : 16;
+      steprecord->steps = (struct reducedstep *)
+        realloc(steprecord->steps, steprecord->size*sizeof(struct reducedstep));
+      if (!steprecord->steps){
+         fprintf(stderr, "%s: memory allocation error (recordstep)\n",
+                 progname);
+         exit(EXIT_FAILURE);
+      }
+   }
+   steprecord->steps[steprecord->count].factor = factor;
+   steprecord->steps[steprecord->count++].divide = divide;
+}
+
+/* Multiplies the factor of theunit by factor, or divides it with flip */
+
+void
+applyfactor(struct unittype *theunit, double factor, int flip)
+{
+   if (flip)
+      theunit->factor /= factor;
+   else
+      theunit->factor *= factor;
+   recordstep(theunit, factor, flip);
+}
+
+/* Returns true if every slot of theunit other than product holds a
+   primitive unit */
+
+int
+restprimitive(struct unittype *theunit, char **product)
+{
+   struct unitlist *uptr;
+   char **ptr;
+   int i;
+
+   for(i=0;i<2;i++)
+      for(ptr = i ? theunit->denominator : theunit->numerator; *ptr; ptr++)
+         if (ptr != product && (*ptr == NULLUNIT || !(uptr = ulookup(*ptr))
+                                || !strchr(uptr->value, PRIMITIVECHAR)))
+            return 0;
+   return 1;
+}
+
 #define DIDREDUCTION (1<<0)
 #define NOREDUCTION  (1<<1)
 #define REDUCTIONERROR        (1<<2)
@@ -2211,37 +4397,84 @@ reduceproduct(struct unittype *theunit, int flip)
 
    char *toadd;
    char **product;
+   struct unitlist *uptr;
    int didsomething = NOREDUCTION;
    struct unittype newunit;
-   int ret;
+   int ret, node, i;
 
    if (flip)
       product = theunit->denominator;
    else
       product = theunit->numerator;
 
+   STATCOUNT(reduceproduct);
    for (; *product; product++) {
       for (;;) {
+         STATCOUNT(reduceiterations);
          if (!strlen(*product))
             break;
+         uptr = resolvedversion == dbversion || eagerversion == dbversion
+                  ? ulookup(*product) : 0;
+         if (uptr && uptr->resolvemark != RESOLVE_DONE
+             && resolvedversion == dbversion)
+            resolveused(uptr);
+         if (uptr && uptr->circular && resolvedversion == dbversion)
+            return REDUCTIONERROR;
+         /* The stored steps are those of reducing the unit on its own,
+            which are the steps that reducing it here would make only
+            when nothing else is left to reduce. */
+         if (!explain.on && usereduced(uptr)
+             && restprimitive(theunit, product)) {
+            didsomething = DIDREDUCTION;
+            free(*product);
+            for(i=0;i<uptr->reduced->stepcount;i++)
+               applyfactor(theunit, uptr->reduced->steps[i].factor,
+                           flip != uptr->reduced->steps[i].divide);
+            if (expandreduced(uptr->reduced, theunit, product, flip))
+               return REDUCTIONERROR;
+            continue;
+         }
+         /* Reducing the chain from the text would put each unit in
+            the first empty slot, which is this one unless an earlier
+            slot is empty. */
+         if (uptr && uptr->flattened && resolvedversion == dbversion
+             && !function_parameter && !explain.on
+             && !emptybefore(theunit, flip, product)) {
+            didsomething = DIDREDUCTION;
+            free(*product);
+            for(i=0;i<uptr->chainlen;i++)
+               applyfactor(theunit, uptr->chain[i], flip);
+            *product = uptr->target ? dupstr(uptr->target->name) : NULLUNIT;
+            continue;
+         }
+         node = explain.on ? explainstart(*product, 0) : -1;
          toadd = lookupunit(*product,1);
          if (!toadd) {
+            explainfinish(node);
             if (!irreducible)
               irreducible = dupstr(*product);
             return REDUCTIONERROR;
          }
-         if (strchr(toadd, PRIMITIVECHAR))
+         explainfound(node, toadd);
+         if (strchr(toadd, PRIMITIVECHAR)){
+            explainfinish(node);
             break;
+         }
          didsomething = DIDREDUCTION;
          if (*product != NULLUNIT) {
             free(*product);
             *product = NULLUNIT;
          }
-         if (parseunit(&newunit, toadd, 0, 0))
+         if (parseunit(&newunit, toadd, 0, 0)){
+            explainfinish(node);
             return REDUCTIONERROR;
+         }
+         explainchildren(node, &newunit);
+         recordstep(theunit, newunit.factor, flip);
          if (flip) ret=divunit(theunit,&newunit);
          else ret=multunit(theunit,&newunit);
          freeunit(&newunit);
+         explainfinish(node);
          if (ret) 
             return REDUCTIONERROR;
       }
@@ -2291,8 +4524,15 @@ reduceunit(struct unittype *theunit)
       if (!(ret & REDUCTIONERROR))
         ret |= reduceproduct(theunit, 1);
       if (ret & REDUCTIONERROR){
-         if (irreducible) 
+         if (irreducible){
+           struct unitschunk *chunk;
+
+           if (chunklist && (chunk = pendingchunk(irreducible, 1))){
+             notloadedchunk = chunk->name;
+             return E_NOTLOADED;
+           }
            return E_UNKNOWNUNIT;
+         }
          else
            return E_REDUCE;
       }
@@ -2397,3018 +4637,5369 @@ completereduce(struct unittype *unit)
 }
 
 
-/* Raise theunit to the specified power.  This function does not fill
-   in NULLUNIT gaps, which could be considered a deficiency. */
+/*
+   Eager reduction (--eager).  After loading, every unit is reduced to
+   primitive units once, in dependency order, so that the units named
+   in a definition already have a stored reduction when the definition
+   is reached.  reduceproduct() then replaces a unit by its stored
+   reduction in a single step when the rest of the unit is primitive,
+   which is when the steps recorded for the unit on its own are the
+   steps that reducing it there would make.  The stored reductions are
+   only valid for the database version and parser flags they were made
+   with.
+
+   With --jobs, the units at each depth of the dependency graph are
+   divided between worker processes, which inherit the reductions of
+   the lower levels and send theirs back through temporary files.
+   Processes are used rather than threads because the parser and the
+   reduction code keep their state in globals.
+*/
+
+struct parseflag eagerflags;    /* parser flags used by eagerreduce() */
+
+#define LEVEL_UNKNOWN -1
+#define LEVEL_ACTIVE -2
+
+int unitlevel(struct unitlist *uptr);
+
+void
+leveldependency(char *name, void *data)
+{
+  struct unitlist *uptr;
+  int level;
+
+  if ((uptr = findunitentry(name, 1))){
+    level = unitlevel(uptr);
+    if (level >= *(int *)data)
+      *(int *)data = level+1;
+  }
+}
+
+/* Returns the depth of a unit in the dependency graph: 0 for units
+   that depend on no other units. Cycles are cut where they are found. */
 
 int
-expunit(struct unittype *theunit, int  power)
+unitlevel(struct unitlist *uptr)
 {
-  char **numptr, **denptr;
-  double thefactor;
-  int i, uind, denlen, numlen;
+  int level = 0;
 
-  if (power==0){
-    freeunit(theunit);
-    initializeunit(theunit);
+  if (uptr->level == LEVEL_ACTIVE)
     return 0;
-  }
-  numlen=0;
-  for(numptr=theunit->numerator;*numptr;numptr++) numlen++;
-  denlen=0;
-  for(denptr=theunit->denominator;*denptr;denptr++) denlen++;
-  thefactor=theunit->factor;
-  for(i=1;i<power;i++){
-    theunit->factor *= thefactor;
-    for(uind=0;uind<numlen;uind++){
-      if (theunit->numerator[uind]!=NULLUNIT){
-        if (numptr-theunit->numerator>=MAXSUBUNITS-1) {
-           *numptr=*denptr=0;
-           return E_PRODOVERFLOW;
-        }
-        *numptr++=dupstr(theunit->numerator[uind]);
-      }
-    }
-    for(uind=0;uind<denlen;uind++){
-      if (theunit->denominator[uind]!=NULLUNIT){
-        *denptr++=dupstr(theunit->denominator[uind]);
-        if (denptr-theunit->denominator>=MAXSUBUNITS-1) {
-          *numptr=*denptr=0;
-          return E_PRODOVERFLOW;
-        }
-      }   
-    }
-  }
-  *numptr=0;
-  *denptr=0;
-  return 0;
+  if (uptr->level != LEVEL_UNKNOWN)
+    return uptr->level;
+  uptr->level = LEVEL_ACTIVE;
+  if (!strchr(uptr->value, PRIMITIVECHAR))
+    foreachunitname(uptr->value, leveldependency, &level);
+  uptr->level = level;
+  return level;
 }
 
 
+/* A definition that uses '_' refers to the previous result, so its
+   reduction cannot be stored. */
+
 int
-unit2num(struct unittype *input)
+uselastunit(char *def)
 {
-  struct unittype one;
-  int err;
+  char *ptr;
 
-  initializeunit(&one);
-  if ((err=completereduce(input)))
-    return err;
-  if (compareunits(input,&one,ignore_nothing))
-    return E_NOTANUMBER;
-  freeunit(input);
+  for(ptr = strchr(def, '_'); ptr; ptr = strchr(ptr+1, '_'))
+    if (ptr == def || strchr("~;+-*/|\t\n^ ()", ptr[-1]))
+      return 1;
   return 0;
 }
 
 
-int
-unitdimless(struct unittype *input)
+void
+freereduced(struct reducedunit *red)
 {
-  struct unittype one;
-  initializeunit(&one);
-  if (compareunits(input, &one, ignore_dimless))
-    return 0;
-  freeunit(input);  /* Eliminate dimensionless units from list */
-  return 1;
+  if (red){
+    free(red->steps);
+    free(red->names);
+    free(red);
+  }
 }
-                       
 
-/* 
-   The unitroot function takes the nth root of an input unit which has
-   been completely reduced.  Returns 1 if the unit is not a power of n. 
-   Input data can contain NULLUNITs.  
-*/
 
-int 
-subunitroot(int n,char *current[], char *out[])
+/* Returns the stored name for a primitive unit, falling back to a copy
+   in the arena if the name is not in the units table, so that it is
+   freed with the database like the names of the table. */
+
+char *
+reducedname(char *name)
 {
-  char **ptr;
-  int count=0;
+  struct unitlist *uptr;
 
-  while(*current==NULLUNIT) current++;  /* skip past NULLUNIT entries */
-  ptr=current;
-  while(*ptr){
-    while(*ptr){
-      if (*ptr!=NULLUNIT){
-        if (strcmp(*current,*ptr)) break;
-        count++;
-      }
-      ptr++;
-    }
-    if (count % n != 0){  /* If not dimensionless generate error, otherwise */
-      if (!ignore_dimless(*current))    /* just skip over it */
-        return E_NOTROOT;
-    } else {
-      for(count /= n;count>0;count--) *(out++) = dupstr(*current);
-    }
-    current=ptr;
-  }
-  *out = 0;
-  return 0;
+  if ((uptr = ulookup(name)))
+    return uptr->name;
+  return arenastr(name);
 }
-  
 
-int 
-rootunit(struct unittype *inunit,int n)
+
+struct reducedunit *
+makereduced(int stepcount, int numlen, int denlen)
 {
-   struct unittype outunit;
-   int err;
+  struct reducedunit *red;
 
-   initializeunit(&outunit);
-   if ((err=completereduce(inunit)))
-     return err;
-   /* Roots of negative numbers fail in pow(), even odd roots */
-   if (inunit->factor < 0)
-     return E_NOTROOT;
-   outunit.factor = pow(inunit->factor,1.0/(double)n);
-   if ((err = subunitroot(n, inunit->numerator, outunit.numerator)))
-     return err;
-   if ((err = subunitroot(n, inunit->denominator, outunit.denominator)))
-     return err;
-   freeunit(inunit);
-   initializeunit(inunit);
-   return multunit(inunit,&outunit);
+  red = (struct reducedunit *) mymalloc(sizeof(*red), "(makereduced)");
+  red->steps = (struct reducedstep *)
+    mymalloc((stepcount+1)*sizeof(struct reducedstep), "(makereduced)");
+  red->stepcount = stepcount;
+  red->numlen = numlen;
+  red->denlen = denlen;
+  red->names = (char **) mymalloc((numlen+denlen+1)*sizeof(char *),
+                                  "(makereduced)");
+  return red;
 }
 
 
-/* Compute the inverse of a unit (1/theunit) */
+/* Reduces one unit, recording the steps applied to its factor.
+   Returns NULL if the unit cannot be reduced or its reduction should
+   not be stored. */
 
-void
-invertunit(struct unittype *theunit)
+struct reducedunit *
+reduceentry(struct unitlist *uptr)
 {
-  char **ptr, *swap;
-  int numlen, length, ind;
+  struct reducedunit *red;
+  struct unittype unit;
+  struct stepbuffer steps;
+  char **ptr;
+  int numlen=0, denlen=0, i=0, err;
 
-  theunit->factor = 1.0/theunit->factor;  
-  length=numlen=0;
-  for(ptr=theunit->denominator;*ptr;ptr++,length++);
-  for(ptr=theunit->numerator;*ptr;ptr++,numlen++);
-  if (numlen>length)
-    length=numlen;
-  for(ind=0;ind<=length;ind++){
-    swap = theunit->numerator[ind];
-    theunit->numerator[ind] = theunit->denominator[ind];
-    theunit->denominator[ind] = swap;
+  /* The slots are stored as reduceunit() leaves them, before they are
+     sorted and canceled */
+
+  if (uptr->circular || strchr(uptr->value, PRIMITIVECHAR)
+      || uselastunit(uptr->value))
+    return 0;
+  initializeunit(&unit);
+  unit.numerator[0] = dupstr(uptr->name);
+  unit.numerator[1] = 0;
+  steps.unit = &unit;
+  steps.steps = 0;
+  steps.count = steps.size = 0;
+  steprecord = &steps;
+  err = reduceunit(&unit);
+  steprecord = 0;
+  if (err){
+    free(steps.steps);
+    freeunit(&unit);
+    return 0;
   }
+  for(ptr=unit.numerator;*ptr;ptr++)
+    numlen++;
+  for(ptr=unit.denominator;*ptr;ptr++)
+    denlen++;
+  red = makereduced(steps.count, numlen, denlen);
+  if (steps.count)
+    memcpy(red->steps, steps.steps, steps.count*sizeof(struct reducedstep));
+  free(steps.steps);
+  for(ptr=unit.numerator;*ptr;ptr++)
+    red->names[i++] = *ptr == NULLUNIT ? 0 : reducedname(*ptr);
+  for(ptr=unit.denominator;*ptr;ptr++)
+    red->names[i++] = *ptr == NULLUNIT ? 0 : reducedname(*ptr);
+  red->names[i] = 0;
+  freeunit(&unit);
+  return red;
 }
 
 
+/* Returns true if the stored reduction of a unit can be used now */
+
 int
-float2rat(double y, int *p, int *q)
+usereduced(struct unitlist *uptr)
 {
-  int coef[20];           /* How long does this buffer need to be? */
-  int i,termcount,saveq;
-  double fracpart,x;
+  return uptr && uptr->reduced && eagerversion == dbversion
+    && !function_parameter
+    && eagerflags.minusminus == parserflags.minusminus
+    && eagerflags.oldstar == parserflags.oldstar;
+}
 
-  /* Compute continued fraction approximation */
 
-  x=y;
-  termcount=0;
-  while(1){
-    coef[termcount] = (int) floor(x);
-    fracpart = x-coef[termcount];
-    if (fracpart < .001 || termcount==19) break;
-    x = 1/fracpart;
-    termcount++;
-  }
+/* Adds count slots from names, NULL for an empty slot, to the end of
+   product.  Returns E_PRODOVERFLOW if they do not fit. */
 
-  /* Compress continued fraction into rational p/q */
- 
-  *p=0;
-  *q=1;
-  for(i=termcount;i>=1;i--) {
-    saveq=*q;
-    *q = coef[i] * *q + *p;
-    *p = saveq;
-  }
-  *p+=*q*coef[0];
-  return *q<MAXSUBUNITS && fabs((double)*p / (double)*q - y) < DBL_EPSILON;
+int
+appendslots(char *product[], char **names, int count)
+{
+  char **dest;
+  int i;
+
+  for(dest=product;*dest;dest++);
+  if (dest - product + count >= MAXSUBUNITS)
+    return E_PRODOVERFLOW;
+  for(i=0;i<count;i++)
+    *dest++ = names[i] ? dupstr(names[i]) : NULLUNIT;
+  *dest = 0;
+  return 0;
 }
 
 
-/* Raise a unit to a power */
+/* Puts the units of the stored reduction of a unit where reducing the
+   unit at product from its definition would leave them: the first
+   numerator slot in place of the unit, and the other slots at the ends
+   of the products.  The slots line up with those of the reduction
+   when the rest of theunit is primitive.  The steps for the factor are
+   applied separately.  Returns E_PRODOVERFLOW if a product is full. */
 
 int
-unitpower(struct unittype *base, struct unittype *exponent)
+expandreduced(struct reducedunit *red, struct unittype *theunit,
+              char **product, int flip)
 {
-  int errcode, p, q;
+  char **same = flip ? theunit->denominator : theunit->numerator;
+  char **other = flip ? theunit->numerator : theunit->denominator;
 
-  errcode = unit2num(exponent);
-  if (errcode == E_NOTANUMBER)
-    return E_DIMEXPONENT;
-  if (errcode) 
-    return errcode;
-  errcode = unit2num(base);
-  if (!errcode){                     /* Exponent base is dimensionless */
-    base->factor = pow(base->factor,exponent->factor);
-    if (errno)
-      return E_FUNC;
+  *product = red->numlen && red->names[0] ? dupstr(red->names[0]) : NULLUNIT;
+  if (red->numlen > 1
+      && appendslots(same, red->names+1, red->numlen-1))
+    return E_PRODOVERFLOW;
+  return appendslots(other, red->names+red->numlen, red->denlen);
+}
+
+
+#ifdef USE_FORK
+
+/* Writes the reductions made by a worker process as lines of the form
+   "index stepcount numlen denlen steps... slots...", with each step
+   written as '*' or '/' and the factor in hex so that it is read back
+   exactly, and '-' for an empty slot. */
+
+void
+writereduced(FILE *fp, int index, struct reducedunit *red)
+{
+  int i;
+
+  fprintf(fp, "%d %d %d %d", index, red->stepcount, red->numlen, red->denlen);
+  for(i=0;i<red->stepcount;i++)
+    fprintf(fp, " %c%a", red->steps[i].divide ? '/' : '*',
+            red->steps[i].factor);
+  for(i=0;i<red->numlen+red->denlen;i++)
+    fprintf(fp, " %s", red->names[i] ? red->names[i] : "-");
+  fputc('\n', fp);
+}
+
+
+/* Reads the reductions written by writereduced() and stores them in the
+   matching entries of list.  Returns the number of reductions read. */
+
+int
+readreduced(FILE *fp, struct unitlist **list, int count)
+{
+  char *line=0, *ptr, *end, *name;
+  int linelen=0, index, stepcount, numlen, denlen, i, j, n=0;
+  struct reducedunit *red;
+
+  while (fgetslong(&line, &linelen, fp, 0)){
+    index = strtol(line, &ptr, 10);
+    stepcount = strtol(ptr, &ptr, 10);
+    numlen = strtol(ptr, &ptr, 10);
+    denlen = strtol(ptr, &end, 10);
+    if (end == ptr || index<0 || index>=count || stepcount<0 || numlen<0
+        || denlen<0)
+      continue;
+    red = makereduced(stepcount, numlen, denlen);
+    for(i=0;i<stepcount+numlen+denlen;i++){
+      name = strtok(i ? NULL : end, " \n");
+      if (!name)
+        break;
+      if (i < stepcount){
+        if (*name != '*' && *name != '/')
+          break;
+        red->steps[i].divide = *name == '/';
+        red->steps[i].factor = strtod(name+1, 0);
+      } else
+        red->names[i-stepcount] = strcmp(name, "-") ? reducedname(name) : 0;
+    }
+    j = i<stepcount ? 0 : i-stepcount;
+    red->names[j] = 0;
+    if (i<stepcount+numlen+denlen){
+      freereduced(red);
+      continue;
+    }
+    freereduced(list[index]->reduced);
+    list[index]->reduced = red;
+    n++;
   }
-  else if (errcode==E_NOTANUMBER) {          /* Base not dimensionless */
-    if (!float2rat(exponent->factor,&p,&q)){ /* Exponent must be rational */
-      if (unitdimless(base)){
-        base->factor = pow(base->factor,exponent->factor);
-        if (errno)
-          return E_FUNC;
-      }
-      else
-        return E_IRRATIONAL_EXPONENT;
-    } else {
-      if (q!=1) {
-        errcode = rootunit(base, q);
-        if (errcode == E_NOTROOT) 
-          return E_BASE_NOTROOT;
-        if (errcode)
-          return errcode;
-      }
-      errcode = expunit(base, abs(p));
-      if (errcode)
-        return errcode;
-      if (p<0)
-        invertunit(base);
+  free(line);
+  return n;
+}
+
+
+/* Reduces list[start..end-1] using up to jobs worker processes.  Returns
+   0 on success, or 1 if the workers could not be started, in which case
+   nothing was reduced. */
+
+int
+reduceparallel(struct unitlist **list, int start, int end, int jobs)
+{
+  FILE **out;
+  pid_t *pid;
+  int i, j, status, ok = 1;
+
+  out = (FILE **) mymalloc(jobs*sizeof(FILE *), "(reduceparallel)");
+  pid = (pid_t *) mymalloc(jobs*sizeof(pid_t), "(reduceparallel)");
+  fflush(stdout);
+  fflush(stderr);
+  for(j=0;j<jobs;j++){
+    pid[j] = -1;
+    if (!(out[j] = tmpfile()))
+      ok = 0;
+  }
+  for(j=0;ok && j<jobs;j++){
+    pid[j] = fork();
+    if (pid[j] == 0){
+      struct reducedunit *red;
+      for(i=start+j;i<end;i+=jobs)
+        if ((red = reduceentry(list[i])))
+          writereduced(out[j], i, red);
+      fflush(out[j]);
+      _exit(ferror(out[j]) ? EXIT_FAILURE : EXIT_SUCCESS);
     }
-  } 
-  else return errcode;
-  return 0;
+    if (pid[j] < 0)
+      ok = 0;
+  }
+  for(j=0;j<jobs;j++)
+    if (pid[j] > 0 && (waitpid(pid[j], &status, 0) != pid[j]
+                       || !WIFEXITED(status) || WEXITSTATUS(status)))
+      ok = 0;
+  for(j=0;j<jobs;j++){
+    if (!out[j])
+      continue;
+    if (ok){
+      rewind(out[j]);
+      readreduced(out[j], list, end);
+    }
+    fclose(out[j]);
+  }
+  free(out);
+  free(pid);
+  return !ok;
 }
 
+#endif
 
-/* Old units program would give message about what each operand
-   reduced to, showing that they weren't conformable.  Can this
-   be achieved here?  */
 
 int
-addunit(struct unittype *unita, struct unittype *unitb)
+comparelevel(const void *a, const void *b)
 {
-  int err;
+  struct unitlist *ua = *(struct unitlist **)a;
+  struct unitlist *ub = *(struct unitlist **)b;
 
-  if ((err=completereduce(unita)))
-    return err;
-  if ((err=completereduce(unitb)))
-    return err;
-  if (compareunits(unita,unitb,ignore_nothing))
-    return E_BADSUM;
-  unita->factor += unitb->factor;
-  freeunit(unitb);
-  return 0;
+  if (ua->level != ub->level)
+    return ua->level < ub->level ? -1 : 1;
+  return strcmp(ua->name, ub->name);
 }
 
+/* Only levels with at least this many units are given to workers */
 
-double
-linearinterp(double  a, double b, double aval, double bval, double c)
+#define MINPARALLEL 64
+
+/* Reduces every unit in the units table and stores the results.  The
+   jobs argument gives the number of worker processes to use.  Returns
+   the number of units that were reduced. */
+
+int
+eagerreduce(int jobs)
 {
-  double lambda;
+  struct unitlist **list, *uptr;
+  int count=0, reduced=0, i, start, end;
 
-  lambda = (b-c)/(b-a);
-  return lambda*aval + (1-lambda)*bval;
+  parsealllazy();
+  eagerversion = -1;
+  for(i=0;i<HASHSIZE;i++)
+    for(uptr = utab[i]; uptr; uptr = uptr->next){
+      freereduced(uptr->reduced);
+      uptr->reduced = 0;
+      uptr->level = LEVEL_UNKNOWN;
+      count++;
+    }
+  if (!count)
+    return 0;
+  list = (struct unitlist **) mymalloc(count*sizeof(*list), "(eagerreduce)");
+  count = 0;
+  for(i=0;i<HASHSIZE;i++)
+    for(uptr = utab[i]; uptr; uptr = uptr->next){
+      unitlevel(uptr);
+      list[count++] = uptr;
+    }
+  qsort(list, count, sizeof(*list), comparelevel);
+
+  /* The stored reductions are used while reducing the next level */
+
+  eagerversion = dbversion;
+  eagerflags = parserflags;
+  for(start=0;start<count;start=end){
+    for(end=start;end<count && list[end]->level==list[start]->level;end++);
+#ifdef USE_FORK
+    if (jobs > 1 && end-start >= MINPARALLEL
+        && !reduceparallel(list, start, end, jobs))
+      continue;
+#endif
+    for(i=start;i<end;i++)
+      list[i]->reduced = reduceentry(list[i]);
+  }
+  for(i=0;i<count;i++)
+    if (list[i]->reduced)
+      reduced++;
+  free(list);
+  return reduced;
 }
 
 
-/* evaluate a user function */
+#ifdef BUILTIN_UNITS
 
-#define INVERSE 1
-#define FUNCTION 0
-#define ALLERR 1
-#define NORMALERR 0
+/*
+   Uses the resolution, and with reduce set the reductions, that
+   unitsgen stored for the built-in database instead of running
+   resolveunits() and eagerreduce().  This is only possible when the
+   tables hold exactly the definitions that unitsgen loaded, which is
+   checked by comparing every final definition, and the parser flags
+   are the same.  Returns 1 if the stored data was used.
+*/
 
 int
-evalfunc(struct unittype *theunit, struct func *infunc, int inverse, 
-         int allerrors)
+usebuiltin(int reduce)
 {
-   struct unittype result;
-   struct functype *thefunc;
-   int err;
-   double value;
-   int foundit, count;
-   struct unittype *save_value;
-   char *save_function;
+  const struct builtinreduction *br;
+  const struct func *source;
+  struct unitlist **entries, *uptr;
+  struct prefixlist *pptr;
+  struct func *funcptr;
+  struct reducedunit *red;
+  int i, j, count;
 
-   if (infunc->table) {  /* Tables are short, so use dumb search algorithm */
-     err = parseunit(&result, infunc->tableunit, 0, 0);
-     if (err)
-       return E_BADFUNCDIMEN;
-     if (inverse){
-       err = divunit(theunit, &result);
-       if (err)
-         return err;
-       err = unit2num(theunit);
-       if (err==E_NOTANUMBER)
-         return E_BADFUNCARG;
-       if (err)
-         return err;
-       value = theunit->factor;
-       foundit=0;
-       for(count=0;count<infunc->tablelen-1;count++)
-         if ((infunc->table[count].value<=value &&
-              value<=infunc->table[count+1].value) ||
-             (infunc->table[count+1].value<=value &&
-              value<=infunc->table[count].value)){
-           foundit=1;
-           value  = linearinterp(infunc->table[count].value,
-                                 infunc->table[count+1].value,
-                                 infunc->table[count].location,
-                                 infunc->table[count+1].location,
-                                 value);
-           break;
-         }
-       if (!foundit)
-         return E_NOTINDOMAIN;
-       freeunit(&result);
-       freeunit(theunit);
-       theunit->factor = value;
-       return 0;
-     } else {
-       err=unit2num(theunit);
-       if (err)
-         return err;
-       value=theunit->factor;
-       foundit=0;
-       for(count=0;count<infunc->tablelen-1;count++)
-         if (infunc->table[count].location<=value &&
-             value<=infunc->table[count+1].location){
-           foundit=1;
-           value =  linearinterp(infunc->table[count].location,
-                        infunc->table[count+1].location,
-                        infunc->table[count].value,
-                        infunc->table[count+1].value,
-                        value);
-           break;
-         } 
-       if (!foundit)
-         return E_NOTINDOMAIN;
-       result.factor *= value;
-     }
-   } else {  /* it's a function */
-     if (inverse){
-       thefunc=&(infunc->inverse);
-       if (!thefunc->def)
-         return E_NOINVERSE;
-     }
-     else
-       thefunc=&(infunc->forward);
-     err = completereduce(theunit);
-     if (err)
-       return err;
-     if (thefunc->dimen){
-       err = parseunit(&result, thefunc->dimen, 0, 0);
-       if (err)
-         return E_BADFUNCDIMEN;
-       err = completereduce(&result);
-       if (err)
-         return E_BADFUNCDIMEN;
-       if (compareunits(&result, theunit, ignore_nothing))
-         return E_BADFUNCARG;
-       value = theunit->factor/result.factor;
-     } else 
-       value = theunit->factor;
-     if (thefunc->domain_max && 
-         (value > *thefunc->domain_max || 
-          (thefunc->domain_max_open && value == *thefunc->domain_max)))
-       return E_NOTINDOMAIN;
-     if (thefunc->domain_min && 
-         (value < *thefunc->domain_min ||
-          (thefunc->domain_min_open && value == *thefunc->domain_min)))
-       return E_NOTINDOMAIN;
-     save_value = parameter_value;
-     save_function = function_parameter;
-     parameter_value = theunit;
-     function_parameter = thefunc->param;
-     err = parseunit(&result, thefunc->def, 0,0);
-     function_parameter = save_function;
-     parameter_value = save_value;
-     if (err && (allerrors == ALLERR || err==E_PARSEMEM || err==E_PRODOVERFLOW 
-                 || err==E_NOTROOT || err==E_BADFUNCTYPE))
-       return err;
-     if (err)
-       return E_FUNARGDEF;
-   }
-   freeunit(theunit);
-   initializeunit(theunit);
-   multunit(theunit, &result);
-   return 0;
+  if (!builtinresolved || unitindex.count != builtinunitcount
+      || builtinflags.minusminus != parserflags.minusminus
+      || builtinflags.oldstar != parserflags.oldstar)
+    return 0;
+  for(count=0,i=0;i<SIMPLEHASHSIZE;i++)
+    for(pptr=ptab[i];pptr;pptr=pptr->next)
+      count++;
+  if (count != builtinprefixcount)
+    return 0;
+  for(count=0,i=0;i<SIMPLEHASHSIZE;i++)
+    for(funcptr=ftab[i];funcptr;funcptr=funcptr->next)
+      count++;
+  if (count != builtinfunctioncount)
+    return 0;
+  for(i=0;i<builtinprefixcount;i++){
+    pptr = plookup(builtinprefixes[i].name);
+    if (!pptr || strcmp(pptr->name, builtinprefixes[i].name)
+        || strcmp(pptr->value, builtinprefixes[i].value))
+      return 0;
+  }
+  for(i=0;i<builtinfunctioncount;i++){
+    source = builtinfunctions + builtinfunctionentries[i].function;
+    funcptr = fnlookup(builtinfunctionentries[i].name);
+    if (!funcptr || funcptr->table != source->table
+        || (!source->table && funcptr->forward.def != source->forward.def))
+      return 0;
+  }
+  entries = (struct unitlist **)
+    mymalloc(builtinunitcount*sizeof(*entries), "(usebuiltin)");
+  for(i=0;i<builtinunitcount;i++){
+    entries[i] = ulookup(builtinunits[i].name);
+    if (!entries[i] || strcmp(entries[i]->value, builtinunits[i].value)){
+      free(entries);
+      return 0;
+    }
+  }
+  for(i=0;i<builtinunitcount;i++){
+    uptr = entries[i];
+    uptr->flattened = builtinunits[i].flattened;
+    uptr->chain = (double *) (builtinchains + builtinunits[i].chain);
+    uptr->chainlen = builtinunits[i].chainlen;
+    uptr->target = builtinunits[i].target<0 ? 0 : entries[builtinunits[i].target];
+    uptr->circular = 0;
+    uptr->resolvemark = RESOLVE_DONE;
+  }
+  resolvedversion = dbversion;
+  if (reduce){
+    for(i=0;i<builtinunitcount;i++){
+      uptr = entries[i];
+      freereduced(uptr->reduced);
+      uptr->reduced = 0;
+      if (builtinunits[i].reduced < 0)
+        continue;
+      br = builtinreductions + builtinunits[i].reduced;
+      red = makereduced(br->stepcount, br->numlen, br->denlen);
+      for(j=0;j<br->stepcount;j++){
+        red->steps[j].factor = builtinsteps[br->steps+j].factor;
+        red->steps[j].divide = builtinsteps[br->steps+j].divide;
+      }
+      for(j=0;j<br->numlen+br->denlen;j++)
+        red->names[j] = builtinreducednames[br->names+j] < 0 ? 0
+          : entries[builtinreducednames[br->names+j]]->name;
+      red->names[j] = 0;
+      uptr->reduced = red;
+    }
+    eagerversion = dbversion;
+    eagerflags = parserflags;
+  }
+  free(entries);
+  return 1;
 }
 
+#endif
 
-/* 
-   If the given character string has only one unit name in it, then print out
-   the rule for that unit.  In any case, print out the reduced form for
-   the unit.
+
+/*
+   Loads the units files in the null terminated list files as
+   unitsHandler() does on its first call.  The units are resolved as
+   they are used, except with -c or with eager set, which resolve them
+   all now and also reduce them ahead of time for eager.  Returns
+   E_MEMORY or E_FILE if a file could not be read, E_BADFILE if a file
+   had errors or the definitions that were resolved are circular, and
+   0 otherwise.
+*/
+
+int
+loaddatabase(char **files, FILE *errfile,
+             int *unitcount, int *prefixcount, int *funccount, int eager)
+{
+  int err, result = 0;
+
+  for(;*files;files++){
+    tracebegin("readunits", "file", *files, (char *) 0);
+    err = readunits(*files, errfile, unitcount, prefixcount, funccount, 0);
+    traceend();
+    if (err==E_MEMORY || err==E_FILE)
+      return err;
+    if (err)
+      result = err;
+  }
+#ifdef BUILTIN_UNITS
+  if (usebuiltin(eager))
+    ;
+  else
+#endif
+  if (flags.unitcheck || eager){
+    tracebegin("resolveunits", (char *) 0);
+    if (resolveunits(errfile))
+      result = E_BADFILE;
+    traceend();
+  } else
+    resolvedversion = dbversion;   /* see resolveused() */
+  if (eager && eagerversion != dbversion){
+    tracebegin("eagerreduce", (char *) 0);
+    eagerreduce(loadjobs);
+    traceend();
+  }
+  resetstats();
+  return result;
+}
+
+
+/*
+   A long running process can pick up changes to its units files, such
+   as new currency rates from units_cur, with reloadunits().  The new
+   version is loaded into empty tables while the current one is moved
+   aside in a struct unitsdb, and it only replaces the current one if it
+   loaded without errors.  Either way the switch happens between two
+   conversions, and dbversion changes so that nothing cached from the
+   old tables is used.
 */
 
+struct unitsdb {
+  struct unitlist *utab[HASHSIZE];
+  struct prefixlist *ptab[SIMPLEHASHSIZE];
+  struct func *ftab[SIMPLEHASHSIZE];
+  struct pendingunit *pendtab[HASHSIZE];
+  struct wantalias *firstalias;
+  struct unitindex unitindex;
+  struct unitbloom unitbloom;
+  struct dbarena dbarena;
+  struct dbimage *dbimages;
+  struct dbfile *dbfiles;
+  struct unitschunk *chunklist;
+  char *notloadedchunk;
+  char *promptprefix;
+  struct parseflag eagerflags;
+  char hasLoadedUnits;
+  char resolved, eager;         /* resolveunits(), eagerreduce() are current */
+};
+
+/* Moves the current database into db and leaves empty tables */
+
 void
-showdefinition(char *unitstr, struct unittype *theunit)
+savedatabase(struct unitsdb *db)
+{
+  memcpy(db->utab, utab, sizeof(utab));
+  memcpy(db->ptab, ptab, sizeof(ptab));
+  memcpy(db->ftab, ftab, sizeof(ftab));
+  memcpy(db->pendtab, pendtab, sizeof(pendtab));
+  db->firstalias = firstalias;
+  db->unitindex = unitindex;
+  db->unitbloom = unitbloom;
+  db->dbarena = dbarena;
+  db->dbimages = dbimages;
+  db->dbfiles = dbfiles;
+  db->chunklist = chunklist;
+  db->notloadedchunk = notloadedchunk;
+  db->promptprefix = promptprefix;
+  db->eagerflags = eagerflags;
+  db->hasLoadedUnits = hasLoadedUnits;
+  db->resolved = resolvedversion == dbversion;
+  db->eager = eagerversion == dbversion;
+  promptprefix = 0;
+  cleardatabase();
+}
+
+/* Makes db the current database.  The tables must be empty. */
+
+void
+restoredatabase(struct unitsdb *db)
 {
-  logputs(deftext);
-  while((unitstr = lookupunit(unitstr,1))
-        && strspn(unitstr,digits) != strlen(unitstr)
-        && !strchr(unitstr,PRIMITIVECHAR)) {
-    tightprint(stdout,unitstr);
-    if (logfile) tightprint(logfile,unitstr);
-    logputs(" = ");
-  } 
-  showunit(theunit);
-  logputchar('\n');
+  struct wantalias *alias;
+  struct dbfile *dbf;
+
+  memcpy(utab, db->utab, sizeof(utab));
+  memcpy(ptab, db->ptab, sizeof(ptab));
+  memcpy(ftab, db->ftab, sizeof(ftab));
+  memcpy(pendtab, db->pendtab, sizeof(pendtab));
+  firstalias = db->firstalias;
+  aliaslistend = &firstalias;
+  for(alias = firstalias; alias; alias = alias->next)
+    aliaslistend = &alias->next;
+  unitindex = db->unitindex;
+  unitbloom = db->unitbloom;
+  dbarena = db->dbarena;
+  dbimages = db->dbimages;
+  dbfiles = db->dbfiles;
+  dbfilesend = &dbfiles;
+  for(dbf = dbfiles; dbf; dbf = dbf->next)
+    dbfilesend = &dbf->next;
+  chunklist = db->chunklist;
+  notloadedchunk = db->notloadedchunk;
+  if (promptprefix)
+    free(promptprefix);
+  promptprefix = db->promptprefix;
+  eagerflags = db->eagerflags;
+  hasLoadedUnits = db->hasLoadedUnits;
+  dbversion++;
+  resolvedversion = db->resolved ? dbversion : -1;
+  eagerversion = db->eager ? dbversion : -1;
 }
 
+/* Releases the current database, including the prompt it set */
 
-void 
-showfunction(struct functype *func)
+void
+discarddatabase(void)
 {
-  struct unittype unit;
-  int not_dimensionless, i;
+  freedatabase();
+  if (promptprefix)
+    free(promptprefix);
+  promptprefix = 0;
+}
 
-  if (!func->def) {
-    logputs(" is undefined");
-    return;
-  }
 
-  if (func->dimen){                       /* coverity[check_return] */
-    parseunit(&unit,func->dimen,0,0);     /* unit2num returns 0 for */
-    not_dimensionless = unit2num(&unit);  /* dimensionless units    */
-  } 
-    
-  logprintf("(%s) = %s", func->param, func->def);
-  if (func->domain_min || func->domain_max){
-    logputchar('\n');
-    for(i=strwidth(deftext);i;i--) logputchar(' ');
-    logputs("defined for ");
-    if (func->domain_min && func->domain_max) {
-      logprintf(num_format.format, *func->domain_min);
-      if (func->dimen && (not_dimensionless || unit.factor != 1)){
-        if (isdecimal(*func->dimen))
-          logputs(" *");
-        logprintf(" %s",func->dimen);
-      }
-      logputs(func->domain_min_open?" < ":" <= ");
-    }
-    logputs(func->param);
-    if (func->domain_max){
-      logputs(func->domain_max_open?" < ":" <= ");
-      logprintf(num_format.format, *func->domain_max);
-    }
-    else {
-      logputs(func->domain_min_open?" > ":" >= ");
-      logprintf(num_format.format, *func->domain_min);
-    }
-    if (func->dimen && (not_dimensionless || unit.factor != 1)){
-      if (isdecimal(*func->dimen))
-        logputs(" *");
-      logprintf(" %s",func->dimen);
-    }
-    if (!func->dimen) logputs(" (any units)");
-  } else if (func->dimen){
-    logputchar('\n');
-    for(i=strwidth(deftext);i;i--) logputchar(' ');
-    if (not_dimensionless) 
-      logprintf("%s has units %s",func->param, func->dimen);
-    else
-      logprintf("%s is dimensionless",func->param);
-  }    
-  logputchar('\n');
-}
+/* Returns true if a units file read from disk has been changed or
+   removed since it was loaded.  With update set the recorded times are
+   brought up to date, so that the same change is reported only once. */
 
-void
-showtable(struct func *fun, int inverse)
+int
+dbfileschanged(int update)
 {
-  int i;
-
-  logprintf("%sinterpolated table with points\n",deftext);
-  if (inverse){
-    int reverse, j;
-    reverse = (fun->table[0].value > fun->table[fun->tablelen-1].value);
-    for(i=0;i<fun->tablelen;i++){
-      if (reverse) j = fun->tablelen-i-1;
-      else j=i;
-      if (flags.verbose>0)
-        logputs("\t\t    ");
-      logprintf("~%s(", fun->name);
-      logprintf(num_format.format, fun->table[j].value);
-      if (isdecimal(fun->tableunit[0]))
-        logputs(" *");
-      logprintf(" %s",fun->tableunit);
-      logputs(") = ");
-      logprintf(num_format.format, fun->table[j].location);
-      logputchar('\n');
-    }
-  } else {
-    for(i=0;i<fun->tablelen;i++){
-      if (flags.verbose>0)
-        logputs("\t\t    ");
-      logprintf("%s(", fun->name);
-      logprintf(num_format.format, fun->table[i].location);
-      logputs(") = ");
-      logprintf(num_format.format, fun->table[i].value);
-      if (isdecimal(fun->tableunit[0]))
-        logputs(" *");
-      logprintf(" %s\n",fun->tableunit);
+  struct dbfile *dbf;
+  struct stat statbuf;
+  int changed = 0;
+
+  for(dbf = dbfiles; dbf; dbf = dbf->next){
+    if (dbf->builtin)
+      continue;
+    if (stat(dbf->name, &statbuf)){
+      statbuf.st_mtime = 0;
+      statbuf.st_size = 0;
     }
+    if (statbuf.st_mtime == dbf->mtime && (long) statbuf.st_size == dbf->size)
+      continue;
+    changed = 1;
+    if (!update)
+      break;
+    dbf->mtime = statbuf.st_mtime;
+    dbf->size = (long) statbuf.st_size;
   }
+  return changed;
 }
 
 
-void
-showfuncdefinition(struct func *fun, int inverse)
-{
-  if (fun->table)  /* It's a table */
-    showtable(fun, inverse);
-  else { 
-    logprintf("%s%s%s", deftext,inverse?"~":"", fun->name);
-    if (inverse)
-      showfunction(&fun->inverse);
-    else
-      showfunction(&fun->forward);
-  }
-}
-
+/*
+   Reloads the units files if any of them has changed.  The files named
+   on the command line, and any chunks loaded since, are read again in
+   their original order into a new database.  If that succeeds it
+   replaces the current one, which is then released.  If it fails the
+   current database stays in place, and the change is not tried again
+   until the files change once more.  Returns 1 if the units were
+   reloaded, 0 if nothing had changed and -1 on failure.
+*/
 
-void
-showunitlistdef(struct wantalias *alias)
+int
+reloadunits(void)
 {
-  logprintf("%sunit list, ",deftext);
-  tightprint(stdout,alias->definition);
-  if (logfile) tightprint(logfile,alias->definition);
-  logputchar('\n');
+  struct unitsdb *current, *loaded;
+  struct dbfile *dbf;
+  char **files;
+  int count, err, quiet;
+
+  if (!hasLoadedUnits || !dbfileschanged(0))
+    return 0;
+  for(count=0, dbf = dbfiles; dbf; dbf = dbf->next)
+    if (!dbf->depth)
+      count++;
+  files = (char **) mymalloc((count+1)*sizeof(char *), "(reloadunits)");
+  for(count=0, dbf = dbfiles; dbf; dbf = dbf->next)
+    if (!dbf->depth)
+      files[count++] = dbf->name;    /* stays valid in the saved arena */
+  files[count] = 0;
+  current = (struct unitsdb *) mymalloc(sizeof(*current), "(reloadunits)");
+  loaded = (struct unitsdb *) mymalloc(sizeof(*loaded), "(reloadunits)");
+  savedatabase(current);
+  quiet = flags.quiet;
+  flags.quiet = 1;              /* !message was shown on the first load */
+  err = loaddatabase(files, stderr, 0, 0, 0, current->eager);
+  flags.quiet = quiet;
+  free(files);
+  if (err){
+    discarddatabase();
+    restoredatabase(current);
+    dbfileschanged(1);
+    fprintf(stderr, "%s: units files not reloaded, keeping the "
+                    "previous units\n", progname);
+  } else {
+    savedatabase(loaded);
+    restoredatabase(current);
+    discarddatabase();
+    restoredatabase(loaded);
+  }
+  free(current);
+  free(loaded);
+  return err ? -1 : 1;
 }
 
 
-/* Show conversion to a function.  Input unit 'have' is replaced by the 
-   function inverse and completely reduced. */
+/* Raise theunit to the specified power.  This function does not fill
+   in NULLUNIT gaps, which could be considered a deficiency. */
 
 int
-showfunc(char *havestr, struct unittype *have, struct func *fun)
+expunit(struct unittype *theunit, int  power)
 {
-   int err;
-   char *dimen;
+  char **numptr, **denptr;
+  double thefactor;
+  int i, uind, denlen, numlen;
 
-   err = evalfunc(have, fun, INVERSE, NORMALERR);
-   if (!err)
-     err = completereduce(have);
-   if (err) {
-     if (err==E_BADFUNCARG){
-       logputs("conformability error");
-       if (fun->table)
-         dimen = fun->tableunit;
-       else if (fun->inverse.dimen)
-         dimen = fun->inverse.dimen;
-       else 
-         dimen = 0;
-       if (!dimen)
-         logputchar('\n');
-       else {
-         struct unittype want;
-         
-         if (emptystr(dimen))
-           dimen = "1";
-         logprintf(": conversion requires dimensions of '%s'\n",dimen);
-         if (flags.verbose==2) logprintf("\t%s = ",havestr);
-         else if (flags.verbose==1) logputchar('\t');
-         showunit(have);
-         if (flags.verbose==2) logprintf("\n\t%s = ",dimen);
-         else if (flags.verbose==1) logprintf("\n\t");
-         else logputchar('\n');            /* coverity[check_return] */
-         parseunit(&want, dimen, 0, 0);    /* coverity[check_return] */
-         completereduce(&want);         /* dimen was already checked for */
-         showunit(&want);               /* errors so no need to check here */
-         logputchar('\n');
-         }
-     } else if (err==E_NOTINDOMAIN)
-       logprintf("Value '%s' is not in the function's range\n",havestr);
-     else
-       logputs("Function evaluation error (bad function definition)\n");
-     return 1;
-   }
-   if (flags.verbose==2)
-     logprintf("\t%s = %s(", havestr, fun->inverse.param);
-   else if (flags.verbose==1) 
-     logputchar('\t');
-   showunit(have);
-   if (flags.verbose==2)
-     logputchar(')');
-   logputchar('\n');
-   return 0;
+  if (power==0){
+    freeunit(theunit);
+    initializeunit(theunit);
+    return 0;
+  }
+  numlen=0;
+  for(numptr=theunit->numerator;*numptr;numptr++) numlen++;
+  denlen=0;
+  for(denptr=theunit->denominator;*denptr;denptr++) denlen++;
+  thefactor=theunit->factor;
+  for(i=1;i<power;i++){
+    theunit->factor *= thefactor;
+    for(uind=0;uind<numlen;uind++){
+      if (theunit->numerator[uind]!=NULLUNIT){
+        if (numptr-theunit->numerator>=MAXSUBUNITS-1) {
+           *numptr=*denptr=0;
+           return E_PRODOVERFLOW;
+        }
+        *numptr++=dupstr(theunit->numerator[uind]);
+      }
+    }
+    for(uind=0;uind<denlen;uind++){
+      if (theunit->denominator[uind]!=NULLUNIT){
+        *denptr++=dupstr(theunit->denominator[uind]);
+        if (denptr-theunit->denominator>=MAXSUBUNITS-1) {
+          *numptr=*denptr=0;
+          return E_PRODOVERFLOW;
+        }
+      }   
+    }
+  }
+  *numptr=0;
+  *denptr=0;
+  return 0;
 }
 
-/* Print the conformability error message */
-
-void
-showconformabilityerr(char *havestr,struct unittype *have,
-                      char *wantstr,struct unittype *want)
-{
-  logputs("conformability error\n");
-  if (flags.verbose==2)
-    logprintf("\t%s = ",havestr);
-  else if (flags.verbose==1)
-    logputchar('\t');
-  showunit(have);
-  if (flags.verbose==2)
-    logprintf("\n\t%s = ",wantstr);
-  else if (flags.verbose==1)
-    logputs("\n\t");
-  else
-    logputchar('\n');
-  showunit(want);
-  logputchar('\n');
-} /* end showconformabilityerr */
-
 
-
-/*
-  determine whether a unit string begins with a fraction; assume it
-  does if it starts with an integer, '|', and another integer
-*/
 int
-isfract(const char *unitstr)
+unit2num(struct unittype *input)
 {
-  char *enddouble=0, *endlong=0;
+  struct unittype one;
+  int err;
 
-  while (isdigit(*unitstr))
-    unitstr++;
-  if (*unitstr++ == '|') {
-    (void)strtod(unitstr, &enddouble);
-    (void)strtol(unitstr, &endlong, 10);
-    if (enddouble == endlong)
-      return 1;
-  }
+  initializeunit(&one);
+  if ((err=completereduce(input)))
+    return err;
+  if (compareunits(input,&one,ignore_nothing))
+    return E_NOTANUMBER;
+  freeunit(input);
   return 0;
 }
 
+
 int
-checksigdigits(char *arg)
+unitdimless(struct unittype *input)
 {
-  int errors, ival;
-  char *nonum;
-
-  errors = 0;
-
-  if (!strcmp(arg, "max"))
-    num_format.precision = MAXPRECISION;
-  else {
-    ival = (int) strtol(arg, &nonum, 10);
-    if (!emptystr(nonum)) {
-      fprintf(stderr,
-      "%s: invalid significant digits (%s)--integer value or 'max' required\n",
-              progname, arg);
-      errors++;
-    }
-    else if (ival <= 0) {
-      fprintf(stderr, "%s: number of significant digits must be positive\n",
-              progname);
-      errors++;
-    }
-    else if (ival > MAXPRECISION) {
-      fprintf(stderr,
-           "%s: too many significant digits (%d)--using maximum value (%d)\n",
-           progname, ival, MAXPRECISION);
-      num_format.precision = MAXPRECISION;
-    }
-    else
-      num_format.precision = ival;
-  }
-  if (errors)
-    return -1;
-  else
+  struct unittype one;
+  initializeunit(&one);
+  if (compareunits(input, &one, ignore_dimless))
     return 0;
+  freeunit(input);  /* Eliminate dimensionless units from list */
+  return 1;
 }
+                       
 
-/* set output number format specification from significant digits and type */
+/* 
+   The unitroot function takes the nth root of an input unit which has
+   been completely reduced.  Returns 1 if the unit is not a power of n. 
+   Input data can contain NULLUNITs.  
+*/
 
-int
-setnumformat()
+int 
+subunitroot(int n,char *current[], char *out[])
 {
-  size_t len;
-
-  if (strchr("Ee", num_format.type))
-    num_format.precision--;
+  char **ptr;
+  int count=0;
 
-  len = 4;      /* %, decimal point, type, terminating NUL */
-  if (num_format.precision > 0)
-    len += (size_t) floor(log10((double) num_format.precision))+1;
-  num_format.format = (char *) mymalloc(len, "(setnumformat)");
-  sprintf(num_format.format, "%%.%d%c", num_format.precision, num_format.type);
+  while(*current==NULLUNIT) current++;  /* skip past NULLUNIT entries */
+  ptr=current;
+  while(*ptr){
+    while(*ptr){
+      if (*ptr!=NULLUNIT){
+        if (strcmp(*current,*ptr)) break;
+        count++;
+      }
+      ptr++;
+    }
+    if (count % n != 0){  /* If not dimensionless generate error, otherwise */
+      if (!ignore_dimless(*current))    /* just skip over it */
+        return E_NOTROOT;
+    } else {
+      for(count /= n;count>0;count--) *(out++) = dupstr(*current);
+    }
+    current=ptr;
+  }
+  *out = 0;
   return 0;
 }
+  
 
-/*
-    parse and validate the output number format specification and
-    extract its type and precision into the num_format structure.
-    Returns nonzero for invalid format.
-*/
-
-int
-parsenumformat()
+int 
+rootunit(struct unittype *inunit,int n)
 {
-  static char *format_types = NULL;
-  static char *format_flags = "+-# 0'";
-  static char badflag;
-  char *two = "0x1p+1";
-  char *valid="ABCDEFGHIJKLMNOPQRSTUVWXYXabcdefghijklmnopqrstuvwxyx.01234567890";
-  char *dotptr, *lptr, *nonum, *p;
-  char testbuf[80];
-  int errors, ndx;
-
-  if (format_types == NULL){
-    format_types = (char *) mymalloc(strlen(BASE_FORMATS)+4, "(parsenumformat)");
-    strcpy(format_types,BASE_FORMATS);
-
-    /* check for support of type 'F' (MS VS 2012 doesn't have it) */
-    sprintf(testbuf, "%.1F", 1.2);
-    if (strlen(testbuf) == 3 && testbuf[0] == '1' && testbuf[2] == '2')
-      strcat(format_types,"F");
+   struct unittype outunit;
+   int err;
 
-    /* check for support of hexadecimal floating point */
-    sprintf(testbuf, "%.0a", 2.0);
-    if (!strcmp(testbuf,two))
-      strcat(format_types, "aA");
+   initializeunit(&outunit);
+   if ((err=completereduce(inunit)))
+     return err;
+   /* Roots of negative numbers fail in pow(), even odd roots */
+   if (inunit->factor < 0)
+     return E_NOTROOT;
+   outunit.factor = pow(inunit->factor,1.0/(double)n);
+   if ((err = subunitroot(n, inunit->numerator, outunit.numerator)))
+     return err;
+   if ((err = subunitroot(n, inunit->denominator, outunit.denominator)))
+     return err;
+   freeunit(inunit);
+   initializeunit(inunit);
+   return multunit(inunit,&outunit);
+}
 
-    /* check for support of digit-grouping (') flag */
-    sprintf(testbuf, "%'.0f", 1234.0);
-    if (strlen(testbuf) > 2 && testbuf[0] == '1' && testbuf[2] == '2')
-      badflag = '\0'; /* supported */
-    else
-      badflag = '\''; /* not supported */
-  }
 
-  errors = 0;
+/* Compute the inverse of a unit (1/theunit) */
 
-  p = num_format.format;
+void
+invertunit(struct unittype *theunit)
+{
+  char **ptr, *swap;
+  int numlen, length, ind;
 
-  if (*p != '%') {
-    fprintf(stderr, "%s: number format specification must start with '%%'\n",
-            progname);
-    errors++;
-  }
-  else if (strrchr(num_format.format, '%') != num_format.format) {
-    fprintf(stderr, "%s: only one '%%' allowed in number format specification\n",
-            progname);
-    errors++;
-    p++;
+  theunit->factor = 1.0/theunit->factor;  
+  length=numlen=0;
+  for(ptr=theunit->denominator;*ptr;ptr++,length++);
+  for(ptr=theunit->numerator;*ptr;ptr++,numlen++);
+  if (numlen>length)
+    length=numlen;
+  for(ind=0;ind<=length;ind++){
+    swap = theunit->numerator[ind];
+    theunit->numerator[ind] = theunit->denominator[ind];
+    theunit->denominator[ind] = swap;
   }
-  else
-    p++;
+}
 
-  dotptr = strchr(num_format.format, '.');
-  if (dotptr && strrchr(num_format.format, '.') != dotptr) {
-    fprintf(stderr, "%s: only one '.' allowed in number format specification\n",
-            progname);
-    errors++;
-  }
 
-  /* skip over flags */
-  while (*p && strchr(format_flags, *p)) {
-    if (*p == badflag) {   /* only if digit-grouping flag (') not supported */
-      fprintf(stderr, "%s: digit-grouping flag (') not supported\n", progname);
-      errors++;
-    }
-    p++;
-  }
+int
+float2rat(double y, int *p, int *q)
+{
+  int coef[20];           /* How long does this buffer need to be? */
+  int i,termcount,saveq;
+  double fracpart,x;
 
-  /* check for type length modifiers, which aren't allowed */
-  if ((lptr = strstr(num_format.format, "hh"))
-     || (lptr = strstr(num_format.format, "ll"))) {
-    fprintf(stderr, "%s: type length modifier (%.2s) not supported\n", progname, lptr);
-    errors++;
-  }
-  else if ((lptr = strpbrk(num_format.format, "hjLltz"))) {
-    fprintf(stderr, "%s: type length modifier (%c) not supported\n", progname, lptr[0]);
-    errors++;
-  }
+  /* Compute continued fraction approximation */
 
-  /* check for other invalid characters */
-  ndx = strspn(p, valid);
-  if (ndx < strlen(p)) {
-    fprintf(stderr, "%s: invalid character (%c) in width, precision, or type\n",
-    progname, p[ndx]);
-    errors++;
+  x=y;
+  termcount=0;
+  while(1){
+    coef[termcount] = (int) floor(x);
+    fracpart = x-coef[termcount];
+    if (fracpart < .001 || termcount==19) break;
+    x = 1/fracpart;
+    termcount++;
   }
 
-  if (errors) { /* results of any other checks are likely to be misleading */
-    fprintf(stderr, "%s: invalid number format specification (%s)\n", 
-                    progname, num_format.format);
-    fprintf(stderr, "%s: valid specification is %%[flags][width][.precision]type\n",
-            progname);
-    return -1;
+  /* Compress continued fraction into rational p/q */
+ 
+  *p=0;
+  *q=1;
+  for(i=termcount;i>=1;i--) {
+    saveq=*q;
+    *q = coef[i] * *q + *p;
+    *p = saveq;
   }
+  *p+=*q*coef[0];
+  return *q<MAXSUBUNITS && fabs((double)*p / (double)*q - y) < DBL_EPSILON;
+}
 
-  /* get width and precision if specified; check precision */
-  num_format.width = (int) strtol(p, &nonum, 10);
 
-  if (*nonum == '.'){
-    if (isdigit(nonum[1]))
-      num_format.precision = (int) strtol(nonum+1, &nonum, 10);
-    else {
-      num_format.precision = 0;
-      nonum++;
-    }
-  }
-  else  /* precision not given--use printf() default */
-    num_format.precision = 6;
+/* Raise a unit to a power */
 
-  /* check for valid format type */
-  if (emptystr(nonum)) {
-    fprintf(stderr, "%s: missing format type\n", progname);
-    errors++;
+int
+unitpower(struct unittype *base, struct unittype *exponent)
+{
+  int errcode, p, q;
+
+  errcode = unit2num(exponent);
+  if (errcode == E_NOTANUMBER)
+    return E_DIMEXPONENT;
+  if (errcode) 
+    return errcode;
+  errcode = unit2num(base);
+  if (!errcode){                     /* Exponent base is dimensionless */
+    base->factor = pow(base->factor,exponent->factor);
+    if (errno)
+      return E_FUNC;
   }
-  else {
-    if (strchr(format_types, *nonum)) {
-      if (nonum[1]) {
-        fprintf(stderr, "%s: invalid character(s) (%s) after format type\n",
-                progname, nonum + 1);
-        errors++;
+  else if (errcode==E_NOTANUMBER) {          /* Base not dimensionless */
+    if (!float2rat(exponent->factor,&p,&q)){ /* Exponent must be rational */
+      if (unitdimless(base)){
+        base->factor = pow(base->factor,exponent->factor);
+        if (errno)
+          return E_FUNC;
       }
-      else 
-        num_format.type = *nonum;
-    }
-    else {
-      fprintf(stderr,
-              "%s: invalid format type (%c)--valid types are [%s]\n",
-              progname, *nonum, format_types);
-      errors++;
+      else
+        return E_IRRATIONAL_EXPONENT;
+    } else {
+      if (q!=1) {
+        errcode = rootunit(base, q);
+        if (errcode == E_NOTROOT) 
+          return E_BASE_NOTROOT;
+        if (errcode)
+          return errcode;
+      }
+      errcode = expunit(base, abs(p));
+      if (errcode)
+        return errcode;
+      if (p<0)
+        invertunit(base);
     }
-  }
-
-  if (num_format.precision == 0 && 
-      (num_format.type == 'G' || num_format.type == 'g'))
-    num_format.precision = 1;
-
-  if (errors) {
-    fprintf(stderr, "%s: invalid number format specification (%s)\n", 
-                    progname, num_format.format);
-    fprintf(stderr, "%s: valid specification is %%[flags][width][.precision]type\n",
-            progname);
-    return -1;
-  }
-  else
-    return 0;
+  } 
+  else return errcode;
+  return 0;
 }
 
-/*
-   round a number to the lesser of the displayed precision or the
-   remaining significant digits; indicate in hasnondigits if a number
-   will contain any character other than the digits 0-9 in the current
-   display format.
-*/
-
-double
-round_output(double value, int sigdigits, int *hasnondigits)
-{
-  int buflen;
-  char *buf;
-  double rounded;  
-  double mult_factor, rdigits;
-  int fmt_digits;       /* decimal significant digits in format */
-
-  if (!isfinite(value)){
-    if (hasnondigits)
-      *hasnondigits = 1;
-    return value;
-  }
-
-  fmt_digits = num_format.precision;
-  switch (num_format.type) {
-    case 'A':
-    case 'a':
-      sigdigits = round(sigdigits * log2(10) / 4);
-      fmt_digits++;
-      break;
-    case 'E':
-    case 'e':
-      fmt_digits++;
-      break;
-    case 'F':
-    case 'f':
-      if (fabs(value) > 0)
-        fmt_digits += ceil(log10(fabs(value)));
-      break;
-  }
-
-  if (sigdigits < fmt_digits)
-    rdigits = sigdigits;
-  else
-    rdigits = fmt_digits;
-
-  /* place all significant digits to the right of the radix */
-  if (value != 0)
-    rdigits -= ceil(log10(fabs(value)));
-  /* then handle like rounding to specified decimal places */
-  mult_factor = pow(10.0, rdigits);
-  rounded = round(value * mult_factor) / mult_factor;
-
-  /* allow for sign (1), radix (1), exponent (5), E or E formats (1), NUL */
-  buflen = num_format.precision + 9;
-
-  if (num_format.width > buflen)
-    buflen = num_format.width;
-
-  if (strchr("Ff", num_format.type)) {
-    int len=num_format.precision+2;
-    if (fabs(value) > 1.0)
-      len += (int) floor(log10(fabs(value))) + 1;
-    if (len > buflen)
-      buflen = len;
-  }
-
-  /* allocate space for thousands separators with digit-grouping (') flag */
-  /* assume worst case--that all groups are two digits */
-  if (strchr(num_format.format, '\'') && strchr("FfGg", num_format.type)) 
-    buflen = buflen*3/2;
-
-  buf = (char *) mymalloc(buflen, "(round_output)");
-  sprintf(buf, num_format.format, value);
-
-  if (hasnondigits){
-    if (strspn(buf, "1234567890") != strlen(buf))
-      *hasnondigits = 1;
-    else
-      *hasnondigits = 0;
-  }
-
-  free(buf);
-  return rounded;
-}
 
-/* 
-   Determine significant digits in remainder relative to an original
-   value which is assumed to have full double precision.  Returns
-   the number of binary or decimal digits depending on the value
-   of base, which must be 2 or 10. 
-*/
+/* Old units program would give message about what each operand
+   reduced to, showing that they weren't conformable.  Can this
+   be achieved here?  */
 
 int
-getsigdigits(double original, double remainder, int base)
+addunit(struct unittype *unita, struct unittype *unitb)
 {
-  int sigdigits;
-  double maxdigits;
-  double (*logfunc)(double);
-
-  if (base == 2) {
-    maxdigits = DBL_MANT_DIG;
-    logfunc = log2;
-  }
-  else {
-    maxdigits = DBL_MANT_DIG * log10(2.0);
-    logfunc = log10;
-  }
-
-  if (original == 0)
-    return floor(maxdigits);
-  else if (remainder == 0)
-    return 0;
-
-  sigdigits = floor(maxdigits - logfunc(fabs(original/remainder)));
-
-  if (sigdigits < 0)
-    sigdigits = 0;
+  int err;
 
-  return sigdigits;
+  if ((err=completereduce(unita)))
+    return err;
+  if ((err=completereduce(unitb)))
+    return err;
+  if (compareunits(unita,unitb,ignore_nothing))
+    return E_BADSUM;
+  unita->factor += unitb->factor;
+  freeunit(unitb);
+  return 0;
 }
 
-/* Rounds a double to the specified number of binary or decimal 
-   digits.  The base argument must be 2 or 10.  */
 
 double
-round_digits(double value, int digits, int base)
+linearinterp(double  a, double b, double aval, double bval, double c)
 {
-  double mult_factor;
-  double (*logfunc)(double);
-
-  if (digits == 0)
-    return 0.0;
-
-  if (base == 2)
-    logfunc = log2;
-  else
-    logfunc = log10;
-
-  if (value != 0)
-    digits -= ceil(logfunc(fabs(value)));
-
-  mult_factor = pow((double) base, digits);
+  double lambda;
 
-  return round(value*mult_factor)/mult_factor;
+  lambda = (b-c)/(b-a);
+  return lambda*aval + (1-lambda)*bval;
 }
 
 
-/* Returns true if the value will display as equal to the reference 
-   and if hasnondigits is non-null then return true if the displayed
-   output contains any character in "0123456789".  */
-
-int 
-displays_as(double reference, double value, int *hasnondigits)
-{
-  int buflen;
-  char *buf;
-  double rounded;  
-
-  if (!isfinite(value)){
-    if (hasnondigits)
-      *hasnondigits = 1;
-    return 0;
-  }
-  
-  /* allow for sign (1), radix (1), exponent (5), E or E formats (1), NUL */
-  buflen = num_format.precision + 9;
-
-  if (num_format.width > buflen)
-    buflen = num_format.width;
+/* evaluate a user function */
 
-  if (strchr("Ff", num_format.type)) {
-    int len=num_format.precision+2;
-    if (fabs(value) > 1.0)
-      len += (int) floor(log10(fabs(value))) + 1;
-    if (len > buflen)
-      buflen = len;
-  }
+#define INVERSE 1
+#define FUNCTION 0
+#define ALLERR 1
+#define NORMALERR 0
 
-  /* allocate space for thousands separators with digit-grouping (') flag */
-  /* assume worst case--that all groups are two digits */
-  if (strchr(num_format.format, '\'') && strchr("FfGg", num_format.type)) 
-    buflen = buflen*3/2;
+int evaluatefunc(struct unittype *theunit, struct func *infunc, int inverse,
+                 int allerrors);
 
-  buf = (char *) mymalloc(buflen, "(round_to_displayed)");
-  sprintf(buf, num_format.format, value);
+int
+evalfunc(struct unittype *theunit, struct func *infunc, int inverse, 
+         int allerrors)
+{
+   int err, node = -1;
+   char *name;
 
-  if (hasnondigits){
-    if (strspn(buf, "1234567890") != strlen(buf))
-      *hasnondigits = 1;
-    else
-      *hasnondigits = 0;
-  }
-  rounded = strtod(buf, NULL);
-  free(buf);
-  
-  return rounded==reference;
+   if (!tracing.on && !explain.on)
+     return evaluatefunc(theunit, infunc, inverse, allerrors);
+   if (explain.on){
+     name = mymalloc(strlen(infunc->name) + 2, "(evalfunc)");
+     sprintf(name, "%s%s", inverse ? "~" : "", infunc->name);
+     node = explainstart(name, 1);
+     free(name);
+   }
+   tracebegin("evalfunc", "function", infunc->name,
+              "inverse", inverse ? "yes" : (char *) 0, (char *) 0);
+   err = evaluatefunc(theunit, infunc, inverse, allerrors);
+   traceend();
+   explainfinish(node);
+   return err;
 }
 
-
-
-/* Print the unit in 'unitstr' along with any necessary punctuation.
-   The 'value' is the multiplier for the unit.  If printnum is set
-   to PRINTNUM then this value is printed, or set it to NOPRINTNUM
-   to prevent the value from being printed. 
-*/
-
-#define PRINTNUM 1
-#define NOPRINTNUM 0
-
-void
-showunitname(double value, char *unitstr, int printnum)
-{
-  int hasnondigits;     /* flag to indicate nondigits in displayed value */
-  int is_one;           /* Does the value display as 1? */
-
-  is_one = displays_as(1, value, &hasnondigits);
-
-  if (printnum && !(is_one && isdecimal(*unitstr)))
-    logprintf(num_format.format, value);
-
-  if (strpbrk(unitstr, "+-"))   /* show sums and differences of units */
-    logprintf(" (%s)", unitstr);   /* in parens */
-     /* fractional unit 1|x and multiplier is all digits and not one--   */
-     /* no space or asterisk or numerator (3|8 in instead of 3 * 1|8 in) */
-  else if (printnum && !flags.showfactor
-           && startswith(unitstr,"1|") && isfract(unitstr)
-           && !is_one && !hasnondigits)
-    logputs(unitstr+1);
-     /* multiplier is unity and unit begins with a number--no space or       */
-     /* asterisk (multiplier was not shown, and the space was already output)*/
-  else if (is_one && isdecimal(*unitstr))
-    logputs(unitstr);
-     /* unitstr begins with a non-fraction number and multiplier was */
-     /* shown--prefix a spaced asterisk */
-  else if (isdecimal(unitstr[0]))
-    logprintf(" * %s", unitstr);
-  else
-    logprintf(" %s", unitstr);
-} 
-
-
-/* Show the conversion factors or print the conformability error message */
-
 int
-showanswer(char *havestr,struct unittype *have,
-           char *wantstr,struct unittype *want)
+evaluatefunc(struct unittype *theunit, struct func *infunc, int inverse, 
+             int allerrors)
 {
-   struct unittype invhave;
-   int doingrec;  /* reciprocal conversion? */
-   char *right = NULL, *left = NULL;
-
-   doingrec=0;
-   if (compareunits(have, want, ignore_dimless)) {
-        char **src,**dest;
+   struct unittype result;
+   struct functype *thefunc;
+   int err;
+   double value;
+   int foundit, count;
+   struct unittype *save_value;
+   char *save_function;
 
-        invhave.factor=1/have->factor;
-        for(src=have->numerator,dest=invhave.denominator;*src;src++,dest++)
-           *dest=*src;
-        *dest=0;
-        for(src=have->denominator,dest=invhave.numerator;*src;src++,dest++)
-           *dest=*src;
-        *dest=0;
-        if (flags.strictconvert || compareunits(&invhave, want, ignore_dimless)){
-          showconformabilityerr(havestr, have, wantstr, want);
-          return -1;
-        }
-        if (flags.verbose>0)
-          logputchar('\t');
-        logputs("reciprocal conversion\n");
-        have=&invhave;
-        doingrec=1;
-   } 
-   if (flags.verbose==2) {
-     if (!doingrec) 
-       left=right="";
-     else if (strchr(havestr,'/')) {
-       left="1 / (";
-       right=")";
+   STATCOUNT(evalfunc);
+   if (infunc->table) {  /* Tables are short, so use dumb search algorithm */
+     err = parseunit(&result, infunc->tableunit, 0, 0);
+     if (err)
+       return E_BADFUNCDIMEN;
+     if (inverse){
+       err = divunit(theunit, &result);
+       if (!err)
+         err = unit2num(theunit);
+       if (err){
+         freeunit(&result);
+         return err==E_NOTANUMBER ? E_BADFUNCARG : err;
+       }
+       value = theunit->factor;
+       foundit=0;
+       for(count=0;count<infunc->tablelen-1;count++)
+         if ((infunc->table[count].value<=value &&
+              value<=infunc->table[count+1].value) ||
+             (infunc->table[count+1].value<=value &&
+              value<=infunc->table[count].value)){
+           foundit=1;
+           value  = linearinterp(infunc->table[count].value,
+                                 infunc->table[count+1].value,
+                                 infunc->table[count].location,
+                                 infunc->table[count+1].location,
+                                 value);
+           break;
+         }
+       freeunit(&result);
+       if (!foundit)
+         return E_NOTINDOMAIN;
+       freeunit(theunit);
+       theunit->factor = value;
+       return 0;
      } else {
-       left="1 / ";
-       right="";
+       err=unit2num(theunit);
+       if (err){
+         freeunit(&result);
+         return err;
+       }
+       value=theunit->factor;
+       foundit=0;
+       for(count=0;count<infunc->tablelen-1;count++)
+         if (infunc->table[count].location<=value &&
+             value<=infunc->table[count+1].location){
+           foundit=1;
+           value =  linearinterp(infunc->table[count].location,
+                        infunc->table[count+1].location,
+                        infunc->table[count].value,
+                        infunc->table[count+1].value,
+                        value);
+           break;
+         } 
+       if (!foundit){
+         freeunit(&result);
+         return E_NOTINDOMAIN;
+       }
+       result.factor *= value;
      }
-   }   
-
-   /* Print the first line of output. */
-
-   if (flags.verbose==2) 
-     logprintf("\t%s%s%s = ",left,havestr,right);
-   else if (flags.verbose==1)
-     logputs("\t* ");
-   if (flags.verbose==2)
-     showunitname(have->factor / want->factor, wantstr, PRINTNUM);
-   else
-     logprintf(num_format.format, have->factor / want->factor);
-
-   /* Print the second line of output. */
-
-   if (!flags.oneline){
-     if (flags.verbose==2) 
-       logprintf("\n\t%s%s%s = (1 / ",left,havestr,right);
-     else if (flags.verbose==1)
-       logputs("\n\t/ ");
-     else 
-       logputchar('\n');
-     logprintf(num_format.format, want->factor / have->factor);
-     if (flags.verbose==2) {
-       logputchar(')');
-       showunitname(0,wantstr, NOPRINTNUM); 
+   } else {  /* it's a function */
+     if (inverse){
+       thefunc=&(infunc->inverse);
+       if (!thefunc->def)
+         return E_NOINVERSE;
      }
+     else
+       thefunc=&(infunc->forward);
+     err = completereduce(theunit);
+     if (err)
+       return err;
+     if (thefunc->dimen){
+       err = parseunit(&result, thefunc->dimen, 0, 0);
+       if (err)
+         return E_BADFUNCDIMEN;
+       err = completereduce(&result);
+       if (!err && compareunits(&result, theunit, ignore_nothing))
+         err = E_BADFUNCARG;
+       else if (err)
+         err = E_BADFUNCDIMEN;
+       value = theunit->factor/result.factor;
+       freeunit(&result);
+       if (err)
+         return err;
+     } else 
+       value = theunit->factor;
+     if (thefunc->domain_max && 
+         (value > *thefunc->domain_max || 
+          (thefunc->domain_max_open && value == *thefunc->domain_max)))
+       return E_NOTINDOMAIN;
+     if (thefunc->domain_min && 
+         (value < *thefunc->domain_min ||
+          (thefunc->domain_min_open && value == *thefunc->domain_min)))
+       return E_NOTINDOMAIN;
+     save_value = parameter_value;
+     save_function = function_parameter;
+     parameter_value = theunit;
+     function_parameter = thefunc->param;
+     err = parseunit(&result, thefunc->def, 0,0);
+     function_parameter = save_function;
+     parameter_value = save_value;
+     if (err && (allerrors == ALLERR || err==E_PARSEMEM || err==E_PRODOVERFLOW 
+                 || err==E_NOTROOT || err==E_BADFUNCTYPE))
+       return err;
+     if (err)
+       return E_FUNARGDEF;
    }
-   logputchar('\n');
+   freeunit(theunit);
+   initializeunit(theunit);
+   multunit(theunit, &result);
    return 0;
 }
 
 
-/* Checks that the function definition has a valid inverse 
-   Prints a message to stdout if function has bad definition or
-   invalid inverse. 
+/* 
+   If the given character string has only one unit name in it, then print out
+   the rule for that unit.  In any case, print out the reduced form for
+   the unit.
 */
 
-#define SIGN(x) ( (x) > 0.0 ?   1 :   \
-                ( (x) < 0.0 ? (-1) :  \
-                                0 ))
-
 void
-checkfunc(struct func *infunc, int verbose)
+showdefinition(char *unitstr, struct unittype *theunit)
 {
-  struct unittype theunit, saveunit;
-  struct prefixlist *prefix;
-  int err, i;
-  double direction;
+  logputs(deftext);
+  while((unitstr = lookupunit(unitstr,1))
+        && strspn(unitstr,digits) != strlen(unitstr)
+        && !strchr(unitstr,PRIMITIVECHAR)) {
+    tightprint(stdout,unitstr);
+    if (logfile) tightprint(logfile,unitstr);
+    logputs(" = ");
+  } 
+  showunit(theunit);
+  logputchar('\n');
+}
 
-  if (infunc->skip_error_check){
-    if (verbose)
-      printf("skipped function '%s'\n", infunc->name);
+
+void 
+showfunction(struct functype *func)
+{
+  struct unittype unit;
+  int not_dimensionless, i;
+
+  if (!func->def) {
+    logputs(" is undefined");
     return;
   }
-  if (verbose)
-    printf("doing function '%s'\n", infunc->name);
-  if ((prefix=plookup(infunc->name)) 
-      && strlen(prefix->name)==strlen(infunc->name))
-    printf("Warning: '%s' defined as prefix and function\n",infunc->name);
-  if (infunc->table){
-    /* Check for valid unit for the table */
-    if (parseunit(&theunit, infunc->tableunit, 0, 0) ||
-        completereduce(&theunit))
-      printf("Table '%s' has invalid units '%s'\n",
-             infunc->name, infunc->tableunit);
-    freeunit(&theunit);
 
-    /* Check for monotonicity which is needed for unique inverses */
-    if (infunc->tablelen<=1){ 
-      printf("Table '%s' has only one data point\n", infunc->name);
-      return;
-    }
-    direction = SIGN(infunc->table[1].value -  infunc->table[0].value);
-    for(i=2;i<infunc->tablelen;i++)
-      if (SIGN(infunc->table[i].value-infunc->table[i-1].value) != direction){
-        printf("Table '%s' lacks unique inverse around entry %.8g\n",
-               infunc->name, infunc->table[i].location);
-        return;
-      }
-    return;
-  }
-  if (infunc->forward.dimen){
-    if (parseunit(&theunit, infunc->forward.dimen, 0, 0) ||
-        completereduce(&theunit)){
-      printf("Function '%s' has invalid units '%s'\n", 
-             infunc->name, infunc->forward.dimen);
-      freeunit(&theunit);
-      return;
-    }
-  } else initializeunit(&theunit); 
-  if (infunc->forward.domain_max && infunc->forward.domain_min)
-    theunit.factor *= 
-             (*infunc->forward.domain_max+*infunc->forward.domain_min)/2;
-  else if (infunc->forward.domain_max) 
-    theunit.factor = theunit.factor * *infunc->forward.domain_max - 1;
-  else if (infunc->forward.domain_min)
-    theunit.factor = theunit.factor * *infunc->forward.domain_min + 1;
-  else 
-    theunit.factor *= 7;   /* Arbitrary choice where we evaluate inverse */
-  if (infunc->forward.dimen){
-    unitcopy(&saveunit, &theunit);
-    err = evalfunc(&theunit, infunc, FUNCTION, ALLERR);
-    if (err) {
-      printf("Error in definition %s(%s) as '%s':\n",
-             infunc->name, infunc->forward.param, infunc->forward.def);
-      printf("      %s\n",errormsg[err]);
-      freeunit(&theunit);
-      freeunit(&saveunit);
-      return;
-    }
-  } else {
-#   define MAXPOWERTOCHECK 4
-    struct unittype resultunit, arbunit;
-    char unittext[9]; 
-    double factor;
-    int errors[MAXPOWERTOCHECK], errcount=0;
-    char *indent;
-
-    strcpy(unittext,"(kg K)^ ");
-    factor = theunit.factor;
-    initializeunit(&saveunit);
-    initializeunit(&resultunit);
-    for(i=0;i<MAXPOWERTOCHECK;i++){
-      lastchar(unittext) = '0'+i;
-      err = parseunit(&arbunit, unittext, 0, 0);
-      if (err) initializeunit(&arbunit);
-      arbunit.factor = factor;
-      unitcopy(&resultunit, &arbunit);
-      errors[i] = evalfunc(&resultunit, infunc, FUNCTION, ALLERR); 
-      if (errors[i]) errcount++;
-      else {
-        freeunit(&saveunit);
-        freeunit(&theunit);
-        unitcopy(&saveunit, &arbunit);
-        unitcopy(&theunit, &resultunit);
+  if (func->dimen){                       /* coverity[check_return] */
+    parseunit(&unit,func->dimen,0,0);     /* unit2num returns 0 for */
+    not_dimensionless = unit2num(&unit);  /* dimensionless units    */
+  } 
+    
+  logprintf("(%s) = %s", func->param, func->def);
+  if (func->domain_min || func->domain_max){
+    logputchar('\n');
+    for(i=strwidth(deftext);i;i--) logputchar(' ');
+    logputs("defined for ");
+    if (func->domain_min && func->domain_max) {
+      logprintf(num_format.format, *func->domain_min);
+      if (func->dimen && (not_dimensionless || unit.factor != 1)){
+        if (isdecimal(*func->dimen))
+          logputs(" *");
+        logprintf(" %s",func->dimen);
       }
-      freeunit(&resultunit);
-      freeunit(&arbunit);
+      logputs(func->domain_min_open?" < ":" <= ");
     }
-    if (!errors[0] && errcount==3) {
-      printf("Warning: function '%s(%s)' defined as '%s'\n",
-             infunc->name, infunc->forward.param, infunc->forward.def);
-      printf("         appears to require a dimensionless argument, 'units' keyword not given\n");
-      indent = "         ";
+    logputs(func->param);
+    if (func->domain_max){
+      logputs(func->domain_max_open?" < ":" <= ");
+      logprintf(num_format.format, *func->domain_max);
     }
-    else if (errcount==MAXPOWERTOCHECK) {
-      printf("Error or missing 'units' keyword in definion %s(%s) as '%s'\n",
-             infunc->name, infunc->forward.param, infunc->forward.def);
-      indent="      ";
+    else {
+      logputs(func->domain_min_open?" > ":" >= ");
+      logprintf(num_format.format, *func->domain_min);
     }
-    else if (errcount){
-      printf("Warning: function '%s(%s)' defined as '%s'\n",
-             infunc->name, infunc->forward.param, infunc->forward.def);
-      printf("         failed for some test inputs:\n");
-      indent = "         ";
+    if (func->dimen && (not_dimensionless || unit.factor != 1)){
+      if (isdecimal(*func->dimen))
+        logputs(" *");
+      logprintf(" %s",func->dimen);
     }
-    for(i=0;i<MAXPOWERTOCHECK;i++) 
-      if (errors[i]) {
-        lastchar(unittext) = '0'+i;
-        printf("%s%s(",indent,infunc->name);
-        printf(num_format.format, factor);
-        printf("%s): %s\n", unittext, errormsg[errors[i]]);
-      }
-  }
-  if (completereduce(&theunit)){
-    printf("Definition %s(%s) as '%s' is irreducible\n",
-           infunc->name, infunc->forward.param, infunc->forward.def);
-    freeunit(&theunit);
-    freeunit(&saveunit);
-    return;
+    if (!func->dimen) logputs(" (any units)");
+  } else if (func->dimen){
+    logputchar('\n');
+    for(i=strwidth(deftext);i;i--) logputchar(' ');
+    if (not_dimensionless) 
+      logprintf("%s has units %s",func->param, func->dimen);
+    else
+      logprintf("%s is dimensionless",func->param);
   }    
-  if (!(infunc->inverse.def)){
-    printf("Warning: no inverse for function '%s'\n", infunc->name);
-    freeunit(&theunit);
-    freeunit(&saveunit);
-    return;
-  }
-  err = evalfunc(&theunit, infunc, INVERSE, ALLERR);
-  if (err){
-    printf("Error in inverse ~%s(%s) as '%s':\n",
-           infunc->name,infunc->inverse.param, infunc->inverse.def);
-    printf("      %s\n",errormsg[err]);
-    freeunit(&theunit);
-    freeunit(&saveunit);
-    return;
-  }
-  divunit(&theunit, &saveunit);
-  if (unit2num(&theunit) || fabs(theunit.factor-1)>1e-12)
-    printf("Inverse is not the inverse for function '%s'\n", infunc->name);
-  freeunit(&theunit);
+  logputchar('\n');
+  if (func->dimen)
+    freeunit(&unit);
 }
 
-
-struct namedef { 
-  char *name;
-  char *def;
-};
-    
-#define CONFORMABLE 1
-#define TEXTMATCH 2
-
-void 
-addtolist(struct unittype *have, char *searchstring, char *rname, char *name, 
-               char *def, struct namedef **list, int *listsize, 
-               int *maxnamelen, int *count, int searchtype)
+void
+showtable(struct func *fun, int inverse)
 {
-  struct unittype want;
-  int len = 0;
-  int keepit = 0;
+  int i;
 
-  if (!name) 
-    return;
-  if (searchtype==CONFORMABLE){
-    initializeunit(&want);
-    if (!parseunit(&want, name,0,0) && !completereduce(&want))
-      keepit = !compareunits(have,&want,ignore_dimless);
-  } else if (searchtype == TEXTMATCH) {
-    keepit = (strstr(rname,searchstring) != NULL);
-  }
-  if (keepit){
-    if (*count==*listsize){
-      *listsize += 100;
-      *list = (struct namedef *) 
-        realloc(*list,*listsize*sizeof(struct namedef));
-      if (!*list){
-        fprintf(stderr, "%s: memory allocation error (addtolist)\n",
-                progname);  
-        exit(EXIT_FAILURE);
-      }
+  logprintf("%sinterpolated table with points\n",deftext);
+  if (inverse){
+    int reverse, j;
+    reverse = (fun->table[0].value > fun->table[fun->tablelen-1].value);
+    for(i=0;i<fun->tablelen;i++){
+      if (reverse) j = fun->tablelen-i-1;
+      else j=i;
+      if (flags.verbose>0)
+        logputs("\t\t    ");
+      logprintf("~%s(", fun->name);
+      logprintf(num_format.format, fun->table[j].value);
+      if (isdecimal(fun->tableunit[0]))
+        logputs(" *");
+      logprintf(" %s",fun->tableunit);
+      logputs(") = ");
+      logprintf(num_format.format, fun->table[j].location);
+      logputchar('\n');
+    }
+  } else {
+    for(i=0;i<fun->tablelen;i++){
+      if (flags.verbose>0)
+        logputs("\t\t    ");
+      logprintf("%s(", fun->name);
+      logprintf(num_format.format, fun->table[i].location);
+      logputs(") = ");
+      logprintf(num_format.format, fun->table[i].value);
+      if (isdecimal(fun->tableunit[0]))
+        logputs(" *");
+      logprintf(" %s\n",fun->tableunit);
     }
-    (*list)[*count].name = rname;
-    if (strchr(def, PRIMITIVECHAR))
-      (*list)[*count].def = "<primitive unit>";
-    else
-      (*list)[*count].def = def;
-    (*count)++;
-    len = strwidth(name);
-    if (len>*maxnamelen)
-          *maxnamelen = len;
   }
-  if (searchtype == CONFORMABLE)
-    freeunit(&want);
 }
 
 
-int 
-compnd(const void *a, const void *b)
+void
+showfuncdefinition(struct func *fun, int inverse)
 {
-  return strcmp(((struct namedef *)a)->name, ((struct namedef *)b)->name);
+  if (fun->table)  /* It's a table */
+    showtable(fun, inverse);
+  else { 
+    logprintf("%s%s%s", deftext,inverse?"~":"", fun->name);
+    if (inverse)
+      showfunction(&fun->inverse);
+    else
+      showfunction(&fun->forward);
+  }
 }
 
 
-int 
-screensize()
+void
+showunitlistdef(struct wantalias *alias)
 {
-   int lines = 20;      /* arbitrary but probably safe value */
+  logprintf("%sunit list, ",deftext);
+  tightprint(stdout,alias->definition);
+  if (logfile) tightprint(logfile,alias->definition);
+  logputchar('\n');
+}
 
-#if defined (_WIN32) && defined (_MSC_VER)
-   CONSOLE_SCREEN_BUFFER_INFO csbi;
 
-   if (GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &csbi))
-       lines = csbi.srWindow.Bottom - csbi.srWindow.Top + 1;
-#endif
+/* Show conversion to a function.  Input unit 'have' is replaced by the 
+   function inverse and completely reduced. */
 
-#ifdef HAVE_IOCTL
-   struct winsize ws;
-   int fd;
-   fd = open("/dev/tty", O_RDWR);
-   if (fd>=0 && ioctl(fd, TIOCGWINSZ, &ws)==0)
-     lines = ws.ws_row;
-#endif
+int
+showfunc(char *havestr, struct unittype *have, struct func *fun)
+{
+   int err;
+   char *dimen;
 
-   return lines;
+   err = evalfunc(have, fun, INVERSE, NORMALERR);
+   if (!err)
+     err = completereduce(have);
+   if (err) {
+     if (err==E_BADFUNCARG){
+       logputs("conformability error");
+       if (fun->table)
+         dimen = fun->tableunit;
+       else if (fun->inverse.dimen)
+         dimen = fun->inverse.dimen;
+       else 
+         dimen = 0;
+       if (!dimen)
+         logputchar('\n');
+       else {
+         struct unittype want;
+         
+         if (emptystr(dimen))
+           dimen = "1";
+         logprintf(": conversion requires dimensions of '%s'\n",dimen);
+         if (flags.verbose==2) logprintf("\t%s = ",havestr);
+         else if (flags.verbose==1) logputchar('\t');
+         showunit(have);
+         if (flags.verbose==2) logprintf("\n\t%s = ",dimen);
+         else if (flags.verbose==1) logprintf("\n\t");
+         else logputchar('\n');            /* coverity[check_return] */
+         parseunit(&want, dimen, 0, 0);    /* coverity[check_return] */
+         completereduce(&want);         /* dimen was already checked for */
+         showunit(&want);               /* errors so no need to check here */
+         freeunit(&want);
+         logputchar('\n');
+         }
+     } else if (err==E_NOTINDOMAIN)
+       logprintf("Value '%s' is not in the function's range\n",havestr);
+     else
+       logputs("Function evaluation error (bad function definition)\n");
+     return 1;
+   }
+   if (flags.verbose==2)
+     logprintf("\t%s = %s(", havestr, fun->inverse.param);
+   else if (flags.verbose==1) 
+     logputchar('\t');
+   showunit(have);
+   if (flags.verbose==2)
+     logputchar(')');
+   logputchar('\n');
+   return 0;
 }
 
-/*
-  determines whether the output will fit on the screen, and opens a
-  pager if it won't
-*/
-FILE *
-get_output_fp(int lines)
+/* Print the conformability error message */
+
+void
+showconformabilityerr(char *havestr,struct unittype *have,
+                      char *wantstr,struct unittype *want)
 {
-  FILE *fp = NULL;
+  logputs("conformability error\n");
+  if (flags.verbose==2)
+    logprintf("\t%s = ",havestr);
+  else if (flags.verbose==1)
+    logputchar('\t');
+  showunit(have);
+  if (flags.verbose==2)
+    logprintf("\n\t%s = ",wantstr);
+  else if (flags.verbose==1)
+    logputs("\n\t");
+  else
+    logputchar('\n');
+  showunit(want);
+  logputchar('\n');
+} /* end showconformabilityerr */
 
-  if (isatty(fileno(stdout)) && screensize() < lines) {
-    if ((fp = popen(pager, "w")) == NULL) {
-      fprintf(stderr, "%s: can't run pager '%s--'", progname, pager);
-      perror((char*) NULL);
-    }
-  }
-  if (!fp)
-    fp = stdout;
 
-  return fp;
-}
 
+/*
+  determine whether a unit string begins with a fraction; assume it
+  does if it starts with an integer, '|', and another integer
+*/
 int
-countlines(char *msg)
+isfract(const char *unitstr)
 {
-  int nlines = 0;
-  char *p;
-
-  for (p = msg; *p; p++)
-    if (*p == '\n')
-      nlines++;
+  char *enddouble=0, *endlong=0;
 
-  return nlines;
+  while (isdigit(*unitstr))
+    unitstr++;
+  if (*unitstr++ == '|') {
+    (void)strtod(unitstr, &enddouble);
+    (void)strtol(unitstr, &endlong, 10);
+    if (enddouble == endlong)
+      return 1;
+  }
+  return 0;
 }
 
-/* 
-   If have is non-NULL then search through all units and print the ones
-   which are conformable with have.  Otherwise search through all the 
-   units for ones whose names contain the second argument as a substring.
-*/
-
-void 
-tryallunits(struct unittype *have, char *searchstring)
+int
+checksigdigits(char *arg)
 {
-  struct unitlist *uptr;
-  struct namedef *list;
-  int listsize, maxnamelen, count;
-  struct func *funcptr;
-  struct wantalias *aliasptr;
-  int i, j, searchtype;
-  FILE *outfile;
-  char *seploc, *firstunit;
+  int errors, ival;
+  char *nonum;
 
-  list = (struct namedef *) mymalloc( 100 * sizeof(struct namedef), 
-                                       "(tryallunits)");
-  listsize = 100;
-  maxnamelen = 0;
-  count = 0;
+  errors = 0;
 
-  if (have)
-    searchtype = CONFORMABLE;
+  if (!strcmp(arg, "max"))
+    num_format.precision = MAXPRECISION;
   else {
-    if (!searchstring)
-      searchstring="";
-    searchtype = TEXTMATCH;
-  }
-
-  for(i=0;i<HASHSIZE;i++)
-    for (uptr = utab[i]; uptr; uptr = uptr->next)
-      addtolist(have, searchstring, uptr->name, uptr->name, uptr->value, 
-                &list, &listsize, &maxnamelen, &count, searchtype);
-  for(i=0;i<SIMPLEHASHSIZE;i++)
-    for(funcptr=ftab[i];funcptr;funcptr=funcptr->next){
-      if (funcptr->table) 
-        addtolist(have, searchstring, funcptr->name, funcptr->tableunit, 
-                "<piecewise linear>", &list, &listsize, &maxnamelen, &count, 
-                searchtype);
-      else
-        addtolist(have, searchstring, funcptr->name, funcptr->inverse.dimen, 
-                "<nonlinear>", &list, &listsize, &maxnamelen, &count, 
-                searchtype);
-  }
-  for(aliasptr=firstalias;aliasptr;aliasptr=aliasptr->next){
-    firstunit = dupstr(aliasptr->definition);/* coverity[var_assigned] */
-    seploc = strchr(firstunit,UNITSEPCHAR);  /* Alias definitions allowed in */
-    *seploc = 0;                             /* database contain UNITSEPCHAR */
-    addtolist(have, searchstring, aliasptr->name, firstunit, 
-              aliasptr->definition, &list, &listsize, &maxnamelen, &count,
-              searchtype);
-    free(firstunit);
-  }
-    
-  qsort(list, count, sizeof(struct namedef), compnd);
-
-  if (count==0)
-    puts("No matching units found.");
-#ifdef SIGPIPE
-  signal(SIGPIPE, SIG_IGN);
-#endif
-  /* see if we need a pager */
-  outfile = get_output_fp(count);
-  for(i=0;i<count;i++){
-    fputs(list[i].name,outfile);
-    if (flags.verbose > 0 || flags.interactive) {
-        for(j=strwidth(list[i].name);j<=maxnamelen;j++)
-          putc(' ',outfile);
-        tightprint(outfile,list[i].def);
+    ival = (int) strtol(arg, &nonum, 10);
+    if (!emptystr(nonum)) {
+      fprintf(stderr,
+      "%s: invalid significant digits (%s)--integer value or 'max' required\n",
+              progname, arg);
+      errors++;
     }
-    fputc('\n',outfile);
+    else if (ival <= 0) {
+      fprintf(stderr, "%s: number of significant digits must be positive\n",
+              progname);
+      errors++;
+    }
+    else if (ival > MAXPRECISION) {
+      fprintf(stderr,
+           "%s: too many significant digits (%d)--using maximum value (%d)\n",
+           progname, ival, MAXPRECISION);
+      num_format.precision = MAXPRECISION;
+    }
+    else
+      num_format.precision = ival;
   }
-  if (outfile != stdout)
-    pclose(outfile);
-#ifdef SIGPIPE
-  signal(SIGPIPE, SIG_DFL);
-#endif
+  if (errors)
+    return -1;
+  else
+    return 0;
 }
 
+/* set output number format specification from significant digits and type */
 
-/* If quiet is false then prompt user with the query.  
+int
+setnumformat()
+{
+  static char *format = 0;      /* freed when the next one is made */
+  size_t len;
 
-   Fetch one line of input and return it in *buffer.
+  if (strchr("Ee", num_format.type))
+    num_format.precision--;
 
-   The bufsize argument is a dummy argument if we are using readline. 
-   The readline version frees buffer if it is non-null.  The other
-   version keeps the same buffer and grows it as needed.
+  len = 4;      /* %, decimal point, type, terminating NUL */
+  if (num_format.precision > 0)
+    len += (size_t) floor(log10((double) num_format.precision))+1;
+  free(format);
+  num_format.format = format = (char *) mymalloc(len, "(setnumformat)");
+  sprintf(num_format.format, "%%.%d%c", num_format.precision, num_format.type);
+  return 0;
+}
 
-   If no data is read, then this function exits the program. 
+/*
+    parse and validate the output number format specification and
+    extract its type and precision into the num_format structure.
+    Returns nonzero for invalid format.
 */
 
-
-void
-getuser_noreadline(char **buffer, int *bufsize, const char *query)
+int
+parsenumformat()
 {
-#ifdef SUPPORT_UTF8
-  int valid = 0;
-  while(!valid){
-    fputs(query, stdout);
-    if (!fgetslong(buffer, bufsize, stdin,0)){
-      if (!flags.quiet)
-        putchar('\n');
-      exit(EXIT_SUCCESS);
-    }
-    replacectrlchars(*buffer);
-    valid = strwidth(*buffer)>=0;
-    if (!valid)
-      printf("Error: %s\n",invalid_utf8);
-  }
-#else
-  fputs(query, stdout);
-  if (!fgetslong(buffer, bufsize, stdin,0)){
-    if (!flags.quiet)
-      putchar('\n');
-    exit(EXIT_SUCCESS);
-  }
-  replacectrlchars(*buffer);
-#endif
-}  
+  static char *format_types = NULL;
+  static char *format_flags = "+-# 0'";
+  static char badflag;
+  char *two = "0x1p+1";
+  char *valid="ABCDEFGHIJKLMNOPQRSTUVWXYXabcdefghijklmnopqrstuvwxyx.01234567890";
+  char *dotptr, *lptr, *nonum, *p;
+  char testbuf[80];
+  int errors, ndx;
 
+  if (format_types == NULL){
+    format_types = (char *) mymalloc(strlen(BASE_FORMATS)+4, "(parsenumformat)");
+    strcpy(format_types,BASE_FORMATS);
 
-#ifndef READLINE
-#  define getuser getuser_noreadline
-#else 
-           /* we DO have readline */
-void
-getuser_readline(char **buffer, int *bufsize, const char *query)
-{
-#ifdef SUPPORT_UTF8
-  int valid = 0;
-  while (!valid){
-    if (*buffer) free(*buffer);
-    *buffer = readline(query);
-    if (*buffer)
-      replacectrlchars(*buffer);
-    if (!*buffer || strwidth(*buffer)>=0)
-        valid=1;
+    /* check for support of type 'F' (MS VS 2012 doesn't have it) */
+    sprintf(testbuf, "%.1F", 1.2);
+    if (strlen(testbuf) == 3 && testbuf[0] == '1' && testbuf[2] == '2')
+      strcat(format_types,"F");
+
+    /* check for support of hexadecimal floating point */
+    sprintf(testbuf, "%.0a", 2.0);
+    if (!strcmp(testbuf,two))
+      strcat(format_types, "aA");
+
+    /* check for support of digit-grouping (') flag */
+    sprintf(testbuf, "%'.0f", 1234.0);
+    if (strlen(testbuf) > 2 && testbuf[0] == '1' && testbuf[2] == '2')
+      badflag = '\0'; /* supported */
     else
-      printf("Error: %s\n",invalid_utf8);
-  }
-#else
-    if (*buffer) free(*buffer);
-    *buffer = readline(query);
-    if (*buffer)
-      replacectrlchars(*buffer);
-#endif
-  if (nonempty(*buffer)) add_history(*buffer);
-  if (!*buffer){
-    if (!flags.quiet)
-       putchar('\n');
-    exit(EXIT_SUCCESS);
+      badflag = '\''; /* not supported */
   }
-}
 
+  errors = 0;
 
-void
-getuser(char **buffer, int *bufsize, const char *query)
-{
-  if (flags.readline)
-    getuser_readline(buffer,bufsize,query);
+  p = num_format.format;
+
+  if (*p != '%') {
+    fprintf(stderr, "%s: number format specification must start with '%%'\n",
+            progname);
+    errors++;
+  }
+  else if (strrchr(num_format.format, '%') != num_format.format) {
+    fprintf(stderr, "%s: only one '%%' allowed in number format specification\n",
+            progname);
+    errors++;
+    p++;
+  }
   else
-    getuser_noreadline(buffer,bufsize,query);
-}
+    p++;
 
+  dotptr = strchr(num_format.format, '.');
+  if (dotptr && strrchr(num_format.format, '.') != dotptr) {
+    fprintf(stderr, "%s: only one '.' allowed in number format specification\n",
+            progname);
+    errors++;
+  }
 
-/* Unit name completion for readline.  
+  /* skip over flags */
+  while (*p && strchr(format_flags, *p)) {
+    if (*p == badflag) {   /* only if digit-grouping flag (') not supported */
+      fprintf(stderr, "%s: digit-grouping flag (') not supported\n", progname);
+      errors++;
+    }
+    p++;
+  }
 
-   Complete function names or alias names or builtin functions.  
+  /* check for type length modifiers, which aren't allowed */
+  if ((lptr = strstr(num_format.format, "hh"))
+     || (lptr = strstr(num_format.format, "ll"))) {
+    fprintf(stderr, "%s: type length modifier (%.2s) not supported\n", progname, lptr);
+    errors++;
+  }
+  else if ((lptr = strpbrk(num_format.format, "hjLltz"))) {
+    fprintf(stderr, "%s: type length modifier (%c) not supported\n", progname, lptr[0]);
+    errors++;
+  }
 
-   Complete to the end of a prefix or complete to the end of a unit.
-   If the text includes a full prefix plus part of a unit and if the
-   prefix is longer than one character then complete that compound.
-   Don't complete a prefix fragment into prefix plus anything.
-*/
-   
-#define CU_ALIAS 0
-#define CU_BUILTIN 1
-#define CU_FUNC 2
-#define CU_PREFIX 3
-#define CU_UNITS 4
-#define CU_DONE 5
+  /* check for other invalid characters */
+  ndx = strspn(p, valid);
+  if (ndx < strlen(p)) {
+    fprintf(stderr, "%s: invalid character (%c) in width, precision, or type\n",
+    progname, p[ndx]);
+    errors++;
+  }
 
-char *
-completeunits(char *text, int state)
-{
-  static int uhash, fhash, phash, checktype;
-  static struct prefixlist *curprefix, *unitprefix;
-  static struct unitlist *curunit;
-  static struct func *curfunc;
-  static struct wantalias *curalias;
-  static char **curbuiltin;
-  char *output = 0;
+  if (errors) { /* results of any other checks are likely to be misleading */
+    fprintf(stderr, "%s: invalid number format specification (%s)\n", 
+                    progname, num_format.format);
+    fprintf(stderr, "%s: valid specification is %%[flags][width][.precision]type\n",
+            progname);
+    return -1;
+  }
 
-#ifndef NO_SUPPRESS_APPEND
-  rl_completion_suppress_append = 1;
-#endif
-  
-  if (!state){     /* state == 0 means this is the first call, so initialize */
-    checktype = 0; /* start at first type */
-    fhash = uhash = phash = 0;
-    unitprefix=0; /* search for unit continuations starting with this prefix */
-    curfunc=ftab[fhash];
-    curunit=utab[uhash];
-    curprefix=ptab[phash];
-    curbuiltin = builtins;
-    curalias = firstalias;
-  }
-  while (checktype != CU_DONE){
-    if (checktype == CU_ALIAS){
-      while(curalias){
-        if (startswith(curalias->name,text))
-          output = dupstr(curalias->name);
-        curalias = curalias->next;
-        if (output) return output;
-      }
-      checktype++;
-    }
-    if (checktype == CU_BUILTIN){
-      while(*curbuiltin){
-        if (startswith(*curbuiltin,text))
-          output = dupstr(*curbuiltin);
-        curbuiltin++;
-        if (output) return output;
-      }
-      checktype++;
-    }
-    while (checktype == CU_FUNC){
-      while (!curfunc && fhash<SIMPLEHASHSIZE-1){
-        fhash++;
-        curfunc = ftab[fhash];
-      }
-      if (!curfunc) 
-        checktype++;
-      else {
-        if (startswith(curfunc->name,text))
-          output = dupstr(curfunc->name);
-        curfunc = curfunc->next;
-        if (output) return output;  
-      }
+  /* get width and precision if specified; check precision */
+  num_format.width = (int) strtol(p, &nonum, 10);
+
+  if (*nonum == '.'){
+    if (isdigit(nonum[1]))
+      num_format.precision = (int) strtol(nonum+1, &nonum, 10);
+    else {
+      num_format.precision = 0;
+      nonum++;
     }
-    while (checktype == CU_PREFIX){
-      while (!curprefix && phash<SIMPLEHASHSIZE-1){
-        phash++;
-        curprefix = ptab[phash];
-      }
-      if (!curprefix)
-        checktype++;
-      else {
-        if (startswith(curprefix->name,text))
-          output = dupstr(curprefix->name);
-        curprefix = curprefix->next;
-        if (output) return output;
+  }
+  else  /* precision not given--use printf() default */
+    num_format.precision = 6;
+
+  /* check for valid format type */
+  if (emptystr(nonum)) {
+    fprintf(stderr, "%s: missing format type\n", progname);
+    errors++;
+  }
+  else {
+    if (strchr(format_types, *nonum)) {
+      if (nonum[1]) {
+        fprintf(stderr, "%s: invalid character(s) (%s) after format type\n",
+                progname, nonum + 1);
+        errors++;
       }
+      else 
+        num_format.type = *nonum;
     }
-    while (checktype == CU_UNITS){    
-      while (!curunit && uhash<HASHSIZE-1){
-        uhash++;
-        curunit = utab[uhash];
-      }
-      /* If we're done with the units go through them again with */
-      /* the largest possible prefix stripped off */
-      if (!curunit && !unitprefix 
-            && (unitprefix = plookup(text)) && strlen(unitprefix->name)>1){
-        uhash = 0;
-        curunit = utab[uhash];
-      }
-      if (!curunit) {
-        checktype++;
-        break;
-      }
-      if (unitprefix){
-        if (startswith(curunit->name, text+unitprefix->len)){
-          output = (char *)mymalloc(1+strlen(curunit->name)+unitprefix->len,
-                                    "(completeunits)");
-          strcpy(output, unitprefix->name);
-          strcat(output, curunit->name);
-        }       
-      } 
-      else if (startswith(curunit->name,text)) 
-        output = dupstr(curunit->name);
-      curunit=curunit->next;
-      if (output)
-        return output;
+    else {
+      fprintf(stderr,
+              "%s: invalid format type (%c)--valid types are [%s]\n",
+              progname, *nonum, format_types);
+      errors++;
     }
-  } 
-  return 0;
-}
+  }
 
-#endif /* READLINE */
+  if (num_format.precision == 0 && 
+      (num_format.type == 'G' || num_format.type == 'g'))
+    num_format.precision = 1;
 
+  if (errors) {
+    fprintf(stderr, "%s: invalid number format specification (%s)\n", 
+                    progname, num_format.format);
+    fprintf(stderr, "%s: valid specification is %%[flags][width][.precision]type\n",
+            progname);
+    return -1;
+  }
+  else
+    return 0;
+}
 
+/*
+   round a number to the lesser of the displayed precision or the
+   remaining significant digits; indicate in hasnondigits if a number
+   will contain any character other than the digits 0-9 in the current
+   display format.
+*/
 
-/* see if current directory contains an executable file */
-int
-checkcwd (char *file)
+double
+round_output(double value, int sigdigits, int *hasnondigits)
 {
-  FILE *fp;
-  char *p;
+  int buflen;
+  char *buf;
+  double rounded;  
+  double mult_factor, rdigits;
+  int fmt_digits;       /* decimal significant digits in format */
 
-  fp = openfile(file, "r");
-  if (fp){
-    fclose(fp);
-    return 1;
+  if (!isfinite(value)){
+    if (hasnondigits)
+      *hasnondigits = 1;
+    return value;
   }
-#ifdef _WIN32
-  else if (!((p = strrchr(file, '.')) && isexe(p))) {
-    char *pathname;
 
-    pathname = mymalloc(strlen(file) + strlen(EXE_EXT) + 1,
-                        "(checkcwd)");
-    strcpy(pathname, file);
-    strcat(pathname, EXE_EXT);
-    fp = openfile(pathname, "r");
-    free(pathname);
-    if (fp) {
-      fclose(fp);
-      return 1;
-    }
+  fmt_digits = num_format.precision;
+  switch (num_format.type) {
+    case 'A':
+    case 'a':
+      sigdigits = round(sigdigits * log2(10) / 4);
+      fmt_digits++;
+      break;
+    case 'E':
+    case 'e':
+      fmt_digits++;
+      break;
+    case 'F':
+    case 'f':
+      if (fabs(value) > 0)
+        fmt_digits += ceil(log10(fabs(value)));
+      break;
   }
-#endif
 
-  return 0;
+  if (sigdigits < fmt_digits)
+    rdigits = sigdigits;
+  else
+    rdigits = fmt_digits;
+
+  /* place all significant digits to the right of the radix */
+  if (value != 0)
+    rdigits -= ceil(log10(fabs(value)));
+  /* then handle like rounding to specified decimal places */
+  mult_factor = pow(10.0, rdigits);
+  rounded = round(value * mult_factor) / mult_factor;
+
+  /* allow for sign (1), radix (1), exponent (5), E or E formats (1), NUL */
+  buflen = num_format.precision + 9;
+
+  if (num_format.width > buflen)
+    buflen = num_format.width;
+
+  if (strchr("Ff", num_format.type)) {
+    int len=num_format.precision+2;
+    if (fabs(value) > 1.0)
+      len += (int) floor(log10(fabs(value))) + 1;
+    if (len > buflen)
+      buflen = len;
+  }
+
+  /* allocate space for thousands separators with digit-grouping (') flag */
+  /* assume worst case--that all groups are two digits */
+  if (strchr(num_format.format, '\'') && strchr("FfGg", num_format.type)) 
+    buflen = buflen*3/2;
+
+  buf = (char *) mymalloc(buflen, "(round_output)");
+  sprintf(buf, num_format.format, value);
+
+  if (hasnondigits){
+    if (strspn(buf, "1234567890") != strlen(buf))
+      *hasnondigits = 1;
+    else
+      *hasnondigits = 0;
+  }
+
+  free(buf);
+  return rounded;
 }
 
 /* 
-   return the last component of a pathname, and remove a .exe extension
-   if one exists.
+   Determine significant digits in remainder relative to an original
+   value which is assumed to have full double precision.  Returns
+   the number of binary or decimal digits depending on the value
+   of base, which must be 2 or 10. 
 */
 
-char *
-getprogramname(char *path)
+int
+getsigdigits(double original, double remainder, int base)
 {
-  size_t proglen;
-  char *p;
+  int sigdigits;
+  double maxdigits;
+  double (*logfunc)(double);
 
-  path = pathend(path);
+  if (base == 2) {
+    maxdigits = DBL_MANT_DIG;
+    logfunc = log2;
+  }
+  else {
+    maxdigits = DBL_MANT_DIG * log10(2.0);
+    logfunc = log10;
+  }
 
-  /* get rid of filename extensions in Windows */
-  proglen = strlen(path);
+  if (original == 0)
+    return floor(maxdigits);
+  else if (remainder == 0)
+    return 0;
 
-  if ((p = strrchr(path, '.')) && isexe(p))
-    proglen -= 4;
-  return dupnstr(path, proglen);
+  sigdigits = floor(maxdigits - logfunc(fabs(original/remainder)));
+
+  if (sigdigits < 0)
+    sigdigits = 0;
+
+  return sigdigits;
 }
 
-/*
-   Find the directory that contains the invoked executable.
-*/
+/* Rounds a double to the specified number of binary or decimal 
+   digits.  The base argument must be 2 or 10.  */
 
-char *
-getprogdir(char *progname, char **fullprogname)
+double
+round_digits(double value, int digits, int base)
 {
-  char *progdir = NULL;
-  char *p;
-
-#if defined (_WIN32) && defined (_MSC_VER)
-  char buf[FILENAME_MAX + 1];
+  double mult_factor;
+  double (*logfunc)(double);
 
-  /* get the full pathname of the current executable and be done with it */
-  /* TODO: is there way to do this with gcc? */
+  if (digits == 0)
+    return 0.0;
 
-  if (GetModuleFileName(NULL, buf, FILENAME_MAX + 1))
-    progdir = dupstr(buf);
-#endif
+  if (base == 2)
+    logfunc = log2;
+  else
+    logfunc = log10;
 
-  /* If path name is absolute or includes more than one component use it */
+  if (value != 0)
+    digits -= ceil(logfunc(fabs(value)));
 
-  if (!progdir && (isfullpath(progname) || hasdirsep(progname)))
-    progdir = dupstr(progname);
+  mult_factor = pow((double) base, digits);
 
+  return round(value*mult_factor)/mult_factor;
+}
 
-  /*
-  command.com and cmd.exe under Windows always run a program that's in the
-  current directory whether or not the current directory is in PATH, so we need
-  to check the current directory.
 
-  This could return a false positive if units is run from a Unix-like command
-  interpreter under Windows if the current directory is not in PATH but
-  contains 'units' or 'units.exe'
-  */
-#if defined (_WIN32) && !defined (_MSC_VER)
-  if (!progdir && checkcwd(progname)) 
-      progdir = dupstr(progname);
-#endif
+/* Returns true if the value will display as equal to the reference 
+   and if hasnondigits is non-null then return true if the displayed
+   output contains any character in "0123456789".  */
 
-  /* search PATH to find the executable */
-  if (!progdir) {
-    char *env;
-    env = getenv("PATH");
-    if (env) {
-      /* search PATH */
-      char *direc, *direc_end, *pathname;
-      int len;
-      FILE *fp;
+int 
+displays_as(double reference, double value, int *hasnondigits)
+{
+  int buflen;
+  char *buf;
+  double rounded;  
 
-      pathname = mymalloc(strlen(env)+strlen(progname)+strlen(EXE_EXT)+2,
-                                                         "(getprogdir)");
-      direc = env;
-      while (direc) {
-        direc_end = strchr(direc,PATHSEP);
-        if (!direc_end)
-          len = strlen(direc);
-        else 
-          len = direc_end-direc;
-        strncpy(pathname, direc, len);
-        if (len>0)
-          pathname[len++]=DIRSEP;
-        strcpy(pathname+len, progname);
-        fp = openfile(pathname, "r");
-        if (fp){
-          progdir = dupstr(pathname);
-          break;
-        }
-#ifdef _WIN32
-        /*
-          executable may or may not have '.exe' suffix, so we need to
-          look for both
-        */
-        if (!((p = strrchr(pathname, '.')) && isexe(p))) {
-          strcat(pathname, EXE_EXT);
-          fp = openfile(pathname, "r");
-          if (fp){
-            progdir = dupstr(pathname);
-            break;
-          }
-        }
-#endif
-        direc = direc_end;
-        if (direc) direc++;
-      }
-      free(pathname);
-      if (fp)
-        fclose(fp);
-    }
+  if (!isfinite(value)){
+    if (hasnondigits)
+      *hasnondigits = 1;
+    return 0;
   }
+  
+  /* allow for sign (1), radix (1), exponent (5), E or E formats (1), NUL */
+  buflen = num_format.precision + 9;
 
-  if (!progdir) {
-    fprintf(stderr, "%s: cannot find program directory\n", progname);
-    exit(EXIT_FAILURE);
+  if (num_format.width > buflen)
+    buflen = num_format.width;
+
+  if (strchr("Ff", num_format.type)) {
+    int len=num_format.precision+2;
+    if (fabs(value) > 1.0)
+      len += (int) floor(log10(fabs(value))) + 1;
+    if (len > buflen)
+      buflen = len;
   }
 
-  *fullprogname = dupstr(progdir);      /* used by printversion() */
-  p = pathend(progdir);
-  *p = '\0';  
- 
-  return progdir; 
+  /* allocate space for thousands separators with digit-grouping (') flag */
+  /* assume worst case--that all groups are two digits */
+  if (strchr(num_format.format, '\'') && strchr("FfGg", num_format.type)) 
+    buflen = buflen*3/2;
+
+  buf = (char *) mymalloc(buflen, "(round_to_displayed)");
+  sprintf(buf, num_format.format, value);
+
+  if (hasnondigits){
+    if (strspn(buf, "1234567890") != strlen(buf))
+      *hasnondigits = 1;
+    else
+      *hasnondigits = 0;
+  }
+  rounded = strtod(buf, NULL);
+  free(buf);
+  
+  return rounded==reference;
 }
 
-/*
-  find a possible data directory relative to a 'bin' directory that
-  contains the executable
-*/
 
-char *
-getdatadir()
-{
-    int progdirlen;
-    char *p;
 
-    if (isfullpath(DATADIR))
-      return DATADIR;
-    if (!progdir || emptystr(DATADIR))
-      return NULL;
-    progdirlen = strlen(progdir);
-    datadir = (char *) mymalloc(progdirlen + strlen(DATADIR) + 2,
-				"(getdatadir)");
-    strcpy(datadir, progdir);
-    if (isdirsep(progdir[progdirlen - 1]))
-      datadir[progdirlen - 1] = '\0';   /* so pathend() can work */
-    p = pathend(datadir);
-    if ((strlen(p) == 3) && (tolower(p[0]) == 'b') \
-       && (tolower(p[1]) == 'i') && (tolower(p[2]) == 'n')) {
-      p = DATADIR;
-      while (*p == '.')         /* ignore "./", "../" */
-	p++;
-      if (isdirsep(*p))
-	p++;
-      strcpy(pathend(datadir), p);
-      
-      return datadir;
-    }
-    else
-      return NULL;
-}
+/* Print the unit in 'unitstr' along with any necessary punctuation.
+   The 'value' is the multiplier for the unit.  If printnum is set
+   to PRINTNUM then this value is printed, or set it to NOPRINTNUM
+   to prevent the value from being printed. 
+*/
+
+#define PRINTNUM 1
+#define NOPRINTNUM 0
 
 void
-showfilecheck(int errnum, char *filename)
+showunitname(double value, char *unitstr, int printnum)
 {
-  if (errnum==ENOENT)
-    printf("  Checking %s\n", filename);
+  int hasnondigits;     /* flag to indicate nondigits in displayed value */
+  int is_one;           /* Does the value display as 1? */
+
+  is_one = displays_as(1, value, &hasnondigits);
+
+  if (printnum && !(is_one && isdecimal(*unitstr)))
+    logprintf(num_format.format, value);
+
+  if (strpbrk(unitstr, "+-"))   /* show sums and differences of units */
+    logprintf(" (%s)", unitstr);   /* in parens */
+     /* fractional unit 1|x and multiplier is all digits and not one--   */
+     /* no space or asterisk or numerator (3|8 in instead of 3 * 1|8 in) */
+  else if (printnum && !flags.showfactor
+           && startswith(unitstr,"1|") && isfract(unitstr)
+           && !is_one && !hasnondigits)
+    logputs(unitstr+1);
+     /* multiplier is unity and unit begins with a number--no space or       */
+     /* asterisk (multiplier was not shown, and the space was already output)*/
+  else if (is_one && isdecimal(*unitstr))
+    logputs(unitstr);
+     /* unitstr begins with a non-fraction number and multiplier was */
+     /* shown--prefix a spaced asterisk */
+  else if (isdecimal(unitstr[0]))
+    logprintf(" * %s", unitstr);
   else
-    printf("  Checking %s: %s\n", filename, strerror(errnum)); 
+    logprintf(" %s", unitstr);
+} 
+
+
+/* Show the conversion factors or print the conformability error message */
+
+int
+showanswer(char *havestr,struct unittype *have,
+           char *wantstr,struct unittype *want)
+{
+   struct unittype invhave;
+   int doingrec;  /* reciprocal conversion? */
+   char *right = NULL, *left = NULL;
+
+   doingrec=0;
+   if (compareunits(have, want, ignore_dimless)) {
+        char **src,**dest;
+
+        invhave.factor=1/have->factor;
+        for(src=have->numerator,dest=invhave.denominator;*src;src++,dest++)
+           *dest=*src;
+        *dest=0;
+        for(src=have->denominator,dest=invhave.numerator;*src;src++,dest++)
+           *dest=*src;
+        *dest=0;
+        if (flags.strictconvert || compareunits(&invhave, want, ignore_dimless)){
+          showconformabilityerr(havestr, have, wantstr, want);
+          return -1;
+        }
+        if (flags.verbose>0)
+          logputchar('\t');
+        logputs("reciprocal conversion\n");
+        have=&invhave;
+        doingrec=1;
+   } 
+   if (flags.verbose==2) {
+     if (!doingrec) 
+       left=right="";
+     else if (strchr(havestr,'/')) {
+       left="1 / (";
+       right=")";
+     } else {
+       left="1 / ";
+       right="";
+     }
+   }   
+
+   /* Print the first line of output. */
+
+   if (flags.verbose==2) 
+     logprintf("\t%s%s%s = ",left,havestr,right);
+   else if (flags.verbose==1)
+     logputs("\t* ");
+   if (flags.verbose==2)
+     showunitname(have->factor / want->factor, wantstr, PRINTNUM);
+   else
+     logprintf(num_format.format, have->factor / want->factor);
+
+   /* Print the second line of output. */
+
+   if (!flags.oneline){
+     if (flags.verbose==2) 
+       logprintf("\n\t%s%s%s = (1 / ",left,havestr,right);
+     else if (flags.verbose==1)
+       logputs("\n\t/ ");
+     else 
+       logputchar('\n');
+     logprintf(num_format.format, want->factor / have->factor);
+     if (flags.verbose==2) {
+       logputchar(')');
+       showunitname(0,wantstr, NOPRINTNUM); 
+     }
+   }
+   logputchar('\n');
+   return 0;
 }
 
+
 /*
-  On Windows, find the locale map
-  
-  If print is set to ERRMSG then display error message if the file is
-  not valid.  If print is set to SHOWFILES then display files that are
-  checked (when the filename is not a fully specified path).  If print
-  is set to NOERRMSG then do not display anything.
+   Converts numbers from havestr to wantstr without printing anything,
+   for programs that want the numbers rather than the output (see
+   convert_values() in wasmunits.c).  in[i] is a multiple of havestr,
+   or the argument if havestr names a function like tempF, and out[i]
+   is the same quantity as a multiple of wantstr, or the argument of
+   wantstr if it names a function.  An empty wantstr gives the quantity
+   as a dimensionless number.  Reciprocal conversions are not done, as
+   with --strict.
+
+   The units are parsed and reduced once for all count numbers.
+   status[i] is set to 0 or to the error code for in[i], and out[i] is
+   0 after an error.  Returns the first error code, or 0 if every
+   number was converted.
+*/
 
-  Returns filename of valid local map file or NULL if no file was found.
+static int
+convertvalue(struct unittype *have, struct func *havefunc,
+             struct unittype *want, struct func *wantfunc,
+             double in, double *out)
+{
+   struct unittype value;
+   int err;
+
+   if (havefunc){
+     initializeunit(&value);
+     value.factor = in;
+     err = evalfunc(&value, havefunc, FUNCTION, NORMALERR);
+     if (!err)
+       err = completereduce(&value);
+   } else {
+     unitcopy(&value, have);
+     value.factor *= in;
+     err = 0;
+   }
+   if (!err){
+     if (wantfunc){
+       err = evalfunc(&value, wantfunc, INVERSE, NORMALERR);
+       if (!err)
+         err = unit2num(&value);
+       *out = value.factor;
+     } else if (compareunits(&value, want, ignore_dimless))
+       err = E_NOTCONFORMABLE;
+     else
+       *out = value.factor / want->factor;
+   }
+   freeunit(&value);
+   return err;
+}
+
+int
+convertvalues(char *havestr, char *wantstr, const double *in, double *out,
+              int *status, int count)
+{
+   struct unittype have, want;
+   struct func *havefunc = 0, *wantfunc = 0;
+   double factor;
+   int err = 0, first = 0, i;
+
+   initializeunit(&have);
+   initializeunit(&want);
+   if (loadunits())
+     err = E_FILE;
+   else {
+     havefunc = fnlookup(havestr);
+     if (*wantstr)
+       wantfunc = fnlookup(wantstr);
+   }
+   if (!err && !havefunc && !(err = parseunit(&have, havestr, 0, 0)))
+     err = completereduce(&have);
+   if (!err && *wantstr && !wantfunc
+       && !(err = parseunit(&want, wantstr, 0, 0)))
+     err = completereduce(&want);
+
+   if (!err && !havefunc && !wantfunc){     /* Linear, so one factor */
+     if (compareunits(&have, &want, ignore_dimless))
+       err = E_NOTCONFORMABLE;
+     factor = have.factor / want.factor;
+     for (i = 0; i < count && !err; i++){
+       out[i] = in[i] * factor;
+       status[i] = 0;
+     }
+   } else
+     for (i = 0; i < count; i++){
+       status[i] = err ? err : convertvalue(&have, havefunc, &want, wantfunc,
+                                            in[i], out + i);
+       if (status[i]){
+         out[i] = 0;
+         if (!first)
+           first = status[i];
+       }
+     }
+   if (err && !first)
+     for (i = 0; i < count; i++){
+       status[i] = err;
+       out[i] = 0;
+     }
+   freeunit(&have);
+   freeunit(&want);
+   return first ? first : err;
+}
+
+
+/*
+   Converts a batch of numbers, each with its own pair of units, as when
+   converting the rows of a table.  have[i] and want[i] are the units of
+   in[i] and are treated as by convertvalues().  Rows that have the same
+   units as the row before are converted together, so the units are only
+   parsed again where they change.  Returns the first error code, or 0
+   if every row was converted.
+
+   With UNITS_THREADS the rows are divided between up to threads
+   threads.  They share the units database, which is not changed by
+   conversions once every definition has been parsed and resolved, so
+   that is done first if the units were loaded with --lazy.  Tracing
+   and --explain keep their records in globals, so the batch runs in
+   one thread while they are on.
 */
-#ifdef _WIN32
-char *
-findlocalemap(int print)
+
+#define MINTHREADROWS 64       /* Fewest rows worth giving a thread */
+#define THREADSTACK (512*1024) /* Room for the parser's recursion */
+
+struct batchjob {
+  char **have, **want;
+  const double *in;
+  double *out;
+  int *status;
+  int count;
+  int err;
+  int thread;                   /* set if it runs in a thread of its own */
+};
+
+static int
+samestr(char *a, char *b)
 {
-  FILE *map = NULL;
-  char *filename = NULL;
-  char *file;
+  return a == b || !strcmp(a, b);
+}
 
-  /*
-      Try the environment variable UNITSLOCALEMAP, then the #defined
-      value LOCALEMAP, then the directory containing the units
-      executable, then the directory given by datadir, and finally
-      the directory containing the units data file.
-  */
+static void
+convertrows(struct batchjob *job)
+{
+  int i, j, err;
 
-  /* check the environment variable UNITSLOCALEMAP */
-  file = getenv("UNITSLOCALEMAP");
-  if (nonempty(file)) {
-    map = openfile(file,"rt");
-    if (!map) {
-      if (print == ERRMSG) {
-        fprintf(stderr,
-                "%s: cannot open locale map '%s'\n  specified in UNITSLOCALEMAP environment variable. ",
-                progname, file);
-        perror((char *) NULL);
-      }
-      return NULL;
-    }
-    else
-      filename = dupstr(file);
+  job->err = 0;
+  for(i=0;i<job->count;i=j){
+    for(j=i+1;j<job->count && samestr(job->have[j], job->have[i])
+                           && samestr(job->want[j], job->want[i]);j++);
+    err = convertvalues(job->have[i], job->want[i], job->in + i,
+                        job->out + i, job->status + i, j - i);
+    if (err && !job->err)
+      job->err = err;
+  }
+}
+
+#ifdef UNITS_THREADS
+int sharedversion = -1;         /* dbversion when shared by convertbatch() */
+
+static void *
+batchthread(void *arg)
+{
+  convertrows((struct batchjob *) arg);
+  free(buffer);                 /* the thread's lookupunit() buffer */
+  buffer = 0;
+  bufsize = 0;
+  free(irreducible);
+  irreducible = 0;
+  return 0;
+}
+#endif
+
+int
+convertbatch(char **have, char **want, const double *in, double *out,
+             int *status, int count, int threads)
+{
+   struct batchjob job;
+#ifdef UNITS_THREADS
+   struct batchjob *jobs;
+   pthread_t *ids;
+   pthread_attr_t attr;
+   int i, rows, err;
+#endif
+
+   job.have = have;
+   job.want = want;
+   job.in = in;
+   job.out = out;
+   job.status = status;
+   job.count = count;
+   if (loadunits()){
+     convertrows(&job);         /* sets every status to E_FILE */
+     return job.err;
+   }
+#ifdef UNITS_THREADS
+   if (threads > count / MINTHREADROWS)
+     threads = count / MINTHREADROWS;
+   if (tracing.on || explain.on)
+     threads = 1;
+   if (threads > 1){
+     if (sharedversion != dbversion){
+       parsealllazy();
+       resolveunits(0);
+       sharedversion = dbversion;
+     }
+     jobs = (struct batchjob *) mymalloc(threads*sizeof(struct batchjob),
+                                         "(convertbatch)");
+     ids = (pthread_t *) mymalloc(threads*sizeof(pthread_t), "(convertbatch)");
+     pthread_attr_init(&attr);
+     pthread_attr_setstacksize(&attr, THREADSTACK);
+     for(i=0;i<threads;i++){
+       rows = count / threads + (i < count % threads);
+       jobs[i] = job;
+       jobs[i].count = rows;
+       jobs[i].thread = 0;
+       job.have += rows;
+       job.want += rows;
+       job.in += rows;
+       job.out += rows;
+       job.status += rows;
+       if (i)
+         jobs[i].thread = !pthread_create(ids+i, &attr, batchthread, jobs+i);
+     }
+     for(i=0;i<threads;i++)     /* the first share, and any that did not */
+       if (!jobs[i].thread)     /*   get a thread, run in this one */
+         convertrows(jobs+i);
+     for(i=1;i<threads;i++)
+       if (jobs[i].thread)
+         pthread_join(ids[i], 0);
+     pthread_attr_destroy(&attr);
+     for(err=0,i=0;i<threads && !err;i++)
+       err = jobs[i].err;
+     free(jobs);
+     free(ids);
+     return err;
+   }
+#endif
+   convertrows(&job);
+   return job.err;
+}
+
+
+/* Checks that the function definition has a valid inverse 
+   Prints a message to stdout if function has bad definition or
+   invalid inverse. 
+*/
+
+#define SIGN(x) ( (x) > 0.0 ?   1 :   \
+                ( (x) < 0.0 ? (-1) :  \
+                                0 ))
+
+void
+checkfunc(struct func *infunc, int verbose)
+{
+  struct unittype theunit, saveunit;
+  struct prefixlist *prefix;
+  int err, i;
+  double direction;
+
+  if (infunc->skip_error_check){
+    if (verbose)
+      printf("skipped function '%s'\n", infunc->name);
+    return;
   }
+  if (verbose)
+    printf("doing function '%s'\n", infunc->name);
+  if ((prefix=plookup(infunc->name)) 
+      && strlen(prefix->name)==strlen(infunc->name))
+    printf("Warning: '%s' defined as prefix and function\n",infunc->name);
+  if (infunc->table){
+    /* Check for valid unit for the table */
+    if (parseunit(&theunit, infunc->tableunit, 0, 0) ||
+        completereduce(&theunit))
+      printf("Table '%s' has invalid units '%s'\n",
+             infunc->name, infunc->tableunit);
+    freeunit(&theunit);
+
+    /* Check for monotonicity which is needed for unique inverses */
+    if (infunc->tablelen<=1){ 
+      printf("Table '%s' has only one data point\n", infunc->name);
+      return;
+    }
+    direction = SIGN(infunc->table[1].value -  infunc->table[0].value);
+    for(i=2;i<infunc->tablelen;i++)
+      if (SIGN(infunc->table[i].value-infunc->table[i-1].value) != direction){
+        printf("Table '%s' lacks unique inverse around entry %.8g\n",
+               infunc->name, infunc->table[i].location);
+        return;
+      }
+    return;
+  }
+  if (infunc->forward.dimen){
+    if (parseunit(&theunit, infunc->forward.dimen, 0, 0) ||
+        completereduce(&theunit)){
+      printf("Function '%s' has invalid units '%s'\n", 
+             infunc->name, infunc->forward.dimen);
+      freeunit(&theunit);
+      return;
+    }
+  } else initializeunit(&theunit); 
+  if (infunc->forward.domain_max && infunc->forward.domain_min)
+    theunit.factor *= 
+             (*infunc->forward.domain_max+*infunc->forward.domain_min)/2;
+  else if (infunc->forward.domain_max) 
+    theunit.factor = theunit.factor * *infunc->forward.domain_max - 1;
+  else if (infunc->forward.domain_min)
+    theunit.factor = theunit.factor * *infunc->forward.domain_min + 1;
+  else 
+    theunit.factor *= 7;   /* Arbitrary choice where we evaluate inverse */
+  if (infunc->forward.dimen){
+    unitcopy(&saveunit, &theunit);
+    err = evalfunc(&theunit, infunc, FUNCTION, ALLERR);
+    if (err) {
+      printf("Error in definition %s(%s) as '%s':\n",
+             infunc->name, infunc->forward.param, infunc->forward.def);
+      printf("      %s\n",errormsg[err]);
+      freeunit(&theunit);
+      freeunit(&saveunit);
+      return;
+    }
+  } else {
+#   define MAXPOWERTOCHECK 4
+    struct unittype resultunit, arbunit;
+    char unittext[9]; 
+    double factor;
+    int errors[MAXPOWERTOCHECK], errcount=0;
+    char *indent;
+
+    strcpy(unittext,"(kg K)^ ");
+    factor = theunit.factor;
+    initializeunit(&saveunit);
+    initializeunit(&resultunit);
+    for(i=0;i<MAXPOWERTOCHECK;i++){
+      lastchar(unittext) = '0'+i;
+      err = parseunit(&arbunit, unittext, 0, 0);
+      if (err) initializeunit(&arbunit);
+      arbunit.factor = factor;
+      unitcopy(&resultunit, &arbunit);
+      errors[i] = evalfunc(&resultunit, infunc, FUNCTION, ALLERR); 
+      if (errors[i]) errcount++;
+      else {
+        freeunit(&saveunit);
+        freeunit(&theunit);
+        unitcopy(&saveunit, &arbunit);
+        unitcopy(&theunit, &resultunit);
+      }
+      freeunit(&resultunit);
+      freeunit(&arbunit);
+    }
+    if (!errors[0] && errcount==3) {
+      printf("Warning: function '%s(%s)' defined as '%s'\n",
+             infunc->name, infunc->forward.param, infunc->forward.def);
+      printf("         appears to require a dimensionless argument, 'units' keyword not given\n");
+      indent = "         ";
+    }
+    else if (errcount==MAXPOWERTOCHECK) {
+      printf("Error or missing 'units' keyword in definion %s(%s) as '%s'\n",
+             infunc->name, infunc->forward.param, infunc->forward.def);
+      indent="      ";
+    }
+    else if (errcount){
+      printf("Warning: function '%s(%s)' defined as '%s'\n",
+             infunc->name, infunc->forward.param, infunc->forward.def);
+      printf("         failed for some test inputs:\n");
+      indent = "         ";
+    }
+    for(i=0;i<MAXPOWERTOCHECK;i++) 
+      if (errors[i]) {
+        lastchar(unittext) = '0'+i;
+        printf("%s%s(",indent,infunc->name);
+        printf(num_format.format, factor);
+        printf("%s): %s\n", unittext, errormsg[errors[i]]);
+      }
+  }
+  if (completereduce(&theunit)){
+    printf("Definition %s(%s) as '%s' is irreducible\n",
+           infunc->name, infunc->forward.param, infunc->forward.def);
+    freeunit(&theunit);
+    freeunit(&saveunit);
+    return;
+  }    
+  if (!(infunc->inverse.def)){
+    printf("Warning: no inverse for function '%s'\n", infunc->name);
+    freeunit(&theunit);
+    freeunit(&saveunit);
+    return;
+  }
+  err = evalfunc(&theunit, infunc, INVERSE, ALLERR);
+  if (err){
+    printf("Error in inverse ~%s(%s) as '%s':\n",
+           infunc->name,infunc->inverse.param, infunc->inverse.def);
+    printf("      %s\n",errormsg[err]);
+    freeunit(&theunit);
+    freeunit(&saveunit);
+    return;
+  }
+  divunit(&theunit, &saveunit);
+  if (unit2num(&theunit) || fabs(theunit.factor-1)>1e-12)
+    printf("Inverse is not the inverse for function '%s'\n", infunc->name);
+  freeunit(&theunit);
+}
+
+
+struct namedef { 
+  char *name;
+  char *def;
+};
+    
+#define CONFORMABLE 1
+#define TEXTMATCH 2
+
+void 
+addtolist(struct unittype *have, char *searchstring, char *rname, char *name, 
+               char *def, struct namedef **list, int *listsize, 
+               int *maxnamelen, int *count, int searchtype)
+{
+  struct unittype want;
+  int len = 0;
+  int keepit = 0;
+
+  if (!name) 
+    return;
+  if (searchtype==CONFORMABLE){
+    initializeunit(&want);
+    if (!parseunit(&want, name,0,0) && !completereduce(&want))
+      keepit = !compareunits(have,&want,ignore_dimless);
+  } else if (searchtype == TEXTMATCH) {
+    keepit = (strstr(rname,searchstring) != NULL);
+  }
+  if (keepit){
+    if (*count==*listsize){
+      *listsize += 100;
+      *list = (struct namedef *) 
+        realloc(*list,*listsize*sizeof(struct namedef));
+      if (!*list){
+        fprintf(stderr, "%s: memory allocation error (addtolist)\n",
+                progname);  
+        exit(EXIT_FAILURE);
+      }
+    }
+    (*list)[*count].name = rname;
+    if (strchr(def, PRIMITIVECHAR))
+      (*list)[*count].def = "<primitive unit>";
+    else
+      (*list)[*count].def = def;
+    (*count)++;
+    len = strwidth(name);
+    if (len>*maxnamelen)
+          *maxnamelen = len;
+  }
+  if (searchtype == CONFORMABLE)
+    freeunit(&want);
+}
+
+
+int 
+compnd(const void *a, const void *b)
+{
+  return strcmp(((struct namedef *)a)->name, ((struct namedef *)b)->name);
+}
+
+
+int 
+screensize()
+{
+   int lines = 20;      /* arbitrary but probably safe value */
+
+#if defined (_WIN32) && defined (_MSC_VER)
+   CONSOLE_SCREEN_BUFFER_INFO csbi;
+
+   if (GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &csbi))
+       lines = csbi.srWindow.Bottom - csbi.srWindow.Top + 1;
+#endif
+
+#ifdef HAVE_IOCTL
+   struct winsize ws;
+   int fd;
+   fd = open("/dev/tty", O_RDWR);
+   if (fd>=0 && ioctl(fd, TIOCGWINSZ, &ws)==0)
+     lines = ws.ws_row;
+#endif
+
+   return lines;
+}
+
+/*
+  determines whether the output will fit on the screen, and opens a
+  pager if it won't
+*/
+FILE *
+get_output_fp(int lines)
+{
+  FILE *fp = NULL;
+
+  if (isatty(fileno(stdout)) && screensize() < lines) {
+    if ((fp = popen(pager, "w")) == NULL) {
+      fprintf(stderr, "%s: can't run pager '%s--'", progname, pager);
+      perror((char*) NULL);
+    }
+  }
+  if (!fp)
+    fp = stdout;
+
+  return fp;
+}
+
+int
+countlines(char *msg)
+{
+  int nlines = 0;
+  char *p;
+
+  for (p = msg; *p; p++)
+    if (*p == '\n')
+      nlines++;
+
+  return nlines;
+}
+
+/* 
+   If have is non-NULL then search through all units and print the ones
+   which are conformable with have.  Otherwise search through all the 
+   units for ones whose names contain the second argument as a substring.
+*/
+
+void 
+tryallunits(struct unittype *have, char *searchstring)
+{
+  struct unitlist *uptr;
+  struct namedef *list;
+  int listsize, maxnamelen, count;
+  struct func *funcptr;
+  struct wantalias *aliasptr;
+  int i, j, searchtype;
+  FILE *outfile;
+  char *seploc, *firstunit;
+
+  list = (struct namedef *) mymalloc( 100 * sizeof(struct namedef), 
+                                       "(tryallunits)");
+  listsize = 100;
+  maxnamelen = 0;
+  count = 0;
+
+  if (have)
+    searchtype = CONFORMABLE;
+  else {
+    if (!searchstring)
+      searchstring="";
+    searchtype = TEXTMATCH;
+  }
+
+  parsealllazy();
+  for(i=0;i<HASHSIZE;i++)
+    for (uptr = utab[i]; uptr; uptr = uptr->next)
+      addtolist(have, searchstring, uptr->name, uptr->name, uptr->value, 
+                &list, &listsize, &maxnamelen, &count, searchtype);
+  for(i=0;i<SIMPLEHASHSIZE;i++)
+    for(funcptr=ftab[i];funcptr;funcptr=funcptr->next){
+      if (funcptr->table) 
+        addtolist(have, searchstring, funcptr->name, funcptr->tableunit, 
+                "<piecewise linear>", &list, &listsize, &maxnamelen, &count, 
+                searchtype);
+      else
+        addtolist(have, searchstring, funcptr->name, funcptr->inverse.dimen, 
+                "<nonlinear>", &list, &listsize, &maxnamelen, &count, 
+                searchtype);
+  }
+  for(aliasptr=firstalias;aliasptr;aliasptr=aliasptr->next){
+    firstunit = dupstr(aliasptr->definition);/* coverity[var_assigned] */
+    seploc = strchr(firstunit,UNITSEPCHAR);  /* Alias definitions allowed in */
+    *seploc = 0;                             /* database contain UNITSEPCHAR */
+    addtolist(have, searchstring, aliasptr->name, firstunit, 
+              aliasptr->definition, &list, &listsize, &maxnamelen, &count,
+              searchtype);
+    free(firstunit);
+  }
+    
+  qsort(list, count, sizeof(struct namedef), compnd);
+
+  if (count==0)
+    puts("No matching units found.");
+#ifdef SIGPIPE
+  signal(SIGPIPE, SIG_IGN);
+#endif
+  /* see if we need a pager */
+  outfile = get_output_fp(count);
+  for(i=0;i<count;i++){
+    fputs(list[i].name,outfile);
+    if (flags.verbose > 0 || flags.interactive) {
+        for(j=strwidth(list[i].name);j<=maxnamelen;j++)
+          putc(' ',outfile);
+        tightprint(outfile,list[i].def);
+    }
+    fputc('\n',outfile);
+  }
+  if (outfile != stdout)
+    pclose(outfile);
+#ifdef SIGPIPE
+  signal(SIGPIPE, SIG_DFL);
+#endif
+  free(list);
+}
+
+
+/* If quiet is false then prompt user with the query.  
+
+   Fetch one line of input and return it in *buffer.
+
+   The bufsize argument is a dummy argument if we are using readline. 
+   The readline version frees buffer if it is non-null.  The other
+   version keeps the same buffer and grows it as needed.
+
+   If no data is read, then this function exits the program. 
+*/
+
+
+void
+getuser_noreadline(char **buffer, int *bufsize, const char *query)
+{
+#ifdef SUPPORT_UTF8
+  int valid = 0;
+  while(!valid){
+    fputs(query, stdout);
+    if (!fgetslong(buffer, bufsize, stdin,0)){
+      if (!flags.quiet)
+        putchar('\n');
+      exit(EXIT_SUCCESS);
+    }
+    replacectrlchars(*buffer);
+    valid = strwidth(*buffer)>=0;
+    if (!valid)
+      printf("Error: %s\n",invalid_utf8);
+  }
+#else
+  fputs(query, stdout);
+  if (!fgetslong(buffer, bufsize, stdin,0)){
+    if (!flags.quiet)
+      putchar('\n');
+    exit(EXIT_SUCCESS);
+  }
+  replacectrlchars(*buffer);
+#endif
+}  
+
+
+#ifndef READLINE
+#  define getuser getuser_noreadline
+#else 
+           /* we DO have readline */
+void
+getuser_readline(char **buffer, int *bufsize, const char *query)
+{
+#ifdef SUPPORT_UTF8
+  int valid = 0;
+  while (!valid){
+    if (*buffer) free(*buffer);
+    *buffer = readline(query);
+    if (*buffer)
+      replacectrlchars(*buffer);
+    if (!*buffer || strwidth(*buffer)>=0)
+        valid=1;
+    else
+      printf("Error: %s\n",invalid_utf8);
+  }
+#else
+    if (*buffer) free(*buffer);
+    *buffer = readline(query);
+    if (*buffer)
+      replacectrlchars(*buffer);
+#endif
+  if (nonempty(*buffer)) add_history(*buffer);
+  if (!*buffer){
+    if (!flags.quiet)
+       putchar('\n');
+    exit(EXIT_SUCCESS);
+  }
+}
+
+
+void
+getuser(char **buffer, int *bufsize, const char *query)
+{
+  if (flags.readline)
+    getuser_readline(buffer,bufsize,query);
+  else
+    getuser_noreadline(buffer,bufsize,query);
+}
+
+
+/* Unit name completion for readline.  
+
+   Complete function names or alias names or builtin functions.  
+
+   Complete to the end of a prefix or complete to the end of a unit.
+   If the text includes a full prefix plus part of a unit and if the
+   prefix is longer than one character then complete that compound.
+   Don't complete a prefix fragment into prefix plus anything.
+
+   Completion works from sorted name indexes that are built from the
+   units database the first time completion is requested after the
+   database changes.  Each request is then a binary search for the
+   first match followed by a walk over the matching range.
+*/
+
+struct nameindex {
+  char **names;                 /* sorted, without duplicates */
+  int count;
+  int alloc;
+};
+
+struct nameindex allnames;      /* aliases, builtins, functions, prefixes */
+                                /*    and units */
+struct nameindex unitnames;     /* units only (for prefix continuation) */
+int completion_dbversion = -1;  /* dbversion when the indexes were built */
+
+void
+addtoindex(struct nameindex *index, char *name)
+{
+  if (index->count == index->alloc){
+    index->alloc = index->alloc ? 2*index->alloc : 1024;
+    index->names = (char **)realloc(index->names,
+                                    index->alloc*sizeof(char *));
+    if (!index->names){
+      fprintf(stderr, "%s: memory allocation error (addtoindex)\n", progname);
+      exit(EXIT_FAILURE);
+    }
+  }
+  index->names[index->count++] = name;
+}
+
+
+/* Sort the index and remove duplicate names */
+
+void
+sortindex(struct nameindex *index)
+{
+  int i, j;
+
+  qsort(index->names, index->count, sizeof(char *), compare);
+  for(i=j=0;i<index->count;i++)
+    if (!j || strcmp(index->names[i], index->names[j-1]))
+      index->names[j++] = index->names[i];
+  index->count = j;
+}
+
+
+/* Returns the position of the first name in the index that is not
+   alphabetically before text */
+
+int
+indexsearch(struct nameindex *index, const char *text)
+{
+  int low = 0, high = index->count, mid;
+
+  while (low < high){
+    mid = (low+high)/2;
+    if (strcmp(index->names[mid], text) < 0)
+      low = mid+1;
+    else
+      high = mid;
+  }
+  return low;
+}
+
+
+void
+buildcompletionindex(void)
+{
+  struct unitlist *uptr;
+  struct prefixlist *pptr;
+  struct func *funcptr;
+  struct wantalias *aliasptr;
+  char **builtin;
+  int i;
+
+  allnames.count = unitnames.count = 0;
+  for(aliasptr = firstalias; aliasptr; aliasptr = aliasptr->next)
+    addtoindex(&allnames, aliasptr->name);
+  for(builtin = builtins; *builtin; builtin++)
+    addtoindex(&allnames, *builtin);
+  for(i=0;i<SIMPLEHASHSIZE;i++){
+    for(funcptr = ftab[i]; funcptr; funcptr = funcptr->next)
+      addtoindex(&allnames, funcptr->name);
+    for(pptr = ptab[i]; pptr; pptr = pptr->next)
+      addtoindex(&allnames, pptr->name);
+  }
+  for(i=0;i<HASHSIZE;i++)
+    for(uptr = utab[i]; uptr; uptr = uptr->next){
+      addtoindex(&allnames, uptr->name);
+      addtoindex(&unitnames, uptr->name);
+    }
+  sortindex(&allnames);
+  sortindex(&unitnames);
+  completion_dbversion = dbversion;
+}
+
+
+char *
+completeunits(char *text, int state)
+{
+  static int cursor, unitprefixlen;
+  static struct prefixlist *unitprefix;
+  static struct nameindex *curindex;
+  char *output, *match;
+
+#ifndef NO_SUPPRESS_APPEND
+  rl_completion_suppress_append = 1;
+#endif
+  
+  if (!state){     /* state == 0 means this is the first call, so initialize */
+    if (completion_dbversion != dbversion)
+      buildcompletionindex();
+    curindex = &allnames;
+    cursor = indexsearch(curindex, text);
+    unitprefix=0; /* search for unit continuations starting with this prefix */
+    unitprefixlen = 0;
+  }
+  for(;;){
+    if (cursor < curindex->count
+        && startswith(match = curindex->names[cursor], text+unitprefixlen)){
+      cursor++;
+      if (!unitprefix)
+        return dupstr(match);
+      output = (char *)mymalloc(1+strlen(match)+unitprefixlen,
+                                "(completeunits)");
+      strcpy(output, unitprefix->name);
+      strcat(output, match);
+      return output;
+    }
+    /* If we're done with the names go through the units again with */
+    /* the largest possible prefix stripped off */
+    if (!unitprefix && (unitprefix = plookup(text)) 
+        && strlen(unitprefix->name)>1){
+      unitprefixlen = unitprefix->len;
+      curindex = &unitnames;
+      cursor = indexsearch(curindex, text+unitprefixlen);
+      continue;
+    }
+    return 0;
+  }
+}
+
+#endif /* READLINE */
+
+
+
+/* see if current directory contains an executable file */
+int
+checkcwd (char *file)
+{
+  FILE *fp;
+  char *p;
+
+  fp = openfile(file, "r");
+  if (fp){
+    fclose(fp);
+    return 1;
+  }
+#ifdef _WIN32
+  else if (!((p = strrchr(file, '.')) && isexe(p))) {
+    char *pathname;
+
+    pathname = mymalloc(strlen(file) + strlen(EXE_EXT) + 1,
+                        "(checkcwd)");
+    strcpy(pathname, file);
+    strcat(pathname, EXE_EXT);
+    fp = openfile(pathname, "r");
+    free(pathname);
+    if (fp) {
+      fclose(fp);
+      return 1;
+    }
+  }
+#endif
+
+  return 0;
+}
+
+/* 
+   return the last component of a pathname, and remove a .exe extension
+   if one exists.
+*/
+
+char *
+getprogramname(char *path)
+{
+  size_t proglen;
+  char *p;
+
+  path = pathend(path);
+
+  /* get rid of filename extensions in Windows */
+  proglen = strlen(path);
+
+  if ((p = strrchr(path, '.')) && isexe(p))
+    proglen -= 4;
+  return dupnstr(path, proglen);
+}
+
+/*
+   Find the directory that contains the invoked executable.
+*/
+
+char *
+getprogdir(char *progname, char **fullprogname)
+{
+  char *progdir = NULL;
+  char *p;
+
+#if defined (_WIN32) && defined (_MSC_VER)
+  char buf[FILENAME_MAX + 1];
+
+  /* get the full pathname of the current executable and be done with it */
+  /* TODO: is there way to do this with gcc? */
+
+  if (GetModuleFileName(NULL, buf, FILENAME_MAX + 1))
+    progdir = dupstr(buf);
+#endif
+
+  /* If path name is absolute or includes more than one component use it */
+
+  if (!progdir && (isfullpath(progname) || hasdirsep(progname)))
+    progdir = dupstr(progname);
+
+
+  /*
+  command.com and cmd.exe under Windows always run a program that's in the
+  current directory whether or not the current directory is in PATH, so we need
+  to check the current directory.
+
+  This could return a false positive if units is run from a Unix-like command
+  interpreter under Windows if the current directory is not in PATH but
+  contains 'units' or 'units.exe'
+  */
+#if defined (_WIN32) && !defined (_MSC_VER)
+  if (!progdir && checkcwd(progname)) 
+      progdir = dupstr(progname);
+#endif
+
+  /* search PATH to find the executable */
+  if (!progdir) {
+    char *env;
+    env = getenv("PATH");
+    if (env) {
+      /* search PATH */
+      char *direc, *direc_end, *pathname;
+      int len;
+      FILE *fp;
+
+      pathname = mymalloc(strlen(env)+strlen(progname)+strlen(EXE_EXT)+2,
+                                                         "(getprogdir)");
+      direc = env;
+      while (direc) {
+        direc_end = strchr(direc,PATHSEP);
+        if (!direc_end)
+          len = strlen(direc);
+        else 
+          len = direc_end-direc;
+        strncpy(pathname, direc, len);
+        if (len>0)
+          pathname[len++]=DIRSEP;
+        strcpy(pathname+len, progname);
+        fp = openfile(pathname, "r");
+        if (fp){
+          progdir = dupstr(pathname);
+          break;
+        }
+#ifdef _WIN32
+        /*
+          executable may or may not have '.exe' suffix, so we need to
+          look for both
+        */
+        if (!((p = strrchr(pathname, '.')) && isexe(p))) {
+          strcat(pathname, EXE_EXT);
+          fp = openfile(pathname, "r");
+          if (fp){
+            progdir = dupstr(pathname);
+            break;
+          }
+        }
+#endif
+        direc = direc_end;
+        if (direc) direc++;
+      }
+      free(pathname);
+      if (fp)
+        fclose(fp);
+    }
+  }
+
+  if (!progdir) {
+    fprintf(stderr, "%s: cannot find program directory\n", progname);
+    exit(EXIT_FAILURE);
+  }
+
+  *fullprogname = dupstr(progdir);      /* used by printversion() */
+  p = pathend(progdir);
+  *p = '\0';  
+ 
+  return progdir; 
+}
+
+/*
+  find a possible data directory relative to a 'bin' directory that
+  contains the executable
+*/
+
+char *
+getdatadir()
+{
+    int progdirlen;
+    char *p;
+
+    if (isfullpath(DATADIR))
+      return DATADIR;
+    if (!progdir || emptystr(DATADIR))
+      return NULL;
+    progdirlen = strlen(progdir);
+    datadir = (char *) mymalloc(progdirlen + strlen(DATADIR) + 2,
+				"(getdatadir)");
+    strcpy(datadir, progdir);
+    if (isdirsep(progdir[progdirlen - 1]))
+      datadir[progdirlen - 1] = '\0';   /* so pathend() can work */
+    p = pathend(datadir);
+    if ((strlen(p) == 3) && (tolower(p[0]) == 'b') \
+       && (tolower(p[1]) == 'i') && (tolower(p[2]) == 'n')) {
+      p = DATADIR;
+      while (*p == '.')         /* ignore "./", "../" */
+	p++;
+      if (isdirsep(*p))
+	p++;
+      strcpy(pathend(datadir), p);
+      
+      return datadir;
+    }
+    else
+      return NULL;
+}
+
+void
+showfilecheck(int errnum, char *filename)
+{
+  if (errnum==ENOENT)
+    printf("  Checking %s\n", filename);
+  else
+    printf("  Checking %s: %s\n", filename, strerror(errnum)); 
+}
+
+/*
+  On Windows, find the locale map
+  
+  If print is set to ERRMSG then display error message if the file is
+  not valid.  If print is set to SHOWFILES then display files that are
+  checked (when the filename is not a fully specified path).  If print
+  is set to NOERRMSG then do not display anything.
+
+  Returns filename of valid local map file or NULL if no file was found.
+*/
+#ifdef _WIN32
+char *
+findlocalemap(int print)
+{
+  FILE *map = NULL;
+  char *filename = NULL;
+  char *file;
+
+  /*
+      Try the environment variable UNITSLOCALEMAP, then the #defined
+      value LOCALEMAP, then the directory containing the units
+      executable, then the directory given by datadir, and finally
+      the directory containing the units data file.
+  */
+
+  /* check the environment variable UNITSLOCALEMAP */
+  file = getenv("UNITSLOCALEMAP");
+  if (nonempty(file)) {
+    map = openfile(file,"rt");
+    if (!map) {
+      if (print == ERRMSG) {
+        fprintf(stderr,
+                "%s: cannot open locale map '%s'\n  specified in UNITSLOCALEMAP environment variable. ",
+                progname, file);
+        perror((char *) NULL);
+      }
+      return NULL;
+    }
+    else
+      filename = dupstr(file);
+  }
+
+  /* check the #defined value LOCALEMAP */
+  if (!map) {
+    file = LOCALEMAP;
+    map = openfile(file,"rt");
+    if (map)
+      filename = dupstr(file);
+  }
+
+  if (!map && !progdir) {
+    if (print == ERRMSG) {
+      fprintf(stderr,
+              "%s: cannot find locale map--program directory not set\n",
+              progname);
+      exit(EXIT_FAILURE);
+    }
+    else
+      return NULL;
+  }
+
+  /* check the directory with the units executable */
+  if (!map) {
+    filename = (char *) mymalloc(strlen(progdir) + strlen(file) + 2,
+               "(findlocalemap)");
+    strcpy(filename, progdir);
+    strcat(filename, file);
+    map = openfile(filename,"rt");
+    if (print==SHOWFILES && !map)
+      showfilecheck(errno, filename);
+  }
+
+  /* check data directory */
+  if (!map && datadir) {     
+    if (filename)
+      free(filename);
+    filename = (char *) mymalloc(strlen(datadir) + strlen(file) + 3,
+                                 "(findlocalemap)");
+    strcpy(filename, datadir);
+    strcat(filename, DIRSEPSTR);
+    strcat(filename, file);
+    map = openfile(filename, "rt");
+    if (print==SHOWFILES && !map)
+      showfilecheck(errno, filename);
+  }
+
+  /* check the directory with the units data file  */
+  if (!map && unitsfiles[0]) {
+    char *lastfilename = NULL;
+
+    if (filename) {
+      if (datadir)
+	lastfilename = dupstr(filename);
+      free(filename);
+    }
+    filename = (char *) mymalloc(strlen(unitsfiles[0]) + strlen(file) + 2,
+               "(findlocalemap)");
+    strcpy(filename, unitsfiles[0]);
+    strcpy(pathend(filename), file);
+
+    /* don't bother if we've just checked for it */
+    if (lastfilename && strcmp(filename, lastfilename)) {
+      map = openfile(filename,"rt");
+      if (print==SHOWFILES && !map)
+	showfilecheck(errno, filename);
+    }
+  }
+
+  if (map) {
+    fclose(map);
+    return filename;
+  }
+  else {
+    if (filename)
+      free(filename);
+    return NULL;
+  }
+}
+#endif
+
+/*
+  Find the units database file. 
+  
+  If print is set to ERRMSG then display error message if the file is
+  not valid.  If print is set to SHOWFILES then display files that are
+  checked (when the filename is not a fully specified path).  If print
+  is set to NOERRMSG then do not display anything.
+
+  Returns filename of valid database file or NULL if no file
+  was found.  
+*/
+
+char *
+findunitsfile(int print)
+{
+  FILE *testfile=0;
+  char *file;
+
+  file = getenv("UNITSFILE");
+  if (nonempty(file)) {
+    testfile = openfile(file, "rt");
+    if (!testfile) {
+      if (print==ERRMSG) {
+        fprintf(stderr,
+                "%s: cannot open units file '%s' in environment variable UNITSFILE.  ",
+                progname, file);
+        perror((char *) NULL);
+      }
+      return NULL;
+    }
+  }
+
+#ifdef BUILTIN_UNITS
+  if (!testfile)
+    return builtinpath(0);
+#endif
+
+  if (!testfile && isfullpath(UNITSFILE)){
+    file = UNITSFILE;
+    testfile = openfile(file, "rt");
+    if (!testfile) {
+      if (print==ERRMSG) {
+        fprintf(stderr,
+                "%s: cannot open units data file '%s'.  ", progname, UNITSFILE);
+        perror((char *) NULL);
+      }
+      return NULL;
+    }
+  }      
+
+  if (!testfile && !progdir) {
+    if (print==ERRMSG) {
+      fprintf(stderr,
+              "%s: cannot open units file '%s' and cannot find program directory.\n", progname, UNITSFILE);
+      perror((char *) NULL);
+    }
+    return NULL;
+  }
+
+  if (!testfile) {
+    /* check the directory containing the units executable */
+    file = (char *) mymalloc(strlen(progdir)+strlen(UNITSFILE)+1,
+                             "(findunitsfile)");
+    strcpy(file, progdir);
+    strcat(file, UNITSFILE);
+    testfile = openfile(file, "rt");
+    if (print==SHOWFILES && !testfile)
+      showfilecheck(errno, file);
+    if (!testfile)
+      free(file);
+  }
+
+  /* check data directory */
+  if (!testfile && datadir) {
+    file = (char *) mymalloc(strlen(datadir) + strlen(UNITSFILE) + 2,
+                             "(findunitsfile)");
+    strcpy(file, datadir);
+    strcat(file, DIRSEPSTR);
+    strcat(file, UNITSFILE);
+    testfile = openfile(file, "rt");
+    if (print==SHOWFILES && !testfile)
+      showfilecheck(errno, file);
+    if (!testfile)
+      free(file);
+  }
+
+  if (!testfile) {
+    if (print==ERRMSG)
+      fprintf(stderr,"%s: cannot find units file '%s'\n", progname, UNITSFILE);
+     return NULL;
+  }
+  else {
+    fclose(testfile);
+    return file;
+  }
+}
+
+/*
+  Find the user's home directory.  Unlike *nix, Windows doesn't usually
+  set HOME, so we check several other places as well.
+*/
+char *
+findhome(char **errmsg)
+{
+  struct stat statbuf;
+  int allocated = 0;
+  char *homedir;
+  char notfound[] = "Specified home directory '%s' does not exist";
+  char notadir[] = "Specified home directory '%s' is not a directory";
+
+  /*
+    Under UNIX just check HOME.  Under Windows, if HOME is not set then
+    check HOMEDRIVE:HOMEPATH and finally USERPROFILE
+  */
+  homedir = getenv("HOME");
+
+#ifdef _WIN32
+  if (!nonempty(homedir)) {
+    /* try a few other places */
+    /* try HOMEDRIVE and HOMEPATH */
+    char *homedrive, *homepath;
+    if ((homedrive = getenv("HOMEDRIVE")) && *homedrive && (homepath = getenv("HOMEPATH")) && *homepath) {
+      homedir = mymalloc(strlen(homedrive)+strlen(homepath)+1,"(personalfile)");
+      allocated = 1;
+      strcpy(homedir, homedrive);
+      strcat(homedir, homepath);
+    }
+    else
+      /* finally, try USERPROFILE */
+      homedir = getenv("USERPROFILE");
+  }
+#endif
+  
+  /*
+    If a home directory is specified, see if it exists and is a
+    directory.  If not set error message text. 
+  */
+  
+  if (nonempty(homedir)) {
+    if (stat(homedir, &statbuf) != 0) {
+      *errmsg = malloc(strlen(notfound)+strlen(homedir));
+      sprintf(*errmsg, notfound, homedir);
+    }
+    else if (!(statbuf.st_mode & S_IFDIR)) {
+      *errmsg = malloc(strlen(notadir)+strlen(homedir));
+      sprintf(*errmsg, notadir, homedir);
+    }
+    if (!allocated)
+      homedir = dupstr(homedir);
+    return homedir;
+  }
+  else {
+    *errmsg = "no home directory";
+    return NULL;
+  }
+}
+
+/*
+  Find a personal file.  First checks the specified environment variable 
+  (envname) for the filename to  use.  If this is unset then search user's 
+  home directory for basename.  If there is no home directory, returns 
+  NULL.  Otherwise if the file exists then returns its name in newly allocated
+  space and sets *exists to 1. If the file does not exist then sets *exist to 
+  zero and:
+      With checkonly == 0, prints error message and returns NULL
+      With checkonly != 0, returns filename (does not print error message)
+*/
+char *
+personalfile(const char *envname, const char *basename,
+             int checkonly, int *exists)
+{
+  FILE *testfile;
+  char *filename=NULL;
+
+  *exists = 0; 
+
+  /* First check the specified environment variable for a file name */ 
+  if (envname) 
+    filename = getenv(envname);
+  if (nonempty(filename)){       
+    testfile = openfile(filename, "rt");
+    if (testfile){
+      fclose(testfile);
+      *exists = 1;
+      return filename;
+    }
+    if (checkonly)
+      return filename;
+    else {
+      fprintf(stderr, "%s: cannot open file '%s' specified in %s environment variable: ",
+              progname, filename, envname);
+      perror((char *) NULL);
+      return NULL;
+    }
+  }
+  /* Environment variable not set: look in home directory */
+  else if (nonempty(homedir)) {
+    filename = mymalloc(strlen(homedir)+strlen(basename)+2,
+                        "(personalfile)");
+    strcpy(filename,homedir);
+
+    if (strcmp(homedir, "/") && strcmp(homedir, "\\"))
+      strcat(filename,DIRSEPSTR);
+    strcat(filename,basename);
+
+    testfile = openfile(filename, "rt");
+    if (testfile){
+      fclose(testfile);
+      *exists = 1;
+      return filename;
+    }
+    if (checkonly)
+      return filename;
+    else {
+      if (errno==EACCES || errno==EISDIR) {
+        fprintf(stderr,"%s: cannot open file '%s': ",progname,filename);
+        perror(NULL);
+      }
+      free(filename);
+      return NULL;
+    }
+  }
+  else
+    return NULL;
+}
+
+
+/* print usage message */
+
+void 
+usage()
+{
+  int nlines;
+  char *unitsfile;
+  char *msg = "\nUsage: %s [options] ['from-unit' 'to-unit']\n\n\
+Options:\n\
+    -h, --help           show this help and exit\n\
+    -c, --check          check that all units reduce to primitive units\n\
+        --check-changed  like --check, but skips definitions unchanged since\n\
+                           the last check\n\
+        --check-verbose  like --check, but lists units as they are checked\n\
+        --verbose-check    so you can find units that cause endless loops\n\
+    -d, --digits         show output to specified number of digits (default: %d)\n\
+    -e, --exponential    exponential format output\n\
+        --explain        show the reduction of each unit with its cost\n\
+    -f, --file           specify a units data file (-f '' loads default file)\n\
+        --eager          reduce all units to primitive units after loading\n\
+    -j, --jobs           number of worker processes for --eager\n\
+                           and --check\n\
+        --lazy           parse unit definitions only when they are used\n\
+        --subset         write the definitions needed by the names in a file\n\
+        --subset-output  file to write the --subset definitions to\n\
+        --stats          count lookups and parsing during the conversions\n\
+        --memstats       show the memory used by the loaded units database\n\
+        --trace          write a Chrome trace of the conversion to a file\n"
+#ifdef READLINE
+"\
+    -H, --history        specify readline history file (-H '' disables history)\n"
+#endif
+"\
+    -L, --log            specify a file to log conversions\n\
+    -l, --locale         specify a desired locale\n\
+    -m, --minus          make - into a subtraction operator (default)\n\
+        --oldstar        use old '*' precedence, higher than '/'\n\
+        --newstar        use new '*' precedence, equal to '/'\n\
+    -n, --nolists        disable conversion to unit lists\n\
+    -S, --show-factor    show non-unity factor before 1|x in multi-unit output\n\
+        --conformable    in non-interactive mode, show all conformable units\n\
+    -o, --output-format  specify printf numeric output format (default: %%.%d%c)\n\
+    -p, --product        make '-' into a product operator\n\
+    -q, --quiet          suppress prompting\n\
+        --silent         same as --quiet\n\
+    -s, --strict         suppress reciprocal unit conversion (e.g. Hz<->s)\n\
+    -v, --verbose        show slightly more verbose output\n\
+        --compact        suppress printing of tab, '*', and '/' character\n\
+    -1, --one-line       suppress the second line of output\n\
+    -t, --terse          terse output (--strict --compact --quiet --one-line)\n\
+    -r, --round          round last element of unit list output to an integer\n\
+    -U, --unitsfile      show units data filename and exit\n\
+    -u, --units          specify a CGS unit system (gauss[ian]|esu|emu)\n\
+    -V, --version        show version, data filenames (with -t: version only)\n\
+    -I, --info           show version, files, and program properties\n";
+  FILE *fp = NULL;
+
+  unitsfile = findunitsfile(NOERRMSG);
+
+  nlines = countlines(msg);
+  /* see if we need a pager */
+  fp = get_output_fp(nlines + 4);
+
+  fprintf(fp, msg, progname, DEFAULTPRECISION, DEFAULTPRECISION, DEFAULTTYPE);
+  if (!unitsfile)
+    fprintf(fp, "Units data file '%s' not found.\n\n", UNITSFILE);
+  else
+    fprintf(fp, "\nTo learn about the available units look in '%s'\n\n", unitsfile);
+  fputs("Report bugs to adrianm@gnu.org.\n\n", fp);
+
+  if (fp != stdout)
+    pclose(fp);
+}
+
+/* Print message about how to get help */
+
+void 
+helpmsg()
+{
+  fprintf(stderr,"\nTry '%s --help' for more information.\n",progname);
+  exit(EXIT_FAILURE);
+}
+
+/* show units version, and optionally, additional information */
+void
+printversion()
+{
+  int exists;
+  char *u_unitsfile = NULL;  /* units data file specified in UNITSFILE */
+  char *m_unitsfile;         /* personal units data file from HOME_UNITS_ENV */
+  char *p_unitsfile;         /* personal units data file */
+  FILE *fp, *histfile;
+#ifdef _WIN32
+  char *localemap;
+#endif
+
+  if (flags.verbose == 0) {
+    printf("GNU Units version %s\n", VERSION);
+    return;
+  }
+
+  printf("GNU Units version %s\n%s, %s, locale %s\n",
+         VERSION, RVERSTR,UTF8VERSTR,mylocale);
+#if defined (_WIN32) && defined (HAVE_MKS_TOOLKIT)
+  puts("With MKS Toolkit");
+#endif
+
+  if (flags.verbose == 2) {
+    if (!fullprogname)
+      getprogdir(progname, &fullprogname);
+    if (fullprogname)
+      printf("\n%s program is %s\n", progname, fullprogname);
+  }
+
+  /* units data file */
+
+  putchar('\n');
+#ifdef BUILTIN_UNITS
+  printf("Default units data file '%s' is built in\n", UNITSFILE);
+#else
+  if (isfullpath(UNITSFILE))
+    printf("Default units data file is '%s'\n", UNITSFILE);
+  else
+    printf("Default units data file is '%s';\n  %s will search for this file\n",
+           UNITSFILE, progname);
+#endif
+  if (flags.verbose < 2)
+    printf("Default personal units file: %s\n", homeunitsfile);
+
+  if (flags.verbose == 2){
+    u_unitsfile = getenv("UNITSFILE");
+    if (u_unitsfile)
+      printf("Environment variable UNITSFILE set to '%s'\n", u_unitsfile);
+    else
+      puts("Environment variable UNITSFILE not set");
+
+    unitsfiles[0] = findunitsfile(SHOWFILES);
+    
+    if (unitsfiles[0]) {
+      /* We searched for the file in program and data dirs */
+      if (!isfullpath(UNITSFILE) && !nonempty(u_unitsfile))
+        printf("Found data file '%s'\n", unitsfiles[0]);
+      else
+        printf("Units data file is '%s'\n", unitsfiles[0]);
+    } 
+    else {
+      if (errno && (nonempty(u_unitsfile) || isfullpath(UNITSFILE)))
+        printf("*** Units data file invalid: %s ***\n",strerror(errno));
+      else
+        puts("*** Units data file not found ***");
+    }
+    if (homedir_error)
+      printf("\n%s\n", homedir_error);
+    else
+      printf("\nHome directory is '%s'\n", homedir);
+  }
+
+  /* personal units data file: environment */
+  if (flags.verbose == 2){
+    m_unitsfile = getenv(HOME_UNITS_ENV);
+    putchar('\n');
+    if (m_unitsfile) {
+      printf("Environment variable %s set to '%s'\n",
+             HOME_UNITS_ENV,m_unitsfile);
+    }
+    else
+      printf("Environment variable %s not set\n", HOME_UNITS_ENV);
+
+    p_unitsfile = personalfile(HOME_UNITS_ENV, homeunitsfile, 1, &exists);
+    if (p_unitsfile) {
+      printf("Personal units data file is '%s'\n", p_unitsfile);
+      if (!exists){
+        if (homedir_error && !nonempty(m_unitsfile))
+          printf("  (File invalid: %s)\n", homedir_error);
+        else if (errno==ENOENT && !nonempty(m_unitsfile))
+          puts("  (File does not exist)");
+        else 
+          printf("  (File invalid: %s)\n",strerror(errno));
+      }  
+    }
+    else
+      puts("Personal units data file not found: no home directory");
+  }
+#ifdef READLINE
+  if (flags.verbose == 2) {
+    historyfile = personalfile(NULL,HISTORY_FILE,1,&exists);
+    if (historyfile){
+      printf("\nDefault readline history file is '%s'\n", historyfile);
+      histfile = openfile(historyfile,"r+");
+      if (!histfile)
+        printf("  (File invalid: %s)\n",
+               homedir_error ? homedir_error : strerror(errno));
+      else
+        fclose(histfile);
+    }  
+    else 
+      puts("\nReadline history file unusable: no home directory");
+  }
+#endif
+
+#ifdef _WIN32
+  /* locale map */
+  if (flags.verbose == 2) {
+    putchar('\n');
+    localemap = getenv("UNITSLOCALEMAP");
+    if (localemap)
+      printf("Environment variable UNITSLOCALEMAP set to '%s'\n", localemap);
+    else
+      puts("Environment variable UNITSLOCALEMAP not set");
+
+    if (isfullpath(LOCALEMAP))
+      printf("Default locale map is '%s'\n", LOCALEMAP);
+    else
+      printf("Default locale map is '%s';\n  %s will search for this file\n",
+             LOCALEMAP, progname);
+
+    localemap = findlocalemap(SHOWFILES);
+    if (localemap && !isfullpath(LOCALEMAP))
+      printf("Found locale map '%s'\n", localemap);
+    else if (localemap)
+      printf("Locale map is '%s'\n", localemap);
+    else
+      puts("*** Locale map not found ***");
+  }
+#endif
+
+  printf("\n%s\n\n", LICENSE);
+}
+
+void
+showunitsfile()
+{
+  char *unitsfile;
+  unitsfile = findunitsfile(NOERRMSG);
+  if (unitsfile)
+    printf("%s\n", unitsfile);
+  else
+    puts("Units data file not found");
+}
+
+
+char *shortoptions = "VIUu:vqechSstf:o:d:mnpr1l:L:j:"
+#ifdef READLINE
+    "H:"
+#endif
+  ;
+
+struct option longoptions[] = {
+  {"check", no_argument, &flags.unitcheck, 1},
+  {"check-changed", no_argument, 0, 'C'},
+  {"check-verbose", no_argument, &flags.unitcheck, 2},
+  {"compact", no_argument, &flags.verbose, 0},
+  {"digits", required_argument, 0, 'd'},
+  {"eager", no_argument, &flags.eager, 1},
+  {"explain", no_argument, &flags.explain, 1},
+  {"exponential", no_argument, 0, 'e'},
+  {"file", required_argument, 0, 'f'},
+  {"help", no_argument, 0, 'h'},
+#ifdef READLINE  
+  {"history", required_argument, 0, 'H'},
+#endif  
+  {"info", no_argument, 0, 'I'},
+  {"jobs", required_argument, 0, 'j'},
+  {"lazy", no_argument, &flags.lazy, 1},
+  {"locale", required_argument, 0, 'l'}, 
+  {"log", required_argument, 0, 'L'}, 
+  {"memstats", no_argument, &flags.memstats, 1},
+  {"minus", no_argument, &parserflags.minusminus, 1},
+  {"newstar", no_argument, &parserflags.oldstar, 0},
+  {"nolists", no_argument, 0, 'n'},
+  {"oldstar", no_argument, &parserflags.oldstar, 1},
+  {"one-line", no_argument, &flags.oneline, 1},
+  {"output-format", required_argument, 0, 'o'},
+  {"product", no_argument, &parserflags.minusminus, 0},
+  {"quiet", no_argument, &flags.quiet, 1},
+  {"round",no_argument, 0, 'r'},
+  {"show-factor", no_argument, 0, 'S'},
+  {"stats", no_argument, &flags.stats, 1},
+  {"conformable", no_argument, &flags.showconformable, 1 },
+  {"silent", no_argument, &flags.quiet, 1},
+  {"strict",no_argument,&flags.strictconvert, 1},
+  {"subset", required_argument, 0, 'B'},
+  {"subset-output", required_argument, 0, 'W'},
+  {"terse",no_argument, 0, 't'},
+  {"trace", required_argument, 0, 'T'},
+  {"unitsfile", no_argument, 0, 'U'},
+  {"units", required_argument, 0, 'u'},
+  {"verbose", no_argument, &flags.verbose, 2},
+  {"verbose-check", no_argument, &flags.unitcheck, 2},
+  {"version", no_argument, 0, 'V'},
+  {0,0,0,0} };
+
+/* Process the args.  Returns 1 if interactive mode is desired, and 0
+   for command line operation.  If units appear on the command line
+   they are returned in the from and to parameters. */
+
+int
+processargs(int argc, char **argv, char **from, char **to)
+{
+   extern char *optarg;
+   extern int optind;
+   int optchar, optindex;
+   int ind;
+   int doprintversion=0;
+   char *unitsys=0;
+   
+   // Reset getopt
+   optind = 1;
+   optarg = NULL;
+
+   while ( -1 != 
+      (optchar = 
+         getopt_long(argc, argv,shortoptions,longoptions, &optindex ))) {
+      switch (optchar) {
+         case 'm':
+            parserflags.minusminus = 1;
+            break;
+         case 'p':
+            parserflags.minusminus = 0;
+            break;
+         case 't':
+            flags.oneline = 1;
+            flags.quiet = 1;
+            flags.strictconvert = 1;
+            flags.verbose = 0;
+            break;
+
+         /* numeric output format */
+         case 'd':
+            if (checksigdigits(optarg) < 0)
+              exit(EXIT_FAILURE);
+            else    /* ignore anything given with 'o' option */
+              num_format.format = NULL; 
+            break;
+         case 'e':  /* ignore anything given with 'o' option */
+            num_format.format = NULL;   
+            num_format.type = 'e';
+            break;
+         case 'o':
+            num_format.format = optarg;
+            break;
+
+         case 'c':
+            flags.unitcheck = 1;
+            break;
+         case 'C':          /* --check-changed has no short form */
+            flags.unitcheck = 1;
+            flags.checkchanged = 1;
+            break;
+         case 'f':
+            for(ind=0;unitsfiles[ind];ind++); 
+            if (ind==MAXFILES){
+              fprintf(stderr, "At most %d -f specifications are allowed\n",
+                      MAXFILES);
+              exit(EXIT_FAILURE);
+            }
+            if (optarg && *optarg)
+              unitsfiles[ind] = optarg;
+            else {
+              unitsfiles[ind] = findunitsfile(ERRMSG);
+              if (!unitsfiles[ind]) 
+                exit(EXIT_FAILURE);
+            }
+            unitsfiles[ind+1] = 0;
+            break;
+         case 'j':
+            flags.jobs = strtol(optarg, &optarg, 10);
+            if (flags.jobs < 1 || *optarg){
+              fprintf(stderr, "%s: invalid number of jobs\n", progname);
+              exit(EXIT_FAILURE);
+            }
+            break;
+         case 'B':          /* --subset has no short form */
+            subsetnames = optarg;
+            break;
+         case 'W':
+            subsetoutput = optarg;
+            break;
+         case 'T':          /* --trace has no short form */
+            tracefile = optarg;
+            break;
+         case 'L':
+            logfilename = optarg;
+            break;
+         case 'l':
+            mylocale = optarg;
+            break;
+         case 'n':
+            flags.unitlists = 0;
+            break;
+         case 'q':
+            flags.quiet = 1;
+            break; 
+         case 'r':
+            flags.round = 1;
+            break;
+         case 'S':
+            flags.showfactor = 1;
+            break;
+         case 's':
+            flags.strictconvert = 1;
+            break;
+         case 'v':
+            flags.verbose = 2;
+            break;
+         case '1':
+            flags.oneline = 1;
+            break;
+         case 'I':
+            flags.verbose = 2;  /* fall through */
+         case 'V':
+            doprintversion = 1;
+            break;
+         case 'U':
+            showunitsfile();
+            exit(EXIT_SUCCESS);
+            break;
+         case 'u':
+            unitsys = optarg;
+            for(ind=0;unitsys[ind];ind++)
+              unitsys[ind] = tolower(unitsys[ind]);
+            break;
+         case 'h':
+            usage();
+            exit(EXIT_SUCCESS);
+#ifdef READLINE     
+         case 'H':
+           if (emptystr(optarg))
+              historyfile=NULL;
+            else
+              historyfile = optarg;
+            break;
+#endif      
+         case 0: break;  /* This is reached if a long option is 
+                            processed with no return value set. */
+         case '?':        /* Invalid option or missing argument returns '?' */
+         default:
+            helpmsg();    /* helpmsg() exits with error */
+      } 
+   }
+
+   if (doprintversion){
+     printversion();
+     exit(EXIT_SUCCESS);
+   }
+
+   /* command-line option overwrites environment */
+   if (unitsys)
+     setenv("UNITS_SYSTEM", unitsys, 1);
+
+   if (flags.unitcheck || subsetnames) {
+     if (optind != argc){
+       fprintf(stderr, 
+               "Too many arguments (arguments are not allowed with %s).\n",
+               subsetnames ? "--subset" : "-c");
+       helpmsg();         /* helpmsg() exits with error */
+     }
+   } else {
+     if (optind == argc - 2) {
+        if (flags.showconformable) {
+          fprintf(stderr,"Too many arguments (only one unit expression allowed with '--conformable').\n");
+          helpmsg();             /* helpmsg() exits with error */
+        }
+        flags.quiet=1;
+        *from = argv[optind];
+        *to = argv[optind+1];    /* convertunits() copies it, as it may */
+        return 0;                /* get rewritten and freed later      */
+     }
+
+     if (optind == argc - 1) {
+        flags.quiet=1;
+        *from = argv[optind];
+        *to=0;
+        return 0;
+     }
+     if (optind < argc - 2) {
+        fprintf(stderr,"Too many arguments (maybe you need quotes).\n");
+        helpmsg();             /* helpmsg() exits with error */
+     }
+   }
+
+   return 1;
+}
+
+/* 
+   Show a pointer under the input to indicate a problem.
+   Prints 'position' spaces and then the pointer.
+   If 'position' is negative, nothing is printed.
+ */
 
-  /* check the #defined value LOCALEMAP */
-  if (!map) {
-    file = LOCALEMAP;
-    map = openfile(file,"rt");
-    if (map)
-      filename = dupstr(file);
+void
+showpointer(int position)
+{
+  if (position >= 0){
+    while (position--) putchar(' ');
+    puts("^");
   }
+} /* end showpointer */
 
-  if (!map && !progdir) {
-    if (print == ERRMSG) {
-      fprintf(stderr,
-              "%s: cannot find locale map--program directory not set\n",
-              progname);
-      exit(EXIT_FAILURE);
+
+/*
+   Process the string 'unitstr' as a unit, placing the processed data
+   in the unit structure 'theunit'.  Returns 0 on success and 1 on
+   failure.  If an error occurs an error message is printed to stdout.
+   A pointer ('^') will be printed if an error is detected, and  promptlen 
+   should be set to the printing width of the prompt string, or set 
+   it to NOPOINT to supress printing of the pointer.  
+ */
+
+ 
+int 
+parsereduceunit(struct unittype *theunit, char *unitstr, int promptlen)
+{
+  char *errmsg;
+  int errloc,err;
+  char savechar;
+
+  if (flags.unitlists && strchr(unitstr, UNITSEPCHAR)){
+    puts("Unit list not allowed");
+    return 1;
+  }
+  tracebegin("parse", "unit", unitstr, (char *) 0);
+  err = parseunit(theunit, unitstr, &errmsg, &errloc);
+  traceend();
+  if (err){
+    if (promptlen >= 0){
+      if ((err!=E_UNKNOWNUNIT && err!=E_NOTLOADED) || !irreducible){
+        if (errloc>0) {
+          savechar = unitstr[errloc];
+          unitstr[errloc] = 0;
+          showpointer(promptlen+strwidth(unitstr)-1);
+          unitstr[errloc] = savechar;
+        } 
+        else showpointer(promptlen);
+      }
     }
     else
-      return NULL;
-  }
-
-  /* check the directory with the units executable */
-  if (!map) {
-    filename = (char *) mymalloc(strlen(progdir) + strlen(file) + 2,
-               "(findlocalemap)");
-    strcpy(filename, progdir);
-    strcat(filename, file);
-    map = openfile(filename,"rt");
-    if (print==SHOWFILES && !map)
-      showfilecheck(errno, filename);
+      printf("Error in '%s': ", unitstr);
+    fputs(errmsg,stdout);
+    if (err==E_UNKNOWNUNIT && irreducible)
+      printf(" '%s'", irreducible);
+    else if (err==E_NOTLOADED && irreducible)
+      printf(" '%s' (chunk '%s')", irreducible, notloadedchunk);
+    putchar('\n');
+    return 1;
   }
-
-  /* check data directory */
-  if (!map && datadir) {     
-    if (filename)
-      free(filename);
-    filename = (char *) mymalloc(strlen(datadir) + strlen(file) + 3,
-                                 "(findlocalemap)");
-    strcpy(filename, datadir);
-    strcat(filename, DIRSEPSTR);
-    strcat(filename, file);
-    map = openfile(filename, "rt");
-    if (print==SHOWFILES && !map)
-      showfilecheck(errno, filename);
+  tracebegin("reduce", "unit", unitstr, (char *) 0);
+  err = completereduce(theunit);
+  traceend();
+  if (err){
+    fputs(errormsg[err],stdout);
+    if (err==E_UNKNOWNUNIT)
+      printf(" '%s'", irreducible);
+    else if (err==E_NOTLOADED)
+      printf(" '%s' (chunk '%s')", irreducible, notloadedchunk);
+    putchar('\n');
+    return 1;
   }
+  return 0;
+}
 
-  /* check the directory with the units data file  */
-  if (!map && unitsfiles[0]) {
-    char *lastfilename = NULL;
 
-    if (filename) {
-      if (datadir)
-	lastfilename = dupstr(filename);
-      free(filename);
-    }
-    filename = (char *) mymalloc(strlen(unitsfiles[0]) + strlen(file) + 2,
-               "(findlocalemap)");
-    strcpy(filename, unitsfiles[0]);
-    strcpy(pathend(filename), file);
+/* With --explain, prints how the unit was reduced after processing it */
 
-    /* don't bother if we've just checked for it */
-    if (lastfilename && strcmp(filename, lastfilename)) {
-      map = openfile(filename,"rt");
-      if (print==SHOWFILES && !map)
-	showfilecheck(errno, filename);
-    }
-  }
+int
+processunit(struct unittype *theunit, char *unitstr, int promptlen)
+{
+  int err;
 
-  if (map) {
-    fclose(map);
-    return filename;
-  }
-  else {
-    if (filename)
-      free(filename);
-    return NULL;
-  }
+  if (!flags.explain)
+    return parsereduceunit(theunit, unitstr, promptlen);
+  startexplain();
+  err = parsereduceunit(theunit, unitstr, promptlen);
+  showexplain(unitstr);
+  endexplain();
+  return err;
 }
-#endif
+
+
 
 /*
-  Find the units database file. 
-  
-  If print is set to ERRMSG then display error message if the file is
-  not valid.  If print is set to SHOWFILES then display files that are
-  checked (when the filename is not a fully specified path).  If print
-  is set to NOERRMSG then do not display anything.
+   Checks the input parameter unitstr (a list of units separated by
+   UNITSEPCHAR) for errors.  All units must be parseable and
+   conformable to each other.  Returns 0 on success and 1 on failure.
 
-  Returns filename of valid database file or NULL if no file
-  was found.  
+   If an error is found then print an error message on stdout.  A
+   pointer ('^') will be printed to mark the error.  The promptlen
+   parameter should be set to the printing width of the prompt string
+   so that the pointer is correctly aligned.
+
+   To suppress the printing of the pointer set promptlen to NOPOINT.
+   To suppress printing of error messages entirely set promptlen to 
+   NOERRMSG.
 */
 
-char *
-findunitsfile(int print)
+
+int
+checkunitlist(char *unitstr, int promptlen)
 {
-  FILE *testfile=0;
-  char *file;
+  struct unittype unit[2], one;
+  char *firstunitstr,*nextunitstr;
+  int unitidx = 0;
 
-  file = getenv("UNITSFILE");
-  if (nonempty(file)) {
-    testfile = openfile(file, "rt");
-    if (!testfile) {
-      if (print==ERRMSG) {
-        fprintf(stderr,
-                "%s: cannot open units file '%s' in environment variable UNITSFILE.  ",
-                progname, file);
-        perror((char *) NULL);
+  int printerror = promptlen != NOERRMSG;
+
+  initializeunit(&one);
+
+  firstunitstr = unitstr;
+
+  initializeunit(unit);
+  initializeunit(unit+1);
+
+  while (unitstr) {
+    if ((nextunitstr = strchr(unitstr, UNITSEPCHAR)) != 0)
+      *nextunitstr = '\0';
+
+    if (!unitstr[strspn(unitstr, " ")]) {  /* unitstr is blank */
+      if (!nextunitstr) {  /* terminal UNITSEPCHAR indicates repetition */
+        freeunit(unit);    /* of last unit and is permitted */
+        return 0;
+      }
+      else {               /* internal blank units are not allowed */
+        if (printerror){
+          showpointer(promptlen);
+          puts("Error: blank unit not allowed");
+        }
+        freeunit(unit);
+        return 1;
       }
-      return NULL;
     }
-  }
 
-  if (!testfile && isfullpath(UNITSFILE)){
-    file = UNITSFILE;
-    testfile = openfile(file, "rt");
-    if (!testfile) {
-      if (print==ERRMSG) {
-        fprintf(stderr,
-                "%s: cannot open units data file '%s'.  ", progname, UNITSFILE);
-        perror((char *) NULL);
-      }
-      return NULL;
+    /* processunit() prints error messages; avoid it to supress them */
+
+    if ((printerror && processunit(unit+unitidx,unitstr,promptlen)) ||
+        (!printerror && 
+           (parseunit(unit+unitidx, unitstr,0,0) 
+             || completereduce(unit+unitidx) 
+             || compareunits(unit+unitidx,&one, ignore_primitive)))){
+      if (printerror)
+        printf("Error in unit list entry: %s\n",unitstr);
+      freeunit(unit);
+      freeunit(unit+1);
+      return 1;
     }
-  }      
 
-  if (!testfile && !progdir) {
-    if (print==ERRMSG) {
-      fprintf(stderr,
-              "%s: cannot open units file '%s' and cannot find program directory.\n", progname, UNITSFILE);
-      perror((char *) NULL);
+
+    if (unitidx == 0)
+      unitidx = 1;
+    else {
+      if (compareunits(unit, unit+1, ignore_dimless)){
+        if (printerror){
+          int wasverbose = flags.verbose;
+          FILE *savelog = logfile;
+          logfile=0;
+          flags.verbose = 2;   /* always use verbose form to be unambiguous */
+                               /* coverity[returned_null] */
+          *(strchr(firstunitstr, UNITSEPCHAR)) = '\0';
+          removespaces(firstunitstr);
+          removespaces(unitstr);
+          showpointer(promptlen);
+          showconformabilityerr(firstunitstr, unit, unitstr, unit+1);
+          flags.verbose = wasverbose;
+          logfile = savelog;
+        }
+        freeunit(unit);
+        freeunit(unit+1);
+        return 1;
+      }
+      freeunit(unit+1);
     }
-    return NULL;
-  }
 
-  if (!testfile) {
-    /* check the directory containing the units executable */
-    file = (char *) mymalloc(strlen(progdir)+strlen(UNITSFILE)+1,
-                             "(findunitsfile)");
-    strcpy(file, progdir);
-    strcat(file, UNITSFILE);
-    testfile = openfile(file, "rt");
-    if (print==SHOWFILES && !testfile)
-      showfilecheck(errno, file);
-    if (!testfile)
-      free(file);
+    if (nextunitstr) {
+      if (promptlen >= 0) promptlen += strwidth(unitstr)+1;
+      *(nextunitstr++) = UNITSEPCHAR;
+    }
+    unitstr = nextunitstr;
   }
 
-  /* check data directory */
-  if (!testfile && datadir) {
-    file = (char *) mymalloc(strlen(datadir) + strlen(UNITSFILE) + 2,
-                             "(findunitsfile)");
-    strcpy(file, datadir);
-    strcat(file, DIRSEPSTR);
-    strcat(file, UNITSFILE);
-    testfile = openfile(file, "rt");
-    if (print==SHOWFILES && !testfile)
-      showfilecheck(errno, file);
-    if (!testfile)
-      free(file);
-  }
+  freeunit(unit);
+
+  return 0;
+} /* end checkunitlist */
 
-  if (!testfile) {
-    if (print==ERRMSG)
-      fprintf(stderr,"%s: cannot find units file '%s'\n", progname, UNITSFILE);
-     return NULL;
-  }
-  else {
-    fclose(testfile);
-    return file;
-  }
-}
 
 /*
-  Find the user's home directory.  Unlike *nix, Windows doesn't usually
-  set HOME, so we check several other places as well.
+   Call either processunit or checkunitlist, depending on whether the
+   string 'unitstr' contains a separator character.  Returns 0 on
+   success and 1 on failure.  If an error occurs an error message is
+   printed to stdout.
+
+   A pointer will be printed if an error is detected, and  promptlen 
+   should be set to the printing width of the prompt string, or set 
+   it to NOPOINT to supress printing of the pointer.  
 */
-char *
-findhome(char **errmsg)
+
+int
+processwant(struct unittype *theunit, char *unitstr, int promptlen)
 {
-  struct stat statbuf;
-  int allocated = 0;
-  char *homedir;
-  char notfound[] = "Specified home directory '%s' does not exist";
-  char notadir[] = "Specified home directory '%s' is not a directory";
+  if (flags.unitlists && strchr(unitstr, UNITSEPCHAR))
+    return checkunitlist(unitstr, promptlen);
+  else
+    return processunit(theunit, unitstr, promptlen);
+}
 
-  /*
-    Under UNIX just check HOME.  Under Windows, if HOME is not set then
-    check HOMEDRIVE:HOMEPATH and finally USERPROFILE
-  */
-  homedir = getenv("HOME");
 
-#ifdef _WIN32
-  if (!nonempty(homedir)) {
-    /* try a few other places */
-    /* try HOMEDRIVE and HOMEPATH */
-    char *homedrive, *homepath;
-    if ((homedrive = getenv("HOMEDRIVE")) && *homedrive && (homepath = getenv("HOMEPATH")) && *homepath) {
-      homedir = mymalloc(strlen(homedrive)+strlen(homepath)+1,"(personalfile)");
-      allocated = 1;
-      strcpy(homedir, homedrive);
-      strcat(homedir, homepath);
-    }
+void
+checkalias(struct wantalias *aliasptr, int verbose)
+{
+  if (verbose)
+    printf("doing unit list '%s'\n", aliasptr->name);
+  if (checkunitlist(aliasptr->definition,NOERRMSG))
+    printf("Unit list '%s' contains errors\n", aliasptr->name);
+  if (ulookup(aliasptr->name))
+    printf("Unit list '%s' hides a unit definition.\n", aliasptr->name);
+  if (fnlookup(aliasptr->name))
+    printf("Unit list '%s' hides a function definition.\n", aliasptr->name);
+}
+
+
+/* Checks that a unit reduces to primitive units and that its meaning
+   does not depend on whether '-' is subtraction. */
+
+void
+checkunit(struct unitlist *uptr, int verbose)
+{
+  struct unittype have, second, one;
+
+  initializeunit(&one);
+  if (verbose)
+    printf("doing '%s'\n",uptr->name);
+  if (parseunit(&have, uptr->name,0,0) 
+      || completereduce(&have) 
+      || compareunits(&have,&one, ignore_primitive)){
+    if (fnlookup(uptr->name)) 
+      printf("Unit '%s' hidden by function '%s'\n", uptr->name, uptr->name);
     else
-      /* finally, try USERPROFILE */
-      homedir = getenv("USERPROFILE");
-  }
-#endif
-  
-  /*
-    If a home directory is specified, see if it exists and is a
-    directory.  If not set error message text. 
-  */
-  
-  if (nonempty(homedir)) {
-    if (stat(homedir, &statbuf) != 0) {
-      *errmsg = malloc(strlen(notfound)+strlen(homedir));
-      sprintf(*errmsg, notfound, homedir);
-    }
-    else if (!(statbuf.st_mode & S_IFDIR)) {
-      *errmsg = malloc(strlen(notadir)+strlen(homedir));
-      sprintf(*errmsg, notadir, homedir);
+      printf("'%s' defined as '%s' irreducible\n",uptr->name, uptr->value);
+  } else {
+    parserflags.minusminus = !parserflags.minusminus; 
+                                             /* coverity[check_return] */
+    parseunit(&second, uptr->name, 0, 0);    /* coverity[check_return] */
+    completereduce(&second);     /* Can't fail because it worked above */
+    if (compareunits(&have, &second, ignore_nothing)){
+      printf("'%s': replace '-' with '+-' for subtraction or '*' to multiply\n", uptr->name);
     }
-    if (!allocated)
-      homedir = dupstr(homedir);
-    return homedir;
-  }
-  else {
-    *errmsg = "no home directory";
-    return NULL;
+    freeunit(&second);
+    parserflags.minusminus=!parserflags.minusminus;
   }
+  freeunit(&have);
+}
+
+
+/* Checks a prefix by applying it to a test unit */
+
+void
+checkprefix(struct prefixlist *pptr, int verbose)
+{
+  struct unittype have, one;
+  char *prefixbuf, *testunit="meter";
+
+  initializeunit(&one);
+  if (verbose)
+    printf("doing '%s-'\n",pptr->name);
+  prefixbuf = mymalloc(strlen(pptr->name) + strlen(testunit) + 1,
+                       "(checkprefix)");
+  strcpy(prefixbuf,pptr->name);
+  strcat(prefixbuf,testunit);
+  if (parseunit(&have, prefixbuf,0,0) || completereduce(&have) || 
+      compareunits(&have,&one,ignore_primitive))
+    printf("'%s-' defined as '%s' irreducible\n",pptr->name, pptr->value);
+  else { 
+    int plevel;    /* check for bad '/' character in prefix */
+    char *ch;
+    plevel = 0;
+    for(ch=pptr->value;*ch;ch++){
+      if (*ch==')') plevel--;
+      else if (*ch=='(') plevel++;
+      else if (plevel==0 && *ch=='/'){
+        printf(
+          "'%s-' defined as '%s' contains a bad '/'. (Add parentheses.)\n",
+          pptr->name, pptr->value);
+        break;
+      }
+    }           
+  }  
+  freeunit(&have);
+  free(prefixbuf);
 }
 
+
 /*
-  Find a personal file.  First checks the specified environment variable 
-  (envname) for the filename to  use.  If this is unset then search user's 
-  home directory for basename.  If there is no home directory, returns 
-  NULL.  Otherwise if the file exists then returns its name in newly allocated
-  space and sets *exists to 1. If the file does not exist then sets *exist to 
-  zero and:
-      With checkonly == 0, prints error message and returns NULL
-      With checkonly != 0, returns filename (does not print error message)
+   The checks are run in phases (functions, unit lists, units and
+   prefixes).  Each phase collects its items in table order and passes
+   them to runcheckphase(), which can divide them between worker
+   processes.  Every worker takes a contiguous run of items and writes
+   its messages to a temporary file; the files are copied to stdout in
+   order afterwards, so the output is the same as for a serial check.
+
+   When results are tracked (for --check-changed), each item's output
+   is captured so that items which print nothing can be recorded as
+   clean, and the time for each item is kept for the per-file report.
 */
-char *
-personalfile(const char *envname, const char *basename,
-             int checkonly, int *exists)
+
+struct checkphase {
+  char *name;
+  char kind;             /* key character for the check cache */
+  void (*check)(void *item, int verbose);
+  void **items;
+  char **names;
+  char **files;          /* file where each item is defined */
+  int count;
+  int alloc;
+  double seconds;        /* wall clock time used by the phase */
+  char *skip;            /* items known to be clean, or NULL */
+  char *clean;           /* set for items that printed nothing, or NULL */
+  double *times;         /* time for each item, or NULL */
+};
+
+void
+checkfuncitem(void *item, int verbose)
 {
-  FILE *testfile;
-  char *filename=NULL;
+  checkfunc((struct func *)item, verbose);
+}
 
-  *exists = 0; 
+void
+checkaliasitem(void *item, int verbose)
+{
+  checkalias((struct wantalias *)item, verbose);
+}
 
-  /* First check the specified environment variable for a file name */ 
-  if (envname) 
-    filename = getenv(envname);
-  if (nonempty(filename)){       
-    testfile = openfile(filename, "rt");
-    if (testfile){
-      fclose(testfile);
-      *exists = 1;
-      return filename;
-    }
-    if (checkonly)
-      return filename;
-    else {
-      fprintf(stderr, "%s: cannot open file '%s' specified in %s environment variable: ",
-              progname, filename, envname);
-      perror((char *) NULL);
-      return NULL;
-    }
+void
+checkunititem(void *item, int verbose)
+{
+  checkunit((struct unitlist *)item, verbose);
+}
+
+void
+checkprefixitem(void *item, int verbose)
+{
+  checkprefix((struct prefixlist *)item, verbose);
+}
+
+
+void *
+growarray(void *array, int size, const char *mesg)
+{
+  array = realloc(array, size);
+  if (!array){
+    fprintf(stderr, "%s: memory allocation error %s\n", progname, mesg);
+    exit(EXIT_FAILURE);
   }
-  /* Environment variable not set: look in home directory */
-  else if (nonempty(homedir)) {
-    filename = mymalloc(strlen(homedir)+strlen(basename)+2,
-                        "(personalfile)");
-    strcpy(filename,homedir);
+  return array;
+}
 
-    if (strcmp(homedir, "/") && strcmp(homedir, "\\"))
-      strcat(filename,DIRSEPSTR);
-    strcat(filename,basename);
 
-    testfile = openfile(filename, "rt");
-    if (testfile){
-      fclose(testfile);
-      *exists = 1;
-      return filename;
-    }
-    if (checkonly)
-      return filename;
-    else {
-      if (errno==EACCES || errno==EISDIR) {
-        fprintf(stderr,"%s: cannot open file '%s': ",progname,filename);
-        perror(NULL);
-      }
-      free(filename);
-      return NULL;
+void
+addcheckitem(struct checkphase *phase, void *item, char *name, char *file)
+{
+  if (phase->count == phase->alloc){
+    phase->alloc = phase->alloc ? 2 * phase->alloc : 64;
+    phase->items = growarray(phase->items, phase->alloc * sizeof(void *),
+                             "(addcheckitem)");
+    phase->names = growarray(phase->names, phase->alloc * sizeof(char *),
+                             "(addcheckitem)");
+    phase->files = growarray(phase->files, phase->alloc * sizeof(char *),
+                             "(addcheckitem)");
+  }
+  phase->items[phase->count] = item;
+  phase->names[phase->count] = name;
+  phase->files[phase->count] = file;
+  phase->count++;
+}
+
+
+/* Runs the checks for items start..end-1.  If results are tracked,
+   stdout must be a file so that the output of each item can be
+   measured, and the results are also written to status if it is not
+   NULL. */
+
+void
+runcheckitems(struct checkphase *phase, int start, int end, int verbose,
+              FILE *status)
+{
+  long pos;
+  int i;
+
+  for(i=start;i<end;i++){
+    if (phase->skip && phase->skip[i])
+      continue;
+    if (!phase->clean){
+      phase->check(phase->items[i], verbose);
+      continue;
     }
+    fflush(stdout);
+    pos = ftell(stdout);
+    phase->times[i] = walltime();
+    phase->check(phase->items[i], verbose);
+    fflush(stdout);
+    phase->times[i] = walltime() - phase->times[i];
+    phase->clean[i] = pos >= 0 && ftell(stdout) == pos;
+    if (status)
+      fprintf(status, "%d %d %.9f\n", i, phase->clean[i], phase->times[i]);
   }
-  else
-    return NULL;
 }
 
 
-/* print usage message */
+/* Copies the contents of a temporary file to stdout and closes it */
 
-void 
-usage()
+void
+copytostdout(FILE *fp)
 {
-  int nlines;
-  char *unitsfile;
-  char *msg = "\nUsage: %s [options] ['from-unit' 'to-unit']\n\n\
-Options:\n\
-    -h, --help           show this help and exit\n\
-    -c, --check          check that all units reduce to primitive units\n\
-        --check-verbose  like --check, but lists units as they are checked\n\
-        --verbose-check    so you can find units that cause endless loops\n\
-    -d, --digits         show output to specified number of digits (default: %d)\n\
-    -e, --exponential    exponential format output\n\
-    -f, --file           specify a units data file (-f '' loads default file)\n"
-#ifdef READLINE
-"\
-    -H, --history        specify readline history file (-H '' disables history)\n"
-#endif
-"\
-    -L, --log            specify a file to log conversions\n\
-    -l, --locale         specify a desired locale\n\
-    -m, --minus          make - into a subtraction operator (default)\n\
-        --oldstar        use old '*' precedence, higher than '/'\n\
-        --newstar        use new '*' precedence, equal to '/'\n\
-    -n, --nolists        disable conversion to unit lists\n\
-    -S, --show-factor    show non-unity factor before 1|x in multi-unit output\n\
-        --conformable    in non-interactive mode, show all conformable units\n\
-    -o, --output-format  specify printf numeric output format (default: %%.%d%c)\n\
-    -p, --product        make '-' into a product operator\n\
-    -q, --quiet          suppress prompting\n\
-        --silent         same as --quiet\n\
-    -s, --strict         suppress reciprocal unit conversion (e.g. Hz<->s)\n\
-    -v, --verbose        show slightly more verbose output\n\
-        --compact        suppress printing of tab, '*', and '/' character\n\
-    -1, --one-line       suppress the second line of output\n\
-    -t, --terse          terse output (--strict --compact --quiet --one-line)\n\
-    -r, --round          round last element of unit list output to an integer\n\
-    -U, --unitsfile      show units data filename and exit\n\
-    -u, --units          specify a CGS unit system (gauss[ian]|esu|emu)\n\
-    -V, --version        show version, data filenames (with -t: version only)\n\
-    -I, --info           show version, files, and program properties\n";
-  FILE *fp = NULL;
+  char buf[BUFSIZ];
+  size_t len;
+
+  rewind(fp);
+  while ((len = fread(buf, 1, sizeof(buf), fp)))
+    fwrite(buf, 1, len, stdout);
+  fclose(fp);
+}
 
-  unitsfile = findunitsfile(NOERRMSG);
 
-  nlines = countlines(msg);
-  /* see if we need a pager */
-  fp = get_output_fp(nlines + 4);
+#ifdef USE_FORK
 
-  fprintf(fp, msg, progname, DEFAULTPRECISION, DEFAULTPRECISION, DEFAULTTYPE);
-  if (!unitsfile)
-    fprintf(fp, "Units data file '%s' not found.\n\n", UNITSFILE);
-  else
-    fprintf(fp, "\nTo learn about the available units look in '%s'\n\n", unitsfile);
-  fputs("Report bugs to adrianm@gnu.org.\n\n", fp);
+/* Runs the checks for a phase in worker processes.  Returns 0 on
+   success, or 1 if the workers could not be run, in which case no
+   output has been produced. */
 
-  if (fp != stdout)
-    pclose(fp);
+int
+checkparallel(struct checkphase *phase, int verbose, int jobs)
+{
+  FILE **out, **status;
+  pid_t *pid;
+  char *line=0;
+  int linelen=0, index, clean;
+  double seconds;
+  int j, ok = 1;
+  int status_code;
+
+  out = (FILE **) mymalloc(jobs*sizeof(FILE *), "(checkparallel)");
+  status = (FILE **) mymalloc(jobs*sizeof(FILE *), "(checkparallel)");
+  pid = (pid_t *) mymalloc(jobs*sizeof(pid_t), "(checkparallel)");
+  fflush(stdout);
+  fflush(stderr);
+  for(j=0;j<jobs;j++){
+    pid[j] = -1;
+    status[j] = 0;
+    if (!(out[j] = tmpfile()) || (phase->clean && !(status[j] = tmpfile())))
+      ok = 0;
+  }
+  for(j=0;ok && j<jobs;j++){
+    pid[j] = fork();
+    if (pid[j] == 0){
+      if (dup2(fileno(out[j]), fileno(stdout)) < 0)
+        _exit(EXIT_FAILURE);
+      runcheckitems(phase, j*phase->count/jobs, (j+1)*phase->count/jobs,
+                    verbose, status[j]);
+      fflush(stdout);
+      if (status[j])
+        fflush(status[j]);
+      _exit(ferror(stdout) ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+    if (pid[j] < 0)
+      ok = 0;
+  }
+  for(j=0;j<jobs;j++)
+    if (pid[j] > 0 && (waitpid(pid[j], &status_code, 0) != pid[j]
+                       || !WIFEXITED(status_code) || WEXITSTATUS(status_code)))
+      ok = 0;
+  for(j=0;j<jobs;j++){
+    if (out[j]){
+      if (ok)
+        copytostdout(out[j]);
+      else
+        fclose(out[j]);
+    }
+    if (status[j]){
+      rewind(status[j]);
+      while (ok && fgetslong(&line, &linelen, status[j], 0))
+        if (sscanf(line, "%d %d %lf", &index, &clean, &seconds) == 3
+            && index >= 0 && index < phase->count){
+          phase->clean[index] = clean;
+          phase->times[index] = seconds;
+        }
+      fclose(status[j]);
+    }
+  }
+  free(line);
+  free(out);
+  free(status);
+  free(pid);
+  return !ok;
 }
 
-/* Print message about how to get help */
+#endif
 
-void 
-helpmsg()
-{
-  fprintf(stderr,"\nTry '%s --help' for more information.\n",progname);
-  exit(EXIT_FAILURE);
-}
 
-/* show units version, and optionally, additional information */
 void
-printversion()
+runcheckphase(struct checkphase *phase, int verbose, int jobs)
 {
-  int exists;
-  char *u_unitsfile = NULL;  /* units data file specified in UNITSFILE */
-  char *m_unitsfile;         /* personal units data file from HOME_UNITS_ENV */
-  char *p_unitsfile;         /* personal units data file */
-  FILE *fp, *histfile;
-#ifdef _WIN32
-  char *localemap;
-#endif
+  FILE *capture;
+  int saved;
 
-  if (flags.verbose == 0) {
-    printf("GNU Units version %s\n", VERSION);
+  phase->seconds = walltime();
+#ifdef USE_FORK
+  if (jobs > 1 && phase->count >= MINPARALLEL && !verbose
+      && !checkparallel(phase, verbose, jobs)){
+    phase->seconds = walltime() - phase->seconds;
     return;
   }
-
-  printf("GNU Units version %s\n%s, %s, locale %s\n",
-         VERSION, RVERSTR,UTF8VERSTR,mylocale);
-#if defined (_WIN32) && defined (HAVE_MKS_TOOLKIT)
-  puts("With MKS Toolkit");
 #endif
-
-  if (flags.verbose == 2) {
-    if (!fullprogname)
-      getprogdir(progname, &fullprogname);
-    if (fullprogname)
-      printf("\n%s program is %s\n", progname, fullprogname);
+  capture = 0;
+  saved = -1;
+  if (phase->clean){
+    fflush(stdout);
+    if ((capture = tmpfile()) && (saved = dup(fileno(stdout))) >= 0
+        && dup2(fileno(capture), fileno(stdout)) < 0){
+      close(saved);
+      saved = -1;
+    }
+  }
+  runcheckitems(phase, 0, phase->count, verbose, 0);
+  if (saved >= 0){
+    fflush(stdout);
+    dup2(saved, fileno(stdout));
+    close(saved);
   }
+  if (capture)
+    copytostdout(capture);
+  phase->seconds = walltime() - phase->seconds;
+}
 
-  /* units data file */
 
-  putchar('\n');
-  if (isfullpath(UNITSFILE))
-    printf("Default units data file is '%s'\n", UNITSFILE);
+/*
+   The check cache used by --check-changed records the definitions that
+   passed the check.  Each entry is keyed by the kind and name of the
+   definition and a hash of its text together with the text of every
+   definition it depends on, directly or indirectly.  A definition is
+   checked again only if that hash is not in the cache, so an edit to
+   one line rechecks that definition and the ones that use it.  The
+   cache is discarded if the program version or parser flags change.
+*/
+
+#define CHECKCACHE_ENV "UNITS_CHECK_CACHE"
+#define CHECKCACHE_FILE ".units_check"
+#define CHECKCACHE_HEADER "# units check cache"
+#define CHECKCACHE_SIZE 1024
+
+typedef unsigned long long checkhash;
+
+#define CHECKHASH_SEED 14695981039346656037ULL    /* FNV-1a 64 bit */
+#define CHECKHASH_PRIME 1099511628211ULL
+
+checkhash
+hashbytes(checkhash h, const void *data, int len)
+{
+  const unsigned char *ptr = (const unsigned char *) data;
+
+  while (len--)
+    h = (h ^ *ptr++) * CHECKHASH_PRIME;
+  return h;
+}
+
+/* Hashes a string including its terminating null, or a marker for a
+   NULL pointer, so that adjacent fields cannot run together. */
+
+checkhash
+hashtext(checkhash h, const char *str)
+{
+  if (!str)
+    return hashbytes(h, "\377", 1);
+  return hashbytes(h, str, strlen(str)+1);
+}
+
+checkhash
+hashvalue(checkhash h, checkhash value)
+{
+  return hashbytes(h, &value, sizeof(value));
+}
+
+
+/* Closure hashes are memoized by the address of the table entry */
+
+#define CLOSURE_ACTIVE 1
+#define CLOSURE_DONE 2
+
+struct {
+  void **keys;
+  checkhash *hashes;
+  char *state;
+  int size;                    /* a power of two */
+} closurememo;
+
+int
+closureslot(void *key)
+{
+  int slot = ((size_t) key >> 4) & (closurememo.size-1);
+
+  while (closurememo.keys[slot] && closurememo.keys[slot] != key)
+    slot = (slot+1) & (closurememo.size-1);
+  closurememo.keys[slot] = key;
+  return slot;
+}
+
+checkhash unitclosure(struct unitlist *uptr);
+checkhash funcclosure(struct func *fun);
+checkhash prefixclosure(struct prefixlist *pfx);
+
+void
+closureunitname(char *name, void *data)
+{
+  checkhash *h = (checkhash *) data;
+  struct unitlist *uptr;
+  struct prefixlist *pfx;
+
+  *h = hashtext(*h, name);
+  if ((uptr = findunitentry(name, 1)))
+    *h = hashvalue(*h, unitclosure(uptr));
   else
-    printf("Default units data file is '%s';\n  %s will search for this file\n",
-           UNITSFILE, progname);
-  if (flags.verbose < 2)
-    printf("Default personal units file: %s\n", homeunitsfile);
+    *h = hashtext(*h, 0);
+  if (!ulookup(name) && (pfx = plookup(name)))
+    *h = hashvalue(*h, prefixclosure(pfx));
+}
 
-  if (flags.verbose == 2){
-    u_unitsfile = getenv("UNITSFILE");
-    if (u_unitsfile)
-      printf("Environment variable UNITSFILE set to '%s'\n", u_unitsfile);
-    else
-      puts("Environment variable UNITSFILE not set");
+void
+closurefuncname(struct func *fun, void *data)
+{
+  checkhash *h = (checkhash *) data;
 
-    unitsfiles[0] = findunitsfile(SHOWFILES);
-    
-    if (unitsfiles[0]) {
-      /* We searched for the file in program and data dirs */
-      if (!isfullpath(UNITSFILE) && !nonempty(u_unitsfile))
-        printf("Found data file '%s'\n", unitsfiles[0]);
-      else
-        printf("Units data file is '%s'\n", unitsfiles[0]);
-    } 
-    else {
-      if (errno && (nonempty(u_unitsfile) || isfullpath(UNITSFILE)))
-        printf("*** Units data file invalid: %s ***\n",strerror(errno));
-      else
-        puts("*** Units data file not found ***");
-    }
-    if (homedir_error)
-      printf("\n%s\n", homedir_error);
-    else
-      printf("\nHome directory is '%s'\n", homedir);
-  }
+  *h = hashvalue(*h, funcclosure(fun));
+}
 
-  /* personal units data file: environment */
-  if (flags.verbose == 2){
-    m_unitsfile = getenv(HOME_UNITS_ENV);
-    putchar('\n');
-    if (m_unitsfile) {
-      printf("Environment variable %s set to '%s'\n",
-             HOME_UNITS_ENV,m_unitsfile);
-    }
-    else
-      printf("Environment variable %s not set\n", HOME_UNITS_ENV);
+/* Hashes def together with the closures of the names used in it */
 
-    p_unitsfile = personalfile(HOME_UNITS_ENV, homeunitsfile, 1, &exists);
-    if (p_unitsfile) {
-      printf("Personal units data file is '%s'\n", p_unitsfile);
-      if (!exists){
-        if (homedir_error && !nonempty(m_unitsfile))
-          printf("  (File invalid: %s)\n", homedir_error);
-        else if (errno==ENOENT && !nonempty(m_unitsfile))
-          puts("  (File does not exist)");
-        else 
-          printf("  (File invalid: %s)\n",strerror(errno));
-      }  
-    }
-    else
-      puts("Personal units data file not found: no home directory");
+checkhash
+hashdefinition(checkhash h, char *def)
+{
+  h = hashtext(h, def);
+  if (def && !strchr(def, PRIMITIVECHAR))
+    foreachname(def, closureunitname, closurefuncname, &h);
+  return h;
+}
+
+/* Starts the closure computation for an entry.  Returns 1 and sets
+   *slot if the closure must be computed, or returns 0 and sets *h to
+   the stored value.  A cycle is cut by using the entry's name alone. */
+
+int
+closurestart(void *key, char *name, int *slot, checkhash *h)
+{
+  *slot = closureslot(key);
+  if (closurememo.state[*slot] == CLOSURE_DONE){
+    *h = closurememo.hashes[*slot];
+    return 0;
   }
-#ifdef READLINE
-  if (flags.verbose == 2) {
-    historyfile = personalfile(NULL,HISTORY_FILE,1,&exists);
-    if (historyfile){
-      printf("\nDefault readline history file is '%s'\n", historyfile);
-      histfile = openfile(historyfile,"r+");
-      if (!histfile)
-        printf("  (File invalid: %s)\n",
-               homedir_error ? homedir_error : strerror(errno));
-      else
-        fclose(histfile);
-    }  
-    else 
-      puts("\nReadline history file unusable: no home directory");
+  if (closurememo.state[*slot] == CLOSURE_ACTIVE){
+    *h = hashtext(CHECKHASH_SEED, name);
+    return 0;
   }
-#endif
+  closurememo.state[*slot] = CLOSURE_ACTIVE;
+  return 1;
+}
 
-#ifdef _WIN32
-  /* locale map */
-  if (flags.verbose == 2) {
-    putchar('\n');
-    localemap = getenv("UNITSLOCALEMAP");
-    if (localemap)
-      printf("Environment variable UNITSLOCALEMAP set to '%s'\n", localemap);
-    else
-      puts("Environment variable UNITSLOCALEMAP not set");
+checkhash
+closuredone(int slot, checkhash h)
+{
+  closurememo.state[slot] = CLOSURE_DONE;
+  closurememo.hashes[slot] = h;
+  return h;
+}
 
-    if (isfullpath(LOCALEMAP))
-      printf("Default locale map is '%s'\n", LOCALEMAP);
-    else
-      printf("Default locale map is '%s';\n  %s will search for this file\n",
-             LOCALEMAP, progname);
+checkhash
+unitclosure(struct unitlist *uptr)
+{
+  checkhash h;
+  int slot;
 
-    localemap = findlocalemap(SHOWFILES);
-    if (localemap && !isfullpath(LOCALEMAP))
-      printf("Found locale map '%s'\n", localemap);
-    else if (localemap)
-      printf("Locale map is '%s'\n", localemap);
-    else
-      puts("*** Locale map not found ***");
-  }
-#endif
+  if (!closurestart(uptr, uptr->name, &slot, &h))
+    return h;
+  h = hashtext(CHECKHASH_SEED, "unit");
+  h = hashtext(h, uptr->name);
+  h = hashdefinition(h, uptr->value);
+  return closuredone(slot, h);
+}
 
-  printf("\n%s\n\n", LICENSE);
+checkhash
+prefixclosure(struct prefixlist *pfx)
+{
+  checkhash h;
+  int slot;
+
+  if (!closurestart(pfx, pfx->name, &slot, &h))
+    return h;
+  h = hashtext(CHECKHASH_SEED, "prefix");
+  h = hashtext(h, pfx->name);
+  h = hashdefinition(h, pfx->value);
+  return closuredone(slot, h);
 }
 
-void
-showunitsfile()
+checkhash
+hashfunctype(checkhash h, struct functype *ft)
+{
+  h = hashtext(h, ft->param);
+  h = hashdefinition(h, ft->def);
+  h = hashdefinition(h, ft->dimen);
+  h = hashtext(h, ft->domain_min ? "min" : 0);
+  if (ft->domain_min)
+    h = hashbytes(h, ft->domain_min, sizeof(double));
+  h = hashtext(h, ft->domain_max ? "max" : 0);
+  if (ft->domain_max)
+    h = hashbytes(h, ft->domain_max, sizeof(double));
+  h = hashbytes(h, &ft->domain_min_open, sizeof(int));
+  return hashbytes(h, &ft->domain_max_open, sizeof(int));
+}
+
+checkhash
+funcclosure(struct func *fun)
 {
-  char *unitsfile;
-  unitsfile = findunitsfile(NOERRMSG);
-  if (unitsfile)
-    printf("%s\n", unitsfile);
-  else
-    puts("Units data file not found");
+  checkhash h;
+  int slot;
+
+  if (!closurestart(fun, fun->name, &slot, &h))
+    return h;
+  h = hashtext(CHECKHASH_SEED, "function");
+  h = hashtext(h, fun->name);
+  if (fun->table){     /* the other fields are only set for one kind */
+    h = hashdefinition(h, fun->tableunit);
+    h = hashbytes(h, &fun->tablelen, sizeof(int));
+    h = hashbytes(h, fun->table, fun->tablelen * sizeof(struct pair));
+  } else {
+    h = hashfunctype(h, &fun->forward);
+    h = hashfunctype(h, &fun->inverse);
+  }
+  h = hashbytes(h, &fun->skip_error_check, sizeof(int));
+  return closuredone(slot, h);
 }
 
 
-char *shortoptions = "VIUu:vqechSstf:o:d:mnpr1l:L:"
-#ifdef READLINE
-    "H:"
-#endif
-  ;
+/* Returns the closure hash of a unit name, or of a marker if the unit
+   is not defined */
 
-struct option longoptions[] = {
-  {"check", no_argument, &flags.unitcheck, 1},
-  {"check-verbose", no_argument, &flags.unitcheck, 2},
-  {"compact", no_argument, &flags.verbose, 0},
-  {"digits", required_argument, 0, 'd'},
-  {"exponential", no_argument, 0, 'e'},
-  {"file", required_argument, 0, 'f'},
-  {"help", no_argument, 0, 'h'},
-#ifdef READLINE  
-  {"history", required_argument, 0, 'H'},
-#endif  
-  {"info", no_argument, 0, 'I'},
-  {"locale", required_argument, 0, 'l'}, 
-  {"log", required_argument, 0, 'L'}, 
-  {"minus", no_argument, &parserflags.minusminus, 1},
-  {"newstar", no_argument, &parserflags.oldstar, 0},
-  {"nolists", no_argument, 0, 'n'},
-  {"oldstar", no_argument, &parserflags.oldstar, 1},
-  {"one-line", no_argument, &flags.oneline, 1},
-  {"output-format", required_argument, 0, 'o'},
-  {"product", no_argument, &parserflags.minusminus, 0},
-  {"quiet", no_argument, &flags.quiet, 1},
-  {"round",no_argument, 0, 'r'},
-  {"show-factor", no_argument, 0, 'S'},
-  {"conformable", no_argument, &flags.showconformable, 1 },
-  {"silent", no_argument, &flags.quiet, 1},
-  {"strict",no_argument,&flags.strictconvert, 1},
-  {"terse",no_argument, 0, 't'},
-  {"unitsfile", no_argument, 0, 'U'},
-  {"units", required_argument, 0, 'u'},
-  {"verbose", no_argument, &flags.verbose, 2},
-  {"verbose-check", no_argument, &flags.unitcheck, 2},
-  {"version", no_argument, 0, 'V'},
-  {0,0,0,0} };
+checkhash
+namedunitclosure(char *name)
+{
+  struct unitlist *uptr;
+
+  uptr = ulookup(name);
+  return uptr ? unitclosure(uptr) : hashtext(CHECKHASH_SEED, 0);
+}
 
-/* Process the args.  Returns 1 if interactive mode is desired, and 0
-   for command line operation.  If units appear on the command line
-   they are returned in the from and to parameters. */
+
+/* Computes the cache key hash for item i of a phase.  Besides the
+   closure of the definition, the key includes whatever else the check
+   for that kind of definition looks at. */
+
+checkhash
+checkitemhash(struct checkphase *phase, int i)
+{
+  struct prefixlist *pfx;
+  checkhash h;
+  int k;
+
+  h = hashtext(CHECKHASH_SEED, phase->name);
+  switch (phase->kind){
+    case 'f':
+      h = hashvalue(h, funcclosure((struct func *) phase->items[i]));
+      h = hashtext(h, plookup(phase->names[i]) ? "prefix" : 0);
+      h = hashvalue(h, namedunitclosure("kg"));
+      h = hashvalue(h, namedunitclosure("K"));
+      break;
+    case 'a':
+      h = hashtext(h, phase->names[i]);
+      h = hashdefinition(h, ((struct wantalias *) phase->items[i])->definition);
+      h = hashtext(h, ulookup(phase->names[i]) ? "unit" : 0);
+      h = hashtext(h, fnlookup(phase->names[i]) ? "function" : 0);
+      break;
+    case 'u':
+      h = hashvalue(h, unitclosure((struct unitlist *) phase->items[i]));
+      h = hashtext(h, fnlookup(phase->names[i]) ? "function" : 0);
+      break;
+    case 'p':
+      h = hashvalue(h, prefixclosure((struct prefixlist *) phase->items[i]));
+      h = hashvalue(h, namedunitclosure("meter"));
+      for(k=0;k<SIMPLEHASHSIZE;k++)    /* the test unit may parse */
+        for(pfx = ptab[k]; pfx; pfx = pfx->next)  /* with another prefix */
+          h = hashtext(h, pfx->name);
+      break;
+  }
+  return h;
+}
+
+
+/* A set of cache lines, each "kind hash name" */
+
+struct {
+  char **lines[CHECKCACHE_SIZE];
+  int count[CHECKCACHE_SIZE];
+} checkcache;
+
+char *
+checkcacheline(struct checkphase *phase, int i, checkhash h)
+{
+  char *line;
+
+  line = mymalloc(strlen(phase->names[i]) + 21, "(checkcacheline)");
+  sprintf(line, "%c %016llx %s", phase->kind, h, phase->names[i]);
+  return line;
+}
 
 int
-processargs(int argc, char **argv, char **from, char **to)
+checkcachefind(char *line)
 {
-   extern char *optarg;
-   extern int optind;
-   int optchar, optindex;
-   int ind;
-   int doprintversion=0;
-   char *unitsys=0;
-   
-   // Reset getopt
-   optind = 1;
-   optarg = NULL;
+  int slot = uhash(line) % CHECKCACHE_SIZE, i;
 
-   while ( -1 != 
-      (optchar = 
-         getopt_long(argc, argv,shortoptions,longoptions, &optindex ))) {
-      switch (optchar) {
-         case 'm':
-            parserflags.minusminus = 1;
-            break;
-         case 'p':
-            parserflags.minusminus = 0;
-            break;
-         case 't':
-            flags.oneline = 1;
-            flags.quiet = 1;
-            flags.strictconvert = 1;
-            flags.verbose = 0;
-            break;
+  for(i=0;i<checkcache.count[slot];i++)
+    if (!strcmp(checkcache.lines[slot][i], line))
+      return 1;
+  return 0;
+}
 
-         /* numeric output format */
-         case 'd':
-            if (checksigdigits(optarg) < 0)
-              exit(EXIT_FAILURE);
-            else    /* ignore anything given with 'o' option */
-              num_format.format = NULL; 
-            break;
-         case 'e':  /* ignore anything given with 'o' option */
-            num_format.format = NULL;   
-            num_format.type = 'e';
-            break;
-         case 'o':
-            num_format.format = optarg;
-            break;
+void
+checkcacheadd(char *line)
+{
+  int slot = uhash(line) % CHECKCACHE_SIZE;
 
-         case 'c':
-            flags.unitcheck = 1;
-            break;
-         case 'f':
-            for(ind=0;unitsfiles[ind];ind++); 
-            if (ind==MAXFILES){
-              fprintf(stderr, "At most %d -f specifications are allowed\n",
-                      MAXFILES);
-              exit(EXIT_FAILURE);
-            }
-            if (optarg && *optarg)
-              unitsfiles[ind] = optarg;
-            else {
-              unitsfiles[ind] = findunitsfile(ERRMSG);
-              if (!unitsfiles[ind]) 
-                exit(EXIT_FAILURE);
-            }
-            unitsfiles[ind+1] = 0;
-            break;
-         case 'L':
-            logfilename = optarg;
-            break;
-         case 'l':
-            mylocale = optarg;
-            break;
-         case 'n':
-            flags.unitlists = 0;
-            break;
-         case 'q':
-            flags.quiet = 1;
-            break; 
-         case 'r':
-            flags.round = 1;
-            break;
-         case 'S':
-            flags.showfactor = 1;
-            break;
-         case 's':
-            flags.strictconvert = 1;
-            break;
-         case 'v':
-            flags.verbose = 2;
-            break;
-         case '1':
-            flags.oneline = 1;
-            break;
-         case 'I':
-            flags.verbose = 2;  /* fall through */
-         case 'V':
-            doprintversion = 1;
-            break;
-         case 'U':
-            showunitsfile();
-            exit(EXIT_SUCCESS);
-            break;
-         case 'u':
-            unitsys = optarg;
-            for(ind=0;unitsys[ind];ind++)
-              unitsys[ind] = tolower(unitsys[ind]);
-            break;
-         case 'h':
-            usage();
-            exit(EXIT_SUCCESS);
-#ifdef READLINE     
-         case 'H':
-           if (emptystr(optarg))
-              historyfile=NULL;
-            else
-              historyfile = optarg;
-            break;
-#endif      
-         case 0: break;  /* This is reached if a long option is 
-                            processed with no return value set. */
-         case '?':        /* Invalid option or missing argument returns '?' */
-         default:
-            helpmsg();    /* helpmsg() exits with error */
-      } 
-   }
+  checkcache.lines[slot] = growarray(checkcache.lines[slot],
+                                     (checkcache.count[slot]+1)*sizeof(char *),
+                                     "(checkcacheadd)");
+  checkcache.lines[slot][checkcache.count[slot]++] = dupstr(line);
+}
 
-   if (doprintversion){
-     printversion();
-     exit(EXIT_SUCCESS);
-   }
+void
+checkcachefree(void)
+{
+  int i, j;
 
-   /* command-line option overwrites environment */
-   if (unitsys)
-     setenv("UNITS_SYSTEM", unitsys, 1);
+  for(i=0;i<CHECKCACHE_SIZE;i++){
+    for(j=0;j<checkcache.count[i];j++)
+      free(checkcache.lines[i][j]);
+    free(checkcache.lines[i]);
+    checkcache.lines[i] = 0;
+    checkcache.count[i] = 0;
+  }
+}
 
-   if (flags.unitcheck) {
-     if (optind != argc){
-       fprintf(stderr, 
-               "Too many arguments (arguments are not allowed with -c).\n");
-       helpmsg();         /* helpmsg() exits with error */
-     }
-   } else {
-     if (optind == argc - 2) {
-        if (flags.showconformable) {
-          fprintf(stderr,"Too many arguments (only one unit expression allowed with '--conformable').\n");
-          helpmsg();             /* helpmsg() exits with error */
-        }
-        flags.quiet=1;
-        *from = argv[optind];
-        *to = dupstr(argv[optind+1]); /* This string may get rewritten later */
-        return 0;                     /* and we might call free() on it      */
-     }
+char *
+checkcacheheader(void)
+{
+  static char header[80];
 
-     if (optind == argc - 1) {
-        flags.quiet=1;
-        *from = argv[optind];
-        *to=0;
-        return 0;
-     }
-     if (optind < argc - 2) {
-        fprintf(stderr,"Too many arguments (maybe you need quotes).\n");
-        helpmsg();             /* helpmsg() exits with error */
-     }
-   }
+  sprintf(header, "%s %s %d %d", CHECKCACHE_HEADER, VERSION,
+          parserflags.oldstar, parserflags.minusminus);
+  return header;
+}
 
-   return 1;
+void
+readcheckcache(char *filename)
+{
+  FILE *fp;
+  char *line=0;
+  int linelen=0;
+
+  if (!filename || !(fp = fopen(filename, "r")))
+    return;
+  if (fgetslong(&line, &linelen, fp, 0)){
+    removespaces(line);
+    if (!strcmp(line, checkcacheheader()))
+      while (fgetslong(&line, &linelen, fp, 0)){
+        removespaces(line);
+        if (*line)
+          checkcacheadd(line);
+      }
+  }
+  free(line);
+  fclose(fp);
 }
 
-/* 
-   Show a pointer under the input to indicate a problem.
-   Prints 'position' spaces and then the pointer.
-   If 'position' is negative, nothing is printed.
- */
+/* Writes the cache to a temporary file that replaces the old cache, so
+   that an interrupted check leaves the old cache intact. */
 
 void
-showpointer(int position)
+writecheckcache(char *filename, struct checkphase *phases, int nphases,
+                checkhash **hashes)
 {
-  if (position >= 0){
-    while (position--) putchar(' ');
-    puts("^");
+  FILE *fp;
+  char *tmpname, *line;
+  int i, k;
+
+  tmpname = mymalloc(strlen(filename)+5, "(writecheckcache)");
+  sprintf(tmpname, "%s.tmp", filename);
+  if (!(fp = fopen(tmpname, "w"))){
+    fprintf(stderr, "%s: cannot write check cache '%s': ", progname, tmpname);
+    perror(NULL);
+    free(tmpname);
+    return;
   }
-} /* end showpointer */
+  fprintf(fp, "%s\n", checkcacheheader());
+  for(k=0;k<nphases;k++)
+    for(i=0;i<phases[k].count;i++)
+      if (phases[k].skip[i] || phases[k].clean[i]){
+        line = checkcacheline(&phases[k], i, hashes[k][i]);
+        fprintf(fp, "%s\n", line);
+        free(line);
+      }
+  if (fclose(fp) || rename(tmpname, filename)){
+    fprintf(stderr, "%s: cannot write check cache '%s': ", progname, filename);
+    perror(NULL);
+    remove(tmpname);
+  }
+  free(tmpname);
+}
+
+
+/* Prints the number of definitions checked and the time used for each
+   data file */
+
+struct filetiming {
+  char *file;
+  int checked, unchanged;
+  double seconds;
+};
+
+void
+showfiletiming(struct checkphase *phases, int nphases)
+{
+  struct filetiming *files=0;
+  int nfiles=0, i, j, k;
+
+  for(k=0;k<nphases;k++)
+    for(i=0;i<phases[k].count;i++){
+      for(j=0;j<nfiles;j++)
+        if (!strcmp(files[j].file, phases[k].files[i]))
+          break;
+      if (j==nfiles){
+        files = growarray(files, (nfiles+1)*sizeof(*files), "(showfiletiming)");
+        files[j].file = phases[k].files[i];
+        files[j].checked = files[j].unchanged = 0;
+        files[j].seconds = 0;
+        nfiles++;
+      }
+      if (phases[k].skip && phases[k].skip[i])
+        files[j].unchanged++;
+      else {
+        files[j].checked++;
+        if (phases[k].times)
+          files[j].seconds += phases[k].times[i];
+      }
+    }
+  printf("\nCheck timing by file:\n");
+  for(j=0;j<nfiles;j++)
+    printf("  %s: %d checked, %d unchanged, %.3f s\n", files[j].file,
+           files[j].checked, files[j].unchanged, files[j].seconds);
+  free(files);
+}
 
 
 /*
-   Process the string 'unitstr' as a unit, placing the processed data
-   in the unit structure 'theunit'.  Returns 0 on success and 1 on
-   failure.  If an error occurs an error message is printed to stdout.
-   A pointer ('^') will be printed if an error is detected, and  promptlen 
-   should be set to the printing width of the prompt string, or set 
-   it to NOPOINT to supress printing of the pointer.  
- */
+   Check that all units and prefixes are reducible to primitive units and that
+   function definitions are valid and have correct inverses.  A message is
+   printed for every unit that does not reduce to primitive units.
+   The jobs argument gives the number of worker processes to use.
+   If changedonly is set, definitions recorded as clean in the check
+   cache are skipped, and the cache is updated afterwards.
+   A timing summary is printed for verbose checks, when workers are
+   used, or with changedonly.
+*/
+
+#define CHECKPHASES 4
+
+void
+checkunits(int verbosecheck, int jobs, int changedonly)
+{
+  struct checkphase phases[CHECKPHASES] = {
+    {"functions", 'f', checkfuncitem},
+    {"unit lists", 'a', checkaliasitem},
+    {"units", 'u', checkunititem},
+    {"prefixes", 'p', checkprefixitem}};
+  checkhash *hashes[CHECKPHASES];
+  struct unitlist *uptr;
+  struct prefixlist *pptr;
+  struct func *funcptr;
+  struct wantalias *aliasptr;
+  char *cachefile=0, *line;
+  int i, k, total=0, unchanged=0, exists;
+
+  parsealllazy();
+  for(i=0;i<SIMPLEHASHSIZE;i++)
+    for(funcptr=ftab[i];funcptr;funcptr=funcptr->next)
+      addcheckitem(&phases[0], funcptr, funcptr->name, funcptr->file);
+  for(aliasptr = firstalias; aliasptr; aliasptr=aliasptr->next)
+    addcheckitem(&phases[1], aliasptr, aliasptr->name, aliasptr->file);
+  for(i=0;i<HASHSIZE;i++)
+    for (uptr = utab[i]; uptr; uptr = uptr->next)
+      addcheckitem(&phases[2], uptr, uptr->name, uptr->file);
+  for(i=0;i<SIMPLEHASHSIZE;i++)
+    for(pptr = ptab[i]; pptr; pptr = pptr->next)
+      addcheckitem(&phases[3], pptr, pptr->name, pptr->file);
+
+  if (changedonly){
+    cachefile = personalfile(CHECKCACHE_ENV, CHECKCACHE_FILE, 1, &exists);
+    readcheckcache(cachefile);
+    for(k=0;k<CHECKPHASES;k++)
+      total += phases[k].count;
+    for(closurememo.size=64;closurememo.size<2*total;closurememo.size*=2);
+    closurememo.keys = (void **) calloc(closurememo.size, sizeof(void *));
+    closurememo.hashes = (checkhash *) calloc(closurememo.size,
+                                              sizeof(checkhash));
+    closurememo.state = (char *) calloc(closurememo.size, 1);
+    if (!closurememo.keys || !closurememo.hashes || !closurememo.state){
+      fprintf(stderr, "%s: memory allocation error (checkunits)\n", progname);
+      exit(EXIT_FAILURE);
+    }
+    for(k=0;k<CHECKPHASES;k++){
+      int n = phases[k].count ? phases[k].count : 1;
+      hashes[k] = (checkhash *) mymalloc(n*sizeof(checkhash), "(checkunits)");
+      phases[k].skip = (char *) mymalloc(n, "(checkunits)");
+      phases[k].clean = (char *) mymalloc(n, "(checkunits)");
+      phases[k].times = (double *) mymalloc(n*sizeof(double), "(checkunits)");
+      for(i=0;i<phases[k].count;i++){
+        hashes[k][i] = checkitemhash(&phases[k], i);
+        line = checkcacheline(&phases[k], i, hashes[k][i]);
+        phases[k].skip[i] = checkcachefind(line);
+        phases[k].clean[i] = 0;
+        phases[k].times[i] = 0;
+        unchanged += phases[k].skip[i];
+        free(line);
+      }
+    }
+  }
 
- 
-int 
-processunit(struct unittype *theunit, char *unitstr, int promptlen)
-{
-  char *errmsg;
-  int errloc,err;
-  char savechar;
+  for(i=0;i<CHECKPHASES;i++)
+    runcheckphase(&phases[i], verbosecheck, jobs);
 
-  if (flags.unitlists && strchr(unitstr, UNITSEPCHAR)){
-    puts("Unit list not allowed");
-    return 1;
+  if (verbosecheck || jobs > 1 || changedonly){
+    printf("\nCheck timing (%d job%s):\n", jobs, jobs==1 ? "" : "s");
+    for(k=0;k<CHECKPHASES;k++){
+      int checked = phases[k].count;
+      if (phases[k].skip)
+        for(i=0;i<phases[k].count;i++)
+          checked -= phases[k].skip[i];
+      printf("  %-12s %6d checked in %.3f s\n", phases[k].name,
+             checked, phases[k].seconds);
+    }
   }
-  if ((err=parseunit(theunit, unitstr, &errmsg, &errloc))){
-    if (promptlen >= 0){
-      if (err!=E_UNKNOWNUNIT || !irreducible){
-        if (errloc>0) {
-          savechar = unitstr[errloc];
-          unitstr[errloc] = 0;
-          showpointer(promptlen+strwidth(unitstr)-1);
-          unitstr[errloc] = savechar;
-        } 
-        else showpointer(promptlen);
-      }
+  if (changedonly){
+    printf("%d of %d definitions unchanged since the last check\n",
+           unchanged, total);
+    showfiletiming(phases, CHECKPHASES);
+    if (cachefile)
+      writecheckcache(cachefile, phases, CHECKPHASES, hashes);
+    for(k=0;k<CHECKPHASES;k++){
+      free(hashes[k]);
+      free(phases[k].skip);
+      free(phases[k].clean);
+      free(phases[k].times);
     }
-    else
-      printf("Error in '%s': ", unitstr);
-    fputs(errmsg,stdout);
-    if (err==E_UNKNOWNUNIT && irreducible)
-      printf(" '%s'", irreducible);
-    putchar('\n');
-    return 1;
+    free(closurememo.keys);
+    free(closurememo.hashes);
+    free(closurememo.state);
+    checkcachefree();
   }
-  if ((err=completereduce(theunit))){
-    fputs(errormsg[err],stdout);
-    if (err==E_UNKNOWNUNIT)
-      printf(" '%s'", irreducible);
-    putchar('\n');
-    return 1;
+  for(i=0;i<CHECKPHASES;i++){
+    free(phases[i].items);
+    free(phases[i].names);
+    free(phases[i].files);
   }
-  return 0;
 }
 
 
-
 /*
-   Checks the input parameter unitstr (a list of units separated by
-   UNITSEPCHAR) for errors.  All units must be parseable and
-   conformable to each other.  Returns 0 on success and 1 on failure.
+   Subset databases (--subset).  Writes a units file with just the
+   definitions that a list of names needs: the named units, prefixes,
+   functions and unit lists, and everything that their definitions use,
+   followed recursively.  The definitions are written as they are stored
+   in the tables, so the subset is for the locale, unit system and
+   UTF-8 mode in effect, and function copies become full definitions.  The subset
+   also gets the units that checkunits() tests prefixes and functions
+   with, and is loaded back and checked before the sizes and load times
+   are reported.
+*/
 
-   If an error is found then print an error message on stdout.  A
-   pointer ('^') will be printed to mark the error.  The promptlen
-   parameter should be set to the printing width of the prompt string
-   so that the pointer is correctly aligned.
+#define SUBSETRUNS 5            /* loads timed for the report */
 
-   To suppress the printing of the pointer set promptlen to NOPOINT.
-   To suppress printing of error messages entirely set promptlen to 
-   NOERRMSG.
-*/
+struct subsetentry {
+  int kind;                     /* 'f', 'a', 'u' or 'p' as in checkunits() */
+  void *item;
+  char *file;
+  int linenumber;
+};
 
+struct {
+  void **keys;                  /* table entries already added */
+  int size;                     /* a power of two */
+  struct subsetentry *entries;
+  int count;
+} subset;
+
+struct subsetname {             /* state for foreachname() */
+  char *param;                  /* function parameter, not a unit */
+  int unknown;                  /* count of names not defined */
+};
 
 int
-checkunitlist(char *unitstr, int promptlen)
+subsetadd(int kind, void *item, char *file, int linenumber)
 {
-  struct unittype unit[2], one;
-  char *firstunitstr,*nextunitstr;
-  int unitidx = 0;
+  int slot, i;
 
-  int printerror = promptlen != NOERRMSG;
+  if (2*(subset.count+1) > subset.size){
+    void **old = subset.keys;
+    int oldsize = subset.size;
 
-  initializeunit(&one);
+    subset.size = subset.size ? 2*subset.size : 1024;
+    subset.keys = (void **) calloc(subset.size, sizeof(void *));
+    subset.entries = (struct subsetentry *)
+      realloc(subset.entries, subset.size/2*sizeof(struct subsetentry));
+    if (!subset.keys || !subset.entries){
+      fprintf(stderr, "%s: memory allocation error (subsetadd)\n", progname);
+      exit(EXIT_FAILURE);
+    }
+    for(i=0;i<oldsize;i++)
+      if (old[i]){
+        for(slot = ((size_t) old[i] >> 4) & (subset.size-1); subset.keys[slot];
+            slot = (slot+1) & (subset.size-1));
+        subset.keys[slot] = old[i];
+      }
+    free(old);
+  }
+  for(slot = ((size_t) item >> 4) & (subset.size-1); subset.keys[slot];
+      slot = (slot+1) & (subset.size-1))
+    if (subset.keys[slot] == item)
+      return 0;
+  subset.keys[slot] = item;
+  subset.entries[subset.count].kind = kind;
+  subset.entries[subset.count].item = item;
+  subset.entries[subset.count].file = file;
+  subset.entries[subset.count].linenumber = linenumber;
+  subset.count++;
+  return 1;
+}
 
-  firstunitstr = unitstr;
+int subsetdefinition(char *def, char *param);
 
-  initializeunit(unit);
-  initializeunit(unit+1);
+void
+subsetunit(struct unitlist *uptr)
+{
+  if (subsetadd('u', uptr, uptr->file, uptr->linenumber)
+      && !strchr(uptr->value, PRIMITIVECHAR))
+    subsetdefinition(uptr->value, 0);
+}
 
-  while (unitstr) {
-    if ((nextunitstr = strchr(unitstr, UNITSEPCHAR)) != 0)
-      *nextunitstr = '\0';
+void
+subsetprefix(struct prefixlist *pfx)
+{
+  if (subsetadd('p', pfx, pfx->file, pfx->linenumber))
+    subsetdefinition(pfx->value, 0);
+}
 
-    if (!unitstr[strspn(unitstr, " ")]) {  /* unitstr is blank */
-      if (!nextunitstr) {  /* terminal UNITSEPCHAR indicates repetition */
-        freeunit(unit);    /* of last unit and is permitted */
-        return 0;
-      }
-      else {               /* internal blank units are not allowed */
-        if (printerror){
-          showpointer(promptlen);
-          puts("Error: blank unit not allowed");
-        }
-        freeunit(unit);
-        return 1;
-      }
-    }
+/* Returns the function that a function copy, name(), shares its
+   definition with, or NULL */
 
-    /* processunit() prints error messages; avoid it to supress them */
+struct func *
+copysource(struct func *fun)
+{
+  struct func *source;
 
-    if ((printerror && processunit(unit+unitidx,unitstr,promptlen)) ||
-        (!printerror && 
-           (parseunit(unit+unitidx, unitstr,0,0) 
-             || completereduce(unit+unitidx) 
-             || compareunits(unit+unitidx,&one, ignore_primitive)))){
-      if (printerror)
-        printf("Error in unit list entry: %s\n",unitstr);
-      freeunit(unit);
-      freeunit(unit+1);
-      return 1;
-    }
+  if (fun->table || !fun->inverse.param
+      || !strcmp(fun->inverse.param, fun->name))
+    return 0;
+  source = fnlookup(fun->inverse.param);
+  if (source && source->forward.def == fun->forward.def)
+    return source;
+  return 0;
+}
 
+void
+subsetfunc(struct func *fun)
+{
+  struct func *source;
 
-    if (unitidx == 0)
-      unitidx = 1;
-    else {
-      if (compareunits(unit, unit+1, ignore_dimless)){
-        if (printerror){
-          int wasverbose = flags.verbose;
-          FILE *savelog = logfile;
-          logfile=0;
-          flags.verbose = 2;   /* always use verbose form to be unambiguous */
-                               /* coverity[returned_null] */
-          *(strchr(firstunitstr, UNITSEPCHAR)) = '\0';
-          removespaces(firstunitstr);
-          removespaces(unitstr);
-          showpointer(promptlen);
-          showconformabilityerr(firstunitstr, unit, unitstr, unit+1);
-          flags.verbose = wasverbose;
-          logfile = savelog;
-        }
-        freeunit(unit);
-        freeunit(unit+1);
-        return 1;
-      }
-      freeunit(unit+1);
-    }
+  if (!subsetadd('f', fun, fun->file, fun->linenumber))
+    return;
+  if ((source = copysource(fun)))
+    subsetfunc(source);
+  if (fun->table)       /* the other fields are only set for one kind */
+    subsetdefinition(fun->tableunit, 0);
+  else {
+    subsetdefinition(fun->forward.def, fun->forward.param);
+    subsetdefinition(fun->forward.dimen, 0);
+    subsetdefinition(fun->inverse.def, fun->inverse.param);
+    subsetdefinition(fun->inverse.dimen, 0);
+  }
+}
 
-    if (nextunitstr) {
-      if (promptlen >= 0) promptlen += strwidth(unitstr)+1;
-      *(nextunitstr++) = UNITSEPCHAR;
-    }
-    unitstr = nextunitstr;
+void
+subsetunitname(char *name, void *data)
+{
+  struct subsetname *state = (struct subsetname *) data;
+  struct unitlist *uptr;
+  struct prefixlist *pfx;
+
+  if (state->param && !strcmp(name, state->param))
+    return;
+  if ((uptr = findunitentry(name, 1)))
+    subsetunit(uptr);
+  if (!ulookup(name) && (pfx = plookup(name))){
+    subsetprefix(pfx);
+    if (pfx->len == (int) strlen(name))
+      return;
   }
+  if (!uptr)
+    state->unknown++;
+}
 
-  freeunit(unit);
+void
+subsetfuncname(struct func *fun, void *data)
+{
+  subsetfunc(fun);
+}
 
-  return 0;
-} /* end checkunitlist */
+/* Adds what a definition uses.  Returns the number of unknown names. */
 
+int
+subsetdefinition(char *def, char *param)
+{
+  struct subsetname state;
 
-/*
-   Call either processunit or checkunitlist, depending on whether the
-   string 'unitstr' contains a separator character.  Returns 0 on
-   success and 1 on failure.  If an error occurs an error message is
-   printed to stdout.
+  state.param = param;
+  state.unknown = 0;
+  if (def)
+    foreachname(def, subsetunitname, subsetfuncname, &state);
+  return state.unknown;
+}
 
-   A pointer will be printed if an error is detected, and  promptlen 
-   should be set to the printing width of the prompt string, or set 
-   it to NOPOINT to supress printing of the pointer.  
-*/
+
+/* Adds a name from the list, or the units of an expression such as
+   acre-foot.  Returns 0 if anything in it is not defined. */
 
 int
-processwant(struct unittype *theunit, char *unitstr, int promptlen)
+subsetaddname(char *name)
 {
-  if (flags.unitlists && strchr(unitstr, UNITSEPCHAR))
-    return checkunitlist(unitstr, promptlen);
-  else
-    return processunit(theunit, unitstr, promptlen);
+  struct wantalias *alias;
+  struct prefixlist *pfx;
+  struct func *fun;
+
+  if ((fun = fnlookup(name)))
+    subsetfunc(fun);
+  else if ((alias = aliaslookup(name))){
+    if (subsetadd('a', alias, alias->file, alias->linenumber))
+      subsetdefinition(alias->definition, 0);
+  } else if (lastchar(name) == '-'){
+    lastchar(name) = 0;
+    pfx = plookup(name);
+    lastchar(name) = '-';
+    if (!pfx || pfx->len != (int) strlen(name)-1)
+      return 0;
+    subsetprefix(pfx);
+  } else
+    return !subsetdefinition(name, 0);
+  return 1;
+}
+
+
+int
+comparesubsetentry(const void *a, const void *b)
+{
+  const struct subsetentry *x = (const struct subsetentry *) a;
+  const struct subsetentry *y = (const struct subsetentry *) b;
+  int cmp;
+
+  if ((cmp = strcmp(x->file, y->file)))
+    return cmp;
+  return x->linenumber - y->linenumber;
 }
 
 
+/* Writes a number with the fewest digits that read back the same */
+
 void
-checkallaliases(int verbose)
+writenumber(FILE *out, double x)
 {
-  struct wantalias *aliasptr;
+  char buf[40];
+  int digits;
 
-  for(aliasptr = firstalias; aliasptr; aliasptr=aliasptr->next){
-    if (verbose)
-      printf("doing unit list '%s'\n", aliasptr->name);
-    if (checkunitlist(aliasptr->definition,NOERRMSG))
-      printf("Unit list '%s' contains errors\n", aliasptr->name);
-    if (ulookup(aliasptr->name))
-      printf("Unit list '%s' hides a unit definition.\n", aliasptr->name);
-    if (fnlookup(aliasptr->name))
-      printf("Unit list '%s' hides a function definition.\n", aliasptr->name);
+  for(digits = DBL_DIG; digits < 17; digits++){
+    sprintf(buf, "%.*g", digits, x);
+    if (strtod(buf, 0) == x)
+      break;
   }
+  fprintf(out, "%.*g", digits, x);
+}
+
+
+void
+writeinterval(FILE *out, char *keyword, struct functype *type)
+{
+  if (!type->domain_min && !type->domain_max)
+    return;
+  fprintf(out, "%s%c", keyword, type->domain_min_open ? '(' : '[');
+  if (type->domain_min)
+    writenumber(out, *type->domain_min);
+  putc(',', out);
+  if (type->domain_max)
+    writenumber(out, *type->domain_max);
+  fprintf(out, "%c ", type->domain_max_open ? ')' : ']');
 }
 
 
+/* Writes a function or table in units file syntax.  A copy of a
+   function with an inverse stays a copy, because the inverse refers
+   to the function by the name it was defined with. */
 
-/* 
-   Check that all units and prefixes are reducible to primitive units and that
-   function definitions are valid and have correct inverses.  A message is
-   printed for every unit that does not reduce to primitive units.
+void
+writefunction(FILE *out, struct func *fun)
+{
+  char *noerror = fun->skip_error_check ? NOERROR_KEYWORD : "";
+  struct func *source;
+  int i;
 
-*/
+  if ((source = copysource(fun))){
+    fprintf(out, "%s() %s\n", fun->name, source->name);
+    return;
+  }
+  if (fun->table){
+    fprintf(out, "%s[%s] %s", fun->name, fun->tableunit, noerror);
+    for(i=0;i<fun->tablelen;i++){
+      fputs(i ? ", " : "", out);
+      writenumber(out, fun->table[i].location);
+      putc(' ', out);
+      writenumber(out, fun->table[i].value);
+    }
+    putc('\n', out);
+    return;
+  }
+  fprintf(out, "%s(%s) %s", fun->name, fun->forward.param, noerror);
+  if (fun->forward.dimen){
+    fprintf(out, "units=[%s", fun->forward.dimen);
+    if (fun->inverse.dimen)
+      fprintf(out, "%c%s", FUNCSEPCHAR, fun->inverse.dimen);
+    fputs("] ", out);
+  }
+  writeinterval(out, "domain=", &fun->forward);
+  writeinterval(out, "range=", &fun->inverse);
+  fputs(fun->forward.def, out);
+  if (fun->inverse.def)
+    fprintf(out, " %c %s", FUNCSEPCHAR, fun->inverse.def);
+  putc('\n', out);
+}
 
 
-void 
-checkunits(int verbosecheck)
+int
+writesubsetfile(char *outfile, char *namefile)
 {
-  struct unittype have,second,one;
+  struct subsetentry *entry;
   struct unitlist *uptr;
-  struct prefixlist *pptr;
-  struct func *funcptr;
-  char *prefixbuf, *testunit;
-  int i;
+  struct prefixlist *pfx;
+  struct wantalias *alias;
+  FILE *out;
 
-  initializeunit(&one);
+  if (!(out = openfile(outfile, "wt"))){
+    fprintf(stderr, "%s: cannot write subset file '%s': %s\n",
+            progname, outfile, strerror(errno));
+    return 1;
+  }
+  qsort(subset.entries, subset.count, sizeof(*subset.entries),
+        comparesubsetentry);
+  fprintf(out, "# Subset of the units database for the names in '%s'\n\n",
+          namefile);
+  for(entry = subset.entries; entry < subset.entries+subset.count; entry++){
+    switch(entry->kind){
+      case 'u':
+        uptr = (struct unitlist *) entry->item;
+        fprintf(out, "%-15s %s\n", uptr->name, uptr->value);
+        break;
+      case 'p':
+        pfx = (struct prefixlist *) entry->item;
+        fprintf(out, "%s-%*s %s\n", pfx->name,
+                pfx->len < 14 ? 14-pfx->len : 0, "", pfx->value);
+        break;
+      case 'a':
+        alias = (struct wantalias *) entry->item;
+        fprintf(out, "!unitlist %s %s\n", alias->name, alias->definition);
+        break;
+      default:
+        writefunction(out, (struct func *) entry->item);
+        break;
+    }
+  }
+  if (ferror(out) | fclose(out)){
+    fprintf(stderr, "%s: error writing subset file '%s'\n", progname, outfile);
+    return 1;
+  }
+  return 0;
+}
 
-  /* Check all functions for valid definition and correct inverse */
-  
-  for(i=0;i<SIMPLEHASHSIZE;i++)
-    for(funcptr=ftab[i];funcptr;funcptr=funcptr->next)
-      checkfunc(funcptr, verbosecheck);
 
-  checkallaliases(verbosecheck);
+/* Loads the files SUBSETRUNS times and returns the fastest time.  The
+   last load is left in place. */
+
+double
+timedbload(char **files, int *err)
+{
+  double best = 0, start, elapsed;
+  char **file;
+  int i, quiet = flags.quiet;
+
+  *err = 0;
+  flags.quiet = 1;              /* show any !message only once */
+  for(i=0;i<SUBSETRUNS;i++){
+    freedatabase();
+    start = walltime();
+    for(file = files; *file; file++)
+      if (readunits(*file, i ? 0 : stderr, 0, 0, 0, 0))
+        *err = 1;
+    resolvedversion = dbversion;   /* as loaddatabase() leaves it */
+    elapsed = walltime() - start;
+    if (!i || elapsed < best)
+      best = elapsed;
+  }
+  flags.quiet = quiet;
+  return best;
+}
 
-  /* Now check all units for validity */
 
-  for(i=0;i<HASHSIZE;i++)
-    for (uptr = utab[i]; uptr; uptr = uptr->next){
-      if (verbosecheck)
-        printf("doing '%s'\n",uptr->name);
-      if (parseunit(&have, uptr->name,0,0) 
-          || completereduce(&have) 
-          || compareunits(&have,&one, ignore_primitive)){
-        if (fnlookup(uptr->name)) 
-          printf("Unit '%s' hidden by function '%s'\n", uptr->name, uptr->name);
-        else
-          printf("'%s' defined as '%s' irreducible\n",uptr->name, uptr->value);
-      } else {
-        parserflags.minusminus = !parserflags.minusminus; 
-                                                 /* coverity[check_return] */
-        parseunit(&second, uptr->name, 0, 0);    /* coverity[check_return] */
-        completereduce(&second);     /* Can't fail because it worked above */
-        if (compareunits(&have, &second, ignore_nothing)){
-          printf("'%s': replace '-' with '+-' for subtraction or '*' to multiply\n", uptr->name);
-        }
-        freeunit(&second);
-        parserflags.minusminus=!parserflags.minusminus;
-      }
+long
+loadedsize(void)
+{
+  struct dbimage *img;
+  long size = 0;
+
+  for(img = dbimages; img; img = img->next)
+    size += img->size;
+  return size;
+}
+
+
+int
+makesubset(char *namefile, char *outfile)
+{
+  struct unitlist *uptr;
+  struct prefixlist *pfx;
+  struct func *fun;
+  struct wantalias *alias;
+  char *subsetfiles[2];
+  char line[1024], *name;
+  FILE *in;
+  int i, err = 0, requested = 0, counts[4], totals[4];
+  double fulltime, subsettime;
+  long fullsize, subsetsize;
+  struct stat statbuf;
 
-      freeunit(&have);
+  if (!outfile){
+    fprintf(stderr, "%s: --subset requires --subset-output\n", progname);
+    return 1;
+  }
+  if (!(in = openfile(namefile, "rt"))){
+    fprintf(stderr, "%s: cannot read names file '%s': %s\n",
+            progname, namefile, strerror(errno));
+    return 1;
+  }
+  parsealllazy();
+  while (fgets(line, sizeof(line), in)){
+    if ((name = strchr(line, COMMENTCHAR)))
+      *name = 0;
+    for(name = strtok(line, " \t\r\n"); name; name = strtok(0, " \t\r\n")){
+      requested++;
+      if (!subsetaddname(name)){
+        fprintf(stderr, "%s: '%s' in '%s' is not defined\n",
+                progname, name, namefile);
+        err = 1;
+      }
+    }
+  }
+  fclose(in);
+  for(i=0;i<subset.count;i++)
+    if (subset.entries[i].kind == 'p'){
+      subsetaddname("meter");
+      break;
+    }
+  for(i=0;i<subset.count;i++)
+    if (subset.entries[i].kind == 'f'){
+      subsetaddname("kg");
+      subsetaddname("K");
+      break;
     }
 
-  /* Check prefixes */ 
+  for(i=0;i<4;i++)
+    counts[i] = totals[i] = 0;
+  for(i=0;i<subset.count;i++)
+    counts[strchr("upfa", subset.entries[i].kind) - "upfa"]++;
+  for(i=0;i<HASHSIZE;i++)
+    for(uptr=utab[i];uptr;uptr=uptr->next)
+      totals[0]++;
+  for(i=0;i<SIMPLEHASHSIZE;i++){
+    for(pfx=ptab[i];pfx;pfx=pfx->next)
+      totals[1]++;
+    for(fun=ftab[i];fun;fun=fun->next)
+      totals[2]++;
+  }
+  for(alias=firstalias;alias;alias=alias->next)
+    totals[3]++;
+
+  if (!err)
+    err = writesubsetfile(outfile, namefile);
+  free(subset.keys);
+  free(subset.entries);
+  memset(&subset, 0, sizeof(subset));
+  if (err)
+    return 1;
 
-  testunit="meter";
-  for(i=0;i<SIMPLEHASHSIZE;i++)
-    for(pptr = ptab[i]; pptr; pptr = pptr->next){
-      if (verbosecheck)
-        printf("doing '%s-'\n",pptr->name);
-      prefixbuf = mymalloc(strlen(pptr->name) + strlen(testunit) + 1,
-                           "(checkunits)");
-      strcpy(prefixbuf,pptr->name);
-      strcat(prefixbuf,testunit);
-      if (parseunit(&have, prefixbuf,0,0) || completereduce(&have) || 
-          compareunits(&have,&one,ignore_primitive))
-        printf("'%s-' defined as '%s' irreducible\n",pptr->name, pptr->value);
-      else { 
-        int plevel;    /* check for bad '/' character in prefix */
-        char *ch;
-        plevel = 0;
-        for(ch=pptr->value;*ch;ch++){
-          if (*ch==')') plevel--;
-          else if (*ch=='(') plevel++;
-          else if (plevel==0 && *ch=='/'){
-            printf(
-              "'%s-' defined as '%s' contains a bad '/'. (Add parentheses.)\n",
-              pptr->name, pptr->value);
-            break;
-          }
-        }           
-      }  
-      freeunit(&have);
-      free(prefixbuf);
-    }
+  fulltime = timedbload(unitsfiles, &err);
+  fullsize = loadedsize();
+  subsetfiles[0] = outfile;
+  subsetfiles[1] = 0;
+  subsettime = timedbload(subsetfiles, &err);
+  subsetsize = stat(outfile, &statbuf) ? 0 : statbuf.st_size;
+  if (err){
+    fprintf(stderr, "%s: subset file '%s' does not load cleanly\n",
+            progname, outfile);
+    return 1;
+  }
+
+  printf("Wrote %d units, %d prefixes, %d functions and %d unit lists "
+         "for %d names\n", counts[0], counts[1], counts[2], counts[3],
+         requested);
+  printf("  (of %d, %d, %d and %d) to '%s'\n", totals[0], totals[1],
+         totals[2], totals[3], outfile);
+  if (fullsize)
+    printf("Size: %ld bytes, %.1f%% of %ld\n", subsetsize,
+           100.0*subsetsize/fullsize, fullsize);
+  printf("Load time: %.3f ms, %.1f%% of %.3f ms\n", subsettime*1e3,
+         fulltime ? 100*subsettime/fulltime : 0, fulltime*1e3);
+  printf("Checking the subset:\n");
+  checkunits(0, flags.jobs, 0);
+  freedatabase();
+  return 0;
 }
 
 
@@ -5483,9 +10074,11 @@ showunitlist(char *havestr, struct unittype *have, char *wantstr)
           initializeunit(&lastwant);
           if (processunit(&lastwant, lastwantstr, NOPOINT)) {
             freeunit(&lastwant);
+            freeunit(&want);
             return 1;
           }
           remainder = round(remainder / lastwant.factor) * lastwant.factor;
+          freeunit(&lastwant);
         }
         else    /* first unit is last unit */
           remainder = round(remainder / want.factor) * want.factor;
@@ -5499,8 +10092,10 @@ showunitlist(char *havestr, struct unittype *have, char *wantstr)
         logputchar('\t');
     } /* end if first unit */
 
-    if (0==(sigdigits = getsigdigits(have->factor, remainder, 10)))
+    if (0==(sigdigits = getsigdigits(have->factor, remainder, 10))){
+      freeunit(&want);
       break;    /* nothing left */
+    }
 
     /* Remove sub-precision junk accumulating in the remainder.  Rounding
        is base 2 to ensure that we keep all valid bits. */
@@ -5834,165 +10429,786 @@ checklocale()
     mylocale = DEFAULTLOCALE;
 }
 
-#else
+#else
+
+void
+checklocale()
+{
+  char *temp=0;
+#ifndef NO_SETLOCALE  
+  temp = setlocale(LC_CTYPE,"");
+#endif
+  if (!temp)
+    temp = getenv("LC_CTYPE");
+  if (!temp)
+    temp = getenv("LANG");
+  if (!temp)
+    mylocale = DEFAULTLOCALE;
+  else {
+    mylocale = dupstr(temp);  
+    temp = strchr(mylocale,'.');
+    if (temp)
+      *temp = 0;
+  }
+}
+
+#endif
+
+/* 
+   Replaces an alias in the specified string input.  Returns 1 if the
+   alias that is found contains errors. 
+*/
+
+int
+replacealias(char **string, int *buflen)
+{
+  int usefree = 1;
+  struct wantalias *aliasptr;
+  char *input;
+
+  if (!flags.readline && buflen)
+    usefree = 0;
+
+  if (nonempty(*string)) {  /* check that string is defined and nonempty */
+    input = *string;
+    removespaces(input);
+    if ((aliasptr=aliaslookup(input))){
+      if (checkunitlist(aliasptr->definition,NOERRMSG)){
+        puts("Unit list definition contains errors.");
+        return 1;
+      }
+      if (usefree){
+        free(*string);
+        *string = dupstr(aliasptr->definition);
+      } else {                           /* coverity[dead_error_line] */
+        while (strlen(aliasptr->definition)>*buflen)
+          growbuffer(string, buflen);
+        strcpy(*string, aliasptr->definition);
+      }
+    }
+  }
+  return 0;
+}
+
+
+/* 
+   Remaps the locale name returned on Windows systems to the value
+   returned on Unix-like systems
+*/
+
+void
+remaplocale(char *filename)
+{
+  FILE *map;
+  char *value;
+  char name[80];
+
+  map = openfile(filename,"rt");
+  if (!map) {
+    fprintf(stderr,"%s: cannot open locale map '%s'. ",progname,filename);
+    perror((char *) NULL);
+  }
+  else {
+    while(!feof(map)){
+      if (!fgets(name,80,map))
+        break;
+      lastchar(name) = 0;
+      value=strchr(name,'#');
+      if (value) *value=0;
+      value=strchr(name,'\t');
+      if (!value) continue;
+      *value++=0;
+      removespaces(value);
+      removespaces(name);
+      if (!strcmp(name, mylocale))
+        mylocale = dupstr(value);
+    }
+    fclose(map);
+  }
+}
+
+
+void
+close_logfile(void)
+{
+  if (logfile){
+    fputc('\n',logfile);
+    fclose(logfile);
+  }
+}
+
+
+void
+open_logfile(void)
+{  
+  time_t logtime;
+  char * timestr;
+
+  logfile = openfile(logfilename, "at");
+  if (!logfile){
+    fprintf(stderr, "%s: cannot write to log file '%s'.  ", 
+            progname, logfilename);
+    perror(0);
+    exit(EXIT_FAILURE);
+  }
+  time(&logtime);
+  timestr = ctime(&logtime);
+  fprintf(logfile, "### Log started %s \n", timestr);
+  atexit(close_logfile);
+}
+
+
+void
+write_files_sig(int sig)
+{
+#ifdef READLINE
+  if (historyfile)
+    save_history();
+#endif
+  close_logfile();
+  signal(sig, SIG_DFL);
+  raise(sig);
+}
+
+
+/*
+   Memory report (--memstats).  Adds up what the loaded database uses:
+   the nodes of each table with the strings they point to, the stored
+   reductions, function definitions and tables, and the structures
+   around them, with the load and chain lengths of the hash tables.
+   The strings are counted by length wherever they are kept, which may
+   be the arena, a file image or the compiled in database.
+*/
+
+#define MEMHIST 8               /* chain length classes in the report */
+
+char *memhistlabel[MEMHIST] = {"0", "1", "2", "3", "4", "5-8", "9-16", ">16"};
+
+static char *memtext;
+static int memtextsize, memtextlen;
+
+void
+memprintf(const char *fmt, ...)
+{
+  char line[256];
+  va_list args;
+  int len;
+
+  va_start(args, fmt);
+  len = vsprintf(line, fmt, args);
+  va_end(args);
+  while (memtextlen + len + 1 > memtextsize)
+    growbuffer(&memtext, &memtextsize);
+  strcpy(memtext + memtextlen, line);
+  memtextlen += len;
+}
+
+void
+memline(const char *name, unsigned long bytes)
+{
+  memprintf("  %-28s %12lu\n", name, bytes);
+}
+
+unsigned long
+strbytes(const char *str)
+{
+  return str ? strlen(str) + 1 : 0;
+}
+
+/* The inverse of a function uses the function name as its parameter, so
+   the parameter is only counted for the forward function. */
+
+unsigned long
+functypebytes(struct functype *type, int param)
+{
+  return (param ? strbytes(type->param) : 0)
+    + strbytes(type->def) + strbytes(type->dimen)
+    + (type->domain_min ? sizeof(double) : 0)
+    + (type->domain_max ? sizeof(double) : 0);
+}
+
+void
+histogram(unsigned long *hist, int len)
+{
+  int i;
+
+  if (len <= 4)
+    i = len;
+  else if (len <= 8)
+    i = 5;
+  else if (len <= 16)
+    i = 6;
+  else
+    i = 7;
+  hist[i]++;
+}
+
+/* Adds a line for one hash table with the histogram of its chains.  For
+   the open addressing unit index the runs of occupied slots are
+   counted instead. */
+
+void
+memhashline(char *name, int table)
+{
+  unsigned long hist[MEMHIST];
+  struct unitlist *uptr;
+  struct prefixlist *pptr;
+  struct func *funcptr;
+  struct pendingunit *pend;
+  int chains, entries, longest, len, i, size;
+
+  memset(hist, 0, sizeof(hist));
+  size = table == 'p' || table == 'f' ? SIMPLEHASHSIZE : HASHSIZE;
+  if (table == 'i'){
+    size = unitindex.size;
+    for(len=0, i=0;i<size;i++)
+      if (unitindex.slots[i])
+        len++;
+      else if (len){
+        histogram(hist, len);
+        len = 0;
+      }
+    if (len)
+      histogram(hist, len);
+  } else
+    for(i=0;i<size;i++){
+      len = 0;
+      if (table == 'u')
+        for(uptr = utab[i]; uptr; uptr = uptr->next)
+          len++;
+      else if (table == 'p')
+        for(pptr = ptab[i]; pptr; pptr = pptr->next)
+          len++;
+      else if (table == 'f')
+        for(funcptr = ftab[i]; funcptr; funcptr = funcptr->next)
+          len++;
+      else
+        for(pend = pendtab[i]; pend; pend = pend->next)
+          len++;
+      histogram(hist, len);
+    }
+  if (table == 'n'){
+    for(entries=longest=i=0;i<HASHSIZE;i++){
+      for(len=0, pend = pendtab[i]; pend; pend = pend->next)
+        len++;
+      entries += len;
+      if (len > longest)
+        longest = len;
+    }
+    chains = HASHSIZE;
+  } else
+    hashstats(table, &chains, &entries, &longest);
+  memprintf("  %-10s %8d %8d %6.2f %7d ", name, chains, entries,
+            chains ? (double) entries / chains : 0, longest);
+  for(i=0;i<MEMHIST;i++)
+    memprintf(" %5lu", hist[i]);
+  memprintf("\n");
+}
+
+
+/* Returns the report as text, which stays valid until the next call */
+
+char *
+formatmemstats(void)
+{
+  struct unitlist *uptr;
+  struct prefixlist *pptr;
+  struct func *funcptr;
+  struct wantalias *aliasptr;
+  struct dbimage *img;
+  struct dbfile *dbf;
+  struct unitschunk *chunk;
+  struct pendingunit *pend;
+  unsigned long count, nodes, names, values, extra, total = 0;
+  unsigned long mapped = 0, read = 0;
+  int i, j;
+  extern THREADLOCAL int unitcount; /* parser units in use, from parse.y */
+
+  memtextlen = 0;
+  memprintf("");
+
+  count = nodes = names = values = extra = 0;
+  for(i=0;i<HASHSIZE;i++)
+    for(uptr = utab[i]; uptr; uptr = uptr->next){
+      count++;
+      nodes += sizeof(struct unitlist);
+      names += strbytes(uptr->name);
+      values += strbytes(uptr->value);
+      if (uptr->reduced){
+        extra += sizeof(struct reducedunit) + (uptr->reduced->numlen
+                   + uptr->reduced->denlen) * sizeof(char *)
+                 + uptr->reduced->stepcount * sizeof(struct reducedstep);
+        for(j=0;j<uptr->reduced->numlen+uptr->reduced->denlen;j++)
+          if (uptr->reduced->names[j])
+            extra += strbytes(uptr->reduced->names[j]);
+      }
+    }
+  memprintf("units %lu\n", count);
+  memline("utab nodes", nodes);
+  memline("names", names);
+  memline("definitions", values);
+  memline("stored reductions", extra);
+  total += nodes + names + values + extra;
+
+  count = nodes = names = values = 0;
+  for(i=0;i<SIMPLEHASHSIZE;i++)
+    for(pptr = ptab[i]; pptr; pptr = pptr->next){
+      count++;
+      nodes += sizeof(struct prefixlist);
+      names += strbytes(pptr->name);
+      values += strbytes(pptr->value);
+    }
+  memprintf("prefixes %lu\n", count);
+  memline("ptab nodes", nodes);
+  memline("names", names);
+  memline("definitions", values);
+  total += nodes + names + values;
+
+  count = nodes = names = values = extra = 0;
+  for(i=0;i<SIMPLEHASHSIZE;i++)
+    for(funcptr = ftab[i]; funcptr; funcptr = funcptr->next){
+      count++;
+      nodes += sizeof(struct func);
+      names += strbytes(funcptr->name);
+      if (funcptr->table)
+        extra += funcptr->tablelen * sizeof(struct pair)
+          + strbytes(funcptr->tableunit);
+      else
+        values += functypebytes(&funcptr->forward, 1)
+          + functypebytes(&funcptr->inverse, 0);
+    }
+  memprintf("functions %lu\n", count);
+  memline("ftab nodes", nodes);
+  memline("names", names);
+  memline("definitions", values);
+  memline("tables", extra);
+  total += nodes + names + values + extra;
+
+  count = nodes = names = values = 0;
+  for(aliasptr = firstalias; aliasptr; aliasptr = aliasptr->next){
+    count++;
+    nodes += sizeof(struct wantalias);
+    names += strbytes(aliasptr->name);
+    values += strbytes(aliasptr->definition);
+  }
+  memprintf("unit lists %lu\n", count);
+  memline("nodes", nodes);
+  memline("names", names);
+  memline("definitions", values);
+  total += nodes + names + values;
+
+  count = nodes = names = 0;
+  for(dbf = dbfiles; dbf; dbf = dbf->next){
+    count++;
+    nodes += sizeof(struct dbfile);
+    names += strbytes(dbf->name);
+  }
+  for(chunk = chunklist; chunk; chunk = chunk->next){
+    nodes += sizeof(struct unitschunk);
+    names += strbytes(chunk->name);
+  }
+  for(i=0;i<HASHSIZE;i++)
+    for(pend = pendtab[i]; pend; pend = pend->next){
+      nodes += sizeof(struct pendingunit);
+      names += strbytes(pend->name);
+    }
+  memprintf("files %lu\n", count);
+  memline("file and chunk records", nodes);
+  memline("file and unit names", names);
+  total += nodes + names;
+
+  memprintf("tables\n");
+  memline("utab, ptab, ftab, pendtab", sizeof(utab) + sizeof(ptab)
+          + sizeof(ftab) + sizeof(pendtab));
+  memline("unit index", unitindex.size
+          * (sizeof(struct unitlist *) + sizeof(unsigned)));
+  memline("Bloom filter", unitbloom.nbits / 8);
+  total += sizeof(utab) + sizeof(ptab) + sizeof(ftab) + sizeof(pendtab)
+    + unitindex.size * (sizeof(struct unitlist *) + sizeof(unsigned))
+    + unitbloom.nbits / 8;
+
+  memprintf("parser and buffers\n");
+  memline("parser units in use", unitcount * sizeof(struct unittype));
+  memline("parser unit limit", MAXMEM * sizeof(struct unittype));
+  memline("lookupunit buffer", bufsize);
+  total += unitcount * sizeof(struct unittype) + bufsize;
+
+  for(img = dbimages; img; img = img->next){
+    if (img->mapped)
+      mapped += img->size;
+    else
+      read += img->size;
+  }
+  memprintf("storage\n");
+  memline("arena allocated", dbarena.allocated);
+  memline("arena used", dbarena.used);
+  memline("file images read", read);
+  memline("file images mapped", mapped);
+  memprintf("total of the above %lu\n", total);
+
+  memprintf("hash tables, with the number of chains of each length\n");
+  memprintf("  %-10s %8s %8s %6s %7s ", "", "slots", "entries", "load",
+            "longest");
+  for(i=0;i<MEMHIST;i++)
+    memprintf(" %5s", memhistlabel[i]);
+  memprintf("\n");
+  memhashline("utab", 'u');
+  memhashline("unit index", 'i');
+  memhashline("ptab", 'p');
+  memhashline("ftab", 'f');
+  memhashline("pendtab", 'n');
+  return memtext;
+}
+
+
+/*
+   Hot path counters (--stats).  loaddatabase() resets the counters once
+   the units have been loaded, so they count the work of the conversions and of
+   --check rather than of reading the units data files.  They are printed
+   when unitsHandler returns, or at exit in interactive mode.
+*/
+
+#ifndef NO_STATS
+THREADLOCAL struct unitsstats unitsstats;
+
+static void
+statline(char *buf, const char *name, unsigned long count, const char *what,
+         unsigned long other)
+{
+   buf += strlen(buf);
+   if (what)
+     sprintf(buf, "%-22s %10lu %10lu %s\n", name, count, other, what);
+   else
+     sprintf(buf, "%-22s %10lu\n", name, count);
+}
+#endif
+
+/* Returns the counters as text, one per line, or NULL if they were
+   compiled out with NO_STATS */
+
+char *
+formatstats(void)
+{
+#ifndef NO_STATS
+   static char buf[1024];
+   char peak[40];
+
+   sprintf(peak, "in use at most, of %d", MAXMEM);
+   buf[0] = 0;
+   statline(buf, "unit lookups", unitsstats.ulookup,
+            "slots probed", unitsstats.ulookupprobes);
+   statline(buf, "prefix lookups", unitsstats.plookup,
+            "prefixes compared", unitsstats.plookupprobes);
+   statline(buf, "function lookups", unitsstats.fnlookup,
+            "functions compared", unitsstats.fnlookupprobes);
+   statline(buf, "lookupunit calls", unitsstats.lookupunit,
+            "rejected by the Bloom filter", unitsstats.bloomrejects);
+   statline(buf, "plural retries", unitsstats.pluralretries, 0, 0);
+   statline(buf, "prefix retries", unitsstats.prefixretries, 0, 0);
+   statline(buf, "parseunit calls", unitsstats.parseunit,
+            "max nesting depth", unitsstats.maxparsedepth);
+   statline(buf, "parser units", unitsstats.getnewunit,
+            peak, unitsstats.maxparserunits);
+   statline(buf, "dupstr calls", unitsstats.dupstr,
+            "bytes", unitsstats.dupstrbytes);
+   statline(buf, "reduceproduct calls", unitsstats.reduceproduct,
+            "iterations", unitsstats.reduceiterations);
+   statline(buf, "evalfunc calls", unitsstats.evalfunc, 0, 0);
+   return buf;
+#else
+   return NULL;
+#endif
+}
+
+void
+resetstats(void)
+{
+#ifndef NO_STATS
+   memset(&unitsstats, 0, sizeof(unitsstats));
+#endif
+}
+
+void
+showstats(void)
+{
+   char *text;
+
+   if (!(text = formatstats()))
+     fprintf(stderr, "%s: --stats is not available, built with NO_STATS\n",
+             progname);
+   else
+     fputs(text, stderr);
+}
+
+
+/* Writes the --trace file when interactive mode exits */
 
 void
-checklocale()
+savetrace(void)
 {
-  char *temp=0;
-#ifndef NO_SETLOCALE  
-  temp = setlocale(LC_CTYPE,"");
-#endif
-  if (!temp)
-    temp = getenv("LC_CTYPE");
-  if (!temp)
-    temp = getenv("LANG");
-  if (!temp)
-    mylocale = DEFAULTLOCALE;
-  else {
-    mylocale = dupstr(temp);  
-    temp = strchr(mylocale,'.');
-    if (temp)
-      *temp = 0;
-  }
+   traceendall();
+   writetrace(tracefile);
 }
 
-#endif
 
-/* 
-   Replaces an alias in the specified string input.  Returns 1 if the
-   alias that is found contains errors. 
-*/
+/* Sets the program name and finds the directories and the locale that
+   the units files are looked up with.  This is only done on the first
+   call, so that a program that calls unitsHandler() repeatedly does not
+   allocate them again for every conversion. */
 
-int
-replacealias(char **string, int *buflen)
+static void
+setupenvironment(char *argv0)
 {
-  int usefree = 1;
-  struct wantalias *aliasptr;
-  char *input;
+   static int done = 0;
 
-  if (!flags.readline && buflen)
-    usefree = 0;
+   if (done)
+     return;
+   done = 1;
+   progname = getprogramname(argv0);
 
-  if (nonempty(*string)) {  /* check that string is defined and nonempty */
-    input = *string;
-    removespaces(input);
-    if ((aliasptr=aliaslookup(input))){
-      if (checkunitlist(aliasptr->definition,NOERRMSG)){
-        puts("Unit list definition contains errors.");
-        return 1;
-      }
-      if (usefree){
-        free(*string);
-        *string = dupstr(aliasptr->definition);
-      } else {                           /* coverity[dead_error_line] */
-        while (strlen(aliasptr->definition)>*buflen)
-          growbuffer(string, buflen);
-        strcpy(*string, aliasptr->definition);
-      }
-    }
-  }
-  return 0;
+   /*
+     unless UNITSFILE and LOCALEMAP have absolute pathnames, we may need
+     progdir to search for supporting files
+   */
+   if (!(isfullpath(UNITSFILE) && isfullpath(LOCALEMAP)))
+     progdir = getprogdir(argv0, &fullprogname);
+   else {
+     progdir = NULL;
+     fullprogname = NULL;
+   }
+   datadir = getdatadir();      /* directory to search as last resort */
+
+   checklocale();
+
+   homedir = findhome(&homedir_error);
 }
 
 
-/* 
-   Remaps the locale name returned on Windows systems to the value
-   returned on Unix-like systems
-*/
+/* Finds the units files unless they were given with -f and loads them
+   unless they are loaded already.  Returns 1 if they cannot be found
+   or read. */
 
-void
-remaplocale(char *filename)
+static int
+loadunitsfiles(int *unitcount, int *prefixcount, int *funccount)
 {
-  FILE *map;
-  char *value;
-  char name[80];
+   static char *defaultfiles[2];   /* found once, like setupenvironment() */
+   int readerr;
+#ifdef _WIN32
+   char *localemap;
+#endif
 
-  map = openfile(filename,"rt");
-  if (!map) {
-    fprintf(stderr,"%s: cannot open locale map '%s'. ",progname,filename);
-    perror((char *) NULL);
-  }
-  else {
-    while(!feof(map)){
-      if (!fgets(name,80,map))
-        break;
-      lastchar(name) = 0;
-      value=strchr(name,'#');
-      if (value) *value=0;
-      value=strchr(name,'\t');
-      if (!value) continue;
-      *value++=0;
-      removespaces(value);
-      removespaces(name);
-      if (!strcmp(name, mylocale))
-        mylocale = dupstr(value);
-    }
-    fclose(map);
-  }
-}
+   if (!unitsfiles[0]){
+     if (!defaultfiles[0]){
+       char *unitsfile;
+       tracebegin("findunitsfile", (char *) 0);
+       unitsfile = findunitsfile(ERRMSG);
+       traceend();
+       if (!unitsfile)
+         return 1;
+       else {
+         int file_exists;
 
+         defaultfiles[0] = unitsfile;
+         tracebegin("personalfile", (char *) 0);
+         defaultfiles[1] = personalfile(HOME_UNITS_ENV,homeunitsfile, 
+                                        0, &file_exists);
+         traceend();
+       }
+     }
+     unitsfiles[0] = defaultfiles[0];
+     unitsfiles[1] = defaultfiles[1];
+     unitsfiles[2] = 0;
+   }
 
-void
-close_logfile(void)
-{
-  if (logfile){
-    fputc('\n',logfile);
-    fclose(logfile);
-  }
+#ifdef _WIN32
+   localemap = findlocalemap(ERRMSG);
+   if (localemap)
+     remaplocale(localemap);
+#endif
+ 
+   if (!hasLoadedUnits) {
+     loadjobs = flags.jobs;
+     lazyload = flags.lazy;
+     tracebegin("loaddatabase", (char *) 0);
+     readerr = loaddatabase(unitsfiles, stderr, unitcount, prefixcount,
+                            funccount, flags.eager);
+     traceend();
+     if (readerr==E_MEMORY || readerr==E_FILE)
+       return 1;
+   }
+   return 0;
 }
 
 
-void
-open_logfile(void)
-{  
-  time_t logtime;
-  char * timestr;
+/*
+   Loads the units database for programs that convert numbers with
+   convertvalues() instead of running conversions through
+   unitsHandler().  The default units files are loaded lazily, as
+   the WASM module loads them.  Returns 0 if the units are loaded.
+*/
 
-  logfile = openfile(logfilename, "at");
-  if (!logfile){
-    fprintf(stderr, "%s: cannot write to log file '%s'.  ", 
-            progname, logfilename);
-    perror(0);
-    exit(EXIT_FAILURE);
-  }
-  time(&logtime);
-  timestr = ctime(&logtime);
-  fprintf(logfile, "### Log started %s \n", timestr);
-  atexit(close_logfile);
+int
+loadunits(void)
+{
+   int unitcount=0, prefixcount=0, funccount=0;
+
+   if (hasLoadedUnits)
+     return 0;
+   setupenvironment("units");
+   flags.lazy = 1;
+   flags.eager = 0;
+   flags.jobs = 1;
+   parserflags.minusminus = 1;
+   parserflags.oldstar = 0;
+   unitsfiles[0] = 0;
+   return loadunitsfiles(&unitcount, &prefixcount, &funccount);
 }
 
 
+/* Keeps a copy of a result for '_', replacing the last one */
+
 void
-write_files_sig(int sig)
+setlastunit(struct unittype *unit)
 {
-#ifdef READLINE
-  if (historyfile)
-    save_history();
+   freeunit(&lastunit);
+   unitcopy(&lastunit, unit);
+   lastunitset = 1;
+}
+
+
+/* Runs the conversion given on the command line.  have and want may
+   hold units on return, even after an error, and *wantstr may be
+   replaced by a unit list, so the caller frees all three. */
+
+static int
+convertargs(char *havestr, char **wantstr, struct unittype *have,
+            struct unittype *want)
+{
+   struct func *funcval;
+   struct wantalias *alias;
+
+   replacectrlchars(havestr);
+   if (*wantstr)
+     replacectrlchars(*wantstr);
+#ifdef SUPPORT_UTF8
+   if (strwidth(havestr)<0){
+     printf("Error: %s on input\n",invalid_utf8);
+     return EXIT_FAILURE;
+   }
+   if (*wantstr && strwidth(*wantstr)<0){
+     printf("Error: %s on input\n",invalid_utf8);
+     return EXIT_FAILURE;
+   }
 #endif
-  close_logfile();
-  signal(sig, SIG_DFL);
-  raise(sig);
+   replace_minus(havestr);
+   removespaces(havestr);
+   if (*wantstr) {
+     replace_minus(*wantstr);
+     removespaces(*wantstr);
+   }
+   if ((funcval = fnlookup(havestr))){
+     tracebegin("output", "function", havestr, (char *) 0);
+     showfuncdefinition(funcval, FUNCTION);
+     setlastunit(have);
+     freeunit(have);
+     return EXIT_SUCCESS;
+   }
+   if ((funcval = invfnlookup(havestr))){
+     tracebegin("output", "function", havestr, (char *) 0);
+     showfuncdefinition(funcval, INVERSE);
+     setlastunit(have);
+     freeunit(have);
+     return EXIT_SUCCESS;
+   }
+   if ((alias = aliaslookup(havestr))){
+     tracebegin("output", "unitlist", havestr, (char *) 0);
+     showunitlistdef(alias);
+     return EXIT_SUCCESS;
+   }
+   if (processunit(have, havestr, NOPOINT))
+     return EXIT_FAILURE;
+   if (flags.showconformable == 1) {
+     tracebegin("output", "have", havestr, (char *) 0);
+     tryallunits(have,0);
+     return EXIT_SUCCESS;
+   }
+   if (!*wantstr){
+     tracebegin("output", "have", havestr, (char *) 0);
+     showdefinition(havestr,have);
+     setlastunit(have);
+     freeunit(have);
+     return EXIT_SUCCESS;
+   }
+   if (replacealias(wantstr, 0)) /* the 0 says that we can free *wantstr */
+     return EXIT_FAILURE;
+   if ((funcval = fnlookup(*wantstr))){
+     tracebegin("output", "have", havestr, "want", *wantstr, (char *) 0);
+     if (showfunc(havestr, have, funcval)) {  /* Clobbers have */
+       return EXIT_FAILURE;
+     } else {
+       setlastunit(have);
+       freeunit(have);
+       return EXIT_SUCCESS;
+     }
+   }
+   if (processwant(want, *wantstr, NOPOINT))
+     return EXIT_FAILURE;
+   tracebegin("output", "have", havestr, "want", *wantstr, (char *) 0);
+   if (strchr(*wantstr, UNITSEPCHAR)){
+     if (showunitlist(havestr, have, *wantstr)) {
+       return EXIT_FAILURE;
+     } else {
+       setlastunit(have);
+       freeunit(have);
+       return EXIT_SUCCESS;
+     }
+   }
+   if (showanswer(havestr,have,*wantstr,want)) {
+     return EXIT_FAILURE;
+   } else {
+     freeunit(want);
+     setlastunit(have);
+     freeunit(have);
+     return EXIT_SUCCESS;
+   }
 }
 
 
+static int convertunits(int argc, char **argv);
+
 int
 unitsHandler(int argc, char **argv)
+{
+   int status;
+
+   status = convertunits(argc, argv);
+   if (flags.stats && !flags.interactive && hasLoadedUnits)
+     showstats();
+   if (tracefile && !flags.interactive){
+     traceendall();
+     if (writetrace(tracefile))
+       status = EXIT_FAILURE;
+     stoptrace();
+   }
+   return status;
+}
+
+
+static int
+convertunits(int argc, char **argv)
 {
    static struct unittype have, want;
+   double argstart;
    char *havestr=0, *wantstr=0;
    struct func *funcval;
    struct wantalias *alias;
+   int status;
    int havestrsize=0;   /* Only used if READLINE is undefined */
    int wantstrsize=0;   /* Only used if READLINE is undefined */
-   int readerr;
-   char **unitfileptr;
    int unitcount=0, prefixcount=0, funccount=0;   /* for counting units */
    char *queryhave, *querywant, *comment;
+   static char *prefixedhave = 0, *prefixedwant = 0;  /* with promptprefix */
    int queryhavewidth, querywantwidth;
-#ifdef _WIN32
-   char *localemap;
-#endif
 
    /* Set program parameter defaults */
    num_format.format = NULL;
@@ -6001,6 +11217,7 @@ unitsHandler(int argc, char **argv)
 
    flags.quiet = 0;       /* Do not supress prompting */
    flags.unitcheck = 0;   /* Unit checking is off */
+   flags.checkchanged = 0;
    flags.verbose = 1;     /* Medium verbosity */
    flags.round = 0;       /* Rounding off */
    flags.strictconvert=0; /* Strict conversion disabled (reciprocals active) */
@@ -6009,26 +11226,18 @@ unitsHandler(int argc, char **argv)
    flags.showconformable=0;  /* show unit conversion rather than all conformable units */
    flags.showfactor = 0;  /* Don't show a multiplier for a 1|x fraction */
                           /*       in unit list output */
+   flags.eager = 0;       /* Units are reduced when they are used */
+   flags.lazy = 0;        /* Definitions are parsed when they are read */
+   flags.stats = 0;       /* No counters printed */
+   flags.explain = 0;     /* Reductions are not shown */
+   flags.memstats = 0;    /* No memory report */
+   flags.jobs = 1;        /* No worker processes */
+   subsetnames = subsetoutput = 0;   /* No --subset */
+   tracefile = 0;                    /* No --trace */
    parserflags.minusminus = 1;  /* '-' character gives subtraction */
    parserflags.oldstar = 0;     /* '*' has same precedence as '/' */
 
-   progname = getprogramname(argv[0]);
-
-   /*
-     unless UNITSFILE and LOCALEMAP have absolute pathnames, we may need
-     progdir to search for supporting files
-   */
-   if (!(isfullpath(UNITSFILE) && isfullpath(LOCALEMAP)))
-     progdir = getprogdir(argv[0], &fullprogname);
-   else {
-     progdir = NULL;
-     fullprogname = NULL;
-   }
-   datadir = getdatadir();      /* directory to search as last resort */
-
-   checklocale();
-
-   homedir = findhome(&homedir_error);
+   setupenvironment(argv[0]);
 
 #ifdef READLINE
 #  if RL_READLINE_VERSION > 0x0402 
@@ -6057,7 +11266,14 @@ unitsHandler(int argc, char **argv)
    if (!pager)
      pager = DEFAULTPAGER;
 
+   argstart = walltime();
    flags.interactive = processargs(argc, argv, &havestr, &wantstr);
+   if (tracefile){
+     starttrace(argstart);
+     tracespan("processargs", argstart, (char *) 0);
+     if (flags.interactive)
+       atexit(savetrace);
+   }
 
 #ifdef READLINE   
    if (flags.interactive && flags.readline && historyfile){
@@ -6090,34 +11306,18 @@ unitsHandler(int argc, char **argv)
    if (flags.verbose==0)
      deftext = "";
 
-   if (!unitsfiles[0]){
-     char *unitsfile;
-     unitsfile = findunitsfile(ERRMSG);
-     if (!unitsfile)
-       return EXIT_FAILURE;
-     else {
-       int file_exists;
+   if (loadunitsfiles(&unitcount, &prefixcount, &funccount))
+     return EXIT_FAILURE;
+   if (flags.stats && flags.interactive)
+     atexit(showstats);
 
-       unitsfiles[0] = unitsfile;
-       unitsfiles[1] = personalfile(HOME_UNITS_ENV,homeunitsfile, 
-                                         0, &file_exists);
-       unitsfiles[2] = 0;
-     }
-   }
+   if (subsetnames)
+     return makesubset(subsetnames, subsetoutput)
+       ? EXIT_FAILURE : EXIT_SUCCESS;
 
-#ifdef _WIN32
-   localemap = findlocalemap(ERRMSG);
-   if (localemap)
-     remaplocale(localemap);
-#endif
- 
-   if (!hasLoadedUnits) {
-		for(unitfileptr=unitsfiles;*unitfileptr;unitfileptr++){
-		 readerr = readunits(*unitfileptr, stderr, &unitcount, &prefixcount, 
-							 &funccount, 0);
-		 if (readerr==E_MEMORY || readerr==E_FILE) 
-		   return EXIT_FAILURE;
-	   }   
+   if (flags.memstats){
+     fputs(formatmemstats(), stdout);
+     return EXIT_SUCCESS;
    }
 
    if (flags.quiet)
@@ -6127,10 +11327,12 @@ unitsHandler(int argc, char **argv)
        queryhave = QUERYHAVE;
        querywant = QUERYWANT;
      } else {
-       queryhave = (char *)mymalloc(strlen(promptprefix)+strlen(QUERYHAVE)+1,
-                                    "(main)");
-       querywant = (char *)mymalloc(strlen(promptprefix)+strlen(QUERYWANT)+1,
-                                    "(main)");
+       free(prefixedhave);
+       free(prefixedwant);
+       queryhave = prefixedhave =
+         (char *)mymalloc(strlen(promptprefix)+strlen(QUERYHAVE)+1, "(main)");
+       querywant = prefixedwant =
+         (char *)mymalloc(strlen(promptprefix)+strlen(QUERYWANT)+1, "(main)");
        strcpy(queryhave, promptprefix);
        strcat(queryhave, QUERYHAVE);
        memset(querywant, ' ', strlen(promptprefix));
@@ -6143,99 +11345,27 @@ unitsHandler(int argc, char **argv)
    querywantwidth = strwidth(querywant);
 
    if (flags.unitcheck) {
-     checkunits(flags.unitcheck==2 || flags.verbose==2);
+     tracebegin("checkunits", (char *) 0);
+     checkunits(flags.unitcheck==2 || flags.verbose==2, flags.jobs,
+                flags.checkchanged);
+     traceend();
      return EXIT_SUCCESS;
    }
 
    if (!flags.interactive) {
-     replacectrlchars(havestr);
-     if (wantstr)
-       replacectrlchars(wantstr);
-#ifdef SUPPORT_UTF8
-     if (strwidth(havestr)<0){
-       printf("Error: %s on input\n",invalid_utf8);
-       return EXIT_FAILURE;
-     }
-     if (wantstr && strwidth(wantstr)<0){
-       printf("Error: %s on input\n",invalid_utf8);
-       return EXIT_FAILURE;
-     }
-#endif
-     replace_minus(havestr);
-     removespaces(havestr);
-     if (wantstr) {
-       replace_minus(wantstr);
-       removespaces(wantstr);
-     }
-     if ((funcval = fnlookup(havestr))){
-       showfuncdefinition(funcval, FUNCTION);
-	   unitcopy(&lastunit, &have);
-       lastunitset=1;
-       freeunit(&have);
-       return EXIT_SUCCESS;
-     }
-     if ((funcval = invfnlookup(havestr))){
-       showfuncdefinition(funcval, INVERSE);
-	   unitcopy(&lastunit, &have);
-       lastunitset=1;
-       freeunit(&have);
-       return EXIT_SUCCESS;
-     }
-     if ((alias = aliaslookup(havestr))){
-       showunitlistdef(alias);
-       return EXIT_SUCCESS;
-     }
-     if (processunit(&have, havestr, NOPOINT))
-       return EXIT_FAILURE;
-     if (flags.showconformable == 1) {
-       tryallunits(&have,0);
-       return EXIT_SUCCESS;
-     }
-     if (!wantstr){
-       showdefinition(havestr,&have);
-	   unitcopy(&lastunit, &have);
-       lastunitset=1;
-       freeunit(&have);
-       return EXIT_SUCCESS;
-     }
-     if (replacealias(&wantstr, 0)) /* the 0 says that we can free wantstr */
-       return EXIT_FAILURE;
-     if ((funcval = fnlookup(wantstr))){
-       if (showfunc(havestr, &have, funcval)) {  /* Clobbers have */
-         return EXIT_FAILURE;
-       } else {
-		 unitcopy(&lastunit, &have);
-         lastunitset=1;
-         freeunit(&have);
-         return EXIT_SUCCESS;
-	   }
-     }
-     if (processwant(&want, wantstr, NOPOINT))
-       return EXIT_FAILURE;
-     if (strchr(wantstr, UNITSEPCHAR)){
-       if (showunitlist(havestr, &have, wantstr)) {
-         return EXIT_FAILURE;
-       } else {
-		 unitcopy(&lastunit, &have);
-         lastunitset=1;
-         freeunit(&have);
-         return EXIT_SUCCESS;
-	   }
-     }
-     if (showanswer(havestr,&have,wantstr,&want)) {
-       return EXIT_FAILURE;
-     } else {
-	   freeunit(&want);
-	   unitcopy(&lastunit, &have);
-       lastunitset=1;
-       freeunit(&have);
-       return EXIT_SUCCESS;
-	 }
+     if (wantstr)               /* replacealias() may free and replace it */
+       wantstr = dupstr(wantstr);
+     status = convertargs(havestr, &wantstr, &have, &want);
+     freeunit(&have);
+     freeunit(&want);
+     free(wantstr);
+     return status;
    } else {       /* interactive */
      for (;;) {
        do {
          fflush(stdout);
          getuser(&havestr,&havestrsize,queryhave);
+         reloadunits();
          replace_minus(havestr);
          comment = strip_comment(havestr);
          removespaces(havestr);
@@ -6252,15 +11382,21 @@ unitsHandler(int argc, char **argv)
            fprintf(logfile, "%s%s\n", LOGFROM, havestr);
        }
        if ((alias = aliaslookup(havestr))){
+         tracebegin("output", "unitlist", havestr, (char *) 0);
          showunitlistdef(alias);
+         traceend();
          continue;
        }
        if ((funcval = fnlookup(havestr))){
+         tracebegin("output", "function", havestr, (char *) 0);
          showfuncdefinition(funcval, FUNCTION);
+         traceend();
          continue;
        }
        if ((funcval = invfnlookup(havestr))){
+         tracebegin("output", "function", havestr, (char *) 0);
          showfuncdefinition(funcval, INVERSE);
+         traceend();
          continue;
        }
        do { 
@@ -6291,6 +11427,8 @@ unitsHandler(int argc, char **argv)
            fprintf(logfile, "\t#%s", comment);
          putc('\n', logfile);
        }
+       tracebegin("output", "have", havestr,
+                  "want", emptystr(wantstr) ? (char *) 0 : wantstr, (char *) 0);
        if (emptystr(wantstr))
          showdefinition(havestr,&have);
        else if (strchr(wantstr, UNITSEPCHAR))
@@ -6301,8 +11439,8 @@ unitsHandler(int argc, char **argv)
          showanswer(havestr,&have,wantstr, &want);
          freeunit(&want);
        }
-       unitcopy(&lastunit, &have);
-       lastunitset=1;
+       traceend();
+       setlastunit(&have);
        freeunit(&have);
      }
    }
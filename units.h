@@ -23,6 +23,18 @@
 #include <math.h>
 #include <errno.h>
 
+/*
+   With UNITS_THREADS defined, conversions can run in several threads at
+   once with convertbatch().  The state that the parser and the reduction
+   code change while they work is then kept per thread.
+*/
+
+#ifdef UNITS_THREADS
+#  define THREADLOCAL _Thread_local
+#else
+#  define THREADLOCAL
+#endif
+
 /* Apparently popen and pclose require leading _ under windows */
 #if defined(_MSC_VER) || defined(__MINGW32__)
 #  define popen _popen
@@ -84,6 +96,8 @@
 #define E_BASE_NOTROOT 23
 #define E_DIMEXPONENT 24
 #define E_NOTAFUNC 25
+#define E_NOTLOADED 26    /* Unit is in a chunk not loaded yet */
+#define E_NOTCONFORMABLE 27
 
 extern char *errormsg[];
 
@@ -99,6 +113,7 @@ extern char *errormsg[];
 extern char *NULLUNIT;
 
 #define MAXSUBUNITS 100         /* Size of internal unit reduction buffer */
+#define MAXMEM 100              /* Units the parser can have allocated */
 
 struct unittype {
    char *numerator[MAXSUBUNITS];
@@ -138,8 +153,8 @@ struct parseflag {
 };
 extern struct parseflag parserflags;
 
-extern struct unittype *parameter_value;
-extern char *function_parameter;
+extern THREADLOCAL struct unittype *parameter_value;
+extern THREADLOCAL char *function_parameter;
 
 extern int lastunitset;
 extern struct unittype lastunit;
@@ -165,4 +180,126 @@ int evalfunc(struct unittype *theunit, struct func *infunc, int inverse,
 int parseunit(struct unittype *output, const char *input, char **errstr,
               int *errloc);
 int unitsHandler(int argc, char **argv);
+int loadunits(void);
+int convertvalues(char *havestr, char *wantstr, const double *in,
+                  double *out, int *status, int count);
+int convertbatch(char **have, char **want, const double *in, double *out,
+                 int *status, int count, int threads);
+void freedatabase(void);
+int loadunitschunk(char *file, int lazy);
+int reloadunits(void);
+char *pendingunitschunk(void);
+char *formatstats(void);
+char *formatmemstats(void);
+void resetstats(void);
+double walltime(void);
+void starttrace(double start);
+void stoptrace(void);
+char *tracejson(void);
+
+
+/*
+   Counters for the hot paths of the lookup and reduction code, printed
+   by --stats.  Building with NO_STATS defined compiles the counting out
+   entirely, and --stats then only reports that they are missing.
+*/
+
+#ifndef NO_STATS
+struct unitsstats {
+  unsigned long ulookup, ulookupprobes;     /* unit table lookups, slots */
+  unsigned long plookup, plookupprobes;     /* prefix lookups, chain links */
+  unsigned long fnlookup, fnlookupprobes;   /* function lookups, links */
+  unsigned long lookupunit, bloomrejects;   /* lookups, Bloom filter misses */
+  unsigned long pluralretries, prefixretries;
+  unsigned long parseunit, parsedepth, maxparsedepth;
+  unsigned long getnewunit, maxparserunits; /* parser units, peak in use */
+  unsigned long dupstr, dupstrbytes;
+  unsigned long reduceproduct, reduceiterations;
+  unsigned long evalfunc;
+};
+extern THREADLOCAL struct unitsstats unitsstats;
+#  define STATCOUNT(field) (unitsstats.field++)
+#  define STATADD(field, n) (unitsstats.field += (n))
+#  define STATMAX(field, n) \
+     (unitsstats.field < (unsigned long)(n) ? unitsstats.field = (n) : 0)
+#else
+#  define STATCOUNT(field)
+#  define STATADD(field, n)
+#  define STATMAX(field, n)
+#endif
+
+
+/*
+   The standard units database compiled into the program by unitsgen.
+   Each file is a list of records in file order.  Plain unit and prefix
+   definitions and functions are stored ready to add to the tables;
+   commands and any other lines are stored as text and read as usual.
+   builtinunits, builtinprefixes and builtinfunctionentries list the
+   final definitions in the tables that unitsgen loaded, so that the
+   resolution and reductions stored with the units can be used when
+   the loaded tables turn out to be the same.
+*/
+
+#define BUILTIN_LINE 0          /* text of a normalized line */
+#define BUILTIN_UNIT 1
+#define BUILTIN_PREFIX 2        /* name without the trailing '-' */
+#define BUILTIN_FUNCTION 3      /* function or table in builtinfunctions */
+
+#define BUILTIN_REDEFINE 1      /* definition marked with '+' */
+#define BUILTIN_ASCII 2         /* line has only ASCII characters */
+
+struct builtinrecord {
+  char kind;
+  char flags;
+  int linenumber;
+  char *name;                   /* the whole line for BUILTIN_LINE */
+  char *value;
+  int function;                 /* index in builtinfunctions */
+};
+
+struct builtinfile {
+  char *name;                   /* file name without its directory */
+  const struct builtinrecord *records;
+  int count;
+  int maxline;                  /* longest BUILTIN_LINE text */
+};
+
+struct builtinentry {           /* final prefix or function */
+  char *name;
+  char *value;                  /* definition of a prefix */
+  int function;                 /* builtinfunctions entry whose */
+};                              /*   definition a function shares */
+
+struct builtinunit {            /* final unit */
+  char *name;
+  char *value;
+  int target;                   /* index in builtinunits or -1 */
+  int chain, chainlen;          /* start in builtinchains and length */
+  char flattened;
+  int reduced;                  /* index in builtinreductions or -1 */
+};
+
+struct builtinreduction {
+  int steps, stepcount;         /* start in builtinsteps and length */
+  int numlen, denlen;
+  int names;                    /* start in builtinreducednames */
+};
+
+struct builtinstep {            /* multiply by factor, or divide by it */
+  double factor;                /*   with divide set */
+  char divide;
+};
 
+extern const struct builtinfile builtinfiles[];  /* ends with a null name */
+extern const struct func builtinfunctions[];
+extern const struct builtinunit builtinunits[];
+extern const struct builtinentry builtinprefixes[];
+extern const struct builtinentry builtinfunctionentries[];
+extern const struct builtinreduction builtinreductions[];
+extern const int builtinreducednames[];  /* indexes in builtinunits, */
+                                         /*   or -1 for an empty slot */
+extern const struct builtinstep builtinsteps[];
+extern const double builtinchains[];     /* factors of flattened units */
+extern const int builtinunitcount, builtinprefixcount, builtinfunctioncount;
+extern const int builtinresolved;        /* resolution data is present */
+extern const struct parseflag builtinflags;  /* parser flags for reductions */
@@ -0,0 +1,1492 @@
+/*
+ *  unitsbench, timing tests for the units library
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+   Usage: unitsbench load [-n iterations] [-l] file...
+          unitsbench first [-n iterations] [-l] have want file...
+          unitsbench width [-n iterations] file...
+          unitsbench query [-n iterations] file...
+          unitsbench scale [-n iterations] file...
+          unitsbench batch [-n iterations] [-j threads] file...
+          unitsbench steady [-n calls] file...
+          unitsbench generate lines file
+
+   load     Times loading the units data files.  Every iteration loads
+            the files into a fresh process, so each run measures a
+            complete cold load of the database.  With -l the
+            definitions are loaded lazily as with --lazy.
+
+   first    Times the first conversion in a fresh process: loading the
+            files and converting have to want through unitsHandler(),
+            as the units program and the WASM module do.  With -l the
+            conversion is run with --lazy.
+
+   generate Writes a synthetic units file with the given number of lines
+            for timing loads of very large databases.  Its units are
+            defined in terms of the SI base units and of each other, so
+            it should be loaded after definitions.units.  It also has
+            prefixes, functions, tables and unit lists in about the
+            proportions of definitions.units.
+
+   scale    Loads the files followed by synthetic files of 10000, 100000
+            and 1000000 lines, each in a fresh process, and prints one
+            line per size: the numbers of units, prefixes, functions and
+            unit lists, the readunits() time, the peak resident size
+            from getrusage(), the arena size, the mean and longest utab
+            chains, the longest run of occupied slots in the unit
+            index, the longest ptab and ftab chains, and the median
+            times in nanoseconds to look up a unit, a prefix, a
+            function and a unit list.
+
+   batch    Converts the pairs of conformable units of the query corpus
+            below as one batch of rows with convertbatch(), first in one
+            thread and then in twice as many each time up to the number
+            given with -j or the number of processors.  It prints the
+            median time, the rows per second and the speedup over one
+            thread for each, and fails if any number of threads gives
+            different results.  Only a build with UNITS_THREADS defined
+            uses more than one thread.
+
+   steady   Runs a mix of conversions, definitions and errors through
+            unitsHandler() in one process, one million calls or the
+            number given with -n, and fails if the blocks allocated
+            after the first tenth of them are not all freed by the end.
+            It prints the time and the mymalloc() calls per conversion
+            and the blocks left allocated during and after that warmup.
+
+   width    Times strwidth() over every line of the files in a UTF-8
+            locale and checks each result against mbsrtowcs() and
+            wcswidth().
+
+   query    Times the operations behind a single query on their own,
+            with corpora built from the loaded files: every unit name,
+            every prefix and unit pair that lookupunit() accepts, every
+            function with an argument it can evaluate, pairs of
+            conformable units and units paired with the unit lists of
+            the same dimension.  Each item is timed over enough
+            repetitions to take about a microsecond, and its fastest
+            time over the iterations is kept.  One line is printed for
+            each operation with the number of items, the repetitions,
+            the mean time per operation, the mymalloc() calls per
+            operation and the percentiles of the item times, all in
+            nanoseconds.  The operations that change their argument
+            work on a copy, so unitcopy is timed too as a baseline.
+*/
+
+#define _XOPEN_SOURCE 600
+
+#include <stdio.h>
+#include <locale.h>
+#include <wchar.h>
+#include <sys/stat.h>
+
+#include "units.h"
+
+#if !defined (_WIN32)
+#  include <unistd.h>
+#  include <sys/wait.h>
+#  include <sys/time.h>
+#  include <sys/resource.h>
+#  include <time.h>
+#  define USE_FORK
+#endif
+
+#define DEFAULTITERATIONS 20
+#define QUERYITERATIONS 3
+#define MINSAMPLE 1000          /* Nanoseconds timed for each query item */
+
+/* Internal functions and variables of units.c */
+
+extern char *progname;
+extern int utf8mode;
+extern int loadjobs;
+extern int lazyload;
+void checklocale();
+int readunits(char *file, FILE *errfile,
+              int *unitcount, int *prefixcount, int *funccount, int depth);
+double walltime(void);
+size_t arenaused(void);
+int strwidth(const char *str);
+extern THREADLOCAL unsigned long mymalloccount;
+void foreachdbname(void (*fn)(int kind, char *name, char *def, void *data),
+                   void *data);
+struct prefixlist *plookup(const char *str);
+char *lookupunit(char *unit, int prefixok);
+int completereduce(struct unittype *unit);
+int compareunits(struct unittype *first, struct unittype *second,
+                 int (*isdimless)(char *name));
+int ignore_dimless(char *name);
+int checkunitlist(char *unitstr, int promptlen);
+int showanswer(char *havestr, struct unittype *have,
+               char *wantstr, struct unittype *want);
+int showunitlist(char *havestr, struct unittype *have, char *wantstr);
+struct wantalias *aliaslookup(const char *str);
+void hashstats(int table, int *chains, int *entries, int *longest);
+
+#define FUNCTION 0              /* evalfunc() arguments */
+#define NORMALERR 0
+#define NOERRMSG -2             /* checkunitlist() reports nothing */
+
+
+struct loadresult {
+  double seconds;
+  int units, prefixes, funcs;
+  size_t arena;
+};
+
+
+void
+loadfiles(char **files, int nfiles, struct loadresult *result)
+{
+  int i;
+
+  result->units = result->prefixes = result->funcs = 0;
+  result->seconds = walltime();
+  for(i=0;i<nfiles;i++)
+    if (readunits(files[i], stderr, &result->units, &result->prefixes,
+                  &result->funcs, 0) == E_FILE)
+      exit(EXIT_FAILURE);
+  result->seconds = walltime() - result->seconds;
+  result->arena = arenaused();
+}
+
+
+/* Runs a single conversion with unitsHandler(), starting from an empty
+   database.  The output is discarded when running in a child
+   process. */
+
+void
+convertfirst(char **files, int nfiles, char **conversion,
+             struct loadresult *result)
+{
+  char **argv;
+  int i, argc = 0;
+
+  argv = (char **) mymalloc((2*nfiles+7)*sizeof(char *), "(convertfirst)");
+  argv[argc++] = "units";
+  argv[argc++] = "--strict";
+  argv[argc++] = "--one-line";
+  if (lazyload)
+    argv[argc++] = "--lazy";
+  for(i=0;i<nfiles;i++){
+    argv[argc++] = "-f";
+    argv[argc++] = files[i];
+  }
+  argv[argc++] = conversion[0];
+  argv[argc++] = conversion[1];
+  argv[argc] = 0;
+#ifdef USE_FORK
+  if (!freopen("/dev/null", "w", stdout))
+    exit(EXIT_FAILURE);
+#endif
+  freedatabase();
+  result->units = result->prefixes = result->funcs = 0;
+  result->seconds = walltime();
+  if (unitsHandler(argc, argv))
+    exit(EXIT_FAILURE);
+  result->seconds = walltime() - result->seconds;
+  result->arena = arenaused();
+  free(argv);
+}
+
+
+/* Loads the files, and runs the conversion if one is given, in a child
+   process so that every load starts with empty tables. */
+
+int
+timeload(char **files, int nfiles, char **conversion,
+         struct loadresult *result)
+{
+#ifdef USE_FORK
+  int fd[2], status;
+  pid_t pid;
+
+  if (pipe(fd))
+    return 1;
+  fflush(stdout);
+  pid = fork();
+  if (pid < 0)
+    return 1;
+  if (pid == 0){
+    close(fd[0]);
+    if (conversion)
+      convertfirst(files, nfiles, conversion, result);
+    else
+      loadfiles(files, nfiles, result);
+    _exit(write(fd[1], result, sizeof(*result)) == sizeof(*result)
+          ? EXIT_SUCCESS : EXIT_FAILURE);
+  }
+  close(fd[1]);
+  status = read(fd[0], result, sizeof(*result)) != sizeof(*result);
+  close(fd[0]);
+  waitpid(pid, 0, 0);
+  return status;
+#else
+  if (conversion)
+    convertfirst(files, nfiles, conversion, result);
+  else
+    loadfiles(files, nfiles, result);
+  return 0;
+#endif
+}
+
+
+int
+comparedouble(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+
+void
+report(char *name, double *times, int n, double bytes)
+{
+  double total = 0;
+  int i;
+
+  qsort(times, n, sizeof(double), comparedouble);
+  for(i=0;i<n;i++)
+    total += times[i];
+  printf("%-10s %4d runs  min %8.3f ms  median %8.3f ms  mean %8.3f ms",
+         name, n, 1000*times[0], 1000*times[n/2], 1000*total/n);
+  if (bytes > 0)
+    printf("  %7.1f MB/s", bytes / times[n/2] / 1e6);
+  putchar('\n');
+}
+
+
+int
+benchload(char **files, int nfiles, char **conversion, int iterations)
+{
+  struct loadresult result;
+  struct stat statbuf;
+  double *times, bytes = 0;
+  int i;
+
+  for(i=0;i<nfiles;i++)
+    if (!stat(files[i], &statbuf))
+      bytes += statbuf.st_size;
+  times = (double *) mymalloc(iterations*sizeof(double), "(benchload)");
+  for(i=0;i<iterations;i++){
+    if (timeload(files, nfiles, conversion, &result)){
+      fprintf(stderr, "%s: %s failed\n", progname,
+              conversion ? "conversion" : "load");
+      return EXIT_FAILURE;
+    }
+    times[i] = result.seconds;
+  }
+  if (conversion){
+    printf("'%s' to '%s'%s, %lu KB in arena\n", conversion[0],
+           conversion[1], lazyload ? " with --lazy" : "",
+           (unsigned long) (result.arena / 1024));
+    report("first", times, iterations, 0);
+  } else {
+    printf("%d units, %d prefixes, %d nonlinear units, %lu KB in arena\n",
+           result.units, result.prefixes, result.funcs,
+           (unsigned long) (result.arena / 1024));
+    report("load", times, iterations, bytes);
+  }
+  free(times);
+  return EXIT_SUCCESS;
+}
+
+
+/* The width computation used before the ASCII fast path was added */
+
+int
+refwidth(const char *str)
+{
+  wchar_t *widestr;
+  int len;
+
+  len = strlen(str)+1;
+  widestr = (wchar_t *) mymalloc(sizeof(wchar_t)*len, "(refwidth)");
+  len = mbsrtowcs(widestr, &str, len, NULL);
+  if (len != -1)
+    len = wcswidth(widestr, len);
+  free(widestr);
+  return len;
+}
+
+
+/* Reads the lines of the files, without their newlines, into one
+   array. */
+
+char **
+readlines(char **files, int nfiles, int *count, double *bytes)
+{
+  char **lines = 0, buf[4096];
+  int i, alloc = 0;
+  size_t len;
+  FILE *in;
+
+  *count = 0;
+  *bytes = 0;
+  for(i=0;i<nfiles;i++){
+    in = fopen(files[i], "r");
+    if (!in){
+      fprintf(stderr, "%s: cannot open '%s'\n", progname, files[i]);
+      exit(EXIT_FAILURE);
+    }
+    while (fgets(buf, sizeof(buf), in)){
+      len = strlen(buf);
+      if (len && buf[len-1] == '\n')
+        buf[--len] = 0;
+      if (*count == alloc){
+        alloc = alloc ? 2*alloc : 1024;
+        lines = (char **) realloc(lines, alloc*sizeof(char *));
+        if (!lines){
+          fprintf(stderr, "%s: memory allocation error\n", progname);
+          exit(EXIT_FAILURE);
+        }
+      }
+      lines[(*count)++] = dupstr(buf);
+      *bytes += len;
+    }
+    fclose(in);
+  }
+  return lines;
+}
+
+
+int
+benchwidth(char **files, int nfiles, int iterations)
+{
+  char **lines;
+  double *times, bytes;
+  int i, j, count, ascii = 0, mismatch = 0;
+  volatile int sink = 0;
+
+  if (!setlocale(LC_CTYPE, "C.UTF-8") && !setlocale(LC_CTYPE, "en_US.UTF-8")){
+    fprintf(stderr, "%s: no UTF-8 locale available\n", progname);
+    return EXIT_FAILURE;
+  }
+  utf8mode = 1;
+  lines = readlines(files, nfiles, &count, &bytes);
+  for(i=0;i<count;i++){
+    for(j=0;lines[i][j] && !(lines[i][j] & 0x80);j++);
+    ascii += !lines[i][j];
+    if (strwidth(lines[i]) != refwidth(lines[i])){
+      if (mismatch++ < 10)
+        fprintf(stderr, "%s: width %d, expected %d: %s\n", progname,
+                strwidth(lines[i]), refwidth(lines[i]), lines[i]);
+    }
+  }
+  printf("%d lines, %d plain ASCII, %d width mismatches\n",
+         count, ascii, mismatch);
+  times = (double *) mymalloc(iterations*sizeof(double), "(benchwidth)");
+  for(j=0;j<iterations;j++){
+    times[j] = walltime();
+    for(i=0;i<count;i++)
+      sink += strwidth(lines[i]);
+    times[j] = walltime() - times[j];
+  }
+  report("strwidth", times, iterations, bytes);
+  for(j=0;j<iterations;j++){
+    times[j] = walltime();
+    for(i=0;i<count;i++)
+      sink += refwidth(lines[i]);
+    times[j] = walltime() - times[j];
+  }
+  report("reference", times, iterations, bytes);
+  free(times);
+  for(i=0;i<count;i++)
+    free(lines[i]);
+  free(lines);
+  return mismatch ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+/* Writes a unit name made from n that cannot collide with the names in
+   definitions.units or end in a digit */
+
+void
+synthname(FILE *out, unsigned long n)
+{
+  fputs("syn", out);
+  do {
+    putc('a' + n % 26, out);
+    n /= 26;
+  } while (n);
+}
+
+
+/*
+   The synthetic file has roughly the mix of definitions.units: mostly
+   units defined by a factor and a few other units, which are in turn
+   defined in terms of others, some prefixes, nonlinear functions,
+   tables and unit lists, comments, blank lines and continued lines.
+   Prefixes, functions and unit lists get a random first letter, since
+   the prefix and function tables are hashed on it.  A fixed seed makes
+   the file the same on every run.
+*/
+
+int
+generate(long lines, char *file)
+{
+  static const char *base[] = {"m", "kg", "s", "A", "K", "mol", "cd"};
+  static const char *lists[] = {"hr;min;s", "km;m;cm", "lb;oz", "ft;in"};
+  unsigned long seed = 12345, r, name, recent[100];
+  unsigned long f1, f2;
+  const char *unit;
+  int letter;
+  long i, units = 0;
+  FILE *out;
+
+  if (!(out = fopen(file, "w"))){
+    fprintf(stderr, "%s: cannot write '%s'\n", progname, file);
+    return EXIT_FAILURE;
+  }
+  for(i=0;i<lines;i++){
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    r = (seed >> 33) % 1000;
+    f1 = 1 + (seed >> 24) % 100;
+    f2 = (seed >> 40) % 1000;
+    unit = base[(seed >> 12) % 7];
+    if (r < 100)
+      fputs(r < 50 ? "\n" : "# synthetic units\n", out);
+    else if (r < 125){
+      letter = 'a' + (seed >> 28) % 26;
+      if (r == 124)
+        fputs("!unitlist ", out);
+      putc(letter, out);
+      synthname(out, i);
+      if (r < 110)
+        fprintf(out, "-\t\t%lu\n", 2 + (seed >> 20) % 1000);
+      else if (r < 122){
+        fprintf(out, "(x) units=[1;%s^2] range=[0,) %lu.%lu x^2 %s^2 ; "
+                "sqrt(%c", unit, f1, f2, unit, letter);
+        synthname(out, i);
+        fprintf(out, " / (%lu.%lu %s^2))\n", f1, f2, unit);
+      } else if (r < 124){
+        fprintf(out, "[%s] \\\n\t0 0  1 %lu.%lu  2 %lu.%lu \\\n"
+                "\t3 %lu.%lu  4 %lu\n", unit, f1, f2, 2*f1, f2,
+                3*f1, f2, 4*f1+1);
+        i += 2;
+      } else
+        fprintf(out, " %s\n", lists[(seed >> 16) % 4]);
+    } else {
+      name = i;
+      synthname(out, name);
+      fprintf(out, "\t\t%lu.%lu %s", f1, f2, unit);
+      if (units && r < 600){
+        putc(' ', out);
+        synthname(out, recent[(seed >> 16) % (units < 100 ? units : 100)]);
+      }
+      if (r < 165){
+        fputs(" \\\n\t\t/ s", out);
+        i++;
+      }
+      fputs(r % 3 ? "\n" : "   # comment\n", out);
+      recent[units++ % 100] = name;
+    }
+  }
+  if (fclose(out)){
+    fprintf(stderr, "%s: error writing '%s'\n", progname, file);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+
+/* Returns the number of processors online */
+
+int
+processors(void)
+{
+#if defined (USE_FORK) && defined (_SC_NPROCESSORS_ONLN)
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+  return n > 1 ? (int) n : 1;
+#else
+  return 1;
+#endif
+}
+
+
+/* Returns a monotonic time in nanoseconds for timing single queries */
+
+double
+nanotime(void)
+{
+#ifdef USE_FORK
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+#else
+  return walltime() * 1e9;
+#endif
+}
+
+
+/* One item of a query corpus.  Which fields are set depends on the
+   corpus; the units are parsed, and reduced where the operation needs
+   a reduced unit, before any timing starts. */
+
+struct query {
+  char *have, *want;
+  struct unittype haveunit, wantunit;
+  struct func *func;
+  char *key;                    /* dimension, for pairing conformable units */
+};
+
+struct corpus {
+  struct query *items;
+  int count, alloc;
+};
+
+struct dbnames {
+  char **names[4];              /* units, prefixes, functions, aliases */
+  char **defs[4];
+  int count[4], alloc[4];
+};
+
+void
+collectname(int kind, char *name, char *def, void *data)
+{
+  struct dbnames *db = (struct dbnames *) data;
+  int i = strchr("upfa", kind) - "upfa";
+
+  if (db->count[i] == db->alloc[i]){
+    db->alloc[i] = db->alloc[i] ? 2*db->alloc[i] : 256;
+    db->names[i] = (char **) realloc(db->names[i],
+                                     db->alloc[i]*sizeof(char *));
+    db->defs[i] = (char **) realloc(db->defs[i],
+                                    db->alloc[i]*sizeof(char *));
+    if (!db->names[i] || !db->defs[i]){
+      fprintf(stderr, "%s: memory allocation error\n", progname);
+      exit(EXIT_FAILURE);
+    }
+  }
+  db->names[i][db->count[i]] = name;
+  db->defs[i][db->count[i]++] = def;
+}
+
+struct query *
+addquery(struct corpus *corpus)
+{
+  struct query *q;
+
+  if (corpus->count == corpus->alloc){
+    corpus->alloc = corpus->alloc ? 2*corpus->alloc : 1024;
+    corpus->items = (struct query *)
+      realloc(corpus->items, corpus->alloc*sizeof(struct query));
+    if (!corpus->items){
+      fprintf(stderr, "%s: memory allocation error\n", progname);
+      exit(EXIT_FAILURE);
+    }
+  }
+  q = corpus->items + corpus->count++;
+  memset(q, 0, sizeof(*q));
+  initializeunit(&q->haveunit);
+  initializeunit(&q->wantunit);
+  return q;
+}
+
+/* Returns the dimension of a reduced unit as a string */
+
+char *
+dimensionkey(struct unittype *unit)
+{
+  char **name, *key;
+  int len = 2;
+
+  for(name = unit->numerator; *name; name++)
+    len += strlen(*name)+1;
+  for(name = unit->denominator; *name; name++)
+    len += strlen(*name)+1;
+  key = (char *) mymalloc(len, "(dimensionkey)");
+  *key = 0;
+  for(name = unit->numerator; *name; name++)
+    strcat(strcat(key, *name), " ");
+  strcat(key, "/");
+  for(name = unit->denominator; *name; name++)
+    strcat(strcat(key, " "), *name);
+  return key;
+}
+
+int
+comparekey(const void *a, const void *b)
+{
+  return strcmp(((const struct query *) a)->key,
+                ((const struct query *) b)->key);
+}
+
+/* Sets the argument of a nonlinear function to a value inside its
+   domain, trying a few values until one can be evaluated.  Returns 0
+   on success. */
+
+int
+functionarg(struct func *func, struct unittype *arg)
+{
+  static const double tries[] = {1.5, 0.5, 2, 10};
+  struct functype *fwd = &func->forward;
+  struct unittype copy;
+  double value;
+  int i;
+
+  for(i=0;i<sizeof(tries)/sizeof(tries[0]);i++){
+    if (fwd->domain_min && fwd->domain_max)
+      value = (*fwd->domain_min + *fwd->domain_max) / 2;
+    else if (fwd->domain_min)
+      value = *fwd->domain_min + tries[i];
+    else if (fwd->domain_max)
+      value = *fwd->domain_max - tries[i];
+    else
+      value = tries[i];
+    if (fwd->dimen){
+      if (parseunit(arg, fwd->dimen, 0, 0))
+        return 1;
+    } else
+      initializeunit(arg);
+    arg->factor *= value;
+    if (!completereduce(arg)){
+      unitcopy(&copy, arg);
+      if (!evalfunc(&copy, func, FUNCTION, NORMALERR)){
+        freeunit(&copy);
+        return 0;
+      }
+      freeunit(&copy);
+    }
+    freeunit(arg);
+  }
+  return 1;
+}
+
+/* The corpora for the query benchmarks */
+
+struct corpus unitcorpus, prefixcorpus, tablecorpus, nonlinearcorpus;
+struct corpus pairedcorpus, listcorpus;
+
+void
+buildcorpora(void)
+{
+  struct dbnames db;
+  struct corpus reduced;
+  struct query *q, *r;
+  struct func *func;
+  char *name, *list, *first;
+  int i, j, k;
+
+  memset(&db, 0, sizeof(db));
+  memset(&reduced, 0, sizeof(reduced));
+  foreachdbname(collectname, &db);
+  for(i=0;i<db.count[0];i++){
+    q = addquery(&unitcorpus);
+    q->have = db.names[0][i];
+    if (parseunit(&q->haveunit, q->have, 0, 0)){
+      unitcorpus.count--;
+      continue;
+    }
+    r = addquery(&reduced);
+    r->have = q->have;
+    unitcopy(&r->haveunit, &q->haveunit);
+    if (completereduce(&r->haveunit)){
+      freeunit(&r->haveunit);
+      reduced.count--;
+      continue;
+    }
+    r->key = dimensionkey(&r->haveunit);
+  }
+  for(i=0;i<db.count[1];i++)
+    for(j=0;j<db.count[0];j++){
+      name = (char *) mymalloc(strlen(db.names[1][i])
+                               + strlen(db.names[0][j]) + 1, "(buildcorpora)");
+      strcat(strcpy(name, db.names[1][i]), db.names[0][j]);
+      if (!lookupunit(name, 1)){
+        free(name);
+        continue;
+      }
+      addquery(&prefixcorpus)->have = name;
+    }
+  for(i=0;i<db.count[2];i++){
+    func = fnlookup(db.names[2][i]);
+    if (func->table){
+      if (func->tablelen < 2)
+        continue;
+      q = addquery(&tablecorpus);
+      q->haveunit.factor = (func->table[0].location
+                            + func->table[1].location) / 2;
+    } else {
+      q = addquery(&nonlinearcorpus);
+      if (functionarg(func, &q->haveunit)){
+        nonlinearcorpus.count--;
+        continue;
+      }
+    }
+    q->have = func->name;
+    q->func = func;
+  }
+  /* Each unit is paired with the next one of the same dimension */
+  qsort(reduced.items, reduced.count, sizeof(struct query), comparekey);
+  for(i=0;i<reduced.count;i=j){
+    for(j=i+1;j<reduced.count
+              && !strcmp(reduced.items[i].key, reduced.items[j].key);j++);
+    if (j-i < 2)
+      continue;
+    for(k=i;k<j;k++){
+      q = addquery(&pairedcorpus);
+      r = reduced.items + (k+1 < j ? k+1 : i);
+      q->have = reduced.items[k].have;
+      q->want = r->have;
+      unitcopy(&q->haveunit, &reduced.items[k].haveunit);
+      unitcopy(&q->wantunit, &r->haveunit);
+    }
+  }
+  /* Every unit list is paired with the units of its dimension */
+  for(i=0;i<db.count[3];i++){
+    list = dupstr(db.defs[3][i]);
+    if (checkunitlist(list, NOERRMSG)){
+      free(list);
+      continue;
+    }
+    first = dupstr(list);
+    *strchr(first, ';') = 0;
+    q = addquery(&listcorpus);
+    if (parseunit(&q->wantunit, first, 0, 0) || completereduce(&q->wantunit)){
+      listcorpus.count--;
+      free(first);
+      free(list);
+      continue;
+    }
+    free(first);
+    name = dimensionkey(&q->wantunit);
+    freeunit(&q->wantunit);
+    listcorpus.count--;
+    for(j=0;j<reduced.count;j++)
+      if (!strcmp(reduced.items[j].key, name)){
+        q = addquery(&listcorpus);
+        q->have = reduced.items[j].have;
+        q->want = list;
+        unitcopy(&q->haveunit, &reduced.items[j].haveunit);
+      }
+    free(name);
+  }
+  for(i=0;i<reduced.count;i++){
+    freeunit(&reduced.items[i].haveunit);
+    free(reduced.items[i].key);
+  }
+  free(reduced.items);
+  for(i=0;i<4;i++){
+    free(db.names[i]);
+    free(db.defs[i]);
+  }
+}
+
+
+/* The timed operations.  Each one leaves the query as it was. */
+
+volatile long querysink;
+
+void
+oplookupunit(struct query *q)
+{
+  querysink += lookupunit(q->have, 1) != 0;
+}
+
+void
+opplookup(struct query *q)
+{
+  querysink += plookup(q->have) != 0;
+}
+
+void
+opparseunit(struct query *q)
+{
+  struct unittype unit;
+
+  querysink += parseunit(&unit, q->have, 0, 0);
+  freeunit(&unit);
+}
+
+void
+opunitcopy(struct query *q)
+{
+  struct unittype unit;
+
+  unitcopy(&unit, &q->haveunit);
+  freeunit(&unit);
+}
+
+void
+opcompletereduce(struct query *q)
+{
+  struct unittype unit;
+
+  unitcopy(&unit, &q->haveunit);
+  querysink += completereduce(&unit);
+  freeunit(&unit);
+}
+
+void
+opcompareunits(struct query *q)
+{
+  querysink += compareunits(&q->haveunit, &q->wantunit, ignore_dimless);
+}
+
+void
+opevalfunc(struct query *q)
+{
+  struct unittype unit;
+
+  unitcopy(&unit, &q->haveunit);
+  querysink += evalfunc(&unit, q->func, FUNCTION, NORMALERR);
+  freeunit(&unit);
+}
+
+void
+opshowanswer(struct query *q)
+{
+  querysink += showanswer(q->have, &q->haveunit, q->want, &q->wantunit);
+}
+
+void
+opshowunitlist(struct query *q)
+{
+  char list[512];
+
+  strncpy(list, q->want, sizeof(list)-1);    /* showunitlist() splits it */
+  list[sizeof(list)-1] = 0;
+  querysink += showunitlist(q->have, &q->haveunit, list);
+}
+
+struct querybench {
+  char *name;
+  struct corpus *corpus;
+  void (*op)(struct query *q);
+} querybenches[] = {
+  {"lookupunit/units", &unitcorpus, oplookupunit},
+  {"lookupunit/prefixed", &prefixcorpus, oplookupunit},
+  {"plookup/prefixed", &prefixcorpus, opplookup},
+  {"parseunit/units", &unitcorpus, opparseunit},
+  {"parseunit/prefixed", &prefixcorpus, opparseunit},
+  {"unitcopy/units", &unitcorpus, opunitcopy},
+  {"completereduce/units", &unitcorpus, opcompletereduce},
+  {"compareunits/conformable", &pairedcorpus, opcompareunits},
+  {"evalfunc/tables", &tablecorpus, opevalfunc},
+  {"evalfunc/nonlinear", &nonlinearcorpus, opevalfunc},
+  {"showanswer/conformable", &pairedcorpus, opshowanswer},
+  {"showunitlist/unitlists", &listcorpus, opshowunitlist},
+  {0, 0, 0}
+};
+
+
+/* Times op on each item of the corpus over enough repetitions to take
+   MINSAMPLE nanoseconds, and leaves the fastest time of each item over
+   the iterations in best, sorted.  Returns the repetitions and sets
+   allocs to the mymalloc() calls per operation. */
+
+int
+timecorpus(struct corpus *corpus, void (*op)(struct query *q),
+           int iterations, double *best, double *allocs)
+{
+  unsigned long count;
+  double t;
+  int i, j, pass, reps;
+
+  count = mymalloccount;
+  for(i=0;i<corpus->count;i++)
+    op(corpus->items+i);
+  *allocs = (double) (mymalloccount - count) / corpus->count;
+  t = nanotime();               /* the first pass warmed the caches */
+  for(i=0;i<corpus->count;i++)
+    op(corpus->items+i);
+  t = (nanotime() - t) / corpus->count;
+  reps = t < MINSAMPLE ? MINSAMPLE / (t > 1 ? t : 1) : 1;
+  for(pass=0;pass<iterations;pass++)
+    for(i=0;i<corpus->count;i++){
+      t = nanotime();
+      for(j=0;j<reps;j++)
+        op(corpus->items+i);
+      t = (nanotime() - t) / reps;
+      if (!pass || t < best[i])
+        best[i] = t;
+    }
+  qsort(best, corpus->count, sizeof(double), comparedouble);
+  return reps;
+}
+
+
+void
+runquerybench(struct querybench *bench, int iterations, FILE *out)
+{
+  struct corpus *corpus = bench->corpus;
+  double *best, allocs, total = 0;
+  int i, reps;
+
+  if (!corpus->count){
+    fprintf(out, "%-26s %7d\n", bench->name, 0);
+    return;
+  }
+  best = (double *) mymalloc(corpus->count*sizeof(double), "(runquerybench)");
+  reps = timecorpus(corpus, bench->op, iterations, best, &allocs);
+  for(i=0;i<corpus->count;i++)
+    total += best[i];
+  fprintf(out, "%-26s %7d %5d %9.1f %9.2f %9.1f %9.1f %9.1f %9.1f\n",
+          bench->name, corpus->count, reps, total / corpus->count, allocs,
+          best[(corpus->count-1)/2], best[(int) ((corpus->count-1)*0.9)],
+          best[(int) ((corpus->count-1)*0.99)], best[corpus->count-1]);
+  fflush(out);
+  free(best);
+}
+
+
+/* Loads the files with unitsHandler(), so that the options and the
+   number format have their defaults.  The operations that print write
+   to stdout, which is discarded; returns a copy of the original stdout
+   for the results, or NULL on failure. */
+
+FILE *
+loadquiet(char **files, int nfiles)
+{
+  FILE *out = stdout;
+  char **argv;
+  int i, argc = 0;
+
+  argv = (char **) mymalloc((2*nfiles+4)*sizeof(char *), "(loadquiet)");
+  argv[argc++] = "units";
+  for(i=0;i<nfiles;i++){
+    argv[argc++] = "-f";
+    argv[argc++] = files[i];
+  }
+  argv[argc++] = dupstr("m");
+  argv[argc++] = dupstr("m");
+  argv[argc] = 0;
+  fflush(stdout);
+#ifdef USE_FORK
+  if (!(out = fdopen(dup(fileno(stdout)), "w"))
+      || !freopen("/dev/null", "w", stdout))
+    return NULL;
+#endif
+  if (unitsHandler(argc, argv))
+    return NULL;
+  return out;
+}
+
+
+/* Runs the query benchmarks */
+
+int
+benchquery(char **files, int nfiles, int iterations)
+{
+  struct querybench *bench;
+  FILE *out;
+
+  if (!(out = loadquiet(files, nfiles)))
+    return EXIT_FAILURE;
+  buildcorpora();
+  fprintf(out, "# %-24s %7s %5s %9s %9s %9s %9s %9s %9s\n", "operation",
+          "items", "reps", "ns/op", "allocs/op", "p50", "p90", "p99", "max");
+  for(bench = querybenches; bench->name; bench++)
+    runquerybench(bench, iterations, out);
+  return EXIT_SUCCESS;
+}
+
+
+/*
+   The batch benchmark converts the pairs of conformable units of the
+   query corpus, repeated to at least BATCHROWS rows, with
+   convertbatch().  It doubles the number of threads up to the maximum,
+   and checks the results of each number of threads against one
+   thread.
+*/
+
+#define BATCHROWS 20000
+
+int
+benchbatch(char **files, int nfiles, int maxthreads, int iterations)
+{
+  char **have, **want;
+  double *in, *out, *first, *times, median, single = 0;
+  int *status, *firststatus, rows, threads, i, j, mismatch = 0;
+  FILE *report;
+
+  if (!(report = loadquiet(files, nfiles)))
+    return EXIT_FAILURE;
+  buildcorpora();
+  if (!pairedcorpus.count){
+    fprintf(stderr, "%s: no conformable units to convert\n", progname);
+    return EXIT_FAILURE;
+  }
+  rows = pairedcorpus.count;
+  while (rows < BATCHROWS)
+    rows += pairedcorpus.count;
+  have = (char **) mymalloc(rows*sizeof(char *), "(benchbatch)");
+  want = (char **) mymalloc(rows*sizeof(char *), "(benchbatch)");
+  in = (double *) mymalloc(rows*sizeof(double), "(benchbatch)");
+  out = (double *) mymalloc(rows*sizeof(double), "(benchbatch)");
+  first = (double *) mymalloc(rows*sizeof(double), "(benchbatch)");
+  status = (int *) mymalloc(rows*sizeof(int), "(benchbatch)");
+  firststatus = (int *) mymalloc(rows*sizeof(int), "(benchbatch)");
+  times = (double *) mymalloc(iterations*sizeof(double), "(benchbatch)");
+  for(i=0;i<rows;i++){
+    have[i] = pairedcorpus.items[i % pairedcorpus.count].have;
+    want[i] = pairedcorpus.items[i % pairedcorpus.count].want;
+    in[i] = 1 + i % 7;
+  }
+#ifndef UNITS_THREADS
+  fprintf(report, "# built without UNITS_THREADS, so only one thread\n");
+  maxthreads = 1;
+#endif
+  fprintf(report, "# %7s %8s %10s %12s %8s\n", "threads", "rows",
+          "median_ms", "rows/s", "speedup");
+  for(threads=1;threads<=maxthreads;threads*=2){
+    for(j=0;j<iterations;j++){
+      times[j] = walltime();
+      convertbatch(have, want, in, out, status, rows, threads);
+      times[j] = walltime() - times[j];
+    }
+    qsort(times, iterations, sizeof(double), comparedouble);
+    median = times[iterations/2];
+    if (threads == 1){
+      single = median;
+      memcpy(first, out, rows*sizeof(double));
+      memcpy(firststatus, status, rows*sizeof(int));
+    } else
+      for(i=0;i<rows;i++)
+        if (status[i] != firststatus[i]
+            || (!status[i] && out[i] != first[i])){
+          if (mismatch++ < 10)
+            fprintf(stderr, "%s: %d threads differ on '%s' to '%s'\n",
+                    progname, threads, have[i], want[i]);
+        }
+    fprintf(report, "%9d %8d %10.3f %12.0f %8.2f\n", threads, rows,
+            1000*median, rows / median, single / median);
+    fflush(report);
+    if (threads < maxthreads && 2*threads > maxthreads)
+      threads = maxthreads / 2;  /* end with maxthreads */
+  }
+  free(have);
+  free(want);
+  free(in);
+  free(out);
+  free(first);
+  free(status);
+  free(firststatus);
+  free(times);
+  return mismatch ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+/*
+   The steady test runs conversions through unitsHandler() in one
+   process, as a program that embeds units or the WASM module does,
+   cycling through steadyqueries: conversions with and without unit
+   lists, functions, definitions and errors of each kind, with the
+   options that change how the answers are shown.  After the first
+   tenth of the calls, by which time every buffer that is kept has
+   grown to its size, each block allocated must be freed again, so
+   the count of blocks in use is the same at the end.  The count is
+   kept by the malloc(), calloc(), realloc() and free() below, which
+   replace those of the C library with glibc.  Elsewhere only the
+   allocations are reported.
+*/
+
+#define STEADYCALLS 1000000
+
+#if defined (__GLIBC__)
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void __libc_free(void *ptr);
+
+int countblocks = 0;            /* set while the steady test counts */
+long blocksinuse = 0;           /* blocks allocated less blocks freed */
+
+void *
+malloc(size_t size)
+{
+  void *ptr = __libc_malloc(size);
+
+  if (countblocks && ptr)
+    blocksinuse++;
+  return ptr;
+}
+
+void *
+calloc(size_t count, size_t size)
+{
+  void *ptr = __libc_calloc(count, size);
+
+  if (countblocks && ptr)
+    blocksinuse++;
+  return ptr;
+}
+
+/* realloc() with size zero frees the block */
+
+void *
+realloc(void *ptr, size_t size)
+{
+  void *newptr = __libc_realloc(ptr, size);
+
+  if (countblocks){
+    if (!ptr && newptr)
+      blocksinuse++;
+    else if (ptr && !size)
+      blocksinuse--;
+  }
+  return newptr;
+}
+
+void
+free(void *ptr)
+{
+  if (countblocks && ptr)
+    blocksinuse--;
+  __libc_free(ptr);
+}
+
+#  define COUNTBLOCKS
+#endif
+
+struct steadyquery {
+  char *option, *have, *want;
+} steadyqueries[] = {
+  {0, "mile", "km"},
+  {0, "3 ft + 2 in", "cm"},
+  {"--terse", "60 mph", "m/s"},
+  {"--verbose", "kilometers", "feet"},
+  {"--one-line", "acre", "hectare"},
+  {"--digits=12", "lightyear", "parsec"},
+  {"--output-format=%.4f", "1|3 cup", "tablespoon"},
+  {0, "tempF(75)", "tempC"},
+  {"--verbose", "tempC(100)", "tempF"},
+  {0, "wiregauge(12)", "mm"},
+  {0, "2 m", "ft;in"},
+  {"--round", "1 day", "hr;min;s"},
+  {"--show-factor", "mile", "ft;yd"},
+  {0, "2 hr", "hms"},
+  {0, "foot", ""},
+  {"--verbose", "tempF", ""},
+  {0, "~tempF", ""},
+  {0, "hms", ""},
+  {"--strict", "ohm", "V/A"},
+  {0, "s/m", "m/s"},
+  {"--compact", "N", "kg m/s^2"},
+  {"--explain", "hbar c", "MeV fm"},
+  {0, "blargh", "m"},
+  {0, "m", "blargh"},
+  {"--verbose", "m", "kg"},
+  {0, "kg", "tempC"},
+  {0, "3 kg", "wiregauge"},
+  {0, "tempC(-300)", "tempF"},
+  {0, "2 m", "ft;kg"},
+  {0, "3 +", "m"},
+  {0, "1|0", ""},
+  {0, 0, 0}
+};
+
+int
+steadytest(char **files, int nfiles, long calls)
+{
+  char **argv, have[80], want[80];
+  struct steadyquery *q;
+  long i, warmup, blocks1 = 0, blocks2 = 0;
+  double start;
+  unsigned long allocs;
+  int argc, base, count, failed = 0;
+  FILE *out;
+
+  if (!(out = loadquiet(files, nfiles)))
+    return EXIT_FAILURE;
+  argv = (char **) mymalloc((2*nfiles+5)*sizeof(char *), "(steadytest)");
+  base = 0;
+  argv[base++] = "units";
+  for(i=0;i<nfiles;i++){
+    argv[base++] = "-f";
+    argv[base++] = files[i];
+  }
+  for(count=0;steadyqueries[count].have;count++);
+  /* The blocks are compared at the same place in the cycle */
+  warmup = (calls / 10 + count - 1) / count * count;
+  if (warmup < count)
+    warmup = count;
+  calls = (calls + count - 1) / count * count;
+  if (calls < warmup + count)
+    calls = warmup + count;
+#ifdef COUNTBLOCKS
+  blocksinuse = 0;
+  countblocks = 1;
+#endif
+  allocs = mymalloccount;
+  start = walltime();
+  for(i=0;i<calls;i++){
+    q = steadyqueries + i % count;
+    argc = base;
+    if (q->option)
+      argv[argc++] = q->option;
+    /* unitsHandler() may change the strings it is given */
+    argv[argc++] = strcpy(have, q->have);
+    if (*q->want)
+      argv[argc++] = strcpy(want, q->want);
+    argv[argc] = 0;
+    unitsHandler(argc, argv);
+    if (i+1 == warmup){
+#ifdef COUNTBLOCKS
+      blocks1 = blocksinuse;
+#endif
+      allocs = mymalloccount;
+    }
+  }
+  start = walltime() - start;
+#ifdef COUNTBLOCKS
+  blocks2 = blocksinuse;
+  countblocks = 0;
+#endif
+  fflush(stdout);
+  fprintf(out, "%ld conversions in %.3f s, %.2f us each, %.1f allocations "
+          "each\n", calls, start, 1e6*start/calls,
+          (double) (mymalloccount - allocs) / (calls - warmup));
+#ifdef COUNTBLOCKS
+  fprintf(out, "%ld blocks left allocated by the first %ld conversions and "
+          "%ld by the rest\n", blocks1, warmup, blocks2 - blocks1);
+  if (blocks2 != blocks1){
+    fprintf(stderr, "%s: %ld blocks left allocated by %ld conversions\n",
+            progname, blocks2 - blocks1, calls - warmup);
+    failed = 1;
+  }
+#else
+  fprintf(out, "blocks in use are not counted on this system\n");
+#endif
+  free(argv);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+/*
+   The scale benchmark loads the files followed by a synthetic file of
+   each size in SCALELINES, in a fresh process for each size, and
+   prints one line per size.  The lookups are timed on at most
+   SCALESAMPLE names of each kind, spread over the whole database.
+*/
+
+#define SCALEFILE "scale.units"
+#define SCALESAMPLE 10000
+
+long scalelines[] = {10000, 100000, 1000000, 0};
+
+void
+opfnlookup(struct query *q)
+{
+  querysink += fnlookup(q->have) != 0;
+}
+
+void
+opaliaslookup(struct query *q)
+{
+  querysink += aliaslookup(q->have) != 0;
+}
+
+/* Returns the median time of op over a sample of the names */
+
+double
+medianlookup(char **names, int count, void (*op)(struct query *q),
+             int iterations)
+{
+  struct corpus corpus;
+  double *best, allocs, median;
+  int i, step = count > SCALESAMPLE ? count / SCALESAMPLE : 1;
+
+  if (!count)
+    return 0;
+  memset(&corpus, 0, sizeof(corpus));
+  for(i=0;i<count;i+=step)
+    addquery(&corpus)->have = names[i];
+  best = (double *) mymalloc(corpus.count*sizeof(double), "(medianlookup)");
+  timecorpus(&corpus, op, iterations, best, &allocs);
+  median = best[(corpus.count-1)/2];
+  free(best);
+  free(corpus.items);
+  return median;
+}
+
+void
+scalerow(char **files, int nfiles, long lines, int iterations, FILE *out)
+{
+  struct loadresult result;
+  struct dbnames db;
+  int chains, entries, longest, unitmax, indexmax, prefixmax, funcmax;
+  int aliases, i;
+  double unitmean;
+  long peak = -1;
+#ifdef USE_FORK
+  struct rusage usage;
+#endif
+
+  loadfiles(files, nfiles, &result);
+#ifdef USE_FORK
+  if (!getrusage(RUSAGE_SELF, &usage))
+    peak = usage.ru_maxrss;
+#endif
+  hashstats('u', &chains, &entries, &unitmax);
+  unitmean = (double) entries / chains;
+  hashstats('i', &chains, &entries, &indexmax);
+  hashstats('p', &chains, &entries, &prefixmax);
+  hashstats('f', &chains, &entries, &funcmax);
+  hashstats('a', &chains, &aliases, &longest);
+  memset(&db, 0, sizeof(db));
+  foreachdbname(collectname, &db);
+  fprintf(out, "%8ld %8d %6d %6d %6d %9.1f %8ld %8lu %8.1f %7d %7d "
+          "%7d %7d %7.1f %7.1f %7.1f %7.1f\n",
+          lines, result.units, result.prefixes, result.funcs, aliases,
+          1000*result.seconds, peak, (unsigned long) (result.arena / 1024),
+          unitmean, unitmax, indexmax, prefixmax,
+          funcmax,
+          medianlookup(db.names[0], db.count[0], oplookupunit, iterations),
+          medianlookup(db.names[1], db.count[1], opplookup, iterations),
+          medianlookup(db.names[2], db.count[2], opfnlookup, iterations),
+          medianlookup(db.names[3], db.count[3], opaliaslookup, iterations));
+  fflush(out);
+  for(i=0;i<4;i++){
+    free(db.names[i]);
+    free(db.defs[i]);
+  }
+}
+
+int
+benchscale(char **files, int nfiles, int iterations)
+{
+  char **allfiles;
+  FILE *out = stdout;
+  int i, status = EXIT_SUCCESS;
+#ifdef USE_FORK
+  pid_t pid;
+#endif
+
+  allfiles = (char **) mymalloc((nfiles+1)*sizeof(char *), "(benchscale)");
+  for(i=0;i<nfiles;i++)
+    allfiles[i] = files[i];
+  allfiles[nfiles] = SCALEFILE;
+  fflush(stdout);
+#ifdef USE_FORK
+  /* !message lines would be mixed with the results */
+  if (!(out = fdopen(dup(fileno(stdout)), "w"))
+      || !freopen("/dev/null", "w", stdout))
+    return EXIT_FAILURE;
+#endif
+  fprintf(out, "# %6s %8s %6s %6s %6s %9s %8s %8s %8s %7s %7s %7s %7s "
+          "%7s %7s %7s %7s\n", "lines", "units", "pfx", "funcs", "lists",
+          "load_ms", "peak_kb", "arena_kb", "utab", "utabmax", "idxrun",
+          "ptabmax", "ftabmax", "unit_ns", "pfx_ns", "func_ns", "list_ns");
+  fflush(out);
+  for(i=0;scalelines[i] && status == EXIT_SUCCESS;i++){
+    if (generate(scalelines[i], SCALEFILE))
+      return EXIT_FAILURE;
+#ifdef USE_FORK
+    pid = fork();
+    if (pid < 0)
+      status = EXIT_FAILURE;
+    else if (pid == 0){
+      scalerow(allfiles, nfiles+1, scalelines[i], iterations, out);
+      _exit(EXIT_SUCCESS);
+    } else if (waitpid(pid, &status, 0) < 0 || status)
+      status = EXIT_FAILURE;
+#else
+    freedatabase();
+    scalerow(allfiles, nfiles+1, scalelines[i], iterations, out);
+#endif
+  }
+  remove(SCALEFILE);
+  free(allfiles);
+  return status;
+}
+
+
+void
+benchusage()
+{
+  fprintf(stderr, "Usage: %s load [-n iterations] [-l] file...\n"
+                  "       %s first [-n iterations] [-l] have want file...\n"
+                  "       %s width [-n iterations] file...\n"
+                  "       %s query [-n iterations] file...\n"
+                  "       %s scale [-n iterations] file...\n"
+                  "       %s batch [-n iterations] [-j threads] file...\n"
+                  "       %s steady [-n calls] file...\n"
+                  "       %s generate lines file\n",
+          progname, progname, progname, progname, progname, progname,
+          progname, progname);
+  exit(EXIT_FAILURE);
+}
+
+
+int
+main(int argc, char **argv)
+{
+  int iterations = 0, threads;
+  int arg = 2;
+
+  progname = argv[0];
+  if (argc < 2)
+    benchusage();
+  if (!strcmp(argv[1], "generate")){
+    if (argc != 4 || atol(argv[2]) < 1)
+      benchusage();
+    return generate(atol(argv[2]), argv[3]);
+  }
+  while (arg < argc && argv[arg][0] == '-'){
+    if (!strcmp(argv[arg], "-l")){
+      lazyload = 1;
+      arg++;
+      continue;
+    }
+    if (arg+1 >= argc)
+      benchusage();
+    if (!strcmp(argv[arg], "-n")){
+      if ((iterations = atoi(argv[arg+1])) < 1)
+        benchusage();
+    } else if (!strcmp(argv[arg], "-j")){
+      if ((loadjobs = atoi(argv[arg+1])) < 1)
+        benchusage();
+    } else
+      benchusage();
+    arg += 2;
+  }
+  if (loadjobs > 1 && strcmp(argv[1], "batch"))
+    benchusage();
+  checklocale();
+  if (!strcmp(argv[1], "query") && arg < argc)
+    return benchquery(argv+arg, argc-arg,
+                      iterations ? iterations : QUERYITERATIONS);
+  if (!strcmp(argv[1], "scale") && arg < argc)
+    return benchscale(argv+arg, argc-arg,
+                      iterations ? iterations : QUERYITERATIONS);
+  if (!strcmp(argv[1], "batch") && arg < argc){
+    threads = loadjobs > 1 ? loadjobs : processors();
+    loadjobs = 1;
+    return benchbatch(argv+arg, argc-arg, threads,
+                      iterations ? iterations : QUERYITERATIONS);
+  }
+  if (!strcmp(argv[1], "steady") && arg < argc)
+    return steadytest(argv+arg, argc-arg,
+                      iterations ? iterations : STEADYCALLS);
+  if (!iterations)
+    iterations = DEFAULTITERATIONS;
+  if (!strcmp(argv[1], "load") && arg < argc)
+    return benchload(argv+arg, argc-arg, 0, iterations);
+  if (!strcmp(argv[1], "first") && arg+2 < argc)
+    return benchload(argv+arg+2, argc-arg-2, argv+arg, iterations);
+  if (!strcmp(argv[1], "width") && arg < argc)
+    return benchwidth(argv+arg, argc-arg, iterations);
+  benchusage();
+  return EXIT_FAILURE;
+}
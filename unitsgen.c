@@ -0,0 +1,1169 @@
+/*
+ *  unitsgen, writes a units database as C source
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+   Usage: unitsgen file > unitsdb.c
+          unitsgen -c dir file
+
+   Writes the units data file and the files it includes as C data for
+   a units program built with -DBUILTIN_UNITS (see the builtin target
+   in Makefile.in), which then needs no data files at run time.
+
+   Each line of the files becomes a record.  Plain ASCII unit and
+   prefix definitions are stored as their name and definition, and
+   functions and tables as prebuilt struct func data, so that loading
+   them does no parsing.  Commands and anything else are stored as the
+   normalized text of the line, which readunits() reads as usual, so
+   !locale, !var, !utf8 and the rest work as they do for the files.
+
+   The files are also loaded as usual, resolved and eagerly reduced,
+   and the results are stored for every unit.  The program uses them
+   when it finds that it has loaded the same tables.  Run unitsgen in
+   a UTF-8 locale with UNITS_SYSTEM unset so that the stored tables are
+   the ones most runs load.
+
+   With -c, unitsgen instead splits the database into chunk files for
+   the browser build, as described before writechunks().
+
+   unitsgen includes units.c to get at the tables, so it is linked
+   without units.o.
+*/
+
+#include "units.c"
+
+struct genrecord {
+  int kind, flags, linenumber;
+  char *name, *value;
+  struct func *func;            /* loaded entry for BUILTIN_FUNCTION */
+  int function;                 /* its index in builtinfunctions */
+  char *text;                   /* normalized line */
+  int utf8;                     /* line is in a !utf8 block */
+};
+
+struct genfile {
+  char *path;                   /* file as loaded */
+  char *name;                   /* relative to the directory of the */
+                                /*   main file */
+  struct genrecord *records;
+  int count, size, maxline;
+};
+
+struct genfile *genfiles = 0;
+int genfilecount = 0;
+
+void
+genfail(const char *msg, const char *arg)
+{
+  fprintf(stderr, "%s: ", progname);
+  fprintf(stderr, msg, arg);
+  fputc('\n', stderr);
+  exit(EXIT_FAILURE);
+}
+
+
+struct genrecord *
+addrecord(struct genfile *file, int kind, int linenumber)
+{
+  struct genrecord *rec;
+
+  if (file->count == file->size){
+    file->size = file->size ? 2*file->size : 1024;
+    file->records = (struct genrecord *)
+      realloc(file->records, file->size*sizeof(struct genrecord));
+    if (!file->records)
+      genfail("%s", "out of memory");
+  }
+  rec = file->records + file->count++;
+  rec->kind = kind;
+  rec->flags = 0;
+  rec->linenumber = linenumber;
+  rec->name = rec->value = 0;
+  rec->func = 0;
+  rec->function = 0;
+  rec->text = 0;
+  rec->utf8 = 0;
+  return rec;
+}
+
+
+/* Returns the loaded function defined on the given line, or NULL if
+   the function defined there is not the final definition.  Function
+   copies, name(), are left as text because they share the definition
+   of the function they copy. */
+
+struct func *
+finalfunction(char *name, char *path, int linenumber)
+{
+  struct func *funcptr;
+  char *end;
+
+  end = strchr(name, '[');
+  if (!end){
+    end = strchr(name, '(');
+    if (end[1] == ')')
+      return 0;
+  }
+  *end = 0;
+  funcptr = fnlookup(name);
+  if (funcptr && funcptr->linenumber == linenumber
+      && !strcmp(funcptr->file, path))
+    return funcptr;
+  return 0;
+}
+
+
+int
+addfile(char *path, char *name)
+{
+  struct genfile *file;
+  int i;
+
+  for(i=0;i<genfilecount;i++)
+    if (!strcmp(genfiles[i].name, name))
+      return i;
+  genfiles = (struct genfile *)
+    realloc(genfiles, (genfilecount+1)*sizeof(struct genfile));
+  if (!genfiles)
+    genfail("%s", "out of memory");
+  file = genfiles + genfilecount;
+  file->path = dupstr(path);
+  file->name = dupstr(name);
+  file->records = 0;
+  file->count = file->size = file->maxline = 0;
+  return genfilecount++;
+}
+
+
+/* Splits a file into records, adding the files it includes */
+
+void
+scanfile(int index)
+{
+  struct dbimage *image;
+  struct genrecord *rec;
+  char *line, *text, *unitname, *unitdef, *path, *name;
+  int linenum = 0, ascii, kind, flags, in_utf8 = 0;
+
+  image = opendbimage(genfiles[index].path);
+  if (!image)
+    genfail("cannot read '%s'", genfiles[index].path);
+  while ((line = nextdbline(image, &linenum, &ascii))){
+    text = dupstr(line);
+    kind = BUILTIN_LINE;
+    flags = 0;
+    if (*line == COMMANDCHAR){
+      unitname = strtok(line+1, " ");
+      if (unitname && !strcmp(unitname, "utf8"))
+        in_utf8 = 1;
+      else if (unitname && !strcmp(unitname, "endutf8"))
+        in_utf8 = 0;
+      else if (unitname && !strcmp(unitname, "include")
+          && (unitname = strtok(0, " ")) && !isfullpath(unitname)){
+        path = (char *) mymalloc(strlen(genfiles[index].path)
+                                 +strlen(unitname)+1, "(scanfile)");
+        strcpy(path, genfiles[index].path);
+        strcpy(pathend(path), unitname);
+        name = (char *) mymalloc(strlen(genfiles[index].name)
+                                 +strlen(unitname)+1, "(scanfile)");
+        strcpy(name, genfiles[index].name);
+        strcpy(pathend(name), unitname);
+        addfile(path, name);
+        free(path);
+        free(name);
+      }
+    } else if (ascii){
+      splitline(line, &unitname, &unitdef);
+      if (unitname && unitdef){
+        if (*unitname == REDEFCHAR){
+          unitname++;
+          flags = BUILTIN_REDEFINE;
+        }
+        if (lastchar(unitname) == '-'){
+          lastchar(unitname) = 0;
+          kind = BUILTIN_PREFIX;
+        } else if (strchr(unitname, '[') || strchr(unitname, '(')){
+          struct func *funcptr;
+
+          if ((funcptr = finalfunction(unitname, genfiles[index].path,
+                                       linenum))){
+            kind = BUILTIN_FUNCTION;
+            rec = addrecord(genfiles+index, kind, linenum);
+            rec->flags = flags;
+            rec->func = funcptr;
+            rec->text = text;
+            rec->utf8 = in_utf8;
+            continue;
+          }
+        } else
+          kind = BUILTIN_UNIT;
+      }
+    }
+    rec = addrecord(genfiles+index, kind, linenum);
+    rec->text = text;
+    rec->utf8 = in_utf8;
+    if (kind == BUILTIN_LINE){
+      rec->name = text;
+      rec->flags = ascii ? BUILTIN_ASCII : 0;
+      if ((int) strlen(text) > genfiles[index].maxline)
+        genfiles[index].maxline = strlen(text);
+    } else {
+      rec->name = dupstr(unitname);
+      rec->value = dupstr(unitdef);
+      rec->flags = flags;
+    }
+  }
+}
+
+
+/* Writes a string as a C string literal, or 0 for a null pointer */
+
+void
+writestring(char *str)
+{
+  int count = 0;
+
+  if (!str){
+    fputs("0", stdout);
+    return;
+  }
+  putchar('"');
+  for(;*str;str++){
+    unsigned char c = *str;
+    if (++count % 500 == 0)     /* keep each piece short for old compilers */
+      fputs("\"\n    \"", stdout);
+    if (c == '"' || c == '\\' || c == '?')    /* '?' could start a trigraph */
+      printf("\\%c", c);
+    else if (c < ' ' || c >= 0x7f)
+      printf("\\%03o", c);
+    else
+      putchar(c);
+  }
+  putchar('"');
+}
+
+
+void
+writedouble(double x)
+{
+  if (x != x)
+    genfail("%s", "cannot store NaN");
+  if (x > DBL_MAX)
+    fputs("HUGE_VAL", stdout);
+  else if (x < -DBL_MAX)
+    fputs("-HUGE_VAL", stdout);
+  else
+    printf("%.17g", x);
+}
+
+
+/* The domains and tables of the functions go into shared arrays */
+
+int domaincount = 0, paircount = 0;
+
+void
+writedomain(double *value)
+{
+  if (value){
+    printf("  ");
+    writedouble(*value);
+    printf(",\n");
+  }
+}
+
+
+void
+writedomainref(double *value, int *index)
+{
+  if (value)
+    printf("(double *) (builtindomains+%d), ", (*index)++);
+  else
+    printf("0, ");
+}
+
+
+void
+writefunctype(struct functype *type, int *domain)
+{
+  printf("{");
+  writestring(type->param);
+  printf(", ");
+  writestring(type->def);
+  printf(", ");
+  writestring(type->dimen);
+  printf(", ");
+  writedomainref(type->domain_min, domain);
+  writedomainref(type->domain_max, domain);
+  printf("%d, %d}", type->domain_min_open, type->domain_max_open);
+}
+
+
+void
+writefunctions(void)
+{
+  struct genrecord *rec;
+  int i, j, k, domain = 0, pair = 0;
+
+  printf("static const double builtindomains[] = {\n");
+  for(i=0;i<genfilecount;i++)
+    for(rec=genfiles[i].records;rec<genfiles[i].records+genfiles[i].count;rec++)
+      if (rec->kind == BUILTIN_FUNCTION && !rec->func->table){
+        writedomain(rec->func->forward.domain_min);
+        writedomain(rec->func->forward.domain_max);
+        writedomain(rec->func->inverse.domain_min);
+        writedomain(rec->func->inverse.domain_max);
+      }
+  printf("  0\n};\n\n");
+  printf("static const struct pair builtinpairs[] = {\n");
+  for(i=0;i<genfilecount;i++)
+    for(rec=genfiles[i].records;rec<genfiles[i].records+genfiles[i].count;rec++)
+      if (rec->kind == BUILTIN_FUNCTION && rec->func->table)
+        for(j=0;j<rec->func->tablelen;j++){
+          printf("  {");
+          writedouble(rec->func->table[j].location);
+          printf(", ");
+          writedouble(rec->func->table[j].value);
+          printf("},\n");
+        }
+  printf("  {0, 0}\n};\n\n");
+  printf("const struct func builtinfunctions[] = {\n");
+  for(k=0,i=0;i<genfilecount;i++)
+    for(rec=genfiles[i].records;rec<genfiles[i].records+genfiles[i].count;rec++)
+      if (rec->kind == BUILTIN_FUNCTION){
+        struct func *funcptr = rec->func;
+
+        rec->function = k++;
+        printf("  {");
+        writestring(funcptr->name);
+        if (funcptr->table){        /* tables leave the functypes unset */
+          printf(",\n   {0, 0, 0, 0, 0, 0, 0}, {0, 0, 0, 0, 0, 0, 0},\n   ");
+          printf("(struct pair *) (builtinpairs+%d), %d, ", pair,
+                 funcptr->tablelen);
+          writestring(funcptr->tableunit);
+          pair += funcptr->tablelen;
+        } else {
+          printf(",\n   ");
+          writefunctype(&funcptr->forward, &domain);
+          printf(",\n   ");
+          writefunctype(&funcptr->inverse, &domain);
+          printf(",\n   0, 0, 0");
+        }
+        printf(", 0, %d, %d, 0},\n", funcptr->skip_error_check,
+               funcptr->linenumber);
+      }
+  if (!k)
+    printf("  {0}\n");
+  printf("};\n\n");
+}
+
+
+void
+writerecords(void)
+{
+  struct genrecord *rec;
+  int i;
+
+  for(i=0;i<genfilecount;i++){
+    printf("static const struct builtinrecord builtinrecords%d[] = {\n", i);
+    for(rec=genfiles[i].records;rec<genfiles[i].records+genfiles[i].count;rec++){
+      printf("  {%d, %d, %d, ", rec->kind, rec->flags, rec->linenumber);
+      if (rec->kind == BUILTIN_FUNCTION)
+        printf("0, 0, %d},\n", rec->function);
+      else {
+        writestring(rec->name);
+        printf(", ");
+        writestring(rec->value);
+        printf(", 0},\n");
+      }
+    }
+    if (!genfiles[i].count)
+      printf("  {0}\n");
+    printf("};\n\n");
+  }
+  printf("const struct builtinfile builtinfiles[] = {\n");
+  for(i=0;i<genfilecount;i++){
+    printf("  {");
+    writestring(genfiles[i].name);
+    printf(", builtinrecords%d, %d, %d},\n", i, genfiles[i].count,
+           genfiles[i].maxline);
+  }
+  printf("  {0, 0, 0, 0}\n};\n\n");
+}
+
+
+int
+compareunitname(const void *a, const void *b)
+{
+  return strcmp((*(struct unitlist **) a)->name,
+                (*(struct unitlist **) b)->name);
+}
+
+
+int
+comparefuncname(const void *a, const void *b)
+{
+  return strcmp((*(struct func **) a)->name, (*(struct func **) b)->name);
+}
+
+
+int
+compareprefixname(const void *a, const void *b)
+{
+  return strcmp((*(struct prefixlist **) a)->name,
+                (*(struct prefixlist **) b)->name);
+}
+
+
+struct unitlist **genunits;
+int genunitcount;
+
+/* Returns the index in genunits of the unit with the given name */
+
+int
+unitnumber(char *name)
+{
+  struct unitlist key, *keyptr = &key, **found;
+
+  key.name = name;
+  found = (struct unitlist **) bsearch(&keyptr, genunits, genunitcount,
+                                       sizeof(*genunits), compareunitname);
+  return found ? found - genunits : -1;
+}
+
+
+/* Writes the final definitions and, if resolved is set, the results
+   of resolveunits() and eagerreduce() for them */
+
+void
+writetables(int resolved)
+{
+  struct unitlist *uptr;
+  struct prefixlist *pptr, **prefixes;
+  struct func *funcptr, **functions;
+  struct reducedunit *red;
+  struct genrecord *rec;
+  int i, j, k, count, reduced, steps, names, *index;
+
+  genunitcount = 0;
+  for(i=0;i<HASHSIZE;i++)
+    for(uptr=utab[i];uptr;uptr=uptr->next)
+      genunitcount++;
+  genunits = (struct unitlist **)
+    mymalloc((genunitcount+1)*sizeof(*genunits), "(writetables)");
+  for(count=0,i=0;i<HASHSIZE;i++)
+    for(uptr=utab[i];uptr;uptr=uptr->next)
+      genunits[count++] = uptr;
+  qsort(genunits, genunitcount, sizeof(*genunits), compareunitname);
+
+  /* A unit whose reduction names a unit missing from the table keeps
+     no stored reduction */
+
+  index = (int *) mymalloc((genunitcount+1)*sizeof(int), "(writetables)");
+  printf("const struct builtinreduction builtinreductions[] = {\n");
+  for(reduced=0,steps=0,names=0,i=0;i<genunitcount;i++){
+    index[i] = -1;
+    red = genunits[i]->reduced;
+    if (!resolved || !red)
+      continue;
+    for(j=0;j<red->numlen+red->denlen
+          && (!red->names[j] || unitnumber(red->names[j])>=0);j++);
+    if (j < red->numlen+red->denlen)
+      continue;
+    printf("  {%d, %d, %d, %d, %d},\n", steps, red->stepcount,
+           red->numlen, red->denlen, names);
+    steps += red->stepcount;
+    names += red->numlen+red->denlen;
+    index[i] = reduced++;
+  }
+  if (!reduced)
+    printf("  {0}\n");
+  printf("};\n\n");
+  printf("const struct builtinstep builtinsteps[] = {\n");
+  for(i=0;i<genunitcount;i++)
+    if (index[i] >= 0){
+      red = genunits[i]->reduced;
+      for(j=0;j<red->stepcount;j++){
+        printf("  {");
+        writedouble(red->steps[j].factor);
+        printf(", %d},\n", red->steps[j].divide);
+      }
+    }
+  printf("  {0}\n};\n\n");
+  printf("const int builtinreducednames[] = {\n");
+  for(i=0;i<genunitcount;i++)
+    if (index[i] >= 0){
+      red = genunits[i]->reduced;
+      printf(" ");
+      for(j=0;j<red->numlen+red->denlen;j++)
+        printf(" %d,", red->names[j] ? unitnumber(red->names[j]) : -1);
+      printf("\n");
+    }
+  printf("  0\n};\n\n");
+
+  printf("const double builtinchains[] = {\n");
+  for(i=0;i<genunitcount;i++){
+    uptr = genunits[i];
+    if (!resolved || !uptr->flattened)
+      continue;
+    printf(" ");
+    for(j=0;j<uptr->chainlen;j++){
+      printf(" ");
+      writedouble(uptr->chain[j]);
+      printf(",");
+    }
+    printf("\n");
+  }
+  printf("  0\n};\n\n");
+
+  printf("const struct builtinunit builtinunits[] = {\n");
+  for(k=0,i=0;i<genunitcount;i++){
+    uptr = genunits[i];
+    printf("  {");
+    writestring(uptr->name);
+    printf(", ");
+    writestring(uptr->value);
+    if (resolved && uptr->flattened){
+      printf(", %d, %d, %d, 1, %d},\n",
+             uptr->target ? unitnumber(uptr->target->name) : -1,
+             k, uptr->chainlen, index[i]);
+      k += uptr->chainlen;
+    } else
+      printf(", -1, 0, 0, 0, %d},\n", index[i]);
+  }
+  if (!genunitcount)
+    printf("  {0}\n");
+  printf("};\n\n");
+  free(index);
+
+  for(count=0,i=0;i<SIMPLEHASHSIZE;i++)
+    for(pptr=ptab[i];pptr;pptr=pptr->next)
+      count++;
+  prefixes = (struct prefixlist **)
+    mymalloc((count+1)*sizeof(*prefixes), "(writetables)");
+  for(count=0,i=0;i<SIMPLEHASHSIZE;i++)
+    for(pptr=ptab[i];pptr;pptr=pptr->next)
+      prefixes[count++] = pptr;
+  qsort(prefixes, count, sizeof(*prefixes), compareprefixname);
+  printf("const struct builtinentry builtinprefixes[] = {\n");
+  for(i=0;i<count;i++){
+    printf("  {");
+    writestring(prefixes[i]->name);
+    printf(", ");
+    writestring(prefixes[i]->value);
+    printf(", 0},\n");
+  }
+  if (!count)
+    printf("  {0}\n");
+  printf("};\n\n");
+  printf("const int builtinprefixcount = %d;\n\n", count);
+  free(prefixes);
+
+  /* Each function must share its definition with one of the function
+     records, which it does unless it copies a function that was
+     redefined later */
+
+  for(count=0,i=0;i<SIMPLEHASHSIZE;i++)
+    for(funcptr=ftab[i];funcptr;funcptr=funcptr->next)
+      count++;
+  functions = (struct func **)
+    mymalloc((count+1)*sizeof(*functions), "(writetables)");
+  for(count=0,i=0;i<SIMPLEHASHSIZE;i++)
+    for(funcptr=ftab[i];funcptr;funcptr=funcptr->next)
+      functions[count++] = funcptr;
+  qsort(functions, count, sizeof(*functions), comparefuncname);
+  printf("const struct builtinentry builtinfunctionentries[] = {\n");
+  for(i=0;i<count;i++){
+    funcptr = functions[i];
+    for(k=0,j=0;j<genfilecount;j++)
+      for(rec=genfiles[j].records;rec<genfiles[j].records+genfiles[j].count;rec++)
+        if (rec->kind == BUILTIN_FUNCTION){
+          if (funcptr->table ? funcptr->table == rec->func->table
+              : funcptr->forward.def == rec->func->forward.def)
+            goto found;
+          k++;
+        }
+    fprintf(stderr, "%s: function '%s' is not stored, so the resolved units cannot be used\n",
+            progname, funcptr->name);
+    resolved = 0;
+    k = 0;
+  found:
+    printf("  {");
+    writestring(funcptr->name);
+    printf(", 0, %d},\n", k);
+  }
+  if (!count)
+    printf("  {0}\n");
+  printf("};\n\n");
+  printf("const int builtinfunctioncount = %d;\n", count);
+  free(functions);
+
+  printf("const int builtinunitcount = %d;\n", genunitcount);
+  printf("const int builtinresolved = %d;\n", resolved);
+  printf("const struct parseflag builtinflags = {%d, %d};\n",
+         eagerflags.oldstar, eagerflags.minusminus);
+  free(genunits);
+}
+
+
+/*
+   Chunked output, unitsgen -c dir file.  The final definitions of the
+   default environment are split by what they measure into units files
+   that the browser build loads one at a time, so that conversions can
+   start once the core chunk is in.  Any definition that an entry of a
+   chunk uses is moved to that chunk if it was in a later one, so each
+   chunk only needs the chunks before it.  dir/manifest.json lists the
+   chunks in loading order with the chunks each one requires.
+*/
+
+#define CHUNK_ALIAS 4           /* entry kind for a unit list */
+
+char *chunknames[] = {"core", "numbers", "area", "volume", "mechanics",
+                      "electromagnetism", "chemistry", "photometry",
+                      "computing", "currency", "misc", 0};
+
+#define CHUNK_CORE 0
+#define CHUNK_NUMBERS 1
+#define CHUNK_AREA 2
+#define CHUNK_VOLUME 3
+#define CHUNK_MECHANICS 4
+#define CHUNK_ELECTRIC 5
+#define CHUNK_CHEMISTRY 6
+#define CHUNK_PHOTOMETRY 7
+#define CHUNK_COMPUTING 8
+#define CHUNK_CURRENCY 9
+#define CHUNK_MISC 10
+#define CHUNKCOUNT 11
+
+/* The first rule that matches the reduced units applies.  Anything
+   else made of the base units below goes to mechanics, and the rest
+   to misc. */
+
+struct chunkrule {
+  int chunk;
+  char *primitive;              /* reduction contains this unit */
+  char *dimension;              /* or is exactly this */
+};
+
+struct chunkrule chunkrules[] = {
+  {CHUNK_CURRENCY, "US$", 0},
+  {CHUNK_COMPUTING, "bit", 0},
+  {CHUNK_ELECTRIC, "A", 0},
+  {CHUNK_CHEMISTRY, "mol", 0},
+  {CHUNK_PHOTOMETRY, "cd", 0},
+  {CHUNK_CORE, 0, "m"},
+  {CHUNK_CORE, 0, "kg"},
+  {CHUNK_CORE, 0, "s"},
+  {CHUNK_CORE, 0, "K"},
+  {CHUNK_CORE, 0, "m / s"},
+  {CHUNK_NUMBERS, 0, ""},
+  {CHUNK_AREA, 0, "m m"},
+  {CHUNK_VOLUME, 0, "m m m"},
+  {0, 0, 0}
+};
+
+char *mechanicsunits[] = {"m", "kg", "s", "K", 0};
+
+struct chunkentry {
+  int kind;                     /* BUILTIN_UNIT, BUILTIN_PREFIX, */
+  char *name;                   /*   BUILTIN_FUNCTION or CHUNK_ALIAS */
+  int file;                     /* index in genfiles */
+  struct genrecord *record;
+  int chunk;
+  int *deps, depcount, depsize;
+};
+
+struct chunkentry *chunkentries;
+int chunkentrycount;
+struct chunkentry **chunkbyname;  /* sorted by kind and name */
+
+
+int
+ismechanics(char *name)
+{
+  char **base;
+
+  for(base = mechanicsunits; *base; base++)
+    if (!strcmp(name, *base))
+      return 1;
+  return 0;
+}
+
+
+/* Returns the chunk for a unit expression from what it reduces to */
+
+int
+dimensionchunk(char *expr)
+{
+  struct unittype unit;
+  struct chunkrule *rule;
+  char dimension[200], **ptr;
+  int err;
+
+  err = parseunit(&unit, expr, 0, 0);
+  if (!err)
+    err = completereduce(&unit);
+  if (err)
+    return CHUNK_MISC;
+  *dimension = 0;
+  for(ptr = unit.numerator; *ptr; ptr++)
+    if (strlen(dimension)+strlen(*ptr)+5 < sizeof(dimension))
+      sprintf(dimension+strlen(dimension), "%s%s",
+              ptr == unit.numerator ? "" : " ", *ptr);
+  for(ptr = unit.denominator; *ptr; ptr++)
+    if (strlen(dimension)+strlen(*ptr)+5 < sizeof(dimension))
+      sprintf(dimension+strlen(dimension), " %s %s",
+              ptr == unit.denominator ? "/" : "", *ptr);
+  for(rule = chunkrules; rule->primitive || rule->dimension; rule++){
+    if (rule->primitive){
+      for(ptr = unit.numerator; *ptr && strcmp(*ptr, rule->primitive); ptr++);
+      if (!*ptr)
+        for(ptr = unit.denominator; *ptr && strcmp(*ptr, rule->primitive);
+            ptr++);
+      if (*ptr)
+        break;
+    } else if (!strcmp(dimension, rule->dimension))
+      break;
+  }
+  if (rule->primitive || rule->dimension){
+    freeunit(&unit);
+    return rule->chunk;
+  }
+  for(ptr = unit.numerator; *ptr && ismechanics(*ptr); ptr++);
+  if (!*ptr)
+    for(ptr = unit.denominator; *ptr && ismechanics(*ptr); ptr++);
+  err = *ptr ? CHUNK_MISC : CHUNK_MECHANICS;
+  freeunit(&unit);
+  return err;
+}
+
+
+struct genrecord *
+findrecord(char *path, int linenumber, int *file)
+{
+  struct genrecord *rec;
+  int i, low, high, mid;
+
+  for(i=0;i<genfilecount;i++)
+    if (!strcmp(genfiles[i].path, path))
+      break;
+  if (i == genfilecount)
+    genfail("definition from unknown file '%s'", path);
+  *file = i;
+  rec = genfiles[i].records;
+  low = 0;
+  high = genfiles[i].count-1;
+  while (low <= high){
+    mid = (low+high)/2;
+    if (rec[mid].linenumber == linenumber)
+      return rec+mid;
+    if (rec[mid].linenumber < linenumber)
+      low = mid+1;
+    else
+      high = mid-1;
+  }
+  genfail("no line for a definition in '%s'", path);
+  return 0;
+}
+
+
+struct chunkentry *
+addchunkentry(int kind, char *name, char *path, int linenumber)
+{
+  struct chunkentry *entry;
+
+  chunkentries = (struct chunkentry *)
+    realloc(chunkentries, (chunkentrycount+1)*sizeof(struct chunkentry));
+  if (!chunkentries)
+    genfail("%s", "out of memory");
+  entry = chunkentries + chunkentrycount++;
+  entry->kind = kind;
+  entry->name = name;
+  entry->record = findrecord(path, linenumber, &entry->file);
+  entry->deps = 0;
+  entry->depcount = entry->depsize = 0;
+  return entry;
+}
+
+
+int
+comparechunkname(const void *a, const void *b)
+{
+  struct chunkentry *x = *(struct chunkentry **) a;
+  struct chunkentry *y = *(struct chunkentry **) b;
+
+  if (x->kind != y->kind)
+    return x->kind - y->kind;
+  return strcmp(x->name, y->name);
+}
+
+
+/* Entries in file order, which keeps function copies after the
+   functions they copy */
+
+int
+comparechunkline(const void *a, const void *b)
+{
+  struct chunkentry *x = *(struct chunkentry **) a;
+  struct chunkentry *y = *(struct chunkentry **) b;
+
+  if (x->file != y->file)
+    return x->file - y->file;
+  return x->record->linenumber - y->record->linenumber;
+}
+
+
+struct depstate {
+  struct chunkentry *entry;
+  char *param;                  /* function parameter, not a unit */
+};
+
+void
+adddep(struct depstate *state, int kind, char *name)
+{
+  struct chunkentry key, *keyptr = &key, **found;
+  struct chunkentry *entry = state->entry;
+  int i, index;
+
+  key.kind = kind;
+  key.name = name;
+  found = (struct chunkentry **) bsearch(&keyptr, chunkbyname,
+                                         chunkentrycount, sizeof(*chunkbyname),
+                                         comparechunkname);
+  if (!found || *found == entry)
+    return;
+  index = *found - chunkentries;
+  for(i=0;i<entry->depcount;i++)
+    if (entry->deps[i] == index)
+      return;
+  if (entry->depcount == entry->depsize){
+    entry->depsize = entry->depsize ? 2*entry->depsize : 8;
+    entry->deps = (int *) realloc(entry->deps, entry->depsize*sizeof(int));
+    if (!entry->deps)
+      genfail("%s", "out of memory");
+  }
+  entry->deps[entry->depcount++] = index;
+}
+
+
+void
+unitdep(char *name, void *data)
+{
+  struct depstate *state = (struct depstate *) data;
+  struct prefixlist *pfxptr;
+  struct unitlist *uptr;
+
+  if (state->param && !strcmp(name, state->param))
+    return;
+  if ((uptr = findunitentry(name, 0)))
+    adddep(state, BUILTIN_UNIT, uptr->name);
+  else if ((pfxptr = plookup(name))){
+    adddep(state, BUILTIN_PREFIX, pfxptr->name);
+    if (!emptystr(name+pfxptr->len)
+        && (uptr = findunitentry(name+pfxptr->len, 0)))
+      adddep(state, BUILTIN_UNIT, uptr->name);
+  }
+}
+
+
+void
+funcdep(struct func *fun, void *data)
+{
+  adddep((struct depstate *) data, BUILTIN_FUNCTION, fun->name);
+}
+
+
+void
+functypedeps(struct depstate *state, struct functype *type)
+{
+  state->param = type->param;
+  if (type->def)
+    foreachname(type->def, unitdep, funcdep, state);
+  state->param = 0;
+  if (type->dimen)
+    foreachname(type->dimen, unitdep, funcdep, state);
+}
+
+
+void
+finddeps(struct chunkentry *entry)
+{
+  struct depstate state;
+  struct func *funcptr;
+  struct wantalias *aliasptr;
+  char *copy, *source;
+
+  state.entry = entry;
+  state.param = 0;
+  switch(entry->kind){
+    case BUILTIN_UNIT:
+      foreachname(ulookup(entry->name)->value, unitdep, funcdep, &state);
+      break;
+    case BUILTIN_PREFIX:
+      foreachname(plookup(entry->name)->value, unitdep, funcdep, &state);
+      break;
+    case BUILTIN_FUNCTION:
+      funcptr = fnlookup(entry->name);
+      if (funcptr->table)
+        foreachname(funcptr->tableunit, unitdep, funcdep, &state);
+      else {
+        functypedeps(&state, &funcptr->forward);
+        functypedeps(&state, &funcptr->inverse);
+      }
+      copy = dupstr(entry->record->text);   /* name() source */
+      strtok(copy, " \t");
+      if ((source = strtok(0, " \t")) && strstr(copy, "()"))
+        adddep(&state, BUILTIN_FUNCTION, source);
+      free(copy);
+      break;
+    case CHUNK_ALIAS:
+      for(aliasptr = firstalias; strcmp(aliasptr->name, entry->name);
+          aliasptr = aliasptr->next);
+      foreachname(aliasptr->definition, unitdep, funcdep, &state);
+      break;
+  }
+}
+
+
+/* Writes the names that a chunk defines on !pending lines of the core
+   chunk, with names that are not plain ASCII in a !utf8 block */
+
+void
+writepending(FILE *out, int chunk, struct chunkentry **order)
+{
+  int i, utf8, count, nonascii;
+  char *ptr;
+
+  for(utf8=0;utf8<2;utf8++){
+    for(count=0,i=0;i<chunkentrycount;i++){
+      if (order[i]->chunk != chunk || order[i]->kind == BUILTIN_PREFIX)
+        continue;
+      for(nonascii = 0, ptr = order[i]->name; *ptr; ptr++)
+        if (*ptr & 0x80)
+          nonascii = 1;
+      if (nonascii != utf8)
+        continue;
+      if (count % 10 == 0)
+        fprintf(out, "%s%s!pending %s", count ? "\n" : "",
+                utf8 && !count ? "!utf8\n" : "", chunknames[chunk]);
+      fprintf(out, " %s", order[i]->name);
+      count++;
+    }
+    if (count)
+      fprintf(out, utf8 ? "\n!endutf8\n" : "\n");
+  }
+}
+
+
+/* Writes a line without the spaces left where its comment was */
+
+void
+writeline(FILE *out, char *text)
+{
+  int len = strlen(text);
+
+  while (len && isspace((unsigned char) text[len-1]))
+    len--;
+  fprintf(out, "%.*s\n", len, text);
+}
+
+
+void
+writechunks(char *dir, char *mainfile)
+{
+  struct unitlist *uptr;
+  struct prefixlist *pfxptr;
+  struct func *funcptr;
+  struct wantalias *aliasptr;
+  struct chunkentry **order, *entry;
+  char *path;
+  FILE *out, *manifest;
+  int i, j, c, changed, utf8, size[CHUNKCOUNT], requires[CHUNKCOUNT], first;
+
+  for(i=0;i<HASHSIZE;i++)
+    for(uptr=utab[i];uptr;uptr=uptr->next)
+      addchunkentry(BUILTIN_UNIT, uptr->name, uptr->file, uptr->linenumber);
+  for(i=0;i<SIMPLEHASHSIZE;i++)
+    for(pfxptr=ptab[i];pfxptr;pfxptr=pfxptr->next)
+      addchunkentry(BUILTIN_PREFIX, pfxptr->name, pfxptr->file,
+                    pfxptr->linenumber);
+  for(i=0;i<SIMPLEHASHSIZE;i++)
+    for(funcptr=ftab[i];funcptr;funcptr=funcptr->next)
+      addchunkentry(BUILTIN_FUNCTION, funcptr->name, funcptr->file,
+                    funcptr->linenumber);
+  for(aliasptr=firstalias;aliasptr;aliasptr=aliasptr->next)
+    addchunkentry(CHUNK_ALIAS, aliasptr->name, aliasptr->file,
+                  aliasptr->linenumber);
+
+  chunkbyname = (struct chunkentry **)
+    mymalloc((chunkentrycount+1)*sizeof(*chunkbyname), "(writechunks)");
+  order = (struct chunkentry **)
+    mymalloc((chunkentrycount+1)*sizeof(*order), "(writechunks)");
+  for(i=0;i<chunkentrycount;i++)
+    chunkbyname[i] = order[i] = chunkentries+i;
+  qsort(chunkbyname, chunkentrycount, sizeof(*chunkbyname), comparechunkname);
+  qsort(order, chunkentrycount, sizeof(*order), comparechunkline);
+
+  /* Prefixes are all core, so that any prefixed unit name is split the
+     same way whichever chunks are loaded.  Functions go by the units of
+     their results and unit lists by their first unit. */
+
+  for(i=0;i<chunkentrycount;i++){
+    entry = chunkentries+i;
+    finddeps(entry);
+    switch(entry->kind){
+      case BUILTIN_UNIT:
+        entry->chunk = dimensionchunk(entry->name);
+        break;
+      case BUILTIN_PREFIX:
+        entry->chunk = CHUNK_CORE;
+        break;
+      case BUILTIN_FUNCTION:
+        funcptr = fnlookup(entry->name);
+        if (funcptr->table)
+          entry->chunk = dimensionchunk(funcptr->tableunit);
+        else if (funcptr->inverse.dimen)
+          entry->chunk = dimensionchunk(funcptr->inverse.dimen);
+        else
+          entry->chunk = CHUNK_MISC;
+        break;
+      case CHUNK_ALIAS:
+        for(aliasptr = firstalias; strcmp(aliasptr->name, entry->name);
+            aliasptr = aliasptr->next);
+        path = dupstr(aliasptr->definition);
+        *(path+strcspn(path, ";")) = 0;
+        entry->chunk = dimensionchunk(path);
+        free(path);
+        break;
+    }
+  }
+  do {
+    changed = 0;
+    for(i=0;i<chunkentrycount;i++){
+      entry = chunkentries+i;
+      for(j=0;j<entry->depcount;j++)
+        if (chunkentries[entry->deps[j]].chunk > entry->chunk){
+          chunkentries[entry->deps[j]].chunk = entry->chunk;
+          changed = 1;
+        }
+    }
+  } while (changed);
+
+  for(c=0;c<CHUNKCOUNT;c++)
+    size[c] = 0;
+  for(i=0;i<chunkentrycount;i++)
+    size[chunkentries[i].chunk]++;
+
+  path = (char *) mymalloc(strlen(dir)+30, "(writechunks)");
+  sprintf(path, "%s/manifest.json", dir);
+  if (!(manifest = fopen(path, "w")))
+    genfail("cannot write '%s'", path);
+  fprintf(manifest, "[\n");
+  for(first=1,c=0;c<CHUNKCOUNT;c++){
+    if (!size[c])
+      continue;
+    sprintf(path, "%s/%s.units", dir, chunknames[c]);
+    if (!(out = fopen(path, "w")))
+      genfail("cannot write '%s'", path);
+    fprintf(out, "# The %s chunk of %s, generated by unitsgen -c.  "
+            "Do not edit.\n\n!chunk %s\n", chunknames[c], mainfile,
+            chunknames[c]);
+    if (c == CHUNK_CORE){
+      for(j=1;j<CHUNKCOUNT;j++)
+        if (size[j])
+          writepending(out, j, order);
+    }
+    fputc('\n', out);
+    for(j=0;j<CHUNKCOUNT;j++)
+      requires[j] = 0;
+    for(utf8=0,i=0;i<chunkentrycount;i++){
+      entry = order[i];
+      if (entry->chunk != c)
+        continue;
+      for(j=0;j<entry->depcount;j++)
+        requires[chunkentries[entry->deps[j]].chunk] = 1;
+      if (entry->record->utf8 != utf8)
+        fprintf(out, (utf8 = entry->record->utf8) ? "!utf8\n" : "!endutf8\n");
+      writeline(out, entry->record->text);
+    }
+    if (utf8)
+      fprintf(out, "!endutf8\n");
+    if (ferror(out) || fclose(out))
+      genfail("error writing '%s'", path);
+
+    fprintf(manifest, "%s  {\"name\": \"%s\", \"file\": \"%s.units\", "
+            "\"definitions\": %d, \"requires\": [", first ? "" : ",\n",
+            chunknames[c], chunknames[c], size[c]);
+    for(first=1,j=0;j<c;j++)
+      if (requires[j]){
+        fprintf(manifest, "%s\"%s\"", first ? "" : ", ", chunknames[j]);
+        first = 0;
+      }
+    fprintf(manifest, "]}");
+    first = 0;
+  }
+  fprintf(manifest, "\n]\n");
+  sprintf(path, "%s/manifest.json", dir);
+  if (ferror(manifest) || fclose(manifest))
+    genfail("error writing '%s'", path);
+  free(path);
+  free(order);
+  free(chunkbyname);
+}
+
+
+int
+main(int argc, char **argv)
+{
+  int i, circular;
+  char *chunkdir = 0;
+
+  progname = "unitsgen";
+  if (argc == 4 && !strcmp(argv[1], "-c")){
+    chunkdir = argv[2];
+    argv += 2;
+    argc -= 2;
+  }
+  if (argc != 2){
+    fprintf(stderr, "Usage: %s file > unitsdb.c\n"
+                    "       %s -c dir file\n", progname, progname);
+    exit(EXIT_FAILURE);
+  }
+  checklocale();
+  flags.quiet = 1;              /* keep !message text out of the output */
+  parserflags.minusminus = 1;   /* the defaults of unitsHandler() */
+  parserflags.oldstar = 0;
+  if (readunits(argv[1], stderr, 0, 0, 0, 0))
+    genfail("cannot load '%s'", argv[1]);
+  circular = resolveunits(stderr);
+  eagerreduce(1);
+
+  addfile(argv[1], pathend(argv[1]));
+  for(i=0;i<genfilecount;i++)
+    scanfile(i);
+  if (chunkdir){
+    writechunks(chunkdir, pathend(argv[1]));
+    return 0;
+  }
+
+  printf("/* Generated by unitsgen from %s.  Do not edit. */\n\n",
+         pathend(argv[1]));
+  printf("#include <math.h>\n#include \"units.h\"\n\n");
+  writefunctions();
+  writerecords();
+  writetables(!circular);
+  return 0;
+}
@@ -0,0 +1,33 @@
+/*
+ *  unitsmain, the units command line program
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+   units.c is built as a library with unitsHandler() as its entry point,
+   so that the WASM module (wasmunits.c) and unitsbench can link it
+   without a main().  This is the main() of the native program.  The
+   native program's output is what wasmcheck.js compares the WASM build
+   against.
+*/
+
+#include "units.h"
+
+int
+main(int argc, char **argv)
+{
+  return unitsHandler(argc, argv);
+}
@@ -0,0 +1,151 @@
+/*
+ *  wasmbatch.js, thread scaling of batch conversions in the WASM module
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+   Usage: node wasmbatch.js [-n iterations] [-r rows] [-t threads] [a.out.js]
+
+   Loads the pthreads build of the module described in README.md, in
+   which node runs the worker pool on worker_threads, and converts a
+   table of rows (default 100000) with convert_batch().  The rows cycle
+   through a list of conversions, a few rows at a time with the same
+   units as a column of a table would have.
+
+   The table is converted with one thread and then with twice as many
+   each time up to the given number of threads, which defaults to the
+   number of processors and should not be more than PTHREAD_POOL_SIZE
+   plus one.  For each it prints the median time over the iterations
+   (default 5), the rows per second and the speedup over one thread.
+   The results and error codes of every run are checked against those
+   of one thread, and the exit status is 1 if any differ.
+
+   The module must export _convert_batch, _malloc and _free, and the
+   runtime methods HEAPF64, HEAP32, stringToUTF8 and lengthBytesUTF8.
+*/
+
+'use strict';
+
+const fs = require('fs');
+const os = require('os');
+const path = require('path');
+const loadwasm = require('./wasmload.js');
+
+const conversions = [
+  ['tempF', 'tempC'],
+  ['mile', 'km'],
+  ['lb', 'kg'],
+  ['gallon', 'liter'],
+  ['mph', 'm/s'],
+  ['wiregauge', 'mm'],
+  ['psi', 'kPa'],
+  ['acre', 'hectare'],
+  ['btu/hr', 'W'],
+  ['furlongs/fortnight', 'ft/min'],
+  ['tempC', 'tempF'],
+  ['kWh', 'MJ'],
+];
+const RUN = 4;                  /* rows in a row with the same units */
+
+let iterations = 5;
+let rows = 100000;
+let maxthreads = os.cpus().length;
+const args = process.argv.slice(2);
+while (args.length > 1 && /^-[nrt]$/.test(args[0])) {
+  const value = parseInt(args[1], 10);
+  switch (args[0]) {
+    case '-n': iterations = value; break;
+    case '-r': rows = value; break;
+    case '-t': maxthreads = value; break;
+  }
+  args.splice(0, 2);
+}
+const script = path.resolve(args[0] || 'a.out.js');
+
+if (!(iterations >= 1) || !(rows >= 1) || !(maxthreads >= 1)
+    || args.length > 1 || !fs.existsSync(script)) {
+  console.error('Usage: node wasmbatch.js [-n iterations] [-r rows] '
+                + '[-t threads] [a.out.js]');
+  process.exit(1);
+}
+
+loadwasm(script, {
+  print: () => {},
+  printErr: () => {},
+  onRuntimeInitialized() {
+    const string = (str) => {
+      const len = Module.lengthBytesUTF8(str) + 1;
+      const ptr = Module._malloc(len);
+      Module.stringToUTF8(str, ptr, len);
+      return ptr;
+    };
+    const units = conversions.map(([have, want]) => [string(have),
+                                                     string(want)]);
+    const have = Module._malloc(rows * 4);
+    const want = Module._malloc(rows * 4);
+    const values = Module._malloc(rows * 8);
+    const results = Module._malloc(rows * 8);
+    const status = Module._malloc(rows * 4);
+    for (let i = 0; i < rows; i++) {
+      const [h, w] = units[Math.floor(i / RUN) % units.length];
+      Module.HEAP32[have / 4 + i] = h;
+      Module.HEAP32[want / 4 + i] = w;
+      Module.HEAPF64[values / 8 + i] = 1 + i % 50;
+    }
+
+    /* The views are copied, as they go stale if the memory grows */
+    const convert = (threads) => {
+      Module._convert_batch(have, want, values, results, status, rows,
+                            threads);
+      return {
+        results: Module.HEAPF64.slice(results / 8, results / 8 + rows),
+        status: Module.HEAP32.slice(status / 4, status / 4 + rows),
+      };
+    };
+
+    const first = convert(1);   /* loads the units */
+    let single = 0, failed = 0;
+    console.log('# threads     rows  median_ms       rows/s  speedup');
+    for (let threads = 1; threads <= maxthreads;
+         threads = threads < maxthreads && 2 * threads > maxthreads
+                   ? maxthreads : 2 * threads) {
+      const times = [];
+      let last;
+      for (let j = 0; j < iterations; j++) {
+        const t = performance.now();
+        last = convert(threads);
+        times.push(performance.now() - t);
+      }
+      for (let i = 0; i < rows; i++)
+        if (last.status[i] !== first.status[i]
+            || (!first.status[i] && last.results[i] !== first.results[i])) {
+          if (failed++ < 10)
+            console.error(`wasmbatch: ${threads} threads differ on row ${i}`);
+        }
+      times.sort((a, b) => a - b);
+      const median = times[times.length >> 1];
+      if (threads === 1)
+        single = median;
+      console.log(`${String(threads).padStart(9)} ${String(rows).padStart(8)}`
+                  + ` ${median.toFixed(3).padStart(10)}`
+                  + ` ${(rows / median * 1000).toFixed(0).padStart(12)}`
+                  + ` ${(single / median).toFixed(2).padStart(8)}`);
+    }
+    for (const ptr of [have, want, values, results, status, ...units.flat()])
+      Module._free(ptr);
+    process.exit(failed ? 1 : 0);
+  },
+});
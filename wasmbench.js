@@ -0,0 +1,111 @@
+/*
+ *  wasmbench.js, time to first conversion for the WASM module
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+   Usage: node wasmbench.js [-n iterations] [a.out.js [have [want]]]
+
+   Loads the module built as described in README.md and reports
+
+   startup  the time until the runtime is ready, including fetching and
+            compiling a.out.wasm and unpacking a.out.data
+   first    the time of the first conversion through convert_unit_lazy(),
+            which loads the units database
+   reload   the first conversion again after unload_units(), so that
+            the database is loaded from scratch without the startup
+   warm     later conversions with the database already loaded
+
+   The module must export _convert_unit_lazy and _unload_units.
+*/
+
+'use strict';
+
+const fs = require('fs');
+const path = require('path');
+const loadwasm = require('./wasmload.js');
+
+let iterations = 20;
+const args = process.argv.slice(2);
+if (args[0] === '-n') {
+  iterations = parseInt(args[1], 10);
+  args.splice(0, 2);
+}
+const script = path.resolve(args[0] || 'a.out.js');
+const have = args[1] || 'mile';
+const want = args[2] || 'km';
+
+if (!(iterations >= 1) || !fs.existsSync(script)) {
+  console.error('Usage: node wasmbench.js [-n iterations] '
+                + '[a.out.js [have [want]]]');
+  process.exit(1);
+}
+
+function report(name, times) {
+  if (times.length === 1) {
+    console.log(`${name.padEnd(10)} ${times[0].toFixed(3).padStart(8)} ms`);
+    return;
+  }
+  times.sort((a, b) => a - b);
+  const total = times.reduce((a, b) => a + b, 0);
+  console.log(`${name.padEnd(10)} ${String(times.length).padStart(4)} runs`
+              + `  min ${times[0].toFixed(3).padStart(8)} ms`
+              + `  median ${times[times.length >> 1].toFixed(3).padStart(8)} ms`
+              + `  mean ${(total / times.length).toFixed(3).padStart(8)} ms`);
+}
+
+const output = [];
+const start = performance.now();
+
+loadwasm(script, {
+  print: (text) => output.push(text),
+  printErr: (text) => output.push(text),
+  onRuntimeInitialized() {
+    const ready = performance.now();
+    const convert = Module.cwrap('convert_unit_lazy', 'number',
+                                 ['string', 'string']);
+    const unload = Module.cwrap('unload_units', null, []);
+    let t, times;
+
+    t = performance.now();
+    if (convert(have, want)) {
+      console.error(`wasmbench: '${have}' to '${want}' failed: `
+                    + output.join('\n'));
+      process.exit(1);
+    }
+    const first = performance.now() - t;
+    console.log(`'${have}' to '${want}': ${output[output.length - 1]}`);
+    report('startup', [ready - start]);
+    report('first', [first]);
+
+    times = [];
+    for (let i = 0; i < iterations; i++) {
+      unload();
+      t = performance.now();
+      convert(have, want);
+      times.push(performance.now() - t);
+    }
+    report('reload', times);
+
+    times = [];
+    for (let i = 0; i < iterations; i++) {
+      t = performance.now();
+      convert(have, want);
+      times.push(performance.now() - t);
+    }
+    report('warm', times);
+  },
+});
@@ -0,0 +1,238 @@
+/*
+ *  wasmcheck.js, conformance and throughput tests for the WASM module
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+   Usage: node wasmcheck.js [-n calls] [-u units] [-f unitsfile]
+                            [-c corpus] [a.out.js]
+
+   Loads the module built as described in README.md without a browser
+   and replays a corpus of conversions through it.
+
+   Each conversion is first run with convert_unit_terse() and compared
+   with the output and exit status of the native program, run as
+   'units --terse --lazy -f unitsfile have want'.  unitsfile should be
+   the definitions.units that was packaged into a.out.data; the default
+   is usr/local/share/units/definitions.units next to a.out.js.  The
+   native program is run in the C.UTF-8 locale with no UNITS
+   environment variables, as the module sees them.
+
+   Then it reports
+
+   startup  the time until the runtime is ready, including fetching and
+            compiling a.out.wasm and unpacking a.out.data
+   first    the time of the first conversion, which loads the units
+            database
+   steady   conversions per second through convert_unit_lazy() over the
+            given number of calls (default 1000000), cycling through
+            the corpus
+   heap     the growth of the heap top and of the WASM memory over those
+            calls, after the first tenth of them and at the end, so that
+            a leak shows as growth that continues after the warmup
+
+   The corpus file has one conversion per line, the unit to convert and
+   the unit to convert to separated by a tab.  A line without a tab
+   asks for the definition of the unit.  Blank lines and lines that
+   start with '#' are skipped.
+
+   The module must export _convert_unit_lazy, _convert_unit_terse and
+   _heap_top.  The exit status is 1 if any conversion differs from the
+   native program.
+*/
+
+'use strict';
+
+const fs = require('fs');
+const path = require('path');
+const loadwasm = require('./wasmload.js');
+const { spawnSync } = require('child_process');
+
+const defaultcorpus = [
+  ['mile', 'km'],
+  ['3 ft + 2 in', 'cm'],
+  ['kilometers', 'feet'],
+  ['60 mph', 'm/s'],
+  ['acre', 'hectare'],
+  ['gallon', 'liter'],
+  ['lightyear', 'parsec'],
+  ['1|3 cup', 'tablespoon'],
+  ['kWh', 'MJ'],
+  ['atm', 'psi'],
+  ['g', 'N/kg'],
+  ['c', 'furlongs/fortnight'],
+  ['hbar c', 'MeV fm'],
+  ['sqrt(acre)', 'ft'],
+  ['2^10 byte', 'KiB'],
+  ['tempF(75)', 'tempC'],
+  ['tempC(100)', 'tempF'],
+  ['tempK(0)', 'tempC'],
+  ['dB(3)', ''],
+  ['log(1000)', ''],
+  ['circlearea(1 m)', 'ft^2'],
+  ['wiregauge(12)', 'mm'],
+  ['2 m', 'ft;in'],
+  ['1 day', 'hr;min;s'],
+  ['mile', 'ft;yd'],
+  ['foot', ''],
+  ['inch', ''],
+  ['tempF', ''],
+  ['pi', ''],
+  ['kg m / s^2', 'N'],
+  ['volt ampere', 'watt'],
+  ['ohm', 'V/A'],
+  ['barrel', 'gallons'],
+  ['carat', 'grams'],
+  ['nauticalmile', 'mile'],
+  ['blargh', 'm'],
+  ['m', 'kg'],
+  ['3 +', 'm'],
+];
+
+let calls = 1000000;
+let unitsprog = 'units';
+let unitsfile = null;
+let corpusfile = null;
+const args = process.argv.slice(2);
+while (args.length > 1 && /^-[nufc]$/.test(args[0])) {
+  const value = args[1];
+  switch (args[0]) {
+    case '-n': calls = parseInt(value, 10); break;
+    case '-u': unitsprog = value; break;
+    case '-f': unitsfile = value; break;
+    case '-c': corpusfile = value; break;
+  }
+  args.splice(0, 2);
+}
+const script = path.resolve(args[0] || 'a.out.js');
+if (!unitsfile)
+  unitsfile = path.join(path.dirname(script),
+                        'usr/local/share/units/definitions.units');
+
+if (!(calls >= 1) || args.length > 1 || !fs.existsSync(script)
+    || !fs.existsSync(unitsfile)) {
+  console.error('Usage: node wasmcheck.js [-n calls] [-u units] '
+                + '[-f unitsfile] [-c corpus] [a.out.js]');
+  process.exit(1);
+}
+
+function readcorpus(file) {
+  const corpus = [];
+  for (const line of fs.readFileSync(file, 'utf8').split('\n')) {
+    if (!line.trim() || line.startsWith('#'))
+      continue;
+    const tab = line.indexOf('\t');
+    corpus.push(tab < 0 ? [line.trim(), '']
+                : [line.slice(0, tab).trim(), line.slice(tab + 1).trim()]);
+  }
+  return corpus;
+}
+
+const corpus = corpusfile ? readcorpus(corpusfile) : defaultcorpus;
+if (!corpus.length) {
+  console.error(`wasmcheck: no conversions in '${corpusfile}'`);
+  process.exit(1);
+}
+
+/* The expected results, from the native program */
+
+const nativeenv = { PATH: process.env.PATH, LANG: 'C.UTF-8',
+                    LC_ALL: 'C.UTF-8' };
+const expected = corpus.map(([have, want]) => {
+  const argv = ['--terse', '--lazy', '-f', unitsfile, have];
+  if (want)
+    argv.push(want);
+  const run = spawnSync(unitsprog, argv, { env: nativeenv,
+                                           encoding: 'utf8' });
+  if (run.error) {
+    console.error(`wasmcheck: cannot run '${unitsprog}': ${run.error.message}`);
+    process.exit(1);
+  }
+  return { status: run.status, output: run.stdout.trimEnd() };
+});
+
+function rate(count, ms) {
+  return (count / ms * 1000).toFixed(0);
+}
+
+function kb(bytes) {
+  return `${(bytes / 1024).toFixed(1)} kB`;
+}
+
+let output = [];
+const start = performance.now();
+
+loadwasm(script, {
+  print: (text) => output.push(text),
+  printErr: (text) => output.push(text),
+  onRuntimeInitialized() {
+    const ready = performance.now();
+    const convert = Module.cwrap('convert_unit_lazy', 'number',
+                                 ['string', 'string']);
+    const terse = Module.cwrap('convert_unit_terse', 'number',
+                               ['string', 'string']);
+    const heaptop = Module.cwrap('heap_top', 'number', []);
+    const memory = () => (Module.HEAP8 ? Module.HEAP8.buffer.byteLength : 0);
+    let t, failed = 0;
+
+    t = performance.now();
+    terse(corpus[0][0], corpus[0][1]);
+    const first = performance.now() - t;
+
+    corpus.forEach(([have, want], i) => {
+      output = [];
+      const status = terse(have, want);
+      const result = output.join('\n').trimEnd();
+      if (status !== expected[i].status || result !== expected[i].output) {
+        if (failed++ < 10)
+          console.log(`differs: '${have}' to '${want}'\n`
+                      + `  wasm   (${status}): ${JSON.stringify(result)}\n`
+                      + `  native (${expected[i].status}): `
+                      + JSON.stringify(expected[i].output));
+      }
+    });
+    console.log(`conformance ${corpus.length - failed} of ${corpus.length}`
+                + ' conversions match the native program');
+
+    console.log(`startup    ${(ready - start).toFixed(3).padStart(10)} ms`);
+    console.log(`first      ${first.toFixed(3).padStart(10)} ms`);
+
+    output = { push() {} };
+    const heap0 = heaptop(), memory0 = memory();
+    const warmup = Math.max(1, Math.floor(calls / 10));
+    let heap1 = heap0, memory1 = memory0;
+    t = performance.now();
+    for (let i = 0; i < calls; i++) {
+      const [have, want] = corpus[i % corpus.length];
+      convert(have, want);
+      if (i + 1 === warmup) {
+        heap1 = heaptop();
+        memory1 = memory();
+      }
+    }
+    const elapsed = performance.now() - t;
+    const heap2 = heaptop(), memory2 = memory();
+
+    console.log(`steady     ${rate(calls, elapsed).padStart(10)} conversions/s`
+                + `  (${calls} calls, ${(elapsed / calls * 1000).toFixed(2)}`
+                + ' us each)');
+    console.log(`heap       ${kb(heap1 - heap0).padStart(10)} after ${warmup}`
+                + ` calls, ${kb(heap2 - heap0)} after ${calls}`);
+    console.log(`memory     ${kb(memory1 - memory0).padStart(10)} after `
+                + `${warmup} calls, ${kb(memory2 - memory0)} after ${calls}`);
+    process.exit(failed ? 1 : 0);
+  },
+});
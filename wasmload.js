@@ -0,0 +1,39 @@
+/*
+ *  wasmload.js, loads the WASM module into the node harnesses
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+   Used by wasmbench.js, wasmcheck.js and wasmbatch.js.  a.out.js is not
+   built as a node module, so it is run in this context with the Module
+   object that it merges its settings with.  settings gives print,
+   printErr and onRuntimeInitialized; the runtime is kept alive after
+   main() so that the harness can go on calling the exports.
+*/
+
+'use strict';
+
+const fs = require('fs');
+const path = require('path');
+const vm = require('vm');
+
+module.exports = function loadwasm(script, settings) {
+  globalThis.require = require;
+  globalThis.__dirname = path.dirname(script);
+  globalThis.__filename = script;
+  globalThis.Module = Object.assign({ noExitRuntime: true }, settings);
+  vm.runInThisContext(fs.readFileSync(script, 'utf8'), { filename: script });
+};
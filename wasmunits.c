@@ -1,3 +1,4 @@
+#include <unistd.h>
 #include "emscripten.h"
 #include "units.h"
 
@@ -16,4 +17,173 @@ int convert_unit(char *youHave, char *youWant) {
 	}
 	
 	return unitsHandler(argc, argv);
-}
\ No newline at end of file
+}
+
+/* Like convert_unit, but with --lazy, so that loading the database only
+   records the unit names and each definition is parsed when it is
+   first needed (see wasmbench.js) */
+EMSCRIPTEN_KEEPALIVE
+int convert_unit_lazy(char *youHave, char *youWant) {
+	int argc = strlen(youWant) ? 6 : 5;
+	char *argv[argc];
+
+	argv[0] = "units";
+	argv[1] = "--strict";
+	argv[2] = "--one-line";
+	argv[3] = "--lazy";
+	argv[4] = youHave;
+
+	if (strlen(youWant)) {
+		argv[5] = youWant;
+	}
+
+	return unitsHandler(argc, argv);
+}
+
+/* Like convert_unit, but with --terse output, so that the result can be
+   compared with the native units program (see wasmcheck.js) */
+EMSCRIPTEN_KEEPALIVE
+int convert_unit_terse(char *youHave, char *youWant) {
+	int argc = strlen(youWant) ? 5 : 4;
+	char *argv[argc];
+
+	argv[0] = "units";
+	argv[1] = "--terse";
+	argv[2] = "--lazy";
+	argv[3] = youHave;
+
+	if (strlen(youWant)) {
+		argv[4] = youWant;
+	}
+
+	return unitsHandler(argc, argv);
+}
+
+/* Converts count numbers from the unit have to the unit want with no
+   strings passed through ccall and no printed output.  have and want
+   point to havelen and wantlen bytes of UTF-8 that the page encodes
+   into the module's memory once and reuses.  values, results and
+   status point to count doubles, doubles and ints, so that the page
+   fills and reads them through Float64Array and Int32Array views on
+   HEAPF64 and HEAP32.  See convertvalues() in units.c for how function
+   names like tempF are handled.  Returns 0 or the first error code,
+   which error_message() describes, and E_PARSE if a length is
+   negative. */
+EMSCRIPTEN_KEEPALIVE
+int convert_values(const char *have, int havelen, const char *want,
+                   int wantlen, const double *values, double *results,
+                   int *status, int count) {
+	char *havestr, *wantstr;
+	int err;
+
+	if (havelen < 0 || wantlen < 0)
+		return E_PARSE;
+	havestr = dupnstr(have, havelen);
+	wantstr = dupnstr(want, wantlen);
+	err = convertvalues(havestr, wantstr, values, results, status, count);
+	free(havestr);
+	free(wantstr);
+	return err;
+}
+
+/* Converts count rows, row i from the unit have[i] to the unit want[i]
+   as convert_values() does for a single pair of units.  have and want
+   are arrays of pointers to NUL-terminated UTF-8 strings in the
+   module's memory, so rows with the same units can share them.  In a
+   build with -pthread and UNITS_THREADS the rows are divided between up
+   to threads threads from the worker pool, and otherwise threads is
+   ignored.  Returns 0 or the first error code. */
+EMSCRIPTEN_KEEPALIVE
+int convert_batch(char **have, char **want, const double *values,
+                  double *results, int *status, int count, int threads) {
+	return convertbatch(have, want, values, results, status, count,
+	                    threads);
+}
+
+/* Returns the message for an error code from convert_values() */
+EMSCRIPTEN_KEEPALIVE
+const char *error_message(int code) {
+	if (code < 0 || code > E_NOTCONFORMABLE)
+		return "Unknown error";
+	return errormsg[code];
+}
+
+/* Loads the units database, so that the first conversion does not
+   have to.  Returns 0 if the units are loaded. */
+EMSCRIPTEN_KEEPALIVE
+int load_units(void) {
+	return loadunits();
+}
+
+/* Returns the top of the heap, so the page can watch it grow */
+EMSCRIPTEN_KEEPALIVE
+long heap_top(void) {
+	return (long) sbrk(0);
+}
+
+/* Drops the loaded units database so the next conversion reloads the
+   units data files */
+EMSCRIPTEN_KEEPALIVE
+void unload_units(void) {
+	freedatabase();
+}
+
+/* Loads the units data files again if any of them has changed since
+   they were read.  Returns 1 if they were reloaded, 0 if nothing
+   changed and -1 if the new files had errors and were not used. */
+EMSCRIPTEN_KEEPALIVE
+int reload_units(void) {
+	return reloadunits();
+}
+
+/* Merges a chunk of the split units database (see unitsgen -c) into the
+   loaded units.  Returns 0 on success. */
+EMSCRIPTEN_KEEPALIVE
+int load_units_chunk(char *file) {
+	return loadunitschunk(file, 1);
+}
+
+/* Returns the chunk that defines the unit of the last "Unit not loaded
+   yet" error, so the page can fetch it and try again */
+EMSCRIPTEN_KEEPALIVE
+char *pending_chunk(void) {
+	return pendingunitschunk();
+}
+
+/* Returns the counters printed by --stats, one per line, for the
+   conversions since the units were loaded or reset_stats() was called.
+   Returns NULL if the module was built with NO_STATS. */
+EMSCRIPTEN_KEEPALIVE
+char *stats(void) {
+	return formatstats();
+}
+
+EMSCRIPTEN_KEEPALIVE
+void reset_stats(void) {
+	resetstats();
+}
+
+/* Returns the --memstats report on the memory used by the loaded units
+   database */
+EMSCRIPTEN_KEEPALIVE
+char *memstats(void) {
+	return formatmemstats();
+}
+
+/* Starts recording the phases of the following conversions, or starts
+   over if it is already recording.  trace_json() returns them as a
+   Chrome trace that Perfetto can load, and stop_trace() frees it. */
+EMSCRIPTEN_KEEPALIVE
+void start_trace(void) {
+	starttrace(walltime());
+}
+
+EMSCRIPTEN_KEEPALIVE
+char *trace_json(void) {
+	return tracejson();
+}
+
+EMSCRIPTEN_KEEPALIVE
+void stop_trace(void) {
+	stoptrace();
+}